@@ -0,0 +1,485 @@
+// iqnet.c
+// Network I/Q stream:  the UDP and TCP sink and the -V receiver - see iqnet.h.
+
+#define _GNU_SOURCE
+#include "iqnet.h"
+#include "iqpack.h"
+#include <alloca.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+int net_resolve( const char *url, int *tcp, int passive, struct sockaddr_storage *addr, socklen_t *len ) {
+
+	char *host, *port, *p;
+	struct addrinfo hints, *res;
+	int ret;
+
+	if( strncasecmp( url, "udp://", 6 ) && strncasecmp( url, "tcp://", 6 ) ) {
+		fprintf( stderr, "%s: Network address must be udp://host:port or tcp://host:port\n", url );
+		return 1;
+	}
+	*tcp = !strncasecmp( url, "tcp", 3 );
+	host = strdupa( url + 6 );
+	if( !( port = strrchr( host, ':' ) ) || !port[ 1 ] ) {
+		fprintf( stderr, "%s: No port given\n", url );
+		return 1;
+	}
+	*port++ = 0;
+	if( *host == '[' && ( p = strchr( host, ']' ) ) ) {
+		*p = 0;
+		host++;
+	}
+
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = *tcp ? SOCK_STREAM : SOCK_DGRAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if( ( ret = getaddrinfo( *host ? host : NULL, port, &hints, &res ) ) ) {
+		fprintf( stderr, "%s: %s\n", url, gai_strerror( ret ) );
+		return 1;
+	}
+	memcpy( addr, res->ai_addr, res->ai_addrlen );
+	*len = res->ai_addrlen;
+	freeaddrinfo( res );
+	return 0;
+}
+
+int net_multicast( const struct sockaddr_storage *addr ) {
+
+	return addr->ss_family == AF_INET ? IN_MULTICAST( ntohl( ( (struct sockaddr_in *)addr )->sin_addr.s_addr ) )
+		: addr->ss_family == AF_INET6 && IN6_IS_ADDR_MULTICAST( &( (struct sockaddr_in6 *)addr )->sin6_addr );
+}
+
+// TCP:  take clients as they come
+static void *net_accept( void *arg ) {
+
+	struct net_sink *s = arg;
+	struct net_client *c;
+	int fd, one = 1;
+
+	for(;;) {
+		if( ( fd = accept4( s->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC ) ) < 0 ) {
+			if( errno != EINTR && errno != ECONNABORTED )
+				usleep( 100000 );
+			continue;
+		}
+		setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+		pthread_mutex_lock( &s->lock );
+		if( s->nclients < NET_MAXCLIENTS && ( c = calloc( 1, sizeof( *c ) ) ) ) {
+			c->fd = fd;
+			s->clients[ s->nclients++ ] = c;
+			if( s->verbose )
+				fprintf( stderr, "%s: client connected, %d total\n", s->url, s->nclients );
+		}
+		else
+			close( fd );
+		pthread_mutex_unlock( &s->lock );
+	}
+	return arg;
+}
+
+struct net_sink *net_open( const char *url, int payload, int format, int channels, int bps, int rate,
+	net_pack_fn *pack, void *arg, int verbose ) {
+
+	struct net_sink *s = calloc( 1, sizeof( *s ) );
+	int one = 1, ttl = 1, sndbuf = 4 << 20;
+
+	if( !s ) {
+		fprintf( stderr, "%s: Cannot allocate the network sink\n", url );
+		return NULL;
+	}
+	s->fd = -1;
+	if( net_resolve( url, &s->tcp, !strncasecmp( url, "tcp", 3 ), &s->addr, &s->addrlen ) )
+		goto fail;
+	if( payload < 64 || payload > 65000 ) {
+		fprintf( stderr, "Network packet size must be 64 to 65000 bytes\n" );
+		goto fail;
+	}
+	s->url = url;
+	s->payload = payload;
+	s->format = format;
+	s->channels = channels;
+	s->bps = bps;
+	s->rate = rate;
+	s->pack = pack;
+	s->pack_arg = arg;
+	s->verbose = verbose;
+	if( ( s->fd = socket( s->addr.ss_family, ( s->tcp ? SOCK_STREAM : SOCK_DGRAM ) | SOCK_CLOEXEC, 0 ) ) < 0 ) {
+		fprintf( stderr, "%s: socket: %s\n", url, strerror( errno ) );
+		goto fail;
+	}
+	setsockopt( s->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof( sndbuf ) );
+
+	if( s->tcp ) {
+		setsockopt( s->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+		if( bind( s->fd, (struct sockaddr *)&s->addr, s->addrlen ) || listen( s->fd, 8 ) ) {
+			fprintf( stderr, "%s: %s\n", url, strerror( errno ) );
+			goto fail;
+		}
+		pthread_mutex_init( &s->lock, NULL );
+		if( pthread_create( &s->thread, NULL, net_accept, s ) ) {
+			fprintf( stderr, "Cannot create network accept thread\n" );
+			goto fail;
+		}
+	}
+	else if( net_multicast( &s->addr ) ) {	// one hop, and looped back to readers on this host
+		if( s->addr.ss_family == AF_INET ) {
+			setsockopt( s->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof( ttl ) );
+			setsockopt( s->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof( one ) );
+		}
+		else {
+			setsockopt( s->fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof( ttl ) );
+			setsockopt( s->fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &one, sizeof( one ) );
+		}
+	}
+	return s;
+
+fail:
+	if( s->fd >= 0 )
+		close( s->fd );
+	free( s );
+	return NULL;
+}
+
+unsigned net_frames( const struct net_sink *s ) {
+
+	return s->bps ? s->payload / ( s->channels * s->bps ) : iqpack_frames( s->format, s->channels, s->payload );
+}
+
+size_t net_wire_size( const struct net_sink *s, unsigned n ) {
+
+	unsigned fpp = net_frames( s );
+
+	return s->bps ? 0 : (size_t)n * s->channels * sizeof( short ) + ( n + fpp - 1 ) / fpp * sizeof( struct iqpack_header );
+}
+
+// Send to one TCP client, keeping the unsent end of a packet for next time.  Returns -1 if the client has gone.
+static int net_send_client( struct net_client *c, struct iovec *iov, unsigned niov, size_t total, unsigned npackets ) {
+
+	struct msghdr msg;
+	ssize_t ret;
+	size_t skip;
+	unsigned i;
+	char *p;
+
+	if( c->npending ) {		// finish the last packet first, or drop this block
+		if( ( ret = send( c->fd, c->pending, c->npending, MSG_DONTWAIT | MSG_NOSIGNAL ) ) < 0 && errno != EAGAIN )
+			return -1;
+		if( ret > 0 )
+			memmove( c->pending, c->pending + ret, c->npending -= ret );
+		if( c->npending ) {
+			c->dropped += npackets;
+			return 0;
+		}
+	}
+
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = iov;
+	msg.msg_iovlen = niov;
+	if( ( ret = sendmsg( c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL ) ) < 0 ) {
+		if( errno != EAGAIN )
+			return -1;
+		c->dropped += npackets;
+		return 0;
+	}
+	if( (size_t)ret == total )
+		return 0;
+
+	// keep the rest of the packet that was cut off, drop the packets after it (a header and its samples are a pair of iovecs)
+	for( i = 0, skip = ret; skip >= iov[ i ].iov_len + iov[ i + 1 ].iov_len; i += 2 )
+		skip -= iov[ i ].iov_len + iov[ i + 1 ].iov_len;
+	c->dropped += ( niov - i ) / 2 - ( skip > 0 );
+	if( skip ) {
+		if( !( p = realloc( c->pending, iov[ i ].iov_len + iov[ i + 1 ].iov_len - skip ) ) )
+			return -1;		// the stream is out of step:  let the client go
+		c->pending = p;
+		c->npending = iov[ i ].iov_len + iov[ i + 1 ].iov_len - skip;
+		if( skip < iov[ i ].iov_len ) {
+			memcpy( c->pending, (char *)iov[ i ].iov_base + skip, iov[ i ].iov_len - skip );
+			memcpy( c->pending + iov[ i ].iov_len - skip, iov[ i + 1 ].iov_base, iov[ i + 1 ].iov_len );
+		}
+		else
+			memcpy( c->pending, (char *)iov[ i + 1 ].iov_base + skip - iov[ i ].iov_len, c->npending );
+	}
+	return 0;
+}
+
+void net_output( struct net_sink *s, const void *buf, unsigned n, uint64_t block_ns, int gain_reduction, void *wire ) {
+
+	unsigned fb = s->channels * ( s->bps ? s->bps : sizeof( short ) ), fpp = net_frames( s );
+	unsigned npackets = ( n + fpp - 1 ) / fpp, i, m, sent;
+	struct net_header *h = alloca( npackets * sizeof( *h ) );
+	struct iovec *iov = alloca( npackets * 2 * sizeof( *iov ) );
+	struct mmsghdr *msgs;
+	char *w = s->bps ? NULL : wire;
+	size_t total = 0;
+	int ret;
+
+	for( i = 0; i < npackets; i++ ) {
+		m = i < npackets - 1 ? fpp : n - i * fpp;
+		h[ i ].magic = NET_MAGIC;
+		h[ i ].version = NET_VERSION;
+		h[ i ].format = s->format;
+		h[ i ].channels = s->channels;
+		h[ i ].bps = s->bps;
+		h[ i ].seq = s->seq++;
+		h[ i ].frames = m;
+		h[ i ].sample = s->frame;
+		h[ i ].time_ns = block_ns + (uint64_t)i * fpp * 1000000000 / s->rate;
+		h[ i ].rate = s->rate;
+		h[ i ].gain_reduction = gain_reduction;
+		iov[ 2 * i ].iov_base = h + i;
+		iov[ 2 * i ].iov_len = sizeof( *h );
+		if( w ) {	// each packet's samples are a unit of their own
+			iov[ 2 * i + 1 ].iov_base = w;
+			w += iov[ 2 * i + 1 ].iov_len = s->pack( s->pack_arg, w, (const short *)buf + (size_t)i * fpp * s->channels, m );
+		}
+		else {
+			iov[ 2 * i + 1 ].iov_base = (char *)buf + (size_t)i * fpp * fb;
+			iov[ 2 * i + 1 ].iov_len = (size_t)m * fb;
+		}
+		total += sizeof( *h ) + iov[ 2 * i + 1 ].iov_len;
+		s->frame += m;
+	}
+	s->packets += npackets;
+
+	if( s->tcp ) {
+		pthread_mutex_lock( &s->lock );
+		for( i = 0; i < s->nclients; i++ )
+			if( net_send_client( s->clients[ i ], iov, npackets * 2, total, npackets ) ) {
+				s->dropped += s->clients[ i ]->dropped;
+				close( s->clients[ i ]->fd );
+				free( s->clients[ i ]->pending );
+				free( s->clients[ i ] );
+				s->clients[ i-- ] = s->clients[ --s->nclients ];
+				if( s->verbose )
+					fprintf( stderr, "%s: client gone, %d left\n", s->url, s->nclients );
+			}
+		pthread_mutex_unlock( &s->lock );
+		return;
+	}
+
+	msgs = alloca( npackets * sizeof( *msgs ) );
+	memset( msgs, 0, npackets * sizeof( *msgs ) );
+	for( i = 0; i < npackets; i++ ) {
+		msgs[ i ].msg_hdr.msg_name = &s->addr;
+		msgs[ i ].msg_hdr.msg_namelen = s->addrlen;
+		msgs[ i ].msg_hdr.msg_iov = iov + 2 * i;
+		msgs[ i ].msg_hdr.msg_iovlen = 2;
+	}
+	for( sent = 0; sent < npackets; sent += ret )
+		if( ( ret = sendmmsg( s->fd, msgs + sent, npackets - sent, MSG_DONTWAIT ) ) <= 0 ) {
+			if( ret < 0 && errno != EAGAIN && errno != ENOBUFS && !s->errors++ )
+				fprintf( stderr, "%s: %s\n", s->url, strerror( errno ) );
+			s->dropped += npackets - sent;
+			break;
+		}
+}
+
+void net_report( struct net_sink *s ) {
+
+	int i;
+
+	if( s->tcp ) {
+		pthread_mutex_lock( &s->lock );
+		for( i = 0; i < s->nclients; i++ )
+			s->dropped += s->clients[ i ]->dropped;
+		pthread_mutex_unlock( &s->lock );
+	}
+	fprintf( stderr, "Network output: %lu packet(s), %lu dropped%s\n", s->packets, s->dropped, s->tcp ? " (summed over clients)" : "" );
+}
+
+static volatile sig_atomic_t net_stop;
+
+static void net_stop_handler( int signum ) {
+
+	net_stop = 1;
+}
+
+static int read_full( int fd, void *p, size_t n ) {
+
+	ssize_t ret;
+
+	while( n ) {
+		if( ( ret = read( fd, p, n ) ) <= 0 ) {
+			if( ret < 0 && errno == EINTR && !net_stop )
+				continue;
+			return -1;
+		}
+		p = (char *)p + ret;
+		n -= ret;
+	}
+	return 0;
+}
+
+int net_monitor( const char *url ) {
+
+	static const char *formats[] = { "S16", "S32", "F32" };
+	struct sockaddr_storage addr;
+	socklen_t len;
+	struct sigaction action;
+	struct net_header *h;
+	struct mmsghdr msgs[ 64 ];
+	struct iovec iov[ 64 ];
+	char *buf = malloc( 64 * 65536 );
+	const struct iqpack_header *u;
+	static short pcm[ 65536 ];	// a packed packet's samples
+	int tcp, fd, one = 1, rcvbuf = 16 << 20, i, n, started = 0;
+	unsigned long long packets = 0, lost = 0, late = 0, bytes = 0, last_packets = 0, last_lost = 0, last_bytes = 0;
+	uint32_t expect = 0;
+	size_t want;
+	int ret;
+	double t, t0 = 0, tlast = 0, tend = 0;
+	struct timespec ts;
+
+	if( !buf ) {
+		fprintf( stderr, "%s: Cannot allocate receive buffers\n", url );
+		return 1;
+	}
+	if( net_resolve( url, &tcp, 0, &addr, &len ) )
+		return 1;
+	if( ( fd = socket( addr.ss_family, tcp ? SOCK_STREAM : SOCK_DGRAM, 0 ) ) < 0 ) {
+		fprintf( stderr, "%s: socket: %s\n", url, strerror( errno ) );
+		return 1;
+	}
+	setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof( rcvbuf ) );
+
+	if( tcp ) {
+		if( connect( fd, (struct sockaddr *)&addr, len ) ) {
+			fprintf( stderr, "%s: %s\n", url, strerror( errno ) );
+			return 1;
+		}
+	}
+	else {
+		setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );	// several readers of one multicast group
+		if( !net_multicast( &addr ) ) {		// a unicast address is ours:  listen on its port on every interface
+			if( addr.ss_family == AF_INET )
+				( (struct sockaddr_in *)&addr )->sin_addr.s_addr = htonl( INADDR_ANY );
+			else
+				( (struct sockaddr_in6 *)&addr )->sin6_addr = in6addr_any;
+		}
+		if( bind( fd, (struct sockaddr *)&addr, len ) ) {
+			fprintf( stderr, "%s: bind: %s\n", url, strerror( errno ) );
+			return 1;
+		}
+		if( net_multicast( &addr ) ) {
+			if( addr.ss_family == AF_INET ) {
+				struct ip_mreq mreq = { ( (struct sockaddr_in *)&addr )->sin_addr, { htonl( INADDR_ANY ) } };
+
+				ret = setsockopt( fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof( mreq ) );
+			}
+			else {
+				struct ipv6_mreq mreq = { ( (struct sockaddr_in6 *)&addr )->sin6_addr, 0 };
+
+				ret = setsockopt( fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof( mreq ) );
+			}
+			if( ret ) {
+				fprintf( stderr, "%s: joining group: %s\n", url, strerror( errno ) );
+				return 1;
+			}
+		}
+	}
+
+	memset( &action, 0, sizeof( action ) );	// no SA_RESTART:  a signal ends the receive
+	action.sa_handler = net_stop_handler;
+	sigaction( SIGTERM, &action, NULL );
+	sigaction( SIGINT, &action, NULL );
+
+	for( i = 0; i < 64; i++ ) {
+		iov[ i ].iov_base = buf + i * 65536;
+		iov[ i ].iov_len = 65536;
+		memset( &msgs[ i ], 0, sizeof( msgs[ i ] ) );
+		msgs[ i ].msg_hdr.msg_iov = iov + i;
+		msgs[ i ].msg_hdr.msg_iovlen = 1;
+	}
+
+	while( !net_stop ) {
+		if( tcp ) {		// one packet:  header, then its samples
+			h = (struct net_header *)buf;
+			if( read_full( fd, h, sizeof( *h ) ) )
+				break;
+			want = h->bps ? (size_t)h->frames * h->channels * h->bps
+				: sizeof( struct iqpack_header ) + iqpack_size( h->format, (size_t)h->frames * h->channels );
+			if( h->magic != NET_MAGIC || sizeof( *h ) + want > 65536 ) {
+				fprintf( stderr, "%s: Bad packet header\n", url );
+				return 1;
+			}
+			if( read_full( fd, h + 1, want ) )
+				break;
+			msgs[ 0 ].msg_len = sizeof( *h ) + want;
+			n = 1;
+		}
+		else if( ( n = recvmmsg( fd, msgs, 64, MSG_WAITFORONE, NULL ) ) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			fprintf( stderr, "%s: %s\n", url, strerror( errno ) );
+			return 1;
+		}
+
+		for( i = 0; i < n; i++ ) {
+			h = (struct net_header *)( buf + i * 65536 );
+			if( msgs[ i ].msg_len < sizeof( *h ) || h->magic != NET_MAGIC )
+				continue;
+			if( !started ) {
+				started = 1;
+				expect = h->seq;
+				clock_gettime( CLOCK_MONOTONIC, &ts );
+				tlast = t0 = ts.tv_sec + ts.tv_nsec * 1e-9;
+				fprintf( stderr, "%s: %u sps, %u channels of %s%s\n", url, h->rate, h->channels, iqpack_name( h->format ) ? iqpack_name( h->format )
+					: formats[ h->format < 3 ? h->format : 0 ], iqpack_name( h->format ) ? " (written out as S16)" : "" );
+			}
+			if( (int32_t)( h->seq - expect ) >= 0 ) {
+				lost += h->seq - expect;
+				expect = h->seq + 1;
+			}
+			else
+				late++;		// out of order (and already counted as lost)
+			packets++;
+			bytes += msgs[ i ].msg_len;
+			if( !h->bps ) {		// a packed unit:  written out decoded
+				u = (const struct iqpack_header *)( h + 1 );
+				if( msgs[ i ].msg_len < sizeof( *h ) + sizeof( *u ) || !iqpack_unit( u ) || msgs[ i ].msg_len < sizeof( *h ) + iqpack_unit( u )
+					|| (size_t)u->frames * u->channels > sizeof( pcm ) / sizeof( pcm[ 0 ] ) || iqpack_decode( u, pcm ) )
+					continue;
+				if( write( 1, pcm, (size_t)u->frames * u->channels * sizeof( short ) ) < 0 && errno != EAGAIN ) {
+					net_stop = 1;
+					break;
+				}
+			}
+			else if( write( 1, h + 1, msgs[ i ].msg_len - sizeof( *h ) ) < 0 && errno != EAGAIN ) {
+				net_stop = 1;
+				break;
+			}
+		}
+
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		tend = t = ts.tv_sec + ts.tv_nsec * 1e-9;
+		if( started && t - tlast >= 1 ) {
+			fprintf( stderr, "%s: %.0f packets/s  %.2f MB/s  lost %llu (%.3f%%)\n", url, ( packets - last_packets ) / ( t - tlast ),
+				( bytes - last_bytes ) / ( t - tlast ) * 1e-6, lost - last_lost,
+				100.0 * ( lost - last_lost ) / ( packets - last_packets + lost - last_lost ) );
+			last_packets = packets;
+			last_lost = lost;
+			last_bytes = bytes;
+			tlast = t;
+		}
+	}
+
+	t = tend - t0;		// first to last packet
+	fprintf( stderr, "%s: %llu packets in %.2f s (%.0f packets/s, %.2f MB/s), %llu lost (%.3f%%), %llu out of order\n", url, packets, t,
+		started ? packets / t : 0, started ? bytes / t * 1e-6 : 0, lost, packets + lost ? 100.0 * lost / ( packets + lost ) : 0, late );
+	close( fd );
+	free( buf );
+	return 0;
+}
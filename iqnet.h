@@ -0,0 +1,93 @@
+// iqnet.h
+// Network I/Q stream (sdrplayalsa -o udp://host:port or tcp://[addr]:port, and -V to receive one).
+//
+// Each block is cut into packets of at most 'payload' bytes of samples behind a struct net_header, so consumers can
+// spot loss from the sequence number and line the samples up by index and time.  The packets are gathered straight
+// from the output buffer (header and samples as separate iovecs, no copying) and a block goes out in one sendmmsg()
+// (UDP) or sendmsg() (TCP).  UDP goes to one address, unicast or multicast;  TCP listens and serves every client
+// that connects.  Nothing blocks:  what the socket buffer cannot take is dropped and counted (for a TCP client, the
+// rest of a part-sent packet is kept so the stream stays in step).  With a compact format (iqpack.h) each packet's
+// samples are one unit of their own, packed by the caller's net_pack_fn.
+//
+// One thread sends (net_output());  a TCP sink has a thread of its own taking clients.
+
+#ifndef IQNET_H
+#define IQNET_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define NET_MAGIC 0x41524453	// "SDRA"
+#define NET_VERSION 1
+#define NET_MAXCLIENTS 16
+
+struct net_header {				// little-endian
+	uint32_t magic;
+	uint8_t version;
+	uint8_t format;				// S16, S32 or F32 (0-2, as sdrplayalsa's -F), or IQPACK_P12, IQPACK_S8 or IQPACK_BFP
+	uint8_t channels;			// 2, or 4 for an RSPduo's two tuners
+	uint8_t bps;				// bytes per sample, or 0 when the samples are one iqpack unit (iqpack.h)
+	uint32_t seq;				// packet sequence number
+	uint32_t frames;			// frames in this packet
+	uint64_t sample;			// index of the first frame since the stream started
+	uint64_t time_ns;			// CLOCK_REALTIME of the first frame (as the block reached the callback)
+	uint32_t rate;				// frames per second
+	uint32_t gain_reduction;	// dB, as last set
+};
+
+// Pack 'frames' frames of interleaved S16 at in into one iqpack unit at out, returning its length
+typedef size_t net_pack_fn( void *arg, void *out, const short *in, unsigned frames );
+
+struct net_client {
+	int fd;
+	char *pending;				// unsent rest of a packet
+	size_t npending;
+	unsigned long dropped;		// packets
+};
+
+struct net_sink {
+	const char *url;
+	int tcp;
+	int fd;						// UDP socket, or TCP listener
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int payload;				// bytes of samples per packet
+	int format, channels, bps, rate;	// bps 0 for a compact format, packed by pack()
+	net_pack_fn *pack;
+	void *pack_arg;
+	int verbose;				// report TCP clients coming and going
+	uint32_t seq;				// next packet's sequence number
+	uint64_t frame;				// index of the next frame
+	unsigned long packets, dropped, errors;
+	pthread_t thread;			// TCP:  accepts clients
+	pthread_mutex_t lock;
+	struct net_client *clients[ NET_MAXCLIENTS ];
+	int nclients;
+};
+
+// Split "udp://host:port" (host may be [v6addr] or empty) and resolve it.  Returns 0, or 1 after reporting an error.
+int net_resolve( const char *url, int *tcp, int passive, struct sockaddr_storage *addr, socklen_t *len );
+int net_multicast( const struct sockaddr_storage *addr );
+
+// Open a sink for url (kept, for messages) sending 'payload' bytes of samples a packet of a stream of format,
+// channels, bytes per sample (0 with pack, for a compact format) and rate.  NULL after reporting an error.
+struct net_sink *net_open( const char *url, int payload, int format, int channels, int bps, int rate,
+	net_pack_fn *pack, void *arg, int verbose );
+
+// Frames in a full packet, and the room net_output() needs in 'wire' to pack n frames (0 when not packing)
+unsigned net_frames( const struct net_sink *s );
+size_t net_wire_size( const struct net_sink *s, unsigned n );
+
+// Send n frames at buf that reached the callback at block_ns, with the gain reduction then in effect
+void net_output( struct net_sink *s, const void *buf, unsigned n, uint64_t block_ns, int gain_reduction, void *wire );
+
+// Report the packets sent and dropped (summed over a TCP sink's clients)
+void net_report( struct net_sink *s );
+
+// -V:  receive a stream, write the samples to stdout (packed ones decoded to S16) and report the packet rate and
+// loss once a second and at the end.  Returns an exit code.
+int net_monitor( const char *url );
+
+#endif
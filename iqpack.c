@@ -0,0 +1,166 @@
+// iqpack.c
+// Compact I/Q wire formats, reference encoders and the decoders - see iqpack.h.
+
+#include "iqpack.h"
+#include <math.h>
+#include <string.h>
+
+size_t iqpack_size( int format, size_t samples ) {
+
+	switch( format ) {
+	case IQPACK_P12:
+		return samples / 2 * 3;
+	case IQPACK_S8:
+		return samples;
+	case IQPACK_BFP:
+		return samples + ( samples + IQPACK_BFP_GROUP - 1 ) / IQPACK_BFP_GROUP;
+	}
+	return 0;
+}
+
+size_t iqpack_frames( int format, int channels, size_t bytes ) {
+
+	if( bytes <= sizeof( struct iqpack_header ) )
+		return 0;
+	bytes -= sizeof( struct iqpack_header );
+	switch( format ) {
+	case IQPACK_P12:
+		return bytes / 3 * 2 / channels;
+	case IQPACK_S8:
+		return bytes / channels;
+	case IQPACK_BFP:	// whole groups, and what is left over after one more exponent
+		return ( bytes / ( IQPACK_BFP_GROUP + 1 ) * IQPACK_BFP_GROUP
+			+ ( bytes % ( IQPACK_BFP_GROUP + 1 ) ? bytes % ( IQPACK_BFP_GROUP + 1 ) - 1 : 0 ) ) / channels;
+	}
+	return 0;
+}
+
+const char *iqpack_name( int format ) {
+
+	return format == IQPACK_P12 ? "p12" : format == IQPACK_S8 ? "s8" : format == IQPACK_BFP ? "bfp" : NULL;
+}
+
+static inline int16_t round_shift( int16_t x, int e ) {	// x >> e rounded, saturating on the way up like paddsw
+
+	int v = e ? x + ( 1 << ( e - 1 ) ) : x;
+
+	return ( v > 32767 ? 32767 : v ) >> e;
+}
+
+void iqpack_p12( uint8_t *out, const int16_t *in, size_t n ) {
+
+	size_t i;
+	uint32_t w;
+
+	for( i = 0; i + 1 < n; i += 2, out += 3 ) {
+		w = ( round_shift( in[ i ], 4 ) & 0xfff ) | ( round_shift( in[ i + 1 ], 4 ) & 0xfff ) << 12;
+		out[ 0 ] = w;
+		out[ 1 ] = w >> 8;
+		out[ 2 ] = w >> 16;
+	}
+}
+
+void iqpack_s8( int8_t *out, const int16_t *in, size_t n, float gain ) {
+
+	size_t i;
+	long v;
+
+	for( i = 0; i < n; i++ ) {
+		v = lrintf( in[ i ] * gain );
+		out[ i ] = v > 127 ? 127 : v < -128 ? -128 : v;
+	}
+}
+
+void iqpack_bfp( uint8_t *out, const int16_t *in, size_t n ) {
+
+	size_t i, j, g;
+	int m, a, e;
+
+	for( i = 0; i < n; i += g ) {
+		g = n - i < IQPACK_BFP_GROUP ? n - i : IQPACK_BFP_GROUP;
+		for( j = m = 0; j < g; j++ ) {
+			a = in[ i + j ] < 0 ? -in[ i + j ] : in[ i + j ];
+			if( a > m )
+				m = a > 32767 ? 32767 : a;
+		}
+		for( e = 0; m >> e > 127; e++ )		// the fewest bits off that leave 8 signed ones
+			;
+		*out++ = e;
+		for( j = 0; j < g; j++ ) {
+			a = round_shift( in[ i + j ], e );
+			*out++ = (uint8_t)( a > 127 ? 127 : a );
+		}
+	}
+}
+
+size_t iqpack_encode( void *out, int format, int channels, const int16_t *in, uint32_t frames ) {
+
+	struct iqpack_header *h = out;
+	size_t i, n = (size_t)frames * channels;
+	int peak = 1, a;
+
+	h->magic = IQPACK_MAGIC;
+	h->format = format;
+	h->channels = channels;
+	h->pad = 0;
+	h->frames = frames;
+	h->scale = 1;
+	if( format == IQPACK_P12 )
+		iqpack_p12( (uint8_t *)( h + 1 ), in, n );
+	else if( format == IQPACK_S8 ) {
+		for( i = 0; i < n; i++ )
+			if( ( a = in[ i ] < 0 ? -in[ i ] : in[ i ] ) > peak )
+				peak = a;
+		h->scale = peak / 127.0f;
+		iqpack_s8( (int8_t *)( h + 1 ), in, n, 127.0f / peak );
+	}
+	else if( format == IQPACK_BFP )
+		iqpack_bfp( (uint8_t *)( h + 1 ), in, n );
+	else
+		return 0;
+	return sizeof( *h ) + iqpack_size( format, n );
+}
+
+size_t iqpack_unit( const struct iqpack_header *h ) {
+
+	if( h->magic != IQPACK_MAGIC || !iqpack_name( h->format ) || !h->channels || h->channels > 4 || h->frames > IQPACK_MAX_FRAMES )
+		return 0;
+	return sizeof( *h ) + iqpack_size( h->format, (size_t)h->frames * h->channels );
+}
+
+int iqpack_decode( const struct iqpack_header *h, int16_t *out ) {
+
+	const uint8_t *p = (const uint8_t *)( h + 1 );
+	size_t i, j, g, n = (size_t)h->frames * h->channels;
+	uint32_t w;
+	long v;
+	int e;
+
+	if( !iqpack_unit( h ) )
+		return -1;
+	switch( h->format ) {
+	case IQPACK_P12:
+		for( i = 0; i + 1 < n; i += 2, p += 3 ) {
+			w = p[ 0 ] | p[ 1 ] << 8 | p[ 2 ] << 16;
+			out[ i ] = (int16_t)( w << 4 );				// each 12 bits to the top of 16
+			out[ i + 1 ] = (int16_t)( w >> 8 & 0xfff0 );
+		}
+		break;
+	case IQPACK_S8:
+		for( i = 0; i < n; i++ ) {
+			v = lrintf( (int8_t)p[ i ] * h->scale );
+			out[ i ] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+		}
+		break;
+	case IQPACK_BFP:
+		for( i = 0; i < n; i += g ) {
+			g = n - i < IQPACK_BFP_GROUP ? n - i : IQPACK_BFP_GROUP;
+			if( ( e = *p++ ) > 8 )
+				return -1;
+			for( j = 0; j < g; j++ )
+				out[ i + j ] = (int16_t)( (int8_t)*p++ * ( 1 << e ) );
+		}
+		break;
+	}
+	return 0;
+}
@@ -0,0 +1,53 @@
+// iqpack.h
+// Compact I/Q wire formats (sdrplayalsa -F p12, s8 or bfp) for stdout and the network, where S16 spends bits on
+// headroom the ADC does not have.  Each block goes out as one unit:  a struct iqpack_header, then the samples of
+// 'frames' frames of 'channels' interleaved channels (2, or 4 for an RSPduo's two tuners), packed as
+//	p12	12 bits, the S16 sample rounded, in pairs of samples a and b as the 24-bit little-endian word a | b << 12:
+//		3 bytes a frame
+//	s8	8 bits, the S16 sample times 127 / the block's peak, rounded;  scale (the peak / 127) turns them back:
+//		2 bytes a frame for the lot, but a weak stretch of a block with a strong one is quantized coarsely
+//	bfp	block floating point:  every IQPACK_BFP_GROUP samples share an exponent e (a byte, 0-8) and are stored
+//		as 8-bit mantissas, the S16 sample >> e rounded, so the step follows the signal 16 I/Q frames at a
+//		time:  2.06 bytes a frame
+// The unit is self-describing, so a stream of them can be decoded without knowing what was sent.  The encoders
+// here are the portable reference;  sdrplayalsa has SIMD versions that must produce the same bytes.
+
+#ifndef IQPACK_H
+#define IQPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define IQPACK_MAGIC 0x4b505149	// "IQPK"
+#define IQPACK_BFP_GROUP 32		// samples to an exponent
+#define IQPACK_MAX_FRAMES ( 1 << 20 )	// most frames in a unit;  a header claiming more is taken as damaged
+
+enum { IQPACK_P12 = 3, IQPACK_S8, IQPACK_BFP };	// following sdrplayalsa's S16, S32 and F32 (0-2) in its packet headers
+
+struct iqpack_header {			// little-endian, 16 bytes, then the packed samples
+	uint32_t magic;
+	uint8_t format;				// IQPACK_P12, IQPACK_S8 or IQPACK_BFP
+	uint8_t channels;
+	uint16_t pad;
+	uint32_t frames;
+	float scale;				// s8:  decoded sample = byte * scale;  otherwise 1
+};
+
+// sizes
+size_t iqpack_size( int format, size_t samples );			// bytes of packed samples (not counting the header)
+size_t iqpack_frames( int format, int channels, size_t bytes );	// most frames whose whole unit fits in bytes
+const char *iqpack_name( int format );						// "p12", "s8" or "bfp", NULL if not one of them
+
+// reference encoders of n interleaved samples (n even for p12), and a whole unit;  iqpack_encode() returns its length
+void iqpack_p12( uint8_t *out, const int16_t *in, size_t n );
+void iqpack_s8( int8_t *out, const int16_t *in, size_t n, float gain );	// gain 127 / the peak
+void iqpack_bfp( uint8_t *out, const int16_t *in, size_t n );
+size_t iqpack_encode( void *out, int format, int channels, const int16_t *in, uint32_t frames );
+
+// decoders:  iqpack_unit() is the length of the unit starting with h (0 if h is not a unit header, or claims more
+// than 4 channels or IQPACK_MAX_FRAMES frames), and iqpack_decode() turns its frames * channels samples back into S16
+// at out, returning 0, or -1 for a bad unit
+size_t iqpack_unit( const struct iqpack_header *h );
+int iqpack_decode( const struct iqpack_header *h, int16_t *out );
+
+#endif
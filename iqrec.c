@@ -0,0 +1,544 @@
+// iqrec.c
+// SigMF recorder, with O_DIRECT and io_uring where available - see iqrec.h.
+
+#define _GNU_SOURCE
+#include "iqrec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if __has_include( <linux/io_uring.h> )
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+static uint64_t now_ns( void ) {
+
+	struct timespec ts;
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void rec_failed( struct recorder *r, int err ) {
+
+	if( !r->failed )
+		fprintf( stderr, "%s.sigmf-data: %s - recording stopped\n", r->name, strerror( err ) );
+	r->failed = 1;
+}
+
+#ifdef HAVE_IO_URING
+// Set up an io_uring without liburing:  the submission and completion rings are shared memory mapped from its fd
+static void rec_uring_init( struct recorder *r ) {
+
+	struct io_uring_params p;
+	size_t sqlen, cqlen;
+	char *sq, *cq;
+
+	memset( &p, 0, sizeof( p ) );
+	if( ( r->uring = syscall( __NR_io_uring_setup, REC_QD, &p ) ) < 0 )
+		return;
+	sqlen = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof( struct io_uring_cqe );
+	if( p.features & IORING_FEAT_SINGLE_MMAP )
+		sqlen = cqlen = sqlen > cqlen ? sqlen : cqlen;
+	sq = mmap( NULL, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->uring, IORING_OFF_SQ_RING );
+	cq = p.features & IORING_FEAT_SINGLE_MMAP ? sq
+		: mmap( NULL, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->uring, IORING_OFF_CQ_RING );
+	r->sqes = mmap( NULL, p.sq_entries * sizeof( struct io_uring_sqe ), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->uring, IORING_OFF_SQES );
+	if( sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED ) {
+		close( r->uring );	// the mappings go with it
+		r->uring = -1;
+		return;
+	}
+	r->sq_tail = (unsigned *)( sq + p.sq_off.tail );
+	r->sq_mask = (unsigned *)( sq + p.sq_off.ring_mask );
+	r->sq_array = (unsigned *)( sq + p.sq_off.array );
+	r->cq_head = (unsigned *)( cq + p.cq_off.head );
+	r->cq_tail = (unsigned *)( cq + p.cq_off.tail );
+	r->cq_mask = (unsigned *)( cq + p.cq_off.ring_mask );
+	r->cqes = (struct io_uring_cqe *)( cq + p.cq_off.cqes );
+}
+
+// Queue a write of c (at most REC_QD at a time, so there is always room in the submission ring)
+static void rec_submit( struct recorder *r, struct rec_chunk *c, uint64_t off ) {
+
+	unsigned tail = *r->sq_tail, i = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = r->sqes + i;
+
+	memset( sqe, 0, sizeof( *sqe ) );
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = r->fd;
+	sqe->addr = (uintptr_t)c->buf;
+	sqe->len = c->wlen;
+	sqe->off = off;
+	sqe->user_data = c - r->chunks;
+	r->sq_array[ i ] = i;
+	atomic_store_explicit( (_Atomic unsigned *)r->sq_tail, tail + 1, memory_order_release );
+	if( !r->inflight++ )
+		r->busy_since = now_ns();
+	while( syscall( __NR_io_uring_enter, r->uring, 1, 0, 0, NULL, 0 ) < 0 )
+		if( errno != EINTR && errno != EAGAIN ) {
+			rec_failed( r, errno );
+			break;
+		}
+}
+
+// Collect finished writes, first waiting for one if wait is set
+static void rec_reap( struct recorder *r, int wait ) {
+
+	unsigned head = *r->cq_head, tail;
+	struct io_uring_cqe *cqe;
+	struct rec_chunk *c;
+
+	if( wait )
+		while( syscall( __NR_io_uring_enter, r->uring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0 && errno == EINTR )
+			;
+	tail = atomic_load_explicit( (_Atomic unsigned *)r->cq_tail, memory_order_acquire );
+	for( ; head != tail; head++ ) {
+		cqe = r->cqes + ( head & *r->cq_mask );
+		c = r->chunks + cqe->user_data;
+		if( cqe->res != (int)c->wlen )	// a short write is the disk filling up
+			rec_failed( r, cqe->res < 0 ? -cqe->res : ENOSPC );
+		atomic_store_explicit( &c->state, REC_FREE, memory_order_release );
+		if( !--r->inflight )
+			r->busy_ns += now_ns() - r->busy_since;
+	}
+	atomic_store_explicit( (_Atomic unsigned *)r->cq_head, head, memory_order_release );
+}
+#else
+static void rec_uring_init( struct recorder *r ) {
+
+	r->uring = -1;
+}
+
+static void rec_submit( struct recorder *r, struct rec_chunk *c, uint64_t off ) {
+}
+
+static void rec_reap( struct recorder *r, int wait ) {
+}
+#endif
+
+// Write c from this thread.  On a filesystem without O_DIRECT, writeback of each chunk is started at once and
+// the one before is dropped from the page cache once it is on disk.
+static void rec_pwrite( struct recorder *r, struct rec_chunk *c, uint64_t off ) {
+
+	uint64_t t0 = now_ns();
+	const char *p = c->buf;
+	size_t len = c->wlen;
+	ssize_t ret;
+
+	for( ; len; p += ret, len -= ret )
+		if( ( ret = pwrite( r->fd, p, len, off + ( p - c->buf ) ) ) <= 0 ) {
+			if( ret < 0 && errno == EINTR ) {
+				ret = 0;
+				continue;
+			}
+			rec_failed( r, ret < 0 ? errno : ENOSPC );
+			break;
+		}
+	if( !r->direct && !r->failed ) {
+		sync_file_range( r->fd, off, c->wlen, SYNC_FILE_RANGE_WRITE );
+		if( off >= r->chunk_size ) {
+			sync_file_range( r->fd, off - r->chunk_size, r->chunk_size, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+			posix_fadvise( r->fd, off - r->chunk_size, r->chunk_size, POSIX_FADV_DONTNEED );
+		}
+	}
+	r->busy_ns += now_ns() - t0;
+	atomic_store_explicit( &c->state, REC_FREE, memory_order_release );
+}
+
+static void rec_datetime( char *s, size_t n, uint64_t ns ) {
+
+	time_t t = ns / 1000000000;
+	struct tm tm;
+	size_t len;
+
+	gmtime_r( &t, &tm );
+	len = strftime( s, n, "%Y-%m-%dT%H:%M:%S", &tm );
+	snprintf( s + len, n - len, ".%06uZ", (unsigned)( ns % 1000000000 / 1000 ) );
+}
+
+// Start a capture segment at the current end of the file with c, whose first frame has stream index c->frame
+static void rec_capture( struct recorder *r, const struct rec_chunk *c ) {
+
+	struct rec_settings s;
+	char when[ 40 ];
+
+	r->settings( r->settings_arg, &s );
+	rec_datetime( when, sizeof( when ), c->time_ns );
+	fprintf( r->captures, "%s\n    { \"core:sample_start\": %llu, \"core:global_index\": %llu, \"core:frequency\": %d, \"core:datetime\": \"%s\"",
+		r->ncaptures++ ? "," : "", (unsigned long long)r->file_frames, (unsigned long long)c->frame, s.freq[ 0 ], when );
+	if( r->channels == 4 )
+		fprintf( r->captures, ", \"sdrplayalsa:frequency_b\": %d", s.freq[ 1 ] );
+	fprintf( r->captures, " }" );
+}
+
+static void rec_annotate( struct recorder *r, uint64_t sample, int tuner_b, const char *comment ) {
+
+	fprintf( r->annotations, "%s\n    { \"core:sample_start\": %llu, \"core:label\": \"gain\", \"core:comment\": \"%s\", \"sdrplayalsa:gain_reduction\": %d",
+		r->nannotations++ ? "," : "", (unsigned long long)sample, comment, r->gain[ tuner_b ] );
+	if( r->channels == 4 )
+		fprintf( r->annotations, ", \"sdrplayalsa:tuner\": \"%c\"", tuner_b ? 'B' : 'A' );
+	fprintf( r->annotations, " }" );
+}
+
+// Write the current file's .sigmf-meta (through a temporary file, so a reader never sees half of one)
+static void rec_meta( struct recorder *r ) {
+
+	static const char *datatype[] = { "ci16_le", "ci32_le", "cf32_le" };
+	struct rec_settings s;
+	char path[ 300 ], tmp[ 310 ];
+	FILE *fp;
+
+	fflush( r->captures );
+	fflush( r->annotations );
+	r->settings( r->settings_arg, &s );
+	snprintf( path, sizeof( path ), "%s.sigmf-meta", r->name );
+	snprintf( tmp, sizeof( tmp ), "%s.tmp", path );
+	if( !( fp = fopen( tmp, "w" ) ) ) {
+		fprintf( stderr, "%s: %s\n", tmp, strerror( errno ) );
+		return;
+	}
+	fprintf( fp, "{\n  \"global\": {\n"
+		"    \"core:datatype\": \"%s\",\n"
+		"    \"core:sample_rate\": %d,\n"
+		"    \"core:num_channels\": %d,\n"
+		"    \"core:version\": \"1.0.0\",\n"
+		"    \"core:recorder\": \"sdrplayalsa\",\n"
+		"    \"core:hw\": \"%s\",\n"
+		"    \"core:extensions\": [ { \"name\": \"sdrplayalsa\", \"version\": \"1.0.0\", \"optional\": true } ],\n"
+		"    \"sdrplayalsa:fs_hz\": %ld,\n"
+		"    \"sdrplayalsa:decimation\": %d,\n"
+		"    \"sdrplayalsa:software_decimation\": %s,\n"
+		"    \"sdrplayalsa:resample\": \"%d/%d\",\n"
+		"    \"sdrplayalsa:lna_state\": %d,\n"
+		"    \"sdrplayalsa:bandwidth_khz\": %d,\n"
+		"    \"sdrplayalsa:agc\": %s\n"
+		"  },\n"
+		"  \"captures\": [%.*s\n  ],\n"
+		"  \"annotations\": [%.*s\n  ]\n}\n",
+		datatype[ r->format ], r->rate, r->channels / 2, s.hw, s.fs_hz, s.decimation, s.software_decimation ? "true" : "false",
+		s.resample_L, s.resample_M, s.lna_state, s.bandwidth_khz, s.agc ? "true" : "false",
+		(int)r->captures_len, r->captures_buf, (int)r->annotations_len, r->annotations_buf );
+	if( fclose( fp ) || rename( tmp, path ) )
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+}
+
+// Start a new data file with c.  Returns 0, or 1 after reporting an error.
+static int rec_open_file( struct recorder *r, const struct rec_chunk *c ) {
+
+	char path[ 300 ];
+
+	if( r->rotate )
+		snprintf( r->name, sizeof( r->name ), "%s-%05u", r->base, r->files );
+	else
+		snprintf( r->name, sizeof( r->name ), "%s", r->base );
+	snprintf( path, sizeof( path ), "%s.sigmf-data", r->name );
+	r->direct = 1;
+	if( ( r->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644 ) ) < 0 && errno == EINVAL ) {
+		r->direct = 0;		// not on this filesystem
+		r->fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	}
+	if( r->fd < 0 ) {
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 1;
+	}
+	r->files++;
+	r->file_bytes = r->file_frames = 0;
+	if( r->captures ) {
+		fclose( r->captures );
+		fclose( r->annotations );
+		free( r->captures_buf );
+		free( r->annotations_buf );
+	}
+	r->captures = open_memstream( &r->captures_buf, &r->captures_len );
+	r->annotations = open_memstream( &r->annotations_buf, &r->annotations_len );
+	r->ncaptures = r->nannotations = 0;
+
+	rec_capture( r, c );
+	rec_annotate( r, 0, 0, "gain at start of file" );
+	if( r->channels == 4 )
+		rec_annotate( r, 0, 1, "gain at start of file" );
+	rec_meta( r );		// so that an interrupted recording is still described
+	return 0;
+}
+
+// Finish the current data file:  wait for its writes, trim the padding of a last short O_DIRECT write, and write
+// the final .sigmf-meta
+static void rec_close_file( struct recorder *r ) {
+
+	if( r->fd < 0 )
+		return;
+	while( r->inflight )
+		rec_reap( r, 1 );
+	if( r->file_bytes % REC_ALIGN && ftruncate( r->fd, r->file_bytes ) )
+		rec_failed( r, errno );
+	close( r->fd );
+	r->fd = -1;
+	rec_meta( r );
+}
+
+// Write a full chunk to the current file, first starting a new one if it is due
+static void rec_write( struct recorder *r, struct rec_chunk *c ) {
+
+	uint64_t end = c->frame + c->len / r->fb;
+	struct rec_event *e;
+
+	if( !r->first_ns )
+		r->first_ns = now_ns();
+	if( !r->failed && ( r->fd < 0 || ( r->max_bytes && r->file_bytes + c->len > r->max_bytes ) || ( r->max_frames && r->file_frames >= r->max_frames ) ) ) {
+		rec_close_file( r );
+		if( rec_open_file( r, c ) )
+			r->failed = 1;
+	}
+	else if( c->frame != r->expect ) {	// samples were dropped before this chunk
+		fprintf( r->annotations, "%s\n    { \"core:sample_start\": %llu, \"core:label\": \"dropped\", \"core:comment\": \"%llu frames dropped - the recorder fell behind\" }",
+			r->nannotations++ ? "," : "", (unsigned long long)r->file_frames, (unsigned long long)( c->frame - r->expect ) );
+		rec_capture( r, c );
+	}
+	r->expect = end;
+	if( r->failed ) {
+		atomic_store_explicit( &c->state, REC_FREE, memory_order_release );
+		return;
+	}
+
+	pthread_mutex_lock( &r->lock );
+	for( ; r->ev < r->nevents && ( e = r->events + r->ev )->frame < end; r->ev++ ) {
+		r->gain[ e->tuner_b ] = e->gain_reduction;
+		rec_annotate( r, r->file_frames + ( e->frame > c->frame ? e->frame - c->frame : 0 ), e->tuner_b, "gain change" );
+	}
+	if( r->ev == r->nevents )
+		r->ev = r->nevents = 0;
+	pthread_mutex_unlock( &r->lock );
+
+	c->wlen = c->len;
+	if( r->direct && c->wlen % REC_ALIGN ) {	// only the last chunk is short:  pad it, the file is trimmed on closing
+		c->wlen = ( c->len + REC_ALIGN - 1 ) & ~(size_t)( REC_ALIGN - 1 );
+		memset( c->buf + c->len, 0, c->wlen - c->len );
+	}
+	atomic_store_explicit( &c->state, REC_WRITING, memory_order_relaxed );
+	if( r->uring >= 0 && r->direct )
+		rec_submit( r, c, r->file_bytes );
+	else
+		rec_pwrite( r, c, r->file_bytes );
+	r->file_bytes += c->len;
+	r->file_frames += c->len / r->fb;
+	r->bytes += c->len;
+}
+
+// Recorder thread:  writes chunks in the order they were filled, keeping up to REC_QD in flight with io_uring
+static void *rec_thread( void *arg ) {
+
+	struct recorder *r = arg;
+	struct rec_chunk *c;
+	sigset_t all;
+
+	sigfillset( &all );		// signals belong on another thread:  it waits for this one
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	for(;;) {
+		if( r->inflight )
+			rec_reap( r, 0 );
+		c = r->chunks + r->next;
+		if( atomic_load_explicit( &c->state, memory_order_acquire ) == REC_FULL && r->inflight < REC_QD ) {
+			rec_write( r, c );
+			r->next = ( r->next + 1 ) % r->nchunks;
+		}
+		else if( r->inflight )
+			rec_reap( r, 1 );
+		else if( atomic_load( &r->stop ) ) {
+			if( atomic_load_explicit( &c->state, memory_order_acquire ) != REC_FULL )	// rec_close() queued it before stopping us
+				break;
+		}
+		else
+			while( sem_wait( &r->sem ) && errno == EINTR )
+				;
+	}
+	rec_close_file( r );
+	return arg;
+}
+
+struct recorder *rec_open( const char *url, int format, int rate, int channels, int bps, const int gain[ 2 ],
+	rec_settings_fn *settings, void *arg ) {
+
+	struct recorder *r = calloc( 1, sizeof( *r ) );
+	char *name = strdup( url ), *opts, *opt, *p;
+	uint64_t want = (uint64_t)rate * channels * bps / 4;
+	unsigned i;
+	int ret;
+
+	if( !r || !name ) {
+		fprintf( stderr, "Cannot allocate the recorder\n" );
+		goto fail;
+	}
+	if( ( opts = strchr( name, '?' ) ) ) {
+		*opts++ = 0;
+		for( opt = strtok( opts, "&" ); opt; opt = strtok( NULL, "&" ) ) {
+			if( !strncmp( opt, "size=", 5 ) && atoi( opt + 5 ) > 0 )
+				r->max_bytes = (uint64_t)atoi( opt + 5 ) << 20;
+			else if( !strncmp( opt, "time=", 5 ) && atoi( opt + 5 ) > 0 )
+				r->max_frames = (uint64_t)atoi( opt + 5 ) * rate;
+			else if( !strcmp( opt, "io=thread" ) )
+				r->uring = -1;
+			else {
+				fprintf( stderr, "sigmf://%s: Unknown option '%s' - expected size=MB, time=seconds or io=thread\n", url, opt );
+				goto fail;
+			}
+		}
+	}
+	if( ( p = strstr( name, ".sigmf-data" ) ) && !p[ 11 ] )	// given the data file's name
+		*p = 0;
+	if( !*name || strlen( name ) >= sizeof( r->base ) ) {
+		fprintf( stderr, "sigmf://%s: Bad file name\n", url );
+		goto fail;
+	}
+	strcpy( r->base, name );
+	strcpy( r->name, name );
+	free( name );
+	name = NULL;
+	r->rotate = r->max_bytes || r->max_frames;
+	r->format = format;
+	r->rate = rate;
+	r->channels = channels;
+	r->fb = channels * bps;
+	r->settings = settings;
+	r->settings_arg = arg;
+
+	for( r->chunk_size = 256 << 10; r->chunk_size < want && r->chunk_size < 4 << 20; r->chunk_size <<= 1 )
+		;
+	if( ( r->nchunks = 8 * want / r->chunk_size ) < 8 )	// two seconds' worth
+		r->nchunks = 8;
+	if( r->max_bytes && r->max_bytes < r->chunk_size )	// files hold whole chunks
+		r->max_bytes = r->chunk_size;
+	if( !( r->chunks = calloc( r->nchunks, sizeof( *r->chunks ) ) ) )
+		goto nomem;
+	for( i = 0; i < r->nchunks; i++ ) {
+		if( posix_memalign( (void **)&r->chunks[ i ].buf, REC_ALIGN, r->chunk_size ) )
+			goto nomem;
+		memset( r->chunks[ i ].buf, 0, r->chunk_size );	// pre-fault the pages now, not in the callback
+	}
+	r->fd = -1;
+	r->gain[ 0 ] = gain[ 0 ];
+	r->gain[ 1 ] = gain[ 1 ];
+	pthread_mutex_init( &r->lock, NULL );
+	sem_init( &r->sem, 0, 0 );
+
+	if( !r->uring )
+		rec_uring_init( r );
+	if( ( ret = pthread_create( &r->thread, NULL, rec_thread, r ) ) ) {
+		fprintf( stderr, "Cannot create recorder thread: %s\n", strerror( ret ) );
+		return NULL;
+	}
+	return r;
+
+nomem:
+	fprintf( stderr, "Cannot allocate %u recording buffers of %zu bytes\n", r->nchunks, r->chunk_size );
+fail:
+	free( name );
+	if( r && r->chunks )
+		for( i = 0; i < r->nchunks; i++ )
+			free( r->chunks[ i ].buf );
+	if( r )
+		free( r->chunks );
+	free( r );
+	return NULL;
+}
+
+// Hand the filled chunk to the recorder thread
+static void rec_pass( struct recorder *r ) {
+
+	atomic_store_explicit( &r->fill->state, REC_FULL, memory_order_release );
+	r->fill = NULL;
+	sem_post( &r->sem );
+}
+
+// The chunk being filled, claiming the next one if need be;  skip is how far into the current block it starts.
+// NULL if none is free.
+static struct rec_chunk *rec_chunk( struct recorder *r, unsigned skip, uint64_t block_ns ) {
+
+	struct rec_chunk *c = r->chunks + r->claim;
+
+	if( r->fill )
+		return r->fill;
+	if( atomic_load_explicit( &c->state, memory_order_acquire ) != REC_FREE )
+		return NULL;
+	c->len = 0;
+	c->frame = atomic_load_explicit( &r->frame, memory_order_relaxed ) + skip;
+	c->time_ns = block_ns + (uint64_t)skip * 1000000000 / r->rate;
+	r->claim = ( r->claim + 1 ) % r->nchunks;
+	return r->fill = c;
+}
+
+void *rec_block( struct recorder *r, unsigned n, uint64_t block_ns ) {
+
+	struct rec_chunk *c = rec_chunk( r, 0, block_ns );
+
+	if( !c || c->len + (size_t)n * r->fb > r->chunk_size )
+		return NULL;
+	return c->buf + c->len;
+}
+
+void rec_output( struct recorder *r, const void *buf, unsigned n, uint64_t block_ns ) {
+
+	size_t len = (size_t)n * r->fb, l;
+	const char *p = buf;
+	struct rec_chunk *c;
+
+	while( len ) {
+		if( !( c = rec_chunk( r, n - len / r->fb, block_ns ) ) ) {	// every chunk is waiting for the disk
+			r->dropped += len / r->fb;
+			break;
+		}
+		if( ( l = r->chunk_size - c->len ) > len )
+			l = len;
+		if( p != c->buf + c->len )	// not already there
+			memcpy( c->buf + c->len, p, l );
+		c->len += l;
+		p += l;
+		len -= l;
+		if( c->len == r->chunk_size )
+			rec_pass( r );
+	}
+	atomic_store_explicit( &r->frame, atomic_load_explicit( &r->frame, memory_order_relaxed ) + n, memory_order_relaxed );
+}
+
+void rec_event( struct recorder *r, int gain_reduction, int tuner_b ) {
+
+	struct rec_event *e, *ev;
+
+	pthread_mutex_lock( &r->lock );
+	if( r->nevents == r->maxevents ) {
+		if( !( ev = realloc( r->events, ( r->maxevents * 2 + 64 ) * sizeof( *r->events ) ) ) ) {	// not annotated
+			pthread_mutex_unlock( &r->lock );
+			return;
+		}
+		r->events = ev;
+		r->maxevents = r->maxevents * 2 + 64;
+	}
+	e = r->events + r->nevents++;
+	e->frame = atomic_load_explicit( &r->frame, memory_order_relaxed );
+	e->gain_reduction = gain_reduction;
+	e->tuner_b = tuner_b;
+	pthread_mutex_unlock( &r->lock );
+}
+
+void rec_close( struct recorder *r ) {
+
+	double t;
+
+	if( r->fill && r->fill->len )
+		rec_pass( r );
+	atomic_store( &r->stop, 1 );
+	sem_post( &r->sem );
+	pthread_join( r->thread, NULL );
+
+	t = r->first_ns ? ( now_ns() - r->first_ns ) * 1e-9 : 0;
+	fprintf( stderr, "SigMF recording: %u file(s), %.1f MB written, %.0f MB/s while writing (busy %.0f%% of %.1f s), %s%s, %lu frame(s) dropped\n",
+		r->files, r->bytes * 1e-6, r->busy_ns ? r->bytes * 1e3 / r->busy_ns : 0, t > 0 ? r->busy_ns * 1e-7 / t : 0, t,
+		r->uring >= 0 ? "io_uring" : "writer thread", r->direct ? ", O_DIRECT" : "", r->dropped );
+}
@@ -0,0 +1,128 @@
+// iqrec.h
+// SigMF recorder (sdrplayalsa -o sigmf://path[?size=MB][&time=s][&io=thread]).
+//
+// Blocks are gathered into large aligned chunks that a recorder thread writes to path.sigmf-data
+// (path-NNNNN.sigmf-data, a new file every 'size' MB or 'time' seconds, when rotating).  Files are opened with
+// O_DIRECT where the filesystem allows, so a long recording does not push everything else out of the page cache,
+// and written through io_uring with several chunks in flight - or with pwrite() from the same thread where io_uring
+// is unavailable or 'io=thread' is given.  Nothing in the output path ever waits for the disk:  if every chunk is
+// still queued, samples are dropped and counted.
+// Each data file has a .sigmf-meta, written when the file is opened and again when it is closed, describing the
+// device settings, with a capture segment wherever samples were dropped and an annotation for every gain change.
+//
+// One thread (sdrplayalsa's callback or writer thread) puts the samples in, with rec_block() and rec_output();
+// gain changes may be noted from any thread.  The device settings can change while recording, so the recorder asks
+// for them (rec_settings_fn) each time it writes a capture segment or a .sigmf-meta, from its own thread.
+
+#ifndef IQREC_H
+#define IQREC_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define REC_ALIGN 4096		// O_DIRECT alignment of buffers, file offsets and lengths
+#define REC_QD 8			// io_uring writes in flight
+
+enum { REC_FREE, REC_FULL, REC_WRITING };
+
+struct rec_settings {		// the device as a .sigmf-meta describes it
+	int freq[ 2 ];			// Hz, of the first two channels' tuner and (four channels) the other two's
+	char hw[ 96 ];			// core:hw
+	long fs_hz;				// ADC rate
+	int decimation, software_decimation, resample_L, resample_M;
+	int lna_state, bandwidth_khz, agc;
+};
+
+typedef void rec_settings_fn( void *arg, struct rec_settings *s );
+
+struct rec_chunk {
+	char *buf;
+	size_t len;				// bytes in it
+	size_t wlen;			// bytes being written, len padded for O_DIRECT
+	uint64_t frame;			// stream index of its first frame
+	uint64_t time_ns;		// and when that reached the callback
+	_Atomic int state;
+};
+
+struct rec_event {			// a gain change
+	uint64_t frame;			// stream index of the first frame at the new gain
+	int gain_reduction;
+	int tuner_b;
+};
+
+struct recorder {
+	char base[ 256 ];		// data and meta file names less their extensions
+	char name[ 272 ];		// the same for the current file
+	uint64_t max_bytes;		// rotate after this many bytes, 0 = never
+	uint64_t max_frames;	// or frames
+	int rotate;
+
+	// the stream
+	int format;				// S16, S32 or F32, as iqshm.h's IQSHM_S16 to IQSHM_F32
+	int rate, channels;		// frames per second, and samples to a frame (2, or 4 for two tuners)
+	unsigned fb;			// bytes per frame
+	rec_settings_fn *settings;
+	void *settings_arg;
+
+	// filled by rec_block() and rec_output()
+	struct rec_chunk *chunks;
+	unsigned nchunks;
+	size_t chunk_size;		// a power of two, about a quarter of a second
+	struct rec_chunk *fill;	// chunk being filled, NULL = none yet
+	unsigned claim;			// next chunk to fill
+	_Atomic uint64_t frame;	// frames output so far, including dropped ones
+	unsigned long dropped;	// frames dropped for want of a free chunk
+	sem_t sem;
+	atomic_int stop;
+	pthread_t thread;
+
+	pthread_mutex_t lock;	// gain changes, from rec_event()
+	struct rec_event *events;
+	unsigned nevents, maxevents;
+
+	// recorder thread
+	unsigned next;			// next chunk to write
+	int fd;					// current file
+	int direct;				// opened with O_DIRECT
+	unsigned files;
+	uint64_t file_bytes, file_frames;
+	uint64_t expect;		// stream index of the frame that should come next
+	FILE *captures, *annotations;	// JSON of the current file's capture segments and annotations
+	char *captures_buf, *annotations_buf;
+	size_t captures_len, annotations_len;
+	unsigned ncaptures, nannotations;
+	unsigned ev;			// events annotated so far
+	int gain[ 2 ];			// the two tuners' gain reduction, as last annotated
+	int failed;
+	uint64_t bytes, first_ns, busy_ns, busy_since;
+
+	// io_uring, uring = -1 if not in use
+	int uring;
+	unsigned inflight;
+	unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+// rec_open() takes the URL (after "sigmf://") and the stream:  format, rate, channels, bytes per sample and the
+// gain reduction of each tuner at the start, and starts the recorder thread.  NULL after reporting an error.
+struct recorder *rec_open( const char *url, int format, int rate, int channels, int bps, const int gain[ 2 ],
+	rec_settings_fn *settings, void *arg );
+
+// Room in the chunk being filled for a block of n frames to be put straight into, else NULL;  then, or with the
+// block somewhere else, rec_output() with the time the block reached the callback.  Frames that find no free chunk
+// are dropped and counted.
+void *rec_block( struct recorder *r, unsigned n, uint64_t block_ns );
+void rec_output( struct recorder *r, const void *buf, unsigned n, uint64_t block_ns );
+
+// Note a gain change of the first (tuner_b 0) or second tuner, taking effect at the next frame rec_output() is given
+void rec_event( struct recorder *r, int gain_reduction, int tuner_b );
+
+// Once the stream has stopped:  write out what is left, finish the last file and report
+void rec_close( struct recorder *r );
+
+#endif
@@ -0,0 +1,233 @@
+// iqshm.c
+// Shared-memory I/Q ring, writer and reader sides - see iqshm.h.
+
+#define _GNU_SOURCE
+#include "iqshm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct iqshm {
+	int fd;
+	char name[ 256 ];
+	int writer;
+	struct iqshm_header *h;
+	char *ring;					// size bytes, mapped twice
+	uint64_t size;
+	uint64_t pos;				// writer:  head;  reader:  next byte to read
+	size_t len;					// reader:  bytes handed out by iqshm_read(), writer:  by iqshm_begin()
+	uint64_t lost;				// reader:  bytes skipped or overwritten
+};
+
+static long futex( _Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout ) {
+
+	return syscall( SYS_futex, addr, op, val, timeout, NULL, 0 );
+}
+
+// Map the ring twice, back to back, so that reads and writes never have to wrap
+static char *map_ring( int fd, uint64_t size, int prot ) {
+
+	char *p = mmap( NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+
+	if( p == MAP_FAILED )
+		return NULL;
+	if( mmap( p, size, prot, MAP_SHARED | MAP_FIXED, fd, IQSHM_HDR ) == MAP_FAILED
+		|| mmap( p + size, size, prot, MAP_SHARED | MAP_FIXED, fd, IQSHM_HDR ) == MAP_FAILED ) {
+		munmap( p, 2 * size );
+		return NULL;
+	}
+	return p;
+}
+
+static void unmap( struct iqshm *q ) {
+
+	if( q->ring )
+		munmap( q->ring, 2 * q->size );
+	if( q->h )
+		munmap( q->h, IQSHM_HDR );
+	if( q->fd >= 0 )
+		close( q->fd );
+	free( q );
+}
+
+// Create (replacing any old one) the ring /name of size bytes, a power of two and a multiple of the page size.
+// NULL on failure, with errno set.
+struct iqshm *iqshm_create( const char *name, uint64_t size, uint32_t rate, int format, int channels, int bps ) {
+
+	struct iqshm *q = calloc( 1, sizeof( *q ) );
+	int err;
+
+	if( !q )
+		return NULL;
+	if( size & ( size - 1 ) || size % sysconf( _SC_PAGESIZE ) ) {
+		free( q );
+		errno = EINVAL;
+		return NULL;
+	}
+	snprintf( q->name, sizeof( q->name ), "/%s", name );
+	q->writer = 1;
+	q->size = size;
+	shm_unlink( q->name );		// readers of an old ring keep their mapping and see it go quiet
+	if( ( q->fd = shm_open( q->name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644 ) ) < 0
+		|| ftruncate( q->fd, IQSHM_HDR + size )
+		|| ( q->h = mmap( NULL, IQSHM_HDR, PROT_READ | PROT_WRITE, MAP_SHARED, q->fd, 0 ) ) == MAP_FAILED
+		|| !( q->ring = map_ring( q->fd, size, PROT_READ | PROT_WRITE ) ) ) {
+		err = errno;
+		if( q->h == MAP_FAILED )
+			q->h = NULL;
+		if( q->fd >= 0 )
+			shm_unlink( q->name );
+		unmap( q );
+		errno = err;
+		return NULL;
+	}
+
+	memset( q->ring, 0, size );	// fault the pages in now rather than in the first callbacks
+	q->h->version = IQSHM_VERSION;
+	q->h->rate = rate;
+	q->h->format = format;
+	q->h->channels = channels;
+	q->h->bps = bps;
+	q->h->writer_pid = getpid();
+	q->h->size = size;
+	atomic_store_explicit( (_Atomic uint32_t *)&q->h->magic, IQSHM_MAGIC, memory_order_release );
+	return q;
+}
+
+// Where to put the next len bytes (at most the ring size).  Readers still on the bytes this overwrites find out in
+// iqshm_done().  iqshm_commit() publishes them.
+void *iqshm_begin( struct iqshm *q, size_t len ) {
+
+	atomic_store_explicit( &q->h->writing, q->pos + len, memory_order_relaxed );
+	atomic_thread_fence( memory_order_release );	// readers must see writing move before any of the new bytes
+	q->len = len;
+	return q->ring + ( q->pos & ( q->size - 1 ) );
+}
+
+void iqshm_commit( struct iqshm *q, uint64_t time_ns, uint32_t gain_reduction ) {
+
+	q->pos += q->len;
+	q->len = 0;
+	atomic_store_explicit( &q->h->time_ns, time_ns, memory_order_relaxed );
+	atomic_store_explicit( &q->h->gain_reduction, gain_reduction, memory_order_relaxed );
+	atomic_store_explicit( &q->h->head, q->pos, memory_order_release );
+	atomic_fetch_add( &q->h->wake, 1 );
+	if( atomic_load( &q->h->waiters ) )		// a system call only when someone is asleep
+		futex( &q->h->wake, FUTEX_WAKE, INT_MAX, NULL );
+}
+
+void iqshm_destroy( struct iqshm *q ) {
+
+	shm_unlink( q->name );
+	unmap( q );
+}
+
+// Attach to the ring /name, reading from the live edge.  NULL on failure, with errno set.
+struct iqshm *iqshm_open( const char *name ) {
+
+	struct iqshm *q = calloc( 1, sizeof( *q ) );
+	int err;
+
+	if( !q )
+		return NULL;
+	snprintf( q->name, sizeof( q->name ), "/%s", name );
+	if( ( q->fd = shm_open( q->name, O_RDWR | O_CLOEXEC, 0 ) ) < 0
+		|| ( q->h = mmap( NULL, IQSHM_HDR, PROT_READ | PROT_WRITE, MAP_SHARED, q->fd, 0 ) ) == MAP_FAILED ) {
+		err = errno;
+		q->h = NULL;
+		unmap( q );
+		errno = err;
+		return NULL;
+	}
+	if( atomic_load_explicit( (_Atomic uint32_t *)&q->h->magic, memory_order_acquire ) != IQSHM_MAGIC || q->h->version != IQSHM_VERSION
+		|| !( q->ring = map_ring( q->fd, q->size = q->h->size, PROT_READ ) ) ) {
+		unmap( q );
+		errno = EPROTO;
+		return NULL;
+	}
+	q->pos = atomic_load_explicit( &q->h->head, memory_order_acquire );
+	atomic_fetch_add( &q->h->readers, 1 );
+	return q;
+}
+
+const struct iqshm_header *iqshm_header( const struct iqshm *q ) {
+
+	return q->h;
+}
+
+// The bytes written since the last read, in one piece, waiting up to timeout_ms (-1 = for ever) for some.  NULL on
+// timeout.  Call iqshm_done() once they have been used.
+const void *iqshm_read( struct iqshm *q, size_t *len, int timeout_ms ) {
+
+	struct timespec ts = { timeout_ms / 1000, timeout_ms % 1000 * 1000000 };
+	uint64_t head;
+	uint32_t wake;
+
+	for(;;) {
+		wake = atomic_load( &q->h->wake );
+		head = atomic_load_explicit( &q->h->head, memory_order_acquire );
+		if( atomic_load_explicit( &q->h->writing, memory_order_relaxed ) - q->pos > q->size ) {	// lapped:  skip to the live edge
+			q->lost += head - q->pos;
+			q->pos = head;
+		}
+		if( head != q->pos )
+			break;
+		if( !timeout_ms )
+			return NULL;
+		atomic_fetch_add( &q->h->waiters, 1 );
+		if( atomic_load_explicit( &q->h->head, memory_order_acquire ) == q->pos	// nothing new since we looked
+			&& futex( &q->h->wake, FUTEX_WAIT, wake, timeout_ms < 0 ? NULL : &ts ) && errno == ETIMEDOUT ) {
+			atomic_fetch_sub( &q->h->waiters, 1 );
+			return NULL;
+		}
+		atomic_fetch_sub( &q->h->waiters, 1 );
+	}
+
+	q->len = head - q->pos;
+	if( q->len > q->size )
+		q->len = q->size;
+	*len = q->len;
+	return q->ring + ( q->pos & ( q->size - 1 ) );
+}
+
+// Finished with what iqshm_read() returned.  Returns 0, or -1 if the writer overwrote some of it meanwhile, in which
+// case it must be thrown away.
+int iqshm_done( struct iqshm *q ) {
+
+	atomic_thread_fence( memory_order_acquire );	// all reads of the bytes happen before this check
+	if( atomic_load_explicit( &q->h->writing, memory_order_relaxed ) - q->pos > q->size ) {
+		q->lost += q->len;
+		q->pos += q->len;
+		q->len = 0;
+		return -1;
+	}
+	q->pos += q->len;
+	q->len = 0;
+	return 0;
+}
+
+// Bytes skipped because this reader fell behind
+uint64_t iqshm_lost( const struct iqshm *q ) {
+
+	return q->lost;
+}
+
+int iqshm_writer_alive( const struct iqshm *q ) {
+
+	return !kill( q->h->writer_pid, 0 ) || errno == EPERM;
+}
+
+void iqshm_close( struct iqshm *q ) {
+
+	atomic_fetch_sub( &q->h->readers, 1 );
+	unmap( q );
+}
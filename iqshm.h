@@ -0,0 +1,80 @@
+// iqshm.h
+// Shared-memory I/Q ring:  one writer (sdrplayalsa -o shm://name) and any number of readers on the same host.
+//
+// The POSIX shared memory object /name holds a 64 KiB header followed by a power-of-two ring of interleaved
+// samples.  The ring is mapped twice, back to back, so any run of bytes in it is contiguous in memory:  the writer
+// puts each block in with one copy (or none, when it interleaves straight into iqshm_begin()'s pointer) and
+// readers use the samples where they lie.  The writer never waits for readers.  Each reader keeps its own position;
+// one that falls a whole ring behind skips to the live edge and counts what it missed, and iqshm_done() tells a
+// reader whether what it just used was overwritten underneath it.
+
+#ifndef IQSHM_H
+#define IQSHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define IQSHM_MAGIC 0x4d485351	// "QSHM"
+#define IQSHM_VERSION 1
+#define IQSHM_HDR 65536			// header size, a multiple of any page size;  the ring follows
+
+enum { IQSHM_S16, IQSHM_S32, IQSHM_F32, IQSHM_SPECTRUM };	// sample formats, as sdrplayalsa's -F, or spectra (-Q)
+
+struct iqshm_header {
+	uint32_t magic;				// written last by the writer, so a reader sees a complete header
+	uint32_t version;
+	uint32_t rate;				// frames per second
+	uint8_t format;
+	uint8_t channels;			// 2, or 4 for an RSPduo's two tuners
+	uint8_t bps;				// bytes per sample
+	uint8_t pad;
+	uint32_t writer_pid;
+	uint64_t size;				// ring bytes, a power of two
+
+	_Alignas(64) _Atomic uint64_t head;		// bytes written since the start;  head / (channels * bps) frames
+	_Alignas(64) _Atomic uint64_t writing;	// head once the write in progress is done
+	_Atomic uint64_t time_ns;				// CLOCK_REALTIME when the block ending at head reached the writer
+	_Atomic uint32_t gain_reduction;		// dB, as last set
+	_Alignas(64) _Atomic uint32_t wake;		// futex, bumped on every commit
+	_Atomic uint32_t waiters;				// readers asleep on it
+	_Atomic uint32_t readers;				// readers attached
+};
+
+// A spectrum ring (sdrplayalsa -Q shm://name) carries one of these per commit, rate of them a second, with bps the
+// bytes of each bin.  -Q to a file writes the same frames one after another.
+#define IQSHM_SPECTRUM_MAGIC 0x43455053	// "SPEC"
+
+struct iqshm_spectrum {			// little-endian, 40 bytes then the bins
+	uint32_t magic;
+	uint16_t bins;				// FFT size;  bin 0 is freq - rate/2, bin bins/2 is freq
+	uint16_t averages;			// snapshots averaged into it
+	uint64_t time_ns;			// CLOCK_REALTIME when the last of them reached the callback
+	uint32_t seq;				// counts frames, from 0
+	uint32_t rate;				// of the samples, so the span in Hz
+	uint32_t freq;				// centre, Hz
+	int16_t peak, floor;		// strongest bin and the median one (the noise floor), dBFS * 100
+	uint16_t peak_bin;
+	uint16_t gain_reduction;	// dB, as last set
+	uint32_t shed;				// snapshots skipped under load since the last frame
+	int16_t bin[];				// power, dBFS * 100, a full-scale tone reading 0
+};
+
+struct iqshm;
+
+// writer
+struct iqshm *iqshm_create( const char *name, uint64_t size, uint32_t rate, int format, int channels, int bps );
+void *iqshm_begin( struct iqshm *q, size_t len );
+void iqshm_commit( struct iqshm *q, uint64_t time_ns, uint32_t gain_reduction );
+void iqshm_destroy( struct iqshm *q );
+
+// reader
+struct iqshm *iqshm_open( const char *name );
+const struct iqshm_header *iqshm_header( const struct iqshm *q );
+const void *iqshm_read( struct iqshm *q, size_t *len, int timeout_ms );
+int iqshm_done( struct iqshm *q );
+uint64_t iqshm_lost( const struct iqshm *q );
+int iqshm_writer_alive( const struct iqshm *q );
+void iqshm_close( struct iqshm *q );
+
+#endif
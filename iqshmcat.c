@@ -0,0 +1,185 @@
+// iqshmcat.c
+// Read the shared-memory I/Q ring written by "sdrplayalsa -o shm://name" (or the spectra of "-Q shm://name") and
+// copy it to stdout, or with -n run that many independent readers for a while and report what each one costs.
+
+#define _GNU_SOURCE
+#include "iqshm.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop;
+static const char *name;
+static double seconds = 5;
+
+struct bench {
+	pthread_t thread;
+	double cpu_s;					// thread CPU time spent reading
+	unsigned long long bytes, reads, torn;
+	uint64_t lost;
+	long sum;						// keeps the compiler from skipping the reads
+	int failed;
+};
+
+static void on_signal( int signum ) {
+
+	stop = 1;
+}
+
+static double now( clockid_t clock ) {
+
+	struct timespec ts;
+
+	clock_gettime( clock, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage( char *argv0 ) {
+
+	fprintf( stderr, "usage: %s [options...] name\n"
+		"Copy the I/Q stream from the shared memory ring 'name' (written by \"sdrplayalsa -o shm://name\") to stdout.\n"
+		"options:\n"
+		"    -n readers  benchmark:  run this many readers, each touching every sample, and report each one's CPU cost\n"
+		"    -s seconds  length of the benchmark, default 5\n", argv0 );
+}
+
+// A benchmark reader:  sums every sample it is handed, as a consumer would at least read them
+static void *reader( void *arg ) {
+
+	struct bench *b = arg;
+	struct iqshm *q = iqshm_open( name );
+	const short *p;
+	size_t len, i;
+	double t0, end;
+	long sum = 0;
+
+	if( !q ) {
+		b->failed = 1;
+		return NULL;
+	}
+	t0 = now( CLOCK_THREAD_CPUTIME_ID );
+	end = now( CLOCK_MONOTONIC ) + seconds;
+	while( !stop && now( CLOCK_MONOTONIC ) < end ) {
+		if( !( p = iqshm_read( q, &len, 100 ) ) )
+			continue;
+		for( i = 0; i < len / sizeof( short ); i++ )
+			sum += p[ i ];
+		if( iqshm_done( q ) )
+			b->torn++;
+		else
+			b->bytes += len;
+		b->reads++;
+	}
+	b->cpu_s = now( CLOCK_THREAD_CPUTIME_ID ) - t0;
+	b->lost = iqshm_lost( q );
+	b->sum = sum;
+	iqshm_close( q );
+	return NULL;
+}
+
+static int benchmark( int n ) {
+
+	struct bench *b = calloc( n, sizeof( *b ) );
+	double cpu = 0, worst = 0;
+	unsigned long long bytes = 0;
+	int i;
+
+	for( i = 0; i < n; i++ )
+		if( pthread_create( &b[ i ].thread, NULL, reader, b + i ) ) {
+			fprintf( stderr, "Cannot create reader thread\n" );
+			return 1;
+		}
+	for( i = 0; i < n; i++ )
+		pthread_join( b[ i ].thread, NULL );
+
+	for( i = 0; i < n; i++ ) {
+		if( b[ i ].failed ) {
+			fprintf( stderr, "%s: cannot attach reader %d\n", name, i );
+			return 1;
+		}
+		if( b[ i ].bytes && b[ i ].cpu_s / b[ i ].bytes > worst )
+			worst = b[ i ].cpu_s / b[ i ].bytes;
+		cpu += b[ i ].cpu_s;
+		bytes += b[ i ].bytes;
+	}
+	printf( "%3d reader(s):  %.2f MB/s each,  CPU per reader %.0f us/MB (mean) %.0f us/MB (worst),  %.1f reads/s each",
+		n, bytes / (double)n / seconds * 1e-6, bytes ? cpu / bytes * 1e12 : 0, worst * 1e12, b[ 0 ].reads / seconds );
+	for( i = 0; i < n; i++ )
+		if( b[ i ].lost || b[ i ].torn ) {
+			printf( ",  reader %d lost %llu bytes (%llu torn reads)", i, (unsigned long long)b[ i ].lost, b[ i ].torn );
+			break;
+		}
+	printf( "\n" );
+	return 0;
+}
+
+int main( int argc, char *argv[] ) {
+
+	struct iqshm *q;
+	const struct iqshm_header *h;
+	const char *p;
+	size_t len;
+	ssize_t ret;
+	int opt, readers = 0;
+
+	while( ( opt = getopt( argc, argv, "hn:s:" ) ) >= 0 )
+		switch( opt ) {
+		case 'n':
+			readers = atoi( optarg );
+			break;
+		case 's':
+			seconds = atof( optarg );
+			break;
+		default:
+			usage( argv[ 0 ] );
+			return opt != 'h';
+		}
+	if( optind != argc - 1 ) {
+		usage( argv[ 0 ] );
+		return 1;
+	}
+	name = argv[ optind ];
+	signal( SIGINT, on_signal );
+	signal( SIGTERM, on_signal );
+	signal( SIGPIPE, SIG_IGN );
+
+	if( !( q = iqshm_open( name ) ) ) {
+		fprintf( stderr, "%s: %s\n", name, strerror( errno ) );
+		return 1;
+	}
+	h = iqshm_header( q );
+	if( h->format == IQSHM_SPECTRUM )	// sdrplayalsa -Q:  whole struct iqshm_spectrum frames
+		fprintf( stderr, "%s: %u spectra per second, %llu byte ring, %u reader(s) attached\n", name, h->rate,
+			(unsigned long long)h->size, h->readers );
+	else
+		fprintf( stderr, "%s: %u sps, %u channels of %s, %llu byte ring, %u reader(s) attached\n", name, h->rate, h->channels,
+			h->format == IQSHM_S32 ? "S32" : h->format == IQSHM_F32 ? "F32" : "S16", (unsigned long long)h->size, h->readers );
+	if( readers > 0 ) {
+		iqshm_close( q );
+		return benchmark( readers );
+	}
+
+	while( !stop ) {
+		if( !( p = iqshm_read( q, &len, 1000 ) ) ) {
+			if( !iqshm_writer_alive( q ) )
+				break;
+			continue;
+		}
+		for( ; len; len -= ret, p += ret )	// straight from the ring to the pipe
+			if( ( ret = write( 1, p, len ) ) <= 0 ) {
+				stop = 1;
+				break;
+			}
+		if( iqshm_done( q ) )
+			fprintf( stderr, "%s: fell behind - output was overwritten while being written\n", name );
+	}
+	if( iqshm_lost( q ) )
+		fprintf( stderr, "%s: %llu bytes lost\n", name, (unsigned long long)iqshm_lost( q ) );
+	iqshm_close( q );
+	return 0;
+}
@@ -0,0 +1,100 @@
+// iqunpack.c
+// Decode the compact output of "sdrplayalsa -F p12|s8|bfp" (a stream of iqpack units on stdin, see iqpack.h) back to
+// interleaved S16 on stdout.  A damaged stream is resynchronised on the next unit header:  bytes that do not start
+// a unit, and units that do not decode, are skipped and counted.
+
+#include "iqpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_UNIT ( sizeof( struct iqpack_header ) + (size_t)IQPACK_MAX_FRAMES * 4 * 2 )	// more than any unit can be
+
+static char *buf;
+static size_t start, end;	// what is in buf, not yet used
+
+// Have at least len bytes in buf from start, returning 0 if stdin ends first
+static int fill( size_t len ) {
+
+	ssize_t ret;
+
+	if( start + len > MAX_UNIT ) {	// room for it
+		memmove( buf, buf + start, end - start );
+		end -= start;
+		start = 0;
+	}
+	while( end - start < len ) {
+		if( ( ret = read( 0, buf + end, MAX_UNIT - end ) ) <= 0 )
+			return 0;
+		end += ret;
+	}
+	return 1;
+}
+
+int main( int argc, char *argv[] ) {
+
+	struct iqpack_header h;
+	char *unit;
+	int16_t *out;
+	size_t len, n, w;
+	unsigned long long units = 0, frames = 0, in = 0, bytes = 0, skipped = 0, damaged = 0;
+	const char *format = NULL;
+	ssize_t ret;
+
+	if( argc > 1 ) {
+		fprintf( stderr, "usage: %s < packed > s16\n"
+			"Decode the output of \"sdrplayalsa -F p12\" (or s8 or bfp) to interleaved S16.\n", argv[ 0 ] );
+		return 1;
+	}
+	buf = malloc( MAX_UNIT );
+	unit = malloc( MAX_UNIT );
+	out = malloc( (size_t)IQPACK_MAX_FRAMES * 4 * sizeof( *out ) );
+	if( !buf || !unit || !out ) {
+		fprintf( stderr, "%s: cannot allocate buffers\n", argv[ 0 ] );
+		return 1;
+	}
+
+	while( fill( sizeof( h ) ) ) {
+		memcpy( &h, buf + start, sizeof( h ) );
+		if( !( len = iqpack_unit( &h ) ) ) {	// not a unit:  slide along a byte
+			start++;
+			skipped++;
+			continue;
+		}
+		if( !fill( len ) ) {		// cut short, or a header that only looked like one
+			start++;
+			skipped++;
+			continue;
+		}
+		memcpy( unit, buf + start, len );
+		if( iqpack_decode( (struct iqpack_header *)unit, out ) ) {	// only looked like a unit, or is damaged:  look again a byte on
+			start++;
+			skipped++;
+			damaged++;
+			continue;
+		}
+		n = (size_t)h.frames * h.channels;
+		for( w = 0; w < n * sizeof( *out ); w += ret )
+			if( ( ret = write( 1, (char *)out + w, n * sizeof( *out ) - w ) ) <= 0 )
+				goto done;
+		format = iqpack_name( h.format );
+		in += len;
+		bytes += n * sizeof( *out );
+		frames += h.frames;
+		units++;
+		start += len;
+	}
+done:
+	fprintf( stderr, "%llu %s unit(s), %llu frames:  %.1f MB decoded to %.1f MB", units, format ? format : "packed", frames, in * 1e-6,
+		bytes * 1e-6 );
+	if( skipped )
+		fprintf( stderr, ",  %llu damaged byte(s) skipped", skipped );
+	if( damaged )
+		fprintf( stderr, ",  %llu unit(s) that did not decode", damaged );
+	fprintf( stderr, "\n" );
+	free( buf );
+	free( unit );
+	free( out );
+	return 0;
+}
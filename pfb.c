@@ -0,0 +1,262 @@
+// pfb.c
+// Complex FFT and polyphase FFT channelizer, with the reference fold and butterfly kernels - see pfb.h.
+
+#define _GNU_SOURCE
+#include "pfb.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void pfb_fold( float *w, const float *g, const float *x, unsigned m, unsigned t ) {
+
+	unsigned j, s;
+	float acc;
+
+	for( j = 0; j < m; j++ ) {
+		for( s = 0, acc = 0; s < t; s++ )
+			acc += g[ s * m + j ] * x[ s * m + j ];
+		w[ j ] = acc;
+	}
+}
+
+void fft_butterfly( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n ) {
+
+	unsigned j;
+	float tr, ti;
+
+	for( j = 0; j < n; j++ ) {
+		tr = br[ j ] * wr[ j ] - bi[ j ] * wi[ j ];
+		ti = br[ j ] * wi[ j ] + bi[ j ] * wr[ j ];
+		br[ j ] = ar[ j ] - tr;
+		bi[ j ] = ai[ j ] - ti;
+		ar[ j ] += tr;
+		ai[ j ] += ti;
+	}
+}
+
+static inline short f32_sat( float v ) {
+
+	return v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (short)lrintf( v );
+}
+
+static double bessel_i0( double x ) {
+
+	double sum = 1, term = 1;
+	int k;
+
+	for( k = 1; k < 50; k++ ) {
+		term *= ( x / ( 2 * k ) ) * ( x / ( 2 * k ) );
+		sum += term;
+	}
+	return sum;
+}
+
+static double kaiser( int n, int len, double beta ) {
+
+	double r = 2.0 * n / ( len - 1 ) - 1;
+
+	return bessel_i0( beta * sqrt( 1 - r * r ) ) / bessel_i0( beta );
+}
+
+int fft_init( struct fft *t, unsigned n ) {
+
+	unsigned h, j, b, r, k;
+
+	t->n = n;
+	t->re = malloc( n * sizeof( float ) );
+	t->im = malloc( n * sizeof( float ) );
+	t->twr = malloc( n * sizeof( float ) );
+	t->twi = malloc( n * sizeof( float ) );
+	t->rev = malloc( n * sizeof( unsigned ) );
+	if( !t->re || !t->im || !t->twr || !t->twi || !t->rev ) {
+		fft_free( t );
+		return -1;
+	}
+	for( h = 1; h < n; h <<= 1 )
+		for( j = 0; j < h; j++ ) {
+			t->twr[ h + j ] = cos( M_PI * j / h );
+			t->twi[ h + j ] = -sin( M_PI * j / h );
+		}
+	for( j = 0; j < n; j++ ) {
+		for( b = 1, r = 0, k = j; b < n; b <<= 1, k >>= 1 )
+			r = r << 1 | ( k & 1 );
+		t->rev[ j ] = r;
+	}
+	return 0;
+}
+
+void fft_free( struct fft *t ) {
+
+	free( t->re );
+	free( t->im );
+	free( t->twr );
+	free( t->twi );
+	free( t->rev );
+	memset( t, 0, sizeof( *t ) );
+}
+
+void fft_run( struct fft *t, const float *xr, const float *xi, const struct pfb_kernels *k ) {
+
+	unsigned n = t->n, h, i, j;
+	float *re = t->re, *im = t->im, ar, ai, br, bi, cr, ci, dr, di;
+
+	for( j = 0; j < n; j++ ) {
+		re[ t->rev[ j ] ] = xr[ j ];
+		im[ t->rev[ j ] ] = xi[ j ];
+	}
+	for( i = 0; i < n; i += 4 ) {
+		ar = re[ i ] + re[ i + 1 ];
+		ai = im[ i ] + im[ i + 1 ];
+		br = re[ i ] - re[ i + 1 ];
+		bi = im[ i ] - im[ i + 1 ];
+		cr = re[ i + 2 ] + re[ i + 3 ];
+		ci = im[ i + 2 ] + im[ i + 3 ];
+		dr = re[ i + 2 ] - re[ i + 3 ];
+		di = im[ i + 2 ] - im[ i + 3 ];
+		re[ i ] = ar + cr;
+		im[ i ] = ai + ci;
+		re[ i + 2 ] = ar - cr;
+		im[ i + 2 ] = ai - ci;
+		re[ i + 1 ] = br + di;		// b + (-j)d
+		im[ i + 1 ] = bi - dr;
+		re[ i + 3 ] = br - di;
+		im[ i + 3 ] = bi + dr;
+	}
+	for( h = 4; h < n; h <<= 1 )
+		for( i = 0; i < n; i += 2 * h )
+			k->fft_butterfly( re + i, im + i, re + i + h, im + i + h, t->twr + h, t->twi + h, h );
+}
+
+unsigned pfb_size( long fs, int rate ) {
+
+	unsigned M;
+
+	for( M = PFB_MAXM; M >= 8; M >>= 1 )
+		if( fs >= 2L * rate * M && !( 2 * fs % M ) )
+			return M;
+	return 0;
+}
+
+struct pfb *pfb_new( unsigned M, unsigned maxin ) {
+
+	struct pfb *f = calloc( 1, sizeof( *f ) );
+	unsigned len = M * PFB_TAPS, n, c;
+	double d, sum = 0, *p = malloc( len * sizeof( double ) );
+
+	if( !f || !p )
+		goto fail;
+	f->M = M;
+	f->T = PFB_TAPS;
+	f->maxin = maxin;
+	f->g = malloc( len * sizeof( float ) );
+	for( c = 0; c < 2; c++ ) {
+		f->x[ c ] = malloc( ( len + maxin ) * sizeof( float ) );
+		f->in[ c ] = malloc( maxin * sizeof( short ) );
+		f->w[ c ] = malloc( M * sizeof( float ) );
+		if( !f->x[ c ] || !f->in[ c ] || !f->w[ c ] )
+			goto fail;
+	}
+	if( !f->g || fft_init( &f->fft, M ) )
+		goto fail;
+
+	for( n = 0; n < len; n++ ) {	// cut-off at the channel spacing;  len is even, so d is never 0
+		d = n - ( len - 1 ) / 2.0;
+		sum += p[ n ] = sin( 2 * M_PI * d / M ) / ( M_PI * d ) * kaiser( n, len, 9.0 );
+	}
+	for( n = 0; n < len; n++ )
+		f->g[ n ] = p[ n ] / sum;
+	free( p );
+
+	f->nx = len - M / 2;	// the first outputs come after M/2 samples, from a history of silence
+	memset( f->x[ 0 ], 0, f->nx * sizeof( float ) );
+	memset( f->x[ 1 ], 0, f->nx * sizeof( float ) );
+	return f;
+
+fail:
+	free( p );
+	pfb_free( f );
+	return NULL;
+}
+
+void pfb_free( struct pfb *f ) {
+
+	int c;
+
+	if( !f )
+		return;
+	for( c = 0; c < 2; c++ ) {
+		free( f->x[ c ] );
+		free( f->in[ c ] );
+		free( f->w[ c ] );
+	}
+	free( f->g );
+	fft_free( &f->fft );
+	free( f );
+}
+
+// Bin k is centred on k*fs/M, and its output is e^(-j2pi k/M) * (-1)^kn times the FFT's, then shifted down by the
+// offset left over
+void pfb_tune( const struct pfb *f, struct pfb_nco *nco, long fs, int offset ) {
+
+	long k = lround( (double)offset * f->M / fs );
+	double rest = offset - (double)k * fs / f->M, a;
+
+	nco->bin = ( k + f->M ) % f->M;
+	a = -2 * M_PI * nco->bin / f->M;
+	nco->ph[ 0 ] = cos( a );
+	nco->ph[ 1 ] = sin( a );
+	a = M_PI * nco->bin - 2 * M_PI * rest * ( f->M / 2 ) / fs;
+	nco->rot[ 0 ] = cos( a );
+	nco->rot[ 1 ] = sin( a );
+}
+
+unsigned pfb_steps( const struct pfb *f, unsigned n ) {
+
+	unsigned len = f->M * f->T;
+
+	return f->nx + n >= len ? ( f->nx + n - len ) / ( f->M / 2 ) + 1 : 0;
+}
+
+int pfb_run( struct pfb *f, const short *buf, unsigned n, struct pfb_nco **nco, unsigned nch, short **out,
+	const struct pfb_kernels *k ) {
+
+	struct pfb_nco *o;
+	unsigned s, c, pos, steps = pfb_steps( f, n );
+	float yr, yi;
+	double pr, pi, mag;
+
+	if( n > f->maxin )
+		return -1;
+	k->deinterleave_s16( f->in[ 0 ], f->in[ 1 ], buf, n );
+	k->s16_to_f32( f->x[ 0 ] + f->nx, f->in[ 0 ], n );
+	k->s16_to_f32( f->x[ 1 ] + f->nx, f->in[ 1 ], n );
+	f->nx += n;
+
+	for( s = 0, pos = 0; s < steps; s++, pos += f->M / 2 ) {
+		k->pfb_fold( f->w[ 0 ], f->g, f->x[ 0 ] + pos, f->M, f->T );
+		k->pfb_fold( f->w[ 1 ], f->g, f->x[ 1 ] + pos, f->M, f->T );
+		fft_run( &f->fft, f->w[ 0 ], f->w[ 1 ], k );
+		for( c = 0; c < nch; c++ ) {
+			o = nco[ c ];
+			yr = f->fft.re[ o->bin ] * 32768;
+			yi = f->fft.im[ o->bin ] * 32768;
+			pr = o->ph[ 0 ];
+			pi = o->ph[ 1 ];
+			out[ c ][ 2 * s ] = f32_sat( yr * pr - yi * pi );
+			out[ c ][ 2 * s + 1 ] = f32_sat( yr * pi + yi * pr );
+			o->ph[ 0 ] = pr * o->rot[ 0 ] - pi * o->rot[ 1 ];
+			o->ph[ 1 ] = pr * o->rot[ 1 ] + pi * o->rot[ 0 ];
+		}
+	}
+	for( c = 0; c < nch && steps; c++ ) {	// keep the NCOs on the unit circle
+		o = nco[ c ];
+		mag = hypot( o->ph[ 0 ], o->ph[ 1 ] );
+		o->ph[ 0 ] /= mag;
+		o->ph[ 1 ] /= mag;
+	}
+
+	f->nx -= pos;
+	memmove( f->x[ 0 ], f->x[ 0 ] + pos, f->nx * sizeof( float ) );
+	memmove( f->x[ 1 ], f->x[ 1 ] + pos, f->nx * sizeof( float ) );
+	return 0;
+}
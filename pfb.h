@@ -0,0 +1,82 @@
+// pfb.h
+// Complex FFT and polyphase FFT channelizer, float, planar I and Q (sdrplayalsa -Z;  the FFT is also -Q's).
+//
+// The FFT is decimation in time:  bit-reversed order in, then the first two stages as one radix-4 pass (their
+// twiddles are 1 and -j) and the rest as rows of butterflies for the fft_butterfly kernel.  n is a power of two,
+// at least 4.
+//
+// The channelizer splits a wideband stream into M channels fs/M apart with an M-branch polyphase filter bank and an
+// M-point FFT, oversampled by two:  every M/2 input samples the branches are folded through the prototype low-pass
+// and transformed, giving every channel a new sample at 2*fs/M.  The prototype (PFB_TAPS taps per branch, Kaiser
+// windowed) passes +/-0.75 of the channel spacing and stops from 1.25 of it, so a signal within 0.75*fs/M of a bin
+// centre comes out of that bin clean and nothing aliases onto it.  Each channel taken from the bank has an NCO
+// (struct pfb_nco) on the bin nearest its offset that moves the rest of the offset to zero, with the (-1)^k per
+// output that the half-FFT hop leaves on bin k folded in.
+//
+// The caller passes the kernels in (struct pfb_kernels);  pfb_fold() and fft_butterfly() here are the portable
+// reference, and sdrplayalsa has SIMD versions that must agree with them to within float rounding.
+
+#ifndef PFB_H
+#define PFB_H
+
+#define PFB_TAPS 12
+#define PFB_MAXM 4096
+
+struct pfb_kernels {
+	void (*deinterleave_s16)( short *e, short *o, const short *in, unsigned n );
+	void (*s16_to_f32)( float *out, const short *in, unsigned n );
+	void (*pfb_fold)( float *w, const float *g, const float *x, unsigned m, unsigned t );
+	void (*fft_butterfly)( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n );
+};
+
+struct fft {
+	unsigned n;
+	float *re, *im;			// the transform, in place
+	float *twr, *twi;		// twiddles:  the stage with butterflies h apart uses [h, 2h)
+	unsigned *rev;			// bit-reversed indices
+};
+
+struct pfb_nco {
+	unsigned bin;			// filter bank output the channel takes
+	double ph[ 2 ], rot[ 2 ];	// phasor and its step per filter bank output, re and im
+};
+
+struct pfb {
+	unsigned M, T;			// branches (the FFT size) and taps per branch
+	float *g;				// prototype, M*T taps;  symmetric, so it needs no reversing for the oldest-first history
+	float *x[ 2 ];			// I and Q:  M*T - M/2 samples of history, then the new block
+	unsigned nx, maxin;		// samples of history and new block in x, and the largest block it has room for
+	short *in[ 2 ];			// the new block, deinterleaved
+	float *w[ 2 ];			// folded branches
+	struct fft fft;			// and their transform
+};
+
+// reference kernels:  fold the t taps of each of m branches of history x through prototype g into w, and the
+// butterflies of one row, a += w*b and b = a - w*b, n of them
+void pfb_fold( float *w, const float *g, const float *x, unsigned m, unsigned t );
+void fft_butterfly( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n );
+
+// fft_init() returns 0, or -1 if it cannot allocate;  fft_run() transforms xr + j*xi into t->re and t->im
+int fft_init( struct fft *t, unsigned n );
+void fft_free( struct fft *t );
+void fft_run( struct fft *t, const float *xr, const float *xi, const struct pfb_kernels *k );
+
+// pfb_size() is the filter bank size for a wideband rate fs and the widest channel:  the most branches that keep
+// the channel spacing at least twice that channel's rate, as its band may sit anywhere in a bin, with the bin rate
+// 2*fs/M a whole number of Hz;  0 if there are none.  pfb_new() makes an M-branch bank for blocks of up to maxin
+// samples, allocating everything it will ever need, or returns NULL if it cannot.
+unsigned pfb_size( long fs, int rate );
+struct pfb *pfb_new( unsigned M, unsigned maxin );
+void pfb_free( struct pfb *f );
+
+// pfb_tune() points an NCO at the bin for a channel 'offset' Hz from the centre of an fs stream, and starts it
+void pfb_tune( const struct pfb *f, struct pfb_nco *nco, long fs, int offset );
+
+// pfb_steps() is the outputs per channel the next n input samples will give;  pfb_run() runs n interleaved S16
+// samples through the bank and writes that many samples of each of nch channels, through nco[ c ], to out[ c ],
+// interleaved S16.  pfb_run() returns 0, or -1 (with nothing written or changed) if n is over maxin.
+unsigned pfb_steps( const struct pfb *f, unsigned n );
+int pfb_run( struct pfb *f, const short *buf, unsigned n, struct pfb_nco **nco, unsigned nch, short **out,
+	const struct pfb_kernels *k );
+
+#endif
@@ -0,0 +1,516 @@
+// sdrplay_sim.c
+// Stand-in for the sdrplay_api library so that sdrplayalsa can be built and exercised without an RSP or
+// the sdrplay_api service:  "make sdrplayalsa-sim" links sdrplayalsa.c against this file instead of
+// -lsdrplay_api.  Only the SDK header is needed.
+//
+// A thread per device generates I/Q at fsHz/decimation and calls StreamACbFn with blocks of the configured
+// size, timing each call.  An RSPduo (SDRSIM_HWVER=3) selected in dual-tuner mode streams both tuners at
+// 2 MS/s/decimation, calling StreamACbFn and then StreamBCbFn with the same sample numbers;  one selected on
+// tuner B alone takes its parameters from rxChannelB and streams through StreamACbFn.  sdrplay_api_Update()
+// gain changes are applied a few blocks later with params->grChanged set on the block where the new gain
+// takes effect, as the real API does.  When the run ends (sdrplay_api_Uninit) a benchmark report is written
+// to stderr.
+//
+// Configuration is by environment variable:
+//   SDRSIM_DEVICES=n       number of devices reported by GetDevices, default 1
+//   SDRSIM_HWVER=n         hwVer reported for each device, default 255 (RSP1A)
+//   SDRSIM_BLOCK=n         samples per callback, default 1008/decimation (minimum 32)
+//   SDRSIM_FAST=1          deliver blocks as fast as the callback returns instead of in real time
+//   SDRSIM_SECONDS=s       send SIGTERM to the process after s seconds of streaming, default 0 (run forever)
+//   SDRSIM_TONE_HZ=f       offset of the test tone from the tuned frequency, default 10000
+//   SDRSIM_TONE_DBFS=d     tone level at SDRSIM_REF_GR gain reduction, default -20
+//   SDRSIM_TONE_B_DBFS=d   the same for tuner B in dual-tuner mode, default SDRSIM_TONE_DBFS
+//   SDRSIM_NOISE_DBFS=d    noise level at SDRSIM_REF_GR gain reduction, default -60
+//   SDRSIM_REF_GR=g        gain reduction at which the levels above apply, default 30
+//   SDRSIM_BURST_EVERY_MS  period of overload bursts, default 0 (no bursts)
+//   SDRSIM_BURST_MS        length of each burst, default 200
+//   SDRSIM_BURST_DB        level of the burst relative to the tone, default 30
+//   SDRSIM_DC_I=n, SDRSIM_DC_Q=n  DC offset of I and Q in LSB, default 0
+//   SDRSIM_IQ_GAIN_DB=d    gain of Q relative to I, default 0
+//   SDRSIM_IQ_PHASE_DEG=d  phase error of Q, default 0
+//   SDRSIM_GR_LATENCY=n    blocks between sdrplay_api_Update and the gain change taking effect, default 4
+
+#define _GNU_SOURCE
+#include <sdrplay_api.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_MAX_DEVICES 8
+#define SIM_HIST_US 20000	// callback latency histogram range, 1 us buckets
+
+struct sim_device {
+	sdrplay_api_DeviceT *selected;
+	sdrplay_api_DevParamsT devParams;
+	sdrplay_api_RxChannelParamsT rxA, rxB;
+	sdrplay_api_DeviceParamsT params;
+	sdrplay_api_CallbackFnsT cb;
+	void *cbContext;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	volatile int running;
+	int dual;				// RSPduo dual-tuner mode:  both tuners stream
+	int first_tuner;		// 0 = A, 1 = tuner B selected alone
+
+	// per tuner, A then B
+	int gr_applied[ 2 ];	// gain reduction currently applied to the generated signal
+	int gr_pending[ 2 ];	// blocks until a requested gain change takes effect, 0 = none
+	int rf_pending[ 2 ];
+	int fs_pending;
+	int overload[ 2 ];		// overload currently reported to the event callback
+	int overload_ack[ 2 ];	// waiting for sdrplay_api_Update_Ctrl_OverloadMsgAck
+
+	// benchmark accounting
+	unsigned *hist;
+	unsigned long long calls, samples, hist_over;
+	double max_us, sum_us;
+	struct timespec start;
+	double t;				// stream time (s) of the block being delivered
+	double burst_start;		// stream time the current burst started, <0 if no burst in progress
+	int burst_seen_update;
+	int burst_unclipped;
+	unsigned long long bursts, agc_reactions;
+	double agc_sum_ms, agc_max_ms;
+	double unclip_sum_ms, unclip_max_ms;
+	unsigned long long unclips;
+	int clipping;
+	unsigned long long gr_updates[ 2 ];
+};
+
+static struct sim_device sim[ SIM_MAX_DEVICES ];
+static int sim_stopping;
+
+static double envd( const char *name, double def ) {
+
+	char *v = getenv( name );
+
+	return v && *v ? atof( v ) : def;
+}
+
+static double elapsed( struct sim_device *d ) {
+
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ( ts.tv_sec - d->start.tv_sec ) + ( ts.tv_nsec - d->start.tv_nsec ) * 1e-9;
+}
+
+static unsigned rng( unsigned *s ) {	// xorshift32
+
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+static short clip( double v ) {
+
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : (short)lrint( v );
+}
+
+static void event( struct sim_device *d, sdrplay_api_EventT id, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *p ) {
+
+	if( d->cb.EventCbFn )
+		d->cb.EventCbFn( id, tuner, p, d->cbContext );
+}
+
+static void *stream( void *arg ) {
+
+	struct sim_device *d = arg;
+	sdrplay_api_RxChannelParamsT *chan[ 2 ] = { &d->rxA, &d->rxB }, *ch = chan[ d->first_tuner ];
+	sdrplay_api_StreamCallback_t cb[ 2 ] = { d->cb.StreamACbFn, d->cb.StreamBCbFn };
+	double decim = ch->ctrlParams.decimation.enable && ch->ctrlParams.decimation.decimationFactor ?
+		ch->ctrlParams.decimation.decimationFactor : 1;
+	double rate = ( d->dual ? 2000000 : d->devParams.fsFreq.fsHz ) / decim;
+	unsigned block = envd( "SDRSIM_BLOCK", 0 );
+	int fast = envd( "SDRSIM_FAST", 0 );
+	double seconds = envd( "SDRSIM_SECONDS", 0 );
+	double tone_hz = envd( "SDRSIM_TONE_HZ", 10000 );
+	double tone_db[ 2 ] = { envd( "SDRSIM_TONE_DBFS", -20 ), envd( "SDRSIM_TONE_B_DBFS", envd( "SDRSIM_TONE_DBFS", -20 ) ) };
+	double noise_db = envd( "SDRSIM_NOISE_DBFS", -60 );
+	double ref_gr = envd( "SDRSIM_REF_GR", 30 );
+	double burst_every = envd( "SDRSIM_BURST_EVERY_MS", 0 ) * 1e-3;
+	double burst_len = envd( "SDRSIM_BURST_MS", 200 ) * 1e-3;
+	double burst_db = envd( "SDRSIM_BURST_DB", 30 );
+	double dc_i = envd( "SDRSIM_DC_I", 0 ), dc_q = envd( "SDRSIM_DC_Q", 0 );
+	double iq_gain = pow( 10, envd( "SDRSIM_IQ_GAIN_DB", 0 ) / 20 ), iq_phase = envd( "SDRSIM_IQ_PHASE_DEG", 0 ) * M_PI / 180;
+	short *xi[ 2 ], *xq[ 2 ];
+	sdrplay_api_StreamCbParamsT params[ 2 ];
+	sdrplay_api_EventParamsT ev;
+	struct timespec next, t0, t1;
+	double phase[ 2 ] = { 0, 0 }, dphase, amp, noise, t, us, gain[ 2 ];
+	unsigned seed = 12345, i, sampleNum = 0;
+	int clipped, burst, first = 1, k, k0 = d->first_tuner, k1 = d->dual ? 1 : d->first_tuner;
+
+	if( !block ) {
+		block = 1008 / decim;
+		if( block < 32 )
+			block = 32;
+	}
+	for( k = 0; k < 2; k++ ) {
+		xi[ k ] = malloc( block * sizeof( short ) );
+		xq[ k ] = malloc( block * sizeof( short ) );
+	}
+	dphase = 2 * M_PI * tone_hz / rate;
+
+	fprintf( stderr, "sdrplay_sim: %s streaming %.0f sps in blocks of %u%s%s\n", d->selected->SerNo, rate, block,
+		d->dual ? " from both tuners" : k0 ? " from tuner B" : "", fast ? " (as fast as possible)" : "" );
+
+	clock_gettime( CLOCK_MONOTONIC, &d->start );
+	next = d->start;
+
+	while( d->running ) {
+		t = fast ? (double)d->samples / rate : elapsed( d );
+		if( seconds > 0 && t >= seconds ) {
+			d->running = 0;
+			if( !__atomic_exchange_n( &sim_stopping, 1, __ATOMIC_SEQ_CST ) )	// one SIGTERM for all devices
+				kill( getpid(), SIGTERM );
+			break;
+		}
+
+		memset( params, 0, sizeof( params ) );
+		pthread_mutex_lock( &d->lock );
+		d->t = t;
+		for( k = k0; k <= k1; k++ ) {
+			if( d->gr_pending[ k ] && !--d->gr_pending[ k ] ) {	// requested gain change takes effect on this block
+				d->gr_applied[ k ] = chan[ k ]->tunerParams.gain.gRdB;
+				params[ k ].grChanged = 1;
+			}
+			if( d->rf_pending[ k ] && !--d->rf_pending[ k ] )
+				params[ k ].rfChanged = 1;
+			gain[ k ] = pow( 10, ( ref_gr - d->gr_applied[ k ] ) / 20 );
+		}
+		if( d->fs_pending && !--d->fs_pending )
+			params[ k0 ].fsChanged = 1;
+		pthread_mutex_unlock( &d->lock );
+
+		burst = burst_every > 0 && fmod( t, burst_every ) < burst_len;
+		if( burst && d->burst_start < 0 ) {
+			d->burst_start = t;
+			d->burst_seen_update = 0;
+			d->burst_unclipped = 0;
+			d->bursts++;
+		}
+		else if( !burst )
+			d->burst_start = -1;
+
+		for( k = k0; k <= k1; k++ ) {
+			amp = 32768 * pow( 10, ( tone_db[ k ] + ( burst ? burst_db : 0 ) ) / 20 ) * gain[ k ];
+			noise = 32768 * pow( 10, noise_db / 20 ) * gain[ k ];
+			for( i = 0; i < block; i++ ) {
+				xi[ k ][ i ] = clip( amp * cos( phase[ k ] ) + noise * ( (int)( rng( &seed ) & 0xffff ) - 32768 ) / 32768.0 + dc_i );
+				xq[ k ][ i ] = clip( iq_gain * amp * sin( phase[ k ] + iq_phase ) + noise * ( (int)( rng( &seed ) & 0xffff ) - 32768 ) / 32768.0 + dc_q );
+				phase[ k ] += dphase;
+			}
+			phase[ k ] = fmod( phase[ k ], 2 * M_PI );
+
+			// judge overload on the envelope rather than on whether this block happened to hit a peak
+			clipped = amp + 3 * noise > 32767;
+			if( k == k0 ) {		// burst statistics are kept for the first tuner
+				if( clipped && !d->clipping )
+					d->clipping = 1;
+				else if( !clipped && d->clipping ) {	// signal came back into range
+					d->clipping = 0;
+					if( d->burst_start >= 0 && !d->burst_unclipped ) {
+						d->burst_unclipped = 1;
+						us = ( t - d->burst_start ) * 1e3;
+						d->unclip_sum_ms += us;
+						if( us > d->unclip_max_ms )
+							d->unclip_max_ms = us;
+						d->unclips++;
+					}
+				}
+			}
+
+			// overload events, one at a time per tuner until acknowledged like the real API
+			if( !d->overload_ack[ k ] && clipped != d->overload[ k ] ) {
+				d->overload[ k ] = clipped;
+				d->overload_ack[ k ] = 1;
+				ev.powerOverloadParams.powerOverloadChangeType = clipped ? sdrplay_api_Overload_Detected : sdrplay_api_Overload_Corrected;
+				event( d, sdrplay_api_PowerOverloadChange, k ? sdrplay_api_Tuner_B : sdrplay_api_Tuner_A, &ev );
+			}
+
+			params[ k ].firstSampleNum = sampleNum;
+			params[ k ].numSamples = block;
+		}
+
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		for( k = k0; k <= k1; k++ )		// tuner B's block follows A's, as from the real API
+			cb[ d->dual ? k : 0 ]( xi[ k ], xq[ k ], params + k, block, first, d->cbContext );
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		first = 0;
+		sampleNum += block;
+
+		us = ( t1.tv_sec - t0.tv_sec ) * 1e6 + ( t1.tv_nsec - t0.tv_nsec ) * 1e-3;
+		if( us < SIM_HIST_US )
+			d->hist[ (unsigned)us ]++;
+		else
+			d->hist_over++;
+		if( us > d->max_us )
+			d->max_us = us;
+		d->sum_us += us;
+		d->calls++;
+		d->samples += block;
+
+		if( !fast ) {	// pace to the sample clock
+			next.tv_nsec += (long)( block * 1e9 / rate );
+			while( next.tv_nsec >= 1000000000 ) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+		}
+	}
+
+	for( k = 0; k < 2; k++ ) {
+		free( xi[ k ] );
+		free( xq[ k ] );
+	}
+	return NULL;
+}
+
+static double percentile( struct sim_device *d, double p ) {
+
+	unsigned long long want = d->calls * p, n = 0;
+	unsigned i;
+
+	for( i = 0; i < SIM_HIST_US; i++ )
+		if( ( n += d->hist[ i ] ) > want )
+			return i;
+	return SIM_HIST_US;
+}
+
+static void report( struct sim_device *d ) {
+
+	double t = elapsed( d );
+
+	if( !d->calls )
+		return;
+
+	fprintf( stderr, "sdrplay_sim: %s benchmark over %.2f s\n", d->selected->SerNo, t );
+	fprintf( stderr, "   callbacks:  %llu  samples:  %llu  sustained:  %.0f sps\n", d->calls, d->samples, d->samples / t );
+	fprintf( stderr, "   callback latency (us):  mean %.1f  p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.1f  (>%u us: %llu)\n",
+		d->sum_us / d->calls, percentile( d, 0.5 ), percentile( d, 0.9 ), percentile( d, 0.99 ), percentile( d, 0.999 ),
+		d->max_us, SIM_HIST_US, d->hist_over );
+	if( d->dual )
+		fprintf( stderr, "   gain updates:  %llu/%llu  final gain reduction:  %d/%d dB (tuner A/B)\n", d->gr_updates[ 0 ], d->gr_updates[ 1 ],
+			d->gr_applied[ 0 ], d->gr_applied[ 1 ] );
+	else
+		fprintf( stderr, "   gain updates:  %llu  final gain reduction:  %d dB\n", d->gr_updates[ d->first_tuner ], d->gr_applied[ d->first_tuner ] );
+	if( d->bursts ) {
+		fprintf( stderr, "   overload bursts:  %llu  AGC reacted to %llu", d->bursts, d->agc_reactions );
+		if( d->agc_reactions )
+			fprintf( stderr, " (first update after mean %.1f ms, max %.1f ms)", d->agc_sum_ms / d->agc_reactions, d->agc_max_ms );
+		fprintf( stderr, "\n   time to unclip:  %llu burst(s)", d->unclips );
+		if( d->unclips )
+			fprintf( stderr, " mean %.1f ms, max %.1f ms", d->unclip_sum_ms / d->unclips, d->unclip_max_ms );
+		fprintf( stderr, "\n" );
+	}
+}
+
+sdrplay_api_ErrT sdrplay_api_Open( void ) {
+
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Close( void ) {
+
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_ApiVersion( float *apiVer ) {
+
+	*apiVer = SDRPLAY_API_VERSION;
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_LockDeviceApi( void ) {
+
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_UnlockDeviceApi( void ) {
+
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_DebugEnable( HANDLE dev, sdrplay_api_DbgLvl_t enable ) {
+
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_GetDevices( sdrplay_api_DeviceT *devices, unsigned int *numDevs, unsigned int maxDevs ) {
+
+	unsigned i, n = envd( "SDRSIM_DEVICES", 1 );
+
+	if( n > maxDevs )
+		n = maxDevs;
+	if( n > SIM_MAX_DEVICES )
+		n = SIM_MAX_DEVICES;
+
+	for( i = 0; i < n; i++ ) {
+		memset( devices + i, 0, sizeof( *devices ) );
+		snprintf( devices[ i ].SerNo, sizeof( devices[ i ].SerNo ), "SIM%05u", i + 1 );
+		devices[ i ].hwVer = envd( "SDRSIM_HWVER", SDRPLAY_RSP1A_ID );
+		devices[ i ].tuner = sdrplay_api_Tuner_A;
+		devices[ i ].valid = 1;
+		devices[ i ].dev = sim + i;
+	}
+	*numDevs = n;
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_SelectDevice( sdrplay_api_DeviceT *device ) {
+
+	struct sim_device *d = device->dev;
+
+	if( !d || d->selected )
+		return sdrplay_api_Fail;
+
+	memset( d, 0, sizeof( *d ) );
+	d->selected = device;
+	pthread_mutex_init( &d->lock, NULL );
+	d->params.devParams = &d->devParams;
+	d->params.rxChannelA = &d->rxA;
+	d->params.rxChannelB = &d->rxB;
+	d->devParams.fsFreq.fsHz = 2000000;
+	d->rxA.tunerParams.rfFreq.rfHz = 200000000;
+	d->rxA.tunerParams.bwType = sdrplay_api_BW_0_200;
+	d->rxA.tunerParams.gain.gRdB = 50;
+	d->rxB = d->rxA;
+	d->burst_start = -1;
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_ReleaseDevice( sdrplay_api_DeviceT *device ) {
+
+	struct sim_device *d = device->dev;
+
+	if( !d || !d->selected )
+		return sdrplay_api_Fail;
+	d->selected = NULL;
+	return sdrplay_api_Success;
+}
+
+const char *sdrplay_api_GetErrorString( sdrplay_api_ErrT err ) {
+
+	switch( err ) {
+	case sdrplay_api_Success:		return "sdrplay_api_Success";
+	case sdrplay_api_Fail:			return "sdrplay_api_Fail";
+	case sdrplay_api_InvalidParam:	return "sdrplay_api_InvalidParam";
+	case sdrplay_api_OutOfRange:	return "sdrplay_api_OutOfRange";
+	case sdrplay_api_NotInitialised:	return "sdrplay_api_NotInitialised";
+	default:						return "sdrplay_api (simulated) error";
+	}
+}
+
+sdrplay_api_ErrT sdrplay_api_GetDeviceParams( HANDLE dev, sdrplay_api_DeviceParamsT **deviceParams ) {
+
+	struct sim_device *d = dev;
+
+	if( !d || !d->selected )
+		return sdrplay_api_NotInitialised;
+	*deviceParams = &d->params;
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Init( HANDLE dev, sdrplay_api_CallbackFnsT *callbackFns, void *cbContext ) {
+
+	struct sim_device *d = dev;
+
+	if( !d || !d->selected )
+		return sdrplay_api_NotInitialised;
+	if( d->running )
+		return sdrplay_api_AlreadyInitialised;
+
+	d->dual = d->selected->tuner == sdrplay_api_Tuner_Both && d->selected->rspDuoMode == sdrplay_api_RspDuoMode_Dual_Tuner;
+	d->first_tuner = d->selected->tuner == sdrplay_api_Tuner_B;
+	if( ( d->dual || d->first_tuner ) && d->selected->hwVer != SDRPLAY_RSPduo_ID )
+		return sdrplay_api_HwVerError;
+	if( d->dual ? d->selected->rspDuoSampleFreq != 6000000 && d->selected->rspDuoSampleFreq != 8000000
+		: d->devParams.fsFreq.fsHz < 2000000 || d->devParams.fsFreq.fsHz > 10660000 )
+		return sdrplay_api_OutOfRange;
+
+	d->cb = *callbackFns;
+	d->cbContext = cbContext;
+	d->gr_applied[ 0 ] = d->rxA.tunerParams.gain.gRdB;
+	d->gr_applied[ 1 ] = d->rxB.tunerParams.gain.gRdB;
+	d->hist = calloc( SIM_HIST_US, sizeof( unsigned ) );
+	d->running = 1;
+	if( pthread_create( &d->thread, NULL, stream, d ) ) {
+		d->running = 0;
+		return sdrplay_api_Fail;
+	}
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Uninit( HANDLE dev ) {
+
+	struct sim_device *d = dev;
+
+	if( !d || !d->hist )
+		return sdrplay_api_NotInitialised;
+
+	if( !pthread_equal( pthread_self(), d->thread ) ) {
+		d->running = 0;
+		pthread_join( d->thread, NULL );
+	}
+	report( d );
+	free( d->hist );
+	d->hist = NULL;
+	return sdrplay_api_Success;
+}
+
+sdrplay_api_ErrT sdrplay_api_Update( HANDLE dev, sdrplay_api_TunerSelectT tuner, sdrplay_api_ReasonForUpdateT reasonForUpdate,
+	sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1 ) {
+
+	struct sim_device *d = dev;
+	sdrplay_api_RxChannelParamsT *chan[ 2 ] = { &d->rxA, &d->rxB };
+	int k, k0 = tuner == sdrplay_api_Tuner_B, k1 = tuner != sdrplay_api_Tuner_A;
+	double ms;
+
+	if( !d || !d->running )
+		return sdrplay_api_NotInitialised;
+	if( !d->dual )		// a single tuner is whichever was selected
+		k0 = k1 = d->first_tuner;
+
+	pthread_mutex_lock( &d->lock );
+	if( reasonForUpdate & sdrplay_api_Update_Tuner_Gr ) {
+		for( k = k0; k <= k1; k++ ) {
+			if( d->gr_pending[ k ] ) {	// the real API rejects a gain change while one is still in progress
+				pthread_mutex_unlock( &d->lock );
+				return sdrplay_api_GainUpdateError;
+			}
+			if( chan[ k ]->tunerParams.gain.gRdB < 20 || chan[ k ]->tunerParams.gain.gRdB > 59 ) {
+				pthread_mutex_unlock( &d->lock );
+				return sdrplay_api_OutOfRange;
+			}
+		}
+		for( k = k0; k <= k1; k++ ) {
+			d->gr_pending[ k ] = envd( "SDRSIM_GR_LATENCY", 4 ) + 1;
+			d->gr_updates[ k ]++;
+		}
+		if( k0 == d->first_tuner && d->burst_start >= 0 && !d->burst_seen_update ) {	// first AGC reaction to this burst
+			ms = ( d->t - d->burst_start ) * 1e3;
+			d->burst_seen_update = 1;
+			d->agc_reactions++;
+			d->agc_sum_ms += ms;
+			if( ms > d->agc_max_ms )
+				d->agc_max_ms = ms;
+		}
+	}
+	for( k = k0; k <= k1; k++ ) {
+		if( reasonForUpdate & sdrplay_api_Update_Tuner_Frf )
+			d->rf_pending[ k ] = 2;
+		if( reasonForUpdate & sdrplay_api_Update_Ctrl_OverloadMsgAck )
+			d->overload_ack[ k ] = 0;
+	}
+	if( reasonForUpdate & sdrplay_api_Update_Dev_Fs )
+		d->fs_pending = 2;
+	pthread_mutex_unlock( &d->lock );
+	return sdrplay_api_Success;
+}
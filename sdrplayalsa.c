@@ -9,11 +9,40 @@
 // 20220304 - Commented out FIR taps option;  Added -R parameter to allow more explicit specification of the raw ADC sample rate and added to the STDOUT the calculated (raw) rate;  Added error trapping.  [Clint]
 // 20230210 - Added "lockout" of the AGC (gain) adjustment based on the value of "params->grChanged".  Its use is undocumented in the API but its use was noted in an email by Frank, K4VZ based on correspondence with Andy Carpenter, one of the authors of the API.  Also fixed issue where blank command line was not causing "usage" to be displayed.  Added "-L" parameter to set latency (in uSec) when used with the "-o" parameter to use a sound device rather than STDIO.  These changes were made to allow testing to reduce the "stutter" issue that can occur on the WebSDRs.  Also added SIGNINT function to allow the API to be shut down gracefully, hopefully reducing the need to do a "sudo system ctl restart sdrplay" to restart it when it was simply killed.
 // 20220214 - Added more graceful shutdown of all SDRPLay API processes;  Moved gain control (API) to end of RX callback so that it occurs AFTER all buffer copying;  Configured timed callback (100 msec) to poll to see if a new value is to be written to the gain file:  This moves the file write outside of the time-critical RX callback function in the event that a file-write blocks the process and upsets the callback timing and interfacing with the API.
+// 20261016 - Added "-q" parameter to decouple output from the RX callback:  The callback only copies samples into a lock-free ring buffer and a separate writer thread does AGC, output and gain updates.  A slow sink now drops whole blocks (counted as overruns) instead of holding up the API.
+// 20261016 - Added SSE2/AVX2/NEON I/Q interleave kernels picked at run time, "-F" parameter to select S16, S32 or float output and "-K" to benchmark the kernels.
+// 20261016 - AGC now cuts each block at the ms ticks and runs a SIMD peak/count detector over each piece, doing the window logic once per tick instead of per sample.  "-K" checks it against the original per-sample AGC.
+// 20261016 - Re-enabled "-t" parameter:  decimation is done in software by a fixed-point SIMD half-band cascade with an optional final FIR instead of in the RSP, replacing the old "FIXME antialias first!" code.
+// 20261016 - "-r" now takes any rate:  If no power-of-two decimation of a valid ADC rate gives it, a rational L/M polyphase resampler (SIMD kernels) runs after decimation.  "-K" reports its cost.
+// 20261016 - Added sdrplay_sim.c, a stand-in for the sdrplay_api library, with "make sdrplayalsa-sim" and "make bench" to run without an RSP.  Fixed a crash when "-i" was not given.
+// 20261016 - ALSA hardware/software parameters are now set explicitly (added "-p" for the period) and "-m" selects mmap access, where rx() interleaves straight into the driver's buffer.
+// 20261016 - Replaced the "prime the pump" xrun recovery:  After an xrun the ALSA buffer is refilled with silence to a target level ("-k"), and a fill-level controller keeps it there against clock drift by dropping or repeating single frames.  Xruns, drops and corrections are counted and reported on exit.
+// 20261016 - Added "-D" daemon mode:  All per-device state now lives in a receiver context, and one process runs a receiver for each line of a config file.  The devices are selected under a single hold of the API lock and started in parallel, each with its writer thread pinned to a CPU.
+// 20261016 - RSPduo dual-tuner mode:  "-u" runs tuner B alongside tuner A through its own receiver (frequency, gain, AGC and processing), to its own output ("-O") or interleaved with tuner A's as 4 channels.  In daemon mode a "-T b" line pairs with the tuner A line of the same device.  Gain updates now go to the receiver's own tuner instead of sdrplay_api_Tuner_Both.
+// 20261016 - Added network output:  "-o udp://host:port" (unicast or multicast) or "-o tcp://[addr]:port" (served to any number of clients) sends sequence-numbered, timestamped packets of "-U" bytes, batched per block with sendmmsg() and gathered straight from the output buffer.  "-V url" receives such a stream to stdout and reports packet rate and loss.
+// 20261016 - Added "-o shm://name":  a shared memory ring, mapped twice so it never wraps, that any number of local readers follow at their own pace with lag detection.  Samples are interleaved straight into it and read in place.  iqshm.c/iqshm.h are the reader (and writer) library and iqshmcat the reader tool and benchmark.
+// 20261016 - Added "-o sigmf://path":  a recorder that writes large aligned chunks from its own thread, with O_DIRECT and io_uring where available, so the disk never holds up rx().  Files rotate by size or time and each gets a SigMF .sigmf-meta with the device settings, capture segments around any dropped samples and an annotation for every gain change.
+// 20261016 - Added "-I file" to replay a SigMF (or raw S16) capture through rx() in the API's block sizes, in real time or with "-P" as fast as it will go, with gain changes applied to the samples after the RSP's latency, so the whole chain runs without a device.  Recordings now annotate gain changes where they take effect.
+// 20261016 - Added "-M path" runtime metrics:  callback interval, jitter and duration histograms, block processing time, samples in and out, dropped blocks and frames, xruns, reset flag changes, gain changes and grChanged lock-out times, kept lock-free in the hot path and published by their own thread in the Prometheus text format to a file or ("unix:path") a Unix socket.
+// 20261016 - Gain updates moved off the sample path:  process_block() posts the gain it wants to a lock-free queue and a control thread makes the sdrplay_api_Update() call and rewrites the gain file (now a new file renamed over the old one) in place of the SIGALRM handler.  A failed update no longer leaves the AGC locked out.
+// 20261016 - Added "-C path" control socket:  frequency, gain, LNA state, bandwidth and every AGC setting can be changed live (retunes through sdrplay_api_Update() on the control thread, AGC settings swapped in whole between blocks), "hop" runs a frequency-hop list, and the time from a retune to its first block is measured and reported.  A failed gain update is retried.
+// 20261016 - Added "-H prio", "-A cpus" and "-Y":  the callback and writer threads run SCHED_FIFO on the given CPUs, all memory is locked once streaming starts, and the sample buffers (now preallocated per receiver in place of alloca()) and thread stacks are faulted in up front.  A startup self-check reports any setting that did not take, and with "-M" the callback jitter is reported at exit.
+// 20261016 - Added "-N dB" AGC fast attack:  a block that clips, or the API's ADC overload event (now handled and acknowledged), steps the gain reduction up at once instead of after the AGC window, within max_gain_reduction;  the slow decay is unchanged.  The time to unclip is reported at exit.
+// 20261016 - Added "-J gr" gain compensation:  a SIMD float gain stage scales the output by the difference between the gain reduction in effect and "gr", switching on the block where grChanged shows the RSP applied each change with a short ramp, so the output level holds steady through AGC steps without the gain file.
+// 20261016 - Added "-Z offset:rate[:output]" polyphase FFT channelizer:  a wideband receiver's stream is split by one 2x-oversampled filter bank (SIMD fold and FFT butterfly kernels) into up to 16 narrowband channels, each with its own offset (bin plus NCO), rate (decimator and resampler) and output, finished on its own writer thread.  "-K" reports the channels per core at 8 MS/s.
+// 20261016 - Added "-Q sink" spectrum tap:  rx() copies a snapshot of the stream into a free slot now and then (none while the slots or the '-q' ring are backed up) and a SCHED_IDLE thread windows, transforms (the FFT is now shared with the channelizer) and averages them into power spectra, published with their peak and noise floor as compact binary frames to a shared memory ring or a file.  The time it costs rx() is reported at exit and with "-M".
+// 20261016 - Added "-E ms" DC offset and I/Q imbalance correction:  SIMD kernels sum each block's moments for running estimates of the offsets and the gain and phase error, and apply the correction in place of the interleave in rx(), removing the centre spike and the mirror images.  "-Q" now taps the corrected stream.  The estimates are reported at exit.
+// 20261016 - Added compact output formats for stdout and the network:  "-F p12" (packed 12-bit), "-F s8" (8-bit with a scale per block) and "-F bfp" (8-bit mantissas with an exponent per 32 samples), packed from S16 by SIMD kernels into self-describing units (iqpack.h).  iqpack.c is the reference encoder and decoder, "-V" writes packed streams out as S16 and iqunpack decodes them.  "-K" reports the packing cost and each format's size against its SNR.
+// 20261016 - Stdout to a pipe (the usual way into the WebSDR) is grown with F_SETPIPE_SZ, and short writes to stdout are finished.  "-j" fills the pipe a page at a time with vmsplice() from a reused page-aligned pool that rx() interleaves straight into, for a reader that read()s it;  in the API callback blocks it has no room for are dropped and counted, elsewhere it waits.  "-K" compares the CPU per MB with write():  vmsplice() costs more for blocks under 16 KiB and saves 15-30% from there up.
 
 #define _GNU_SOURCE
 #include <alloca.h>
 #include <alsa/asoundlib.h>
 #include <sdrplay_api.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,149 +50,661 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "iqshm.h"
+#include "iqpack.h"
+#include "pfb.h"
+#include "iqrec.h"
+#include "iqnet.h"
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#elif defined( __aarch64__ )
+#include <arm_neon.h>
+#endif
 
-static int gain_reduction = 30; // gain reduction
-static int min_gain_reduction = 30;  // this version used to hold onto command-line specified gain values for AGC control
-static int max_gain_reduction = 59;  // used to set maximum amount of gain reduction on command line
-static snd_pcm_t *pcm;
-static int AGCEnable = 0;
-static int AGC1increaseThreshold = 16384;
-static int AGC2decreaseThreshold = 8192;
-static int AGC3minTimeMs = 500;
-static int AGC4A = 4096;
-static int AGC5B = 1000;
-static int AGC6C = 5000;
-static int agc_timer_scaling;
-static int max_adc = 0;
-static int agc_increase_timer = 0;
-static int agc_decrease_timer = 0;
-static int agc_timer = 0;
-static sdrplay_api_DeviceParamsT *dp;
 static sdrplay_api_CallbackFnsT callbacks;
 static sdrplay_api_DeviceT devices[ 8 ];
 static unsigned numdevices;
-static int devind = 0;
 static int verbose = 0;
-static sdrplay_api_TunerSelectT tuner = sdrplay_api_Tuner_Both; // defined in /usr/local/include/sdrplay_api_tuner.h
-static int debugPeriod = 0;
-static int counter_ms = 0;
-static int debug_counter_ms = 0;
-static int counter_samples = 0;
-static int adc_high_count = 0;
-static int wbs = 0;
-static int bulkmode = 0;
-static int bwtype = 1536;
-static int gainstep_inc = 1;	// step size to increase attenuation
-static int gainstep_dec = 1;    // step size to decrease attenuation
-static FILE *gainfp = NULL;
-static int gchange_lockout=0;	// used to lock-out gain changes when API is busy
-static char *in_dev;
-static int gain_changed = 0;
-static char sernum[64];
-static int gainfile_flag = 0;
-
-// Do gain update for SDRPlay device
-void update_sdrplay_gain_reduction() {
+static int devlist = 0;
+static char *config;		// -D, daemon mode config file
+static int use_api;		// some receiver streams from an RSP rather than replaying a capture
+
+// Single-producer/single-consumer ring between the RX callback (producer) and the writer thread (consumer).
+// Each block is stored as a cache line of header followed by its interleaved samples, padded to a cache line.  Head and
+// tail are free-running byte counts and live on their own cache lines so the two threads do not false-share.
+#define RING_ALIGN 64
+struct ring_block {
+	unsigned numSamples;	// 0 marks padding to the end of the buffer
+	unsigned len;			// total bytes of this record including header, multiple of RING_ALIGN
+	int grChanged;			// params->grChanged as seen by the callback for this block
+	unsigned reset;
+	uint64_t time_ns;		// when the block reached the callback (network output only)
+};
+
+// Preallocated per-receiver buffers for a block's samples on their way through (see scratch_init()):  a block too
+// big for one goes on the stack instead
+#define SCRATCH_FRAMES 8192
+#define SCRATCH_BYTES ( SCRATCH_FRAMES * 4 * 4 )	// 4 channels of S32 or F32
+#define SCRATCH( buf, len ) ( (size_t)( len ) <= SCRATCH_BYTES ? (void *)( buf ) : alloca( len ) )
+
+// The largest block the API (or a replay) hands a callback.  The decimator, resampler, filter bank and 4-channel
+// pairing are sized for it when the receiver opens, so nothing on the sample path allocates;  rx() drops and counts
+// any bigger block.
+#define API_MAXFRAMES 16384
+
+enum { FMT_S16, FMT_S32, FMT_F32 };
+
+#define HB_MAXK 16
+#define DEC_MAXSTAGES 6
+
+struct hb_stage {
+	int k;					// 4k-1 taps:  the centre tap plus k symmetric pairs of even-indexed taps
+	short g[ HB_MAXK ];		// even-indexed taps, g[j] == g[2k-1-j]
+	short c;				// centre tap, 0.5 (16384) give or take the rounding
+	short *e[ 2 ], *o[ 2 ];	// even and odd input phases for I and Q, history first
+	unsigned ne, no;		// samples held in e and o
+	unsigned phase;			// parity of the next input sample
+	short *out[ 2 ];
+};
+
+#define RS_TAPS 64
+#define CHAN_MAX 16
+
+struct agc_params {		// the AGC settings the control socket can change, swapped in whole between blocks
+	int AGCEnable, AGC1increaseThreshold, AGC2decreaseThreshold, AGC3minTimeMs, AGC4A, AGC5B, AGC6C;
+	int gainstep_inc, gainstep_dec, min_gain_reduction, max_gain_reduction, agc_fast;
+	int set_gain;			// gain reduction to go to at once, -1 = leave it
+};
+
+// Everything that belongs to one receiver:  an RSP, its settings, AGC state, processing and output.  There is one
+// per process normally and one per line of the config file in daemon mode (-D).  rcv is the receiver the current
+// thread is working for - rx() takes it from the callback context and each writer thread from its argument.
+struct receiver {
+	// settings
+	char *in_dev;
+	int freq;
+	int rate;
+	int lna;
+	int bwtype;
+	int wbs;
+	int bulkmode;
+	int rateval;
+	int taps;
+	char *out;
+	int latency_us;
+	char *gainfile;
+	int debugPeriod;
+	char *replay_file;	// -I, replay this capture instead of streaming from an RSP
+	int replay_fast;	// -P, as fast as possible rather than in real time
+
+	int gain_reduction; // gain reduction
+	int min_gain_reduction;  // this version used to hold onto command-line specified gain values for AGC control
+	int max_gain_reduction;  // used to set maximum amount of gain reduction on command line
+	int gainstep_inc;	// step size to increase attenuation
+	int gainstep_dec;    // step size to decrease attenuation
+	int AGCEnable;
+	int AGC1increaseThreshold;
+	int AGC2decreaseThreshold;
+	int AGC3minTimeMs;
+	int AGC4A;
+	int AGC5B;
+	int AGC6C;
+	int agc_fast;		// -N, fast-attack step in dB, 0 = off
+	int gc_ref;			// -J, level the output to this gain reduction, -1 = off
+	int iqc_ms;			// -E, DC and I/Q imbalance correction time constant, 0 = off
+
+	// device
+	int devind;
+	char sernum[64];
+	sdrplay_api_DeviceParamsT *dp;
+	sdrplay_api_TunerSelectT tuner;	// -T, tuner A or B of an RSPduo (A on everything else)
+	long adc_rate;		// fsHz
+	int decimation;		// ADC rate / output rate ahead of any resampling, in the RSP or in software
+	long cb_rate;		// of the blocks the callback is handed
+
+	// RSPduo dual-tuner mode
+	int freq_b;			// -u, also run tuner B at this frequency with the same settings
+	char *out_b;		// -O, tuner B's output device;  none = both tuners on this receiver's output as 4 channels
+	struct receiver *peer;	// the other tuner of the same RSPduo
+	int quad;			// tuner A of a pair with 4-channel output (I/Q of A, then I/Q of B, in each frame)
+	int channels;		// output channels, 2 or 4
+	unsigned sample_num;	// params->firstSampleNum of the block being processed
+	pthread_mutex_t quad_lock;	// quad_* below live in tuner A's receiver
+	void *quad_buf;		// one tuner's block waiting for the other's
+	size_t quad_size;	// room for an API_MAXFRAMES block, made by pair_tuners()
+	unsigned quad_n, quad_num;	// its length (0 = none waiting) and sample number
+	sdrplay_api_TunerSelectT quad_from;	// and which tuner it came from
+	unsigned long quad_dropped;	// frames dropped because the tuners' blocks did not pair up
+
+	// AGC state
+	int agc_timer_scaling;
+	int max_adc;
+	int agc_increase_timer;
+	int agc_decrease_timer;
+	int agc_timer;
+	int counter_ms;
+	int debug_counter_ms;
+	int counter_samples;
+	int adc_high_count;
+	int gchange_lockout;	// used to lock-out gain changes when API is busy
+	int gain_changed;
+	int gain_inflight;		// gain reduction posted to the control thread and not yet in effect, -1 = none
+	atomic_int gain_failed;	// set by the control thread when an update fails
+	int grChanged_flag;
+	unsigned reset_flag;
+	int grChanged_carry;
+	unsigned long oversize;	// blocks dropped for being over API_MAXFRAMES
+	atomic_int overload;	// the API reports the ADC overloaded (event(), PowerOverloadChange)
+	atomic_ulong overloads, attacks;	// overload events, fast-attack steps
+	uint64_t agc_samples;	// samples through agc()
+	int clipping;			// the last block clipped
+	uint64_t clip_since;	// agc_samples when it started
+	atomic_ulong clips, clip_sum, clip_max;	// clipping episodes over, their total and longest length in samples
+
+	// gain compensation (-J)
+	int gc_gain, gc_target, gc_step;	// Q16 digital gain now, ramping to, per frame
+	unsigned gc_left;		// frames of ramp to go
+
+	// output format
+	int out_format;	// output sample format (-F)
+	int out_bps;				// bytes per output sample (I or Q)
+	int wire;					// -F p12, s8 or bfp:  the IQPACK_ format S16 is packed into for stdout or the network, 0 = none
+	unsigned long long wire_in, wire_out;	// bytes of S16 packed, and what they packed into
+
+	// software decimation
+	int swdec;				// -t given:  decimate in software
+	int dec_stages;
+	struct hb_stage hb[ DEC_MAXSTAGES ];
+	short fir_taps[ 128 ];		// first half of the final FIR, centre tap last
+	int fir_len;					// 0 = no final FIR
+	short *fir_x[ 2 ], *fir_out[ 2 ];
+	unsigned fir_nx;
+
+	// rational resampler
+	int rs_L, rs_M;		// resample ratio, 1/1 = off
+	short *rs_coefs;				// rs_L phases of RS_TAPS taps, in input order
+	short *rs_x[ 2 ], *rs_out[ 2 ];
+	unsigned rs_nx, rs_pos, rs_phase;
+
+	// channelizer (-Z)
+	char *chan_spec[ CHAN_MAX ];	// -Z offset:rate[:sink] as given
+	int nchan_spec;
+	struct receiver *chans[ CHAN_MAX ];	// the channel receivers made from them
+	int nchans;
+	struct pfb *pfb;			// the filter bank that feeds them
+	struct receiver *chan_of;	// a channel:  the wideband receiver it comes from
+	int chan_num;				// its -Z, from 1
+	int chan_offset;			// Hz from that receiver's frequency
+	struct pfb_nco chan_nco;	// the filter bank output it takes, and its NCO
+
+	// ALSA output
+	snd_pcm_t *pcm;
+	int pcm_mmap;		// -m given:  mmap access, blocks are written straight into the driver's buffer
+	int period_us;		// -p, ALSA period;  0 = a quarter of the latency
+	snd_pcm_uframes_t pcm_buffer, pcm_period;	// actual buffer and period sizes, in frames
+	snd_pcm_uframes_t pcm_offset;	// of the region handed out by pcm_area()
+	void *pcm_zc;		// block rx() interleaved straight into the mmap'ed buffer
+	int fill_us;		// -k, ALSA buffer fill to hold;  0 = half the buffer
+	snd_pcm_uframes_t pcm_target;	// the same in frames
+	unsigned pcm_rate;
+	double pcm_fill, pcm_integral, pcm_frac;	// fill-level controller state
+	char *pcm_zero;		// a period of silence
+	char pcm_last[ 16 ];	// last frame written, repeated to insert one
+	unsigned long pcm_xruns, pcm_dropped, pcm_inserted, pcm_removed;	// xruns, frames dropped for lack of room, drift corrections
+
+	uint64_t block_ns;		// when the block being processed reached the callback
+
+	// network output (-o udp://... or tcp://...)
+	struct net_sink *net;
+	int net_payload;	// -U, bytes of samples per packet
+
+	// shared memory output (-o shm://name)
+	struct iqshm *shm;
+	void *shm_zc;		// block rx() interleaved straight into the ring
+
+	// SigMF recording (-o sigmf://path)
+	struct recorder *rec;
+
+	// stdout (no -o)
+	int pipe_splice;		// -j given:  vmsplice() into a pipe
+	int pipe_size;			// stdout is a pipe of this many bytes;  0 = a file or terminal
+	char *pipe_pool;		// page-aligned pool the blocks are spliced from
+	size_t pipe_pool_size, pipe_blk, pipe_page;	// its size, twice the largest block it was made for, and the page size
+	size_t pipe_head, pipe_sent;		// where the next block goes and where what is waiting for the pipe starts
+	void *pipe_zc;			// block rx() interleaved straight into the pool
+	unsigned long long pipe_bytes;
+	unsigned long pipe_calls, pipe_partial, pipe_dropped, pipe_errors;
+
+	// DC and I/Q imbalance correction (-E)
+	double iqc_m[ 5 ];	// running means of I, Q, I*I, Q*Q and I*Q
+	int iqc_c[ 4 ];		// iq_correct()'s coefficients from them
+	int iqc_primed;
+
+	// spectrum tap (-Q)
+	char *spec_sink;
+	struct spectrum *spec;
+
+	// replay (-I file)
+	struct replay *replay;
+
+	// runtime metrics (-M), NULL if not kept
+	struct metrics *met;
+
+	// live control (-C)
+	struct agc_params agc_ctl;		// the settings as the control socket last set them, its thread only
+	struct agc_params agc_staged;	// the next settings for process_block() to take
+	atomic_int agc_staged_ready;
+	unsigned ctl_hop_n, ctl_hop_ms;	// the hop list as last set, for status
+	struct ctl_hop *hop;			// the hop list running, control thread only
+	_Atomic uint64_t retune_ns;		// CLOCK_MONOTONIC of the retune whose first block rx() is waiting for, 0 = none
+	atomic_ulong retunes;
+	_Atomic uint64_t retune_last_ns, retune_sum_ns, retune_max_ns;	// from the retune to its first block
+
+	// callback -> writer ring buffer
+	int ring_ms;		// depth of callback->writer ring buffer in ms, 0 = write directly from the callback
+	char *ring_buf;
+	size_t ring_size;	// power of two
+	_Alignas(RING_ALIGN) atomic_size_t ring_head;
+	_Alignas(RING_ALIGN) atomic_size_t ring_tail;
+	_Alignas(RING_ALIGN) atomic_size_t ring_highwater;
+	atomic_ulong ring_overruns;
+	sem_t ring_sem;
+	pthread_t writer_thread;
+	int cpu;			// CPU the writer thread is pinned to, -1 = not pinned
+
+	char *scratch[ 3 ];	// SCRATCH_BYTES each, for rx(), process_block() and quad_output() in place of alloca()
+	int rt_pending;		// the callback thread still has to be given the -H/-A settings
+	atomic_int rt_cb;	// and how that went:  0 = no callback yet, 1 = done, else -errno
+	int rt_writer;		// the same for the writer thread
+};
+
+#define MAX_RECEIVERS 32	// devices, RSPduo tuner B and '-Z' channels
+
+static struct receiver *receivers[ MAX_RECEIVERS ];
+static int numreceivers;
+static __thread struct receiver *rcv;
+
+static struct receiver *receiver_new( void ) {
+
+	struct receiver *r = aligned_alloc( RING_ALIGN, ( sizeof( *r ) + RING_ALIGN - 1 ) & ~( RING_ALIGN - 1 ) );
+
+	memset( r, 0, sizeof( *r ) );
+	r->lna = 3;
+	r->bwtype = 1536;
+	r->rateval = -1;
+	r->taps = 9;
+	r->latency_us = 50000;
+	r->gain_reduction = 30;
+	r->min_gain_reduction = 30;
+	r->max_gain_reduction = 59;
+	r->gainstep_inc = 1;
+	r->gainstep_dec = 1;
+	r->AGC1increaseThreshold = 16384;
+	r->AGC2decreaseThreshold = 8192;
+	r->AGC3minTimeMs = 500;
+	r->AGC4A = 4096;
+	r->AGC5B = 1000;
+	r->AGC6C = 5000;
+	r->reset_flag = 99;
+	r->gain_inflight = -1;
+	r->tuner = sdrplay_api_Tuner_A;
+	r->channels = 2;
+	r->out_format = FMT_S16;
+	r->out_bps = 2;
+	r->rs_L = r->rs_M = 1;
+	r->net_payload = 1432;	// a 1500-byte Ethernet frame
+	r->cpu = -1;
+	r->gc_ref = -1;
+	return r;
+}
+
+// The API's parameters for rcv's tuner
+static sdrplay_api_RxChannelParamsT *rx_channel( void ) {
+
+	return rcv->tuner == sdrplay_api_Tuner_B ? rcv->dp->rxChannelB : rcv->dp->rxChannelA;
+}
+
+static int replay_update( int gain_reduction );
+static void chan_run( const short *buf, unsigned numSamples );
+static void met_gain( int ret, int gain_reduction );
+static size_t wire_pack( void *out, const short *buf, unsigned numSamples );
+static inline short sat16( long v );
+
+static uint64_t now_ns( void ) {
+
+	struct timespec ts;
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t mono_ns( void ) {
+
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define MET_LOAD( x ) atomic_load_explicit( (_Atomic __typeof__( x ) *)&( x ), memory_order_relaxed )	// a plain field another thread writes
+
+// Write the gain file (-e):  a new file renamed over the old one, so a reader never sees it half written
+static int write_gainfile( int value ) {
+
+	char tmp[ PATH_MAX ];
+	FILE *fp;
+
+	snprintf( tmp, sizeof( tmp ), "%s.tmp", rcv->gainfile );
+	if( !( fp = fopen( tmp, "w" ) ) )
+		return -1;
+	fprintf( fp, "%d\n", value );
+	if( fclose( fp ) || rename( tmp, rcv->gainfile ) ) {
+		unlink( tmp );
+		return -1;
+	}
+	return 0;
+}
+
+// Do gain update for SDRPlay device.  Runs on the control thread, never in the callback.
+static void update_sdrplay_gain_reduction( int gain_reduction ) {
 	int ret;
-//	char s[16];
-//	int l=0;
 
     sdrplay_api_ReasonForUpdateT reasonForUpdate = sdrplay_api_Update_Tuner_Gr;
     sdrplay_api_ReasonForUpdateExtension1T reasonForUpdateExt1 = sdrplay_api_Update_Ext1_None;
 
     if (verbose) {
-		fprintf(stderr, "updating gain_reduction to %d, agc_timer is %d\n", gain_reduction, agc_timer);
+		fprintf(stderr, "updating gain_reduction to %d\n", gain_reduction);
     }
 
-    dp->rxChannelA->tunerParams.gain.gRdB = gain_reduction;
-    ret = sdrplay_api_Update( devices[ devind ].dev, tuner, reasonForUpdate, reasonForUpdateExt1);
+    rx_channel()->tunerParams.gain.gRdB = gain_reduction;
+    if( rcv->replay )	// process_block() has already handed it to the replay
+		ret = sdrplay_api_Success;
+    else
+		ret = sdrplay_api_Update( devices[ rcv->devind ].dev, rcv->tuner, reasonForUpdate, reasonForUpdateExt1);
 
     if(ret) {
 		fprintf( stderr, "Error response from sdr_api_Update: %s\n", sdrplay_api_GetErrorString( ret ) );
+		atomic_store( &rcv->gain_failed, 1 );	// no grChanged will come to end the lock-out
     } else {
 		if (verbose) {
 		    fprintf(stderr, "Successful response from sdr_api_Update\n");
 		}
+		if( rcv->gainfile && write_gainfile( gain_reduction - rcv->min_gain_reduction ) )	// and the gain file
+			fprintf( stderr, "Cannot write gainfile %s: %s\n", rcv->gainfile, strerror( errno ) );
     }
+	met_gain( ret, gain_reduction );
+}
 
-	gainfile_flag = 1;	// Signal to callback that a new gain value is ready to be written
+// Gain control:  process_block() never calls the API or touches the gain file itself.  It posts the gain it wants
+// to a lock-free queue and the control thread makes the update, so neither the callback nor the writer thread
+// ever waits for sdrplay_api_Update() or the disk.  Every receiver's processing thread posts to the one queue, a
+// bounded multi-producer ring with a sequence number per slot;  the control thread sleeps on a semaphore.  The
+// control socket (-C) posts its retunes, LNA and bandwidth changes to the same queue, so every update of a device
+// comes from the one thread, and the control thread also steps through any frequency-hop lists.
+#define CTL_QUEUE 64		// a power of two, well over one gain change in flight per receiver
 
-/*
-    if (gainfp) {	// Write new gain value to file
-		sprintf(s, "%d", gain_reduction-min_gain_reduction);
-		l=strlen(s);
-		fseek(gainfp, 0, SEEK_SET);
-//		fprintf(gainfp, "%d\n", gain_reduction-min_gain_reduction);
-		fwrite(s,1,l,gainfp);
-		fflush(gainfp);
-    }
-*/
+enum { CTL_GAIN, CTL_FREQ, CTL_LNA, CTL_BW, CTL_HOP, CTL_ACK };
+
+struct ctl_hop {			// a frequency-hop list, owned by the control thread once posted
+	unsigned n, i;			// frequencies, next to go to
+	uint64_t dwell_ns, next_ns;	// time on each, CLOCK_MONOTONIC of the next hop
+	int freq[];
+};
+
+struct ctl_cmd {
+	atomic_size_t seq;		// == position:  free for the producer claiming it;  position + 1:  ready to run
+	struct receiver *r;
+	int type, value;
+	struct ctl_hop *hop;
+	int *result;			// if not NULL, the API's answer goes here and done is posted
+	sem_t *done;
+};
+
+static struct ctl_cmd ctl_queue[ CTL_QUEUE ];
+static _Alignas(RING_ALIGN) atomic_size_t ctl_head;	// next position to claim
+static _Alignas(RING_ALIGN) size_t ctl_tail;		// next to run, control thread only
+static sem_t ctl_sem;
+static pthread_t ctl_thread;
+
+// Queue cmd (all but seq) for the control thread.  Returns 0, or -1 if the queue is full (try again later).
+static int ctl_post( const struct ctl_cmd *cmd ) {
+
+	size_t pos = atomic_load_explicit( &ctl_head, memory_order_relaxed ), seq;
+	struct ctl_cmd *c;
+
+	for(;;) {
+		c = ctl_queue + ( pos & ( CTL_QUEUE - 1 ) );
+		seq = atomic_load_explicit( &c->seq, memory_order_acquire );
+		if( seq == pos ) {
+			if( atomic_compare_exchange_weak_explicit( &ctl_head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) )
+				break;
+		}
+		else if( seq < pos )	// still holds a command from a lap ago
+			return -1;
+		else
+			pos = atomic_load_explicit( &ctl_head, memory_order_relaxed );
+	}
+	c->r = cmd->r;
+	c->type = cmd->type;
+	c->value = cmd->value;
+	c->hop = cmd->hop;
+	c->result = cmd->result;
+	c->done = cmd->done;
+	atomic_store_explicit( &c->seq, pos + 1, memory_order_release );
+	sem_post( &ctl_sem );	// a system call only if the control thread is asleep
+	return 0;
+}
+
+// Ask for r's gain reduction to be set
+static int ctl_post_gain( struct receiver *r, int gain_reduction ) {
+
+	struct ctl_cmd c = { .r = r, .type = CTL_GAIN, .value = gain_reduction };
+
+	return ctl_post( &c );
+}
+
+// Retune rcv, noting when so that rx() can time the first block at the new frequency
+static int ctl_retune( int freq ) {
+
+	int ret;
+
+	rx_channel()->tunerParams.rfFreq.rfHz = freq;
+	atomic_store( &rcv->retune_ns, mono_ns() );
+	if( ( ret = sdrplay_api_Update( devices[ rcv->devind ].dev, rcv->tuner, sdrplay_api_Update_Tuner_Frf, sdrplay_api_Update_Ext1_None ) ) ) {
+		atomic_store( &rcv->retune_ns, 0 );
+		fprintf( stderr, "Cannot retune %s to %d Hz: %s\n", rcv->sernum, freq, sdrplay_api_GetErrorString( ret ) );
+	}
+	else
+		rcv->freq = freq;
+	return ret;
+}
+
+static void ctl_exec( const struct ctl_cmd *c ) {
+
+	int ret = sdrplay_api_Success;
+
+	rcv = c->r;
+	switch( c->type ) {
+	case CTL_GAIN:
+		update_sdrplay_gain_reduction( c->value );
+		break;
+	case CTL_FREQ:
+		ret = ctl_retune( c->value );
+		break;
+	case CTL_LNA:
+		rx_channel()->tunerParams.gain.LNAstate = c->value;
+		if( !( ret = sdrplay_api_Update( devices[ rcv->devind ].dev, rcv->tuner, sdrplay_api_Update_Tuner_Gr, sdrplay_api_Update_Ext1_None ) ) )
+			rcv->lna = c->value;
+		break;
+	case CTL_BW:
+		rx_channel()->tunerParams.bwType = c->value;
+		if( !( ret = sdrplay_api_Update( devices[ rcv->devind ].dev, rcv->tuner, sdrplay_api_Update_Tuner_BwType, sdrplay_api_Update_Ext1_None ) ) )
+			rcv->bwtype = c->value;
+		break;
+	case CTL_ACK:	// an overload event, for tuner value:  the API sends no more until it is acknowledged
+		ret = sdrplay_api_Update( devices[ rcv->devind ].dev, c->value, sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None );
+		break;
+	case CTL_HOP:	// replaces any list already running;  the first hop is now
+		free( rcv->hop );
+		if( ( rcv->hop = c->hop ) )
+			rcv->hop->next_ns = mono_ns();
+		break;
+	}
+	if( c->result ) {
+		*c->result = ret;
+		sem_post( c->done );
+	}
+}
+
+// Make any hops that are due.  Returns the CLOCK_MONOTONIC time of the next one, 0 = none.
+static uint64_t ctl_hops( void ) {
+
+	uint64_t now = mono_ns(), next = 0;
+	struct ctl_hop *h;
+	int i;
+
+	for( i = 0; i < numreceivers; i++ ) {
+		if( !( h = receivers[ i ]->hop ) )
+			continue;
+		if( h->next_ns <= now ) {
+			rcv = receivers[ i ];
+			ctl_retune( h->freq[ h->i ] );
+			h->i = ( h->i + 1 ) % h->n;
+			h->next_ns += h->dwell_ns;
+			if( h->next_ns <= now )		// fell behind:  keep the dwell rather than catch up
+				h->next_ns = now + h->dwell_ns;
+		}
+		if( !next || h->next_ns < next )
+			next = h->next_ns;
+	}
+	return next;
+}
+
+static void *ctl_run( void *arg ) {
+
+	struct ctl_cmd c, *q;
+	struct timespec ts;
+	sigset_t all;
+	uint64_t next = 0, t;
+	int ret;
+
+	sigfillset( &all );		// term() belongs on another thread
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	for(;;) {
+		if( next ) {	// sleep until the next hop at the latest
+			t = now_ns() + ( next > mono_ns() ? next - mono_ns() : 0 );
+			ts.tv_sec = t / 1000000000;
+			ts.tv_nsec = t % 1000000000;
+			ret = sem_timedwait( &ctl_sem, &ts );
+		}
+		else
+			ret = sem_wait( &ctl_sem );
+		if( !ret ) {
+			q = ctl_queue + ( ctl_tail & ( CTL_QUEUE - 1 ) );
+			while( atomic_load_explicit( &q->seq, memory_order_acquire ) != ctl_tail + 1 )	// claimed but not yet filled in
+				sched_yield();
+			c = *q;
+			atomic_store_explicit( &q->seq, ctl_tail + CTL_QUEUE, memory_order_release );
+			ctl_tail++;
+			ctl_exec( &c );
+		}
+		next = ctl_hops();
+	}
+	return arg;
+}
+
+static int ctl_start( void ) {
+
+	int i, ret;
+
+	for( i = 0; i < CTL_QUEUE; i++ )
+		atomic_init( &ctl_queue[ i ].seq, i );
+	sem_init( &ctl_sem, 0, 0 );
+	if( ( ret = pthread_create( &ctl_thread, NULL, ctl_run, NULL ) ) ) {
+		fprintf( stderr, "Cannot create control thread: %s\n", strerror( ret ) );
+		return 1;
+	}
+	return 0;
 }
 
-// Process AGC based in samples
-void agc(short *buf, sdrplay_api_StreamCbParamsT *params, unsigned numSamples) {
+// Original per-sample AGC.  No longer used for processing - agc() below must make exactly the same
+// decisions, and the -K self-check runs both over the same buffers to prove it.
+static void agc_reference(short *buf, unsigned numSamples) {
     int adc_result, abs_adc, i;
 	
     for (i = 0; i < numSamples; i++) {
-		counter_samples ++;
-		if (counter_samples > agc_timer_scaling) {	// update AGC "window" timers
-	    	counter_ms++;
-		    debug_counter_ms++;
-		    counter_samples = 0;
-	    	agc_timer++; // this is the timer for the AGC loop;
-		    agc_increase_timer++;
-		    agc_decrease_timer++;
+		rcv->counter_samples ++;
+		if (rcv->counter_samples > rcv->agc_timer_scaling) {	// update AGC "window" timers
+	    	rcv->counter_ms++;
+		    rcv->debug_counter_ms++;
+		    rcv->counter_samples = 0;
+	    	rcv->agc_timer++; // this is the timer for the AGC loop;
+		    rcv->agc_increase_timer++;
+		    rcv->agc_decrease_timer++;
 		}
 
 		// determine absolute amplitude of current sample
 		adc_result = buf[i];
 		abs_adc = abs(adc_result);
 
-		if(abs_adc > max_adc) max_adc = abs_adc;	// get high water mark
+		if(abs_adc > rcv->max_adc) rcv->max_adc = abs_adc;	// get high water mark
 	
-		if(abs_adc > AGC1increaseThreshold)		// is A/D value above high signal level?
-		    if(adc_high_count < 65530) adc_high_count++;	// yes - bump count, prevent overflow
+		if(abs_adc > rcv->AGC1increaseThreshold)		// is A/D value above high signal level?
+		    if(rcv->adc_high_count < 65530) rcv->adc_high_count++;	// yes - bump count, prevent overflow
 
-		if(agc_timer >= AGC3minTimeMs) { // we can look at the AGC timing again since it has been long enough
+		if(rcv->agc_timer >= rcv->AGC3minTimeMs) { // we can look at the AGC timing again since it has been long enough
 		    // (do increase threshold count timing, etc. and decrease gain as necessary)
 	    	// if it has been long enough since we did an increase - AND is there a minimum number of A/D conversions above the last
-		    if((agc_increase_timer > AGC5B) && (adc_high_count > AGC4A)) {
+		    if((rcv->agc_increase_timer > rcv->AGC5B) && (rcv->adc_high_count > rcv->AGC4A)) {
 				// is the current "gain reduction" value below the limit?
-				if(gain_reduction < AGC1increaseThreshold) {
+				if(rcv->gain_reduction < rcv->AGC1increaseThreshold) {
 				    // yes - decrease the gain by one step
-			    	gain_reduction+=gainstep_inc;
+			    	rcv->gain_reduction+=rcv->gainstep_inc;
 
-			    	if(gain_reduction > 59)	// Gain reduction at maximum?
-						gain_reduction = max_gain_reduction;	// limit maximum amount of gain reduction
+			    	if(rcv->gain_reduction > 59)	// Gain reduction at maximum?
+						rcv->gain_reduction = rcv->max_gain_reduction;	// limit maximum amount of gain reduction
 					else	// Do API gain change only if valid value
-					    gain_changed = 1;
+					    rcv->gain_changed = 1;
 
-				    agc_increase_timer = 0;  // reset timer for gain increase
-				    agc_decrease_timer = 0;  // also reset AGC decrease timer because we just did an increase
+				    rcv->agc_increase_timer = 0;  // reset timer for gain increase
+				    rcv->agc_decrease_timer = 0;  // also reset AGC decrease timer because we just did an increase
 				}
 		    } 
-		    else if (max_adc < AGC2decreaseThreshold) {  // (do decrease threshold count timing, etc. and increase gain as necessary)
-				if( (agc_decrease_timer > AGC6C) ) {
+		    else if (rcv->max_adc < rcv->AGC2decreaseThreshold) {  // (do decrease threshold count timing, etc. and increase gain as necessary)
+				if( (rcv->agc_decrease_timer > rcv->AGC6C) ) {
 		    		// yes - is the current "gain reduction" above the limit?
-			    	if(gain_reduction > min_gain_reduction) {	// prevent gain reduction from being set lower than explicitly specified in command line
+			    	if(rcv->gain_reduction > rcv->min_gain_reduction) {	// prevent gain reduction from being set lower than explicitly specified in command line
 						// yes - increase the gain by one step
-						gain_reduction-=gainstep_dec;
-						gain_changed = 1;
-						agc_increase_timer = 0; // reset the gain adjustment timers
-						agc_decrease_timer = 0;
-						adc_high_count = 0;
+						rcv->gain_reduction-=rcv->gainstep_dec;
+						rcv->gain_changed = 1;
+						rcv->agc_increase_timer = 0; // reset the gain adjustment timers
+						rcv->agc_decrease_timer = 0;
+						rcv->adc_high_count = 0;
 				    }
 				}
 	    	}
-		    max_adc = 0; // reset the ADC high-water value before the next AGC sampling window starts
-		    agc_timer = 0;
-	    	adc_high_count = 0;	// end of timing window - reset high count for next time.
+		    rcv->max_adc = 0; // reset the ADC high-water value before the next AGC sampling window starts
+		    rcv->agc_timer = 0;
+	    	rcv->adc_high_count = 0;	// end of timing window - reset high count for next time.
 		}
 
-		if(debugPeriod > 0) {
-	    	if (debug_counter_ms > debugPeriod) {
-				debug_counter_ms = 0;
-				fprintf(stderr, "DEBUG: agc_timer=%d, gain_reduction=%d, abs_adc=%d, max_adc=%d, gain_changed=%d, adc_high_count=%u\n", agc_timer, gain_reduction, abs_adc, max_adc, gain_changed, adc_high_count);
+		if(rcv->debugPeriod > 0) {
+	    	if (rcv->debug_counter_ms > rcv->debugPeriod) {
+				rcv->debug_counter_ms = 0;
+				fprintf(stderr, "DEBUG: agc_timer=%d, gain_reduction=%d, abs_adc=%d, max_adc=%d, gain_changed=%d, adc_high_count=%u\n", rcv->agc_timer, rcv->gain_reduction, abs_adc, rcv->max_adc, rcv->gain_changed, rcv->adc_high_count);
 		    }
 		}
 
@@ -180,350 +721,5430 @@ void agc(short *buf, sdrplay_api_StreamCbParamsT *params, unsigned numSamples) {
 }
 
 
-void rx( short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned numSamples, unsigned reset, void *cbContext ) {
+// I/Q interleave and sample format conversion kernels.  Each set converts the API's separate xi/xq arrays
+// (or an already interleaved S16 buffer) into the output format;  the fastest set the CPU supports is picked
+// at start-up by select_kernels().  All kernels handle any length and need no particular alignment.
 
-    short *buf = alloca( numSamples * 2 * sizeof (short) );
-    short *p;
-    int i;
-    int ret;
-    ssize_t write_return_value;
-    static int grChanged_flag = 0;
-	static unsigned reset_flag = 99;
 
-	// Set lock-outs for AGC gain changes
+struct kernels {
+	const char *name;
+	void (*interleave_s16)( short *out, const short *xi, const short *xq, unsigned n );
+	void (*interleave_s32)( int *out, const short *xi, const short *xq, unsigned n );
+	void (*interleave_f32)( float *out, const short *xi, const short *xq, unsigned n );
+	void (*s16_to_s32)( int *out, const short *in, unsigned n );	// n is the number of shorts, not I/Q pairs
+	void (*s16_to_f32)( float *out, const short *in, unsigned n );
+	// AGC detector:  largest |sample| and number of samples with |sample| > threshold (0..32767) over n shorts
+	void (*peak_count)( const short *in, unsigned n, int threshold, unsigned *peak, unsigned *count );
+	// Symmetric FIR, Q15 taps:  out[m] = sum(j<npairs) g[j]*(x[m+j] + x[m+span-1-j]) + center*c[m], rounded and saturated
+	void (*fir_sym)( short *out, const short *x, const short *g, unsigned npairs, unsigned span, const short *c, short center, unsigned n );
+	// Split n pairs of shorts into their even (e) and odd (o) members - the inverse of interleave_s16
+	void (*deinterleave_s16)( short *e, short *o, const short *in, unsigned n );
+	// Polyphase resampler:  n outputs of sum(t<taps) c[phase*taps+t]*x[pos+t] (Q15, taps a multiple of 16), advancing
+	// phase by M and pos by whole multiples of L after each.  *pos and *phase are updated.
+	void (*resample)( short *out, const short *x, const short *c, unsigned taps, unsigned L, unsigned M, unsigned *pos, unsigned *phase, unsigned n );
+	// Gain in place on n I/Q pairs, pair i by ( g + i*dg ) / 65536 in float, rounded to nearest and saturated
+	void (*scale_s16)( short *buf, unsigned n, int g, int dg );
+	// Polyphase filter bank (-Z):  w[j] = sum(s<t) g[s*m+j]*x[s*m+j] for j < m, float, summed in order of s
+	void (*pfb_fold)( float *w, const float *g, const float *x, unsigned m, unsigned t );
+	// Radix-2 FFT butterflies on split complex data:  for j < n, with t = b[j]*w[j], b[j] = a[j] - t and a[j] += t
+	void (*fft_butterfly)( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n );
+	// DC and I/Q imbalance correction (-E) fused with interleave_s16:  I + c[2] and (c[0]*I + c[1]*Q + c[3]) >> 14,
+	// saturated.  c[0] and c[1] are Q14 and |c[0]| + |c[1]| is at most 1.75, so the sum cannot overflow.
+	void (*iq_correct)( short *out, const short *xi, const short *xq, unsigned n, const int *c );
+	// Adds sum(I), sum(Q), sum(I*I), sum(Q*Q) and sum(I*Q) over n pairs to s[0..4];  SIMD sets sum the products in float
+	void (*iq_stats)( const short *xi, const short *xq, unsigned n, double *s );
+	// Compact output formats (-F p12, s8, bfp) of n interleaved S16 samples, byte for byte as iqpack.c's
+	void (*pack_p12)( uint8_t *out, const short *in, size_t n );
+	void (*pack_s8)( int8_t *out, const short *in, size_t n, float gain );
+	void (*pack_bfp)( uint8_t *out, const short *in, size_t n );
+};
+
+static void interleave_s16_scalar( short *out, const short *xi, const short *xq, unsigned n ) {
 
-	if(params->grChanged)	{	// has "grChanged" gone non-zero indicating an operation in process?
-		grChanged_flag = 1;		// yes
-		gchange_lockout = 1;	// unconditionally set lockout to prevent gain reduction call
+	unsigned i;
+
+	for( i = 0; i < n; i++, out += 2 ) {
+		out[ 0 ] = xi[ i ];
+		out[ 1 ] = xq[ i ];
 	}
-	else if(grChanged_flag)	{	// has grChanged gone BACK to zero after being nonzero?
-		grChanged_flag = 0;		// yes - clear detect flag
-		gchange_lockout = 0;	// clear gain change lockout
+}
+
+static void interleave_s32_scalar( int *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i < n; i++, out += 2 ) {
+		out[ 0 ] = (int)xi[ i ] << 16;
+		out[ 1 ] = (int)xq[ i ] << 16;
 	}
+}
 
-	if(reset != reset_flag)	{	// Indicate change in status of the "reset" flag from the API
-		fprintf( stderr, "API reset Flag is now %u\n", reset);
-		reset_flag = reset;
+static void interleave_f32_scalar( float *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i < n; i++, out += 2 ) {
+		out[ 0 ] = xi[ i ] * ( 1.0f / 32768 );
+		out[ 1 ] = xq[ i ] * ( 1.0f / 32768 );
 	}
+}
 
-#if 1
-    // already decimated
-    for( i = 0, p = buf; i < numSamples; i++, p += 2 ) {	// Copy samples to local buffer
-		p[ 0 ] = *xi++;
-		p[ 1 ] = *xq++;
-    }
-#else
-    // we do the decimation
-    // FIXME antialias first!
-    numSamples >>= 2;
-    for( i = 0, p = buf; i < numSamples; i++, p += 2 ) {
-		p[ 0 ] = *xi;
-		p[ 1 ] = *xq;
-		xi += 4;
-		xq += 4;
-    }
-#endif
+static void s16_to_s32_scalar( int *out, const short *in, unsigned n ) {
 
-    if(AGCEnable) {		// send samples to our own AGC function if enabled
-		agc( buf, params, numSamples );
-    }
+	unsigned i;
 
+	for( i = 0; i < n; i++ )
+		out[ i ] = (int)in[ i ] << 16;
+}
 
-    if( pcm ) {		// Send samples to audio (ALSA) device
-		if( ( ret = snd_pcm_writei( pcm, buf, numSamples ) ) < 0 ) {
-		    if( ret == -EAGAIN )
-			return;
+static void s16_to_f32_scalar( float *out, const short *in, unsigned n ) {
 
-		    if( ret != -EPIPE )
-			fprintf( stderr, "snd_pcm_writei: %s\n", snd_strerror( ret ) );
-	
-	    	if( ( ret = snd_pcm_prepare( pcm ) < 0 ) )
-			fprintf( stderr, "snd_pcm_prepare: %s\n", snd_strerror( ret ) );
+	unsigned i;
 
-		    // prime the pump
-	    	for( i = 0; i < 4; i++ )
-			if( ( ret = snd_pcm_writei( pcm, buf, numSamples ) ) < 0 )
-			    fprintf( stderr, " snd_pcm_writei: %s\n",
-				     snd_strerror( ret ) );
-		}
-    } 
-	else {		// Send samples to STDOUT
-		write_return_value = write( 1, buf, numSamples << 2 );
-		if (!write_return_value) {
-		    fprintf( stderr, "write returned 0\n");
-		}
-    }
-	//
+	for( i = 0; i < n; i++ )
+		out[ i ] = in[ i ] * ( 1.0f / 32768 );
+}
 
-	if (gain_changed) {		// are we to change gain?
-		if(!gchange_lockout)	{	// bail out if gain change is in process - we can wait until later
-	    	gain_changed = 0;		// indicate that we (will) have changed gain
-			gchange_lockout=1;		// set lockout to prevent another gain change until we know API is ready
-		    update_sdrplay_gain_reduction();	// update SDRPlay device
-		}
+static void peak_count_scalar( const short *in, unsigned n, int threshold, unsigned *peak, unsigned *count ) {
+
+	unsigned i, a, m = 0, c = 0;
+
+	for( i = 0; i < n; i++ ) {
+		a = abs( in[ i ] );
+		if( a > m )
+			m = a;
+		c += a > threshold;
 	}
+	*peak = m;
+	*count = c;
+}
 
+static void fir_sym_scalar( short *out, const short *x, const short *g, unsigned npairs, unsigned span, const short *c, short center, unsigned n ) {
+
+	unsigned m, j;
+	int acc;
+
+	for( m = 0; m < n; m++ ) {
+		acc = center * c[ m ];
+		for( j = 0; j < npairs; j++ )
+			acc += g[ j ] * ( x[ m + j ] + x[ m + span - 1 - j ] );
+		acc = ( acc + ( 1 << 14 ) ) >> 15;
+		out[ m ] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+	}
 }
 
-void event() {
+static void deinterleave_s16_scalar( short *e, short *o, const short *in, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i < n; i++, in += 2 ) {
+		e[ i ] = in[ 0 ];
+		o[ i ] = in[ 1 ];
+	}
 }
 
-static void usage( char *argv0 ) {
+static inline short q15_sat( int acc ) {
 
-    fprintf( stderr, "usage: %s [options...]\n"
-	     "options:\n"
-	     "    -a inc   AGC \"increase\" threshold, default 16384\n"
-	     "    -B bwType baseband low-pass filter bandwidth (200, 300, 600, 1536, 5000 kHz)\n"
-	     "    -b dec   AGC \"decrease\" threshold, default 8192\n"
-	     "    -c min   AGC sample period (ms), default 500, minimum 50\n"
-	     "    -d       list available input/output devices\n"
-	     "    -e gainfile  write gain_reduction value to file\n"
-	     "    -f freq  set tuner frequency (in Hz)\n"
-	     "    -g gain  set min gain reduction during AGC operation or fixed gain w/AGC disabled, default 30\n"
-	     "    -G gain  set max gain reduction during AGC operation, default 59\n"
-	     "    -h       show usage\n"
-	     "    -i ser   specify input SDRPlay device by serial number (full or partial)\n"
-	     "    -l val   set LNA state, default 3.  See SDRPlay API gain reduction tables for more info\n"
-         "    -L latency in microseconds - Used only with '-o' parameter - must be >=30000, default 50000\n"
-	     "    -n       AGC enable, uses parameters a,b,c,g,s,S,x,y,z\n"
-	     "    -o dev   specify output device (Use with '-L' parameter) \n"
-	     "    -r rate  set sampling rate (in Hz) [Must be 96000, 192000, 384000 or 768000 unless '-R' is specified]\n"
-         "    -R rexp  If specified, use with '-r' to set decimation and sample rate:  Choose 'rexp' so that 'rate * 2^rexp' is >=2.048 and <8.064 Msamples/sec:  Decimation is 2^rexp (Must be 0-5)\n"
-	     "    -S step_inc  set gain AGC attenuation increase (gain reduction) step size in dB, default = 1 (1-10)\n"
-	     "    -s step_dec  set gain AGC attenuation decrease (gain increase) step size in dB, default = 1 (1-10)\n"
-//	     "    -t taps  set number of antialias FIR taps, default = 9\n"
-	     "    -v       enable verbose output\n"
-	     "    -W       enable wideband signal mode (e.g. half-band filtering). Warning: High CPU useage! (May not work)\n"
-	     "    -w debugPeriodMs    warning/debug output period (ms)\n"
-		 "    -X       Set to USB Xfer mode to BULK rather than Isochronous \n"
-	     "    -x A     num of A/D samples above threshold (-a parameter) before detection, default 4096\n"
-	     "    -y B     gain decrease event time (ms), default 1000, minimum 50\n"
-	     "    -z C     gain increase event time (ms), default 5000, minimum 50\n\n", argv0 );
+	acc = ( acc + ( 1 << 14 ) ) >> 15;
+	return acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
 }
 
-static void setopt( int *p, char *optarg, char *argv0 ) {
+static void resample_scalar( short *out, const short *x, const short *c, unsigned taps, unsigned L, unsigned M, unsigned *pos, unsigned *phase, unsigned n ) {
 
-    char *endp;
+	unsigned i, t, p = *pos, ph = *phase;
+	const short *h;
+	int acc;
 
-    *p = strtol( optarg, &endp, 0 );
+	for( i = 0; i < n; i++ ) {
+		h = c + ph * taps;
+		for( t = 0, acc = 0; t < taps; t++ )
+			acc += h[ t ] * x[ p + t ];
+		out[ i ] = q15_sat( acc );
+		ph += M;
+		p += ph / L;
+		ph %= L;
+	}
+	*pos = p;
+	*phase = ph;
+}
 
-    if( p < 0 || !*optarg || *endp ) {
-	usage( argv0 );
-	exit( 1 );
-    }
+static inline short f32_sat( float v ) {
+
+	return v >= 32767.0f ? 32767 : v <= -32768.0f ? -32768 : (short)lrintf( v );
 }
 
-void term(int signum)	{		// termination signal handler
-int ret;
-int err = 0;
+static void scale_s16_scalar( short *buf, unsigned n, int g, int dg ) {
 
-	ret = sdrplay_api_Uninit((devices+devind)->dev);
+	unsigned i;
+	float f;
 
-	if(ret != sdrplay_api_Success)	{
-		fprintf(stderr, "SDRPlay uninit failed");
-		err = 1;
+	for( i = 0; i < n; i++, buf += 2, g += dg ) {
+		f = (float)g * ( 1.0f / 65536 );
+		buf[ 0 ] = f32_sat( buf[ 0 ] * f );
+		buf[ 1 ] = f32_sat( buf[ 1 ] * f );
 	}
-	else
-		fprintf(stderr, "SDRPlay uninit successful");
+}
 
-	fprintf(stderr, " for device %s\n", devices[devind].SerNo);
+static inline short q14_sat( int acc ) {
 
-	ret = sdrplay_api_ReleaseDevice( devices + devind );
+	acc >>= 14;
+	return acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+}
 
-	if(ret != sdrplay_api_Success)	{
-		fprintf(stderr, "SDRPlay Device release failed");
-		err = 1;
+// bfp:  the bits to drop from samples peaking at m (at most 32767) to leave 8 signed ones
+static inline int bfp_exponent( int m ) {
+
+	return m > 127 ? 25 - __builtin_clz( m ) : 0;
+}
+
+static void iq_correct_scalar( short *out, const short *xi, const short *xq, unsigned n, const int *c ) {
+
+	unsigned i;
+
+	for( i = 0; i < n; i++, out += 2 ) {
+		out[ 0 ] = q14_sat( ( xi[ i ] + c[ 2 ] ) * 16384 );
+		out[ 1 ] = q14_sat( c[ 0 ] * xi[ i ] + c[ 1 ] * xq[ i ] + c[ 3 ] );
 	}
-	else
-		fprintf(stderr, "SDRPlay Device release successful");
+}
 
-	fprintf(stderr, " for device %s\n", devices[devind].SerNo);
+static void iq_stats_scalar( const short *xi, const short *xq, unsigned n, double *s ) {
 
-	ret = sdrplay_api_UnlockDeviceApi();
+	unsigned i;
+	int64_t si = 0, sq = 0, sii = 0, sqq = 0, siq = 0;
 
-	if(ret != sdrplay_api_Success)	{
-		fprintf(stderr, "SDRPlay Device unlock failed");
-		err = 1;
+	for( i = 0; i < n; i++ ) {
+		si += xi[ i ];
+		sq += xq[ i ];
+		sii += xi[ i ] * xi[ i ];
+		sqq += xq[ i ] * xq[ i ];
+		siq += xi[ i ] * xq[ i ];
 	}
-	else
-		fprintf(stderr, "SDRPlay Device unlock successful");
+	s[ 0 ] += si;
+	s[ 1 ] += sq;
+	s[ 2 ] += sii;
+	s[ 3 ] += sqq;
+	s[ 4 ] += siq;
+}
 
-	fprintf(stderr, " for device %s\n", devices[devind].SerNo);
+static const struct kernels kernels_scalar = {
+	"scalar", interleave_s16_scalar, interleave_s32_scalar, interleave_f32_scalar, s16_to_s32_scalar, s16_to_f32_scalar,
+	peak_count_scalar, fir_sym_scalar, deinterleave_s16_scalar, resample_scalar, scale_s16_scalar, pfb_fold, fft_butterfly,
+	iq_correct_scalar, iq_stats_scalar, iqpack_p12, iqpack_s8, iqpack_bfp
+};
 
-	ret = sdrplay_api_Close();	// close sdrplay API as gracefully as possible
+#if defined( __x86_64__ ) || defined( __i386__ )
 
-	if(ret != sdrplay_api_Success)	{
-		fprintf(stderr, "SDRPlay Device close failed");
-		err = 1;
+__attribute__(( target( "sse2" ) ))
+static void interleave_s16_sse2( short *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	__m128i a, b;
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		_mm_storeu_si128( (__m128i *)out, _mm_unpacklo_epi16( a, b ) );
+		_mm_storeu_si128( (__m128i *)( out + 8 ), _mm_unpackhi_epi16( a, b ) );
 	}
-	else
-		fprintf(stderr, "SDRPlay Device close successful for");
+	interleave_s16_scalar( out, xi + i, xq + i, n - i );
+}
 
-	fprintf(stderr, " for device %s\n", devices[devind].SerNo);
+__attribute__(( target( "sse2" ) ))
+static void interleave_s32_sse2( int *out, const short *xi, const short *xq, unsigned n ) {
 
-	if(!err)	// no error
-		exit (0);
-	else	// error in closing
-		exit(1);
+	unsigned i;
+	__m128i a, b, lo, hi, z = _mm_setzero_si128();
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		lo = _mm_unpacklo_epi16( a, b );
+		hi = _mm_unpackhi_epi16( a, b );
+		_mm_storeu_si128( (__m128i *)out, _mm_unpacklo_epi16( z, lo ) );		// zero low half = << 16
+		_mm_storeu_si128( (__m128i *)( out + 4 ), _mm_unpackhi_epi16( z, lo ) );
+		_mm_storeu_si128( (__m128i *)( out + 8 ), _mm_unpacklo_epi16( z, hi ) );
+		_mm_storeu_si128( (__m128i *)( out + 12 ), _mm_unpackhi_epi16( z, hi ) );
+	}
+	interleave_s32_scalar( out, xi + i, xq + i, n - i );
 }
 
+__attribute__(( target( "sse2" ) ))
+static inline __m128 s16x4_to_f32_sse2( __m128i v, __m128 scale ) {	// v holds shorts in its high halves
 
+	return _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( v, 16 ) ), scale );
+}
 
-// Polling to write gain values when updated, independent of other callback processes
+__attribute__(( target( "sse2" ) ))
+static void interleave_f32_sse2( float *out, const short *xi, const short *xq, unsigned n ) {
 
-void timer_callback(int signum)
-{
-	if(gainfile_flag)	{	// is there new gain file data to write?
-    	if (gainfp) {	// Write new gain value to file
-//			sprintf(s, "%d", gain_reduction-min_gain_reduction);
-//			l=strlen(s);
-			fseek(gainfp, 0, SEEK_SET);
-			fprintf(gainfp, "%d\n", gain_reduction-min_gain_reduction);
-//			fwrite(s,1,l,gainfp);
-			fflush(gainfp);
-	    }
-		gainfile_flag = 0;
+	unsigned i;
+	__m128i a, b, lo, hi;
+	__m128 scale = _mm_set1_ps( 1.0f / 32768 );
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		lo = _mm_unpacklo_epi16( a, b );
+		hi = _mm_unpackhi_epi16( a, b );
+		_mm_storeu_ps( out, s16x4_to_f32_sse2( _mm_unpacklo_epi16( lo, lo ), scale ) );
+		_mm_storeu_ps( out + 4, s16x4_to_f32_sse2( _mm_unpackhi_epi16( lo, lo ), scale ) );
+		_mm_storeu_ps( out + 8, s16x4_to_f32_sse2( _mm_unpacklo_epi16( hi, hi ), scale ) );
+		_mm_storeu_ps( out + 12, s16x4_to_f32_sse2( _mm_unpackhi_epi16( hi, hi ), scale ) );
 	}
+	interleave_f32_scalar( out, xi + i, xq + i, n - i );
 }
 
+__attribute__(( target( "sse2" ) ))
+static void s16_to_s32_sse2( int *out, const short *in, unsigned n ) {
 
+	unsigned i;
+	__m128i v, z = _mm_setzero_si128();
 
-extern int main( int argc, char *argv[] ) {
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = _mm_loadu_si128( (const __m128i *)( in + i ) );
+		_mm_storeu_si128( (__m128i *)( out + i ), _mm_unpacklo_epi16( z, v ) );
+		_mm_storeu_si128( (__m128i *)( out + i + 4 ), _mm_unpackhi_epi16( z, v ) );
+	}
+	s16_to_s32_scalar( out + i, in + i, n - i );
+}
 
-    struct sigaction action;
-    memset(&action, 0, sizeof(action));
-    action.sa_handler = term;
-    sigaction(SIGTERM, &action, NULL);
+__attribute__(( target( "sse2" ) ))
+static void s16_to_f32_sse2( float *out, const short *in, unsigned n ) {
 
-    struct itimerval new_timer;
-    struct itimerval old_timer;
-  
-    new_timer.it_value.tv_sec = 0;
-    new_timer.it_value.tv_usec = 100;
-    new_timer.it_interval.tv_sec = 0;
-    new_timer.it_interval.tv_usec = 100 * 1000; // Gain file update is polled every 100 msec
- 
-    setitimer(ITIMER_REAL, &new_timer, &old_timer);
-    signal(SIGALRM, timer_callback); 
+	unsigned i;
+	__m128i v;
+	__m128 scale = _mm_set1_ps( 1.0f / 32768 );
 
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = _mm_loadu_si128( (const __m128i *)( in + i ) );
+		_mm_storeu_ps( out + i, s16x4_to_f32_sse2( _mm_unpacklo_epi16( v, v ), scale ) );
+		_mm_storeu_ps( out + i + 4, s16x4_to_f32_sse2( _mm_unpackhi_epi16( v, v ), scale ) );
+	}
+	s16_to_f32_scalar( out + i, in + i, n - i );
+}
 
-    int opt;
-    static int devlist, bwbad = 0;
-    static int freq = 0;
-    static int lna = 3;
-    static char *out;
-    static char *gainfile;
-    static int rate = 0;
-    static int taps = 9;
-    int ret;
-    int i;
-    static int decimation = 1;
-    static int rateshift = 2;
-    static int rateval = -1;
-    static int latency_us = 50000;
+// |x| of a short fits an unsigned short (|-32768| = 0x8000).  SSE2 has no unsigned 16 bit compare or max,
+// so the absolute values are biased by 0x8000 and compared signed.
+__attribute__(( target( "sse2" ) ))
+static void peak_count_sse2( const short *in, unsigned n, int threshold, unsigned *peak, unsigned *count ) {
 
-	if(argc <2)	{			// do usage if no arguments
-		usage( argv[ 0 ] );
-		return 1;
+	unsigned i, p, c;
+	__m128i v, s, bias = _mm_set1_epi16( (short)0x8000 ), t = _mm_set1_epi16( (short)( threshold ^ 0x8000 ) );
+	__m128i m = _mm_set1_epi16( (short)0x8000 ), acc = _mm_setzero_si128(), one = _mm_set1_epi16( 1 );
+	short lanes[ 8 ];
+	int sums[ 4 ];
+
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = _mm_loadu_si128( (const __m128i *)( in + i ) );
+		s = _mm_srai_epi16( v, 15 );
+		v = _mm_xor_si128( _mm_sub_epi16( _mm_xor_si128( v, s ), s ), bias );	// |v| biased to signed range
+		m = _mm_max_epi16( m, v );
+		acc = _mm_sub_epi32( acc, _mm_madd_epi16( _mm_cmpgt_epi16( v, t ), one ) );
 	}
-	
+	_mm_storeu_si128( (__m128i *)lanes, m );
+	_mm_storeu_si128( (__m128i *)sums, acc );
+	peak_count_scalar( in + i, n - i, threshold, &p, &c );
+	for( i = 0; i < 8; i++ )
+		if( (unsigned short)( lanes[ i ] ^ 0x8000 ) > p )
+			p = (unsigned short)( lanes[ i ] ^ 0x8000 );
+	*peak = p;
+	*count = c + sums[ 0 ] + sums[ 1 ] + sums[ 2 ] + sums[ 3 ];
+}
 
-    while( ( opt = getopt( argc, argv, "a:b:c:de:f:g:hi:l:no:r:s:t:vw:x:y:z:B:L:WG:S:R:X" ) ) >= 0 )
+// Each tap pair is x[m+j] and x[m+span-1-j] unpacked side by side and multiplied by (g, g) with pmaddwd,
+// so the pair sum is formed in 32 bits and cannot overflow
+__attribute__(( target( "sse2" ) ))
+static void fir_sym_sse2( short *out, const short *x, const short *g, unsigned npairs, unsigned span, const short *c, short center, unsigned n ) {
 
-	switch( opt ) {
-	case 'a':
-	    setopt( &AGC1increaseThreshold, optarg, argv[ 0 ] );
-	    break;
+	unsigned m, j;
+	__m128i a, b, gg, lo, hi, z = _mm_setzero_si128(), cc = _mm_set1_epi32( (unsigned short)center ), rnd = _mm_set1_epi32( 1 << 14 );
 
-	case 'b':
-	    setopt( &AGC2decreaseThreshold, optarg, argv[ 0 ] );
-	    break;
+	for( m = 0; m + 8 <= n; m += 8 ) {
+		a = _mm_loadu_si128( (const __m128i *)( c + m ) );
+		lo = _mm_madd_epi16( _mm_unpacklo_epi16( a, z ), cc );
+		hi = _mm_madd_epi16( _mm_unpackhi_epi16( a, z ), cc );
+		for( j = 0; j < npairs; j++ ) {
+			a = _mm_loadu_si128( (const __m128i *)( x + m + j ) );
+			b = _mm_loadu_si128( (const __m128i *)( x + m + span - 1 - j ) );
+			gg = _mm_set1_epi16( g[ j ] );
+			lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), gg ) );
+			hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), gg ) );
+		}
+		lo = _mm_srai_epi32( _mm_add_epi32( lo, rnd ), 15 );
+		hi = _mm_srai_epi32( _mm_add_epi32( hi, rnd ), 15 );
+		_mm_storeu_si128( (__m128i *)( out + m ), _mm_packs_epi32( lo, hi ) );
+	}
+	fir_sym_scalar( out + m, x + m, g, npairs, span, c + m, center, n - m );
+}
 
-    case 'B':
-	    setopt (&bwtype, optarg, argv[ 0 ] );
-	    if((bwtype != 200) && (bwtype != 300) && (bwtype != 600) && (bwtype != 1536) && (bwtype != 5000)) bwbad = 1;
-	    break;
+// Even members are sign-extended in place, odd ones shifted down, then both packed back to shorts
+__attribute__(( target( "sse2" ) ))
+static void deinterleave_s16_sse2( short *e, short *o, const short *in, unsigned n ) {
 
-	case 'c':
-	    setopt( &AGC3minTimeMs, optarg, argv[ 0 ] );
+	unsigned i;
+	__m128i a, b;
+
+	for( i = 0; i + 8 <= n; i += 8, in += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)in );
+		b = _mm_loadu_si128( (const __m128i *)( in + 8 ) );
+		_mm_storeu_si128( (__m128i *)( e + i ), _mm_packs_epi32( _mm_srai_epi32( _mm_slli_epi32( a, 16 ), 16 ), _mm_srai_epi32( _mm_slli_epi32( b, 16 ), 16 ) ) );
+		_mm_storeu_si128( (__m128i *)( o + i ), _mm_packs_epi32( _mm_srai_epi32( a, 16 ), _mm_srai_epi32( b, 16 ) ) );
+	}
+	deinterleave_s16_scalar( e + i, o + i, in, n - i );
+}
+
+__attribute__(( target( "sse2" ) ))
+static void resample_sse2( short *out, const short *x, const short *c, unsigned taps, unsigned L, unsigned M, unsigned *pos, unsigned *phase, unsigned n ) {
+
+	unsigned i, t, p = *pos, ph = *phase;
+	const short *h;
+	__m128i acc;
+
+	for( i = 0; i < n; i++ ) {
+		h = c + ph * taps;
+		acc = _mm_setzero_si128();
+		for( t = 0; t < taps; t += 8 )
+			acc = _mm_add_epi32( acc, _mm_madd_epi16( _mm_loadu_si128( (const __m128i *)( h + t ) ), _mm_loadu_si128( (const __m128i *)( x + p + t ) ) ) );
+		acc = _mm_add_epi32( acc, _mm_shuffle_epi32( acc, 0x4e ) );
+		acc = _mm_add_epi32( acc, _mm_shuffle_epi32( acc, 0xb1 ) );
+		out[ i ] = q15_sat( _mm_cvtsi128_si32( acc ) );
+		ph += M;
+		p += ph / L;
+		ph %= L;
+	}
+	*pos = p;
+	*phase = ph;
+}
+
+__attribute__(( target( "sse2" ) ))
+static void scale_s16_sse2( short *buf, unsigned n, int g, int dg ) {
+
+	unsigned i;
+	__m128i v, lo, hi, ga = _mm_setr_epi32( g, g, g + dg, g + dg ), gb, step = _mm_set1_epi32( 2 * dg );	// gains of pairs 0-1, 2-3
+	__m128 q = _mm_set1_ps( 1.0f / 65536 );
+
+	for( i = 0; i + 4 <= n; i += 4 ) {
+		v = _mm_loadu_si128( (const __m128i *)( buf + 2 * i ) );
+		gb = _mm_add_epi32( ga, step );
+		lo = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( v, v ), 16 ) ), _mm_mul_ps( _mm_cvtepi32_ps( ga ), q ) ) );
+		hi = _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( v, v ), 16 ) ), _mm_mul_ps( _mm_cvtepi32_ps( gb ), q ) ) );
+		_mm_storeu_si128( (__m128i *)( buf + 2 * i ), _mm_packs_epi32( lo, hi ) );
+		ga = _mm_add_epi32( gb, step );
+	}
+	scale_s16_scalar( buf + 2 * i, n - i, g + (int)i * dg, dg );
+}
+
+__attribute__(( target( "sse2" ) ))
+static void pfb_fold_sse2( float *w, const float *g, const float *x, unsigned m, unsigned t ) {
+
+	unsigned j, s;
+	__m128 acc;
+	float a;
+
+	for( j = 0; j + 4 <= m; j += 4 ) {
+		for( s = 0, acc = _mm_setzero_ps(); s < t; s++ )
+			acc = _mm_add_ps( acc, _mm_mul_ps( _mm_loadu_ps( g + s * m + j ), _mm_loadu_ps( x + s * m + j ) ) );
+		_mm_storeu_ps( w + j, acc );
+	}
+	for( ; j < m; j++ ) {
+		for( s = 0, a = 0; s < t; s++ )
+			a += g[ s * m + j ] * x[ s * m + j ];
+		w[ j ] = a;
+	}
+}
+
+__attribute__(( target( "sse2" ) ))
+static void fft_butterfly_sse2( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n ) {
+
+	unsigned j;
+	__m128 xr, xi, yr, yi, tr, ti;
+
+	for( j = 0; j + 4 <= n; j += 4 ) {
+		xr = _mm_loadu_ps( br + j );
+		xi = _mm_loadu_ps( bi + j );
+		yr = _mm_loadu_ps( wr + j );
+		yi = _mm_loadu_ps( wi + j );
+		tr = _mm_sub_ps( _mm_mul_ps( xr, yr ), _mm_mul_ps( xi, yi ) );
+		ti = _mm_add_ps( _mm_mul_ps( xr, yi ), _mm_mul_ps( xi, yr ) );
+		xr = _mm_loadu_ps( ar + j );
+		xi = _mm_loadu_ps( ai + j );
+		_mm_storeu_ps( br + j, _mm_sub_ps( xr, tr ) );
+		_mm_storeu_ps( bi + j, _mm_sub_ps( xi, ti ) );
+		_mm_storeu_ps( ar + j, _mm_add_ps( xr, tr ) );
+		_mm_storeu_ps( ai + j, _mm_add_ps( xi, ti ) );
+	}
+	fft_butterfly( ar + j, ai + j, br + j, bi + j, wr + j, wi + j, n - j );
+}
+
+__attribute__(( target( "sse2" ) ))
+static void iq_correct_sse2( short *out, const short *xi, const short *xq, unsigned n, const int *c ) {
+
+	unsigned i;
+	__m128i a, b, q, k = _mm_set1_epi32( (int)( (unsigned)c[ 1 ] << 16 | ( c[ 0 ] & 0xffff ) ) );	// c[0] for I, c[1] for Q
+	__m128i oi = _mm_set1_epi16( c[ 2 ] ), dq = _mm_set1_epi32( c[ 3 ] );
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		q = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), k ), dq ), 14 ),
+			_mm_srai_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), k ), dq ), 14 ) );
+		a = _mm_adds_epi16( a, oi );
+		_mm_storeu_si128( (__m128i *)out, _mm_unpacklo_epi16( a, q ) );
+		_mm_storeu_si128( (__m128i *)( out + 8 ), _mm_unpackhi_epi16( a, q ) );
+	}
+	iq_correct_scalar( out, xi + i, xq + i, n - i, c );
+}
+
+// Float sums over at most 1024 pairs at a time, so that sum(I) and sum(Q) (at most 256 samples a lane) stay exact
+__attribute__(( target( "sse2" ) ))
+static void iq_stats_sse2( const short *xi, const short *xq, unsigned n, double *s ) {
+
+	unsigned i, j;
+	__m128i a, b;
+	__m128 il, ih, ql, qh, si, sq, sii, sqq, siq;
+	float f[ 5 ][ 4 ];
+
+	for( i = 0; i + 8 <= n; ) {
+		si = sq = sii = sqq = siq = _mm_setzero_ps();
+		for( j = 0; j < 128 && i + 8 <= n; j++, i += 8 ) {
+			a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+			b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+			il = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( a, a ), 16 ) );
+			ih = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( a, a ), 16 ) );
+			ql = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpacklo_epi16( b, b ), 16 ) );
+			qh = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_unpackhi_epi16( b, b ), 16 ) );
+			si = _mm_add_ps( si, _mm_add_ps( il, ih ) );
+			sq = _mm_add_ps( sq, _mm_add_ps( ql, qh ) );
+			sii = _mm_add_ps( sii, _mm_add_ps( _mm_mul_ps( il, il ), _mm_mul_ps( ih, ih ) ) );
+			sqq = _mm_add_ps( sqq, _mm_add_ps( _mm_mul_ps( ql, ql ), _mm_mul_ps( qh, qh ) ) );
+			siq = _mm_add_ps( siq, _mm_add_ps( _mm_mul_ps( il, ql ), _mm_mul_ps( ih, qh ) ) );
+		}
+		_mm_storeu_ps( f[ 0 ], si );
+		_mm_storeu_ps( f[ 1 ], sq );
+		_mm_storeu_ps( f[ 2 ], sii );
+		_mm_storeu_ps( f[ 3 ], sqq );
+		_mm_storeu_ps( f[ 4 ], siq );
+		for( j = 0; j < 5; j++ )
+			s[ j ] += (double)f[ j ][ 0 ] + f[ j ][ 1 ] + f[ j ][ 2 ] + f[ j ][ 3 ];
+	}
+	iq_stats_scalar( xi + i, xq + i, n - i, s );
+}
+
+// Each 32-bit pair of 12-bit samples to 24 bits and two of those to 48 in each 64-bit lane, stored 8 bytes at a time
+// 6 bytes apart:  the last store's two extra bytes are overwritten by what follows
+__attribute__(( target( "sse2" ) ))
+static void pack_p12_sse2( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	__m128i v, r = _mm_set1_epi16( 8 ), lo = _mm_set1_epi32( 0xfff ), hi = _mm_set1_epi32( 0xfff000 );
+	__m128i lo64 = _mm_set1_epi64x( 0xffffff ), hi64 = _mm_set1_epi64x( 0xffffff000000LL );
+
+	for( i = 0; i + 8 < n; i += 8, out += 12 ) {
+		v = _mm_srai_epi16( _mm_adds_epi16( _mm_loadu_si128( (const __m128i *)( in + i ) ), r ), 4 );
+		v = _mm_or_si128( _mm_and_si128( v, lo ), _mm_and_si128( _mm_srli_epi32( v, 4 ), hi ) );
+		v = _mm_or_si128( _mm_and_si128( v, lo64 ), _mm_and_si128( _mm_srli_epi64( v, 8 ), hi64 ) );
+		_mm_storel_epi64( (__m128i *)out, v );
+		_mm_storel_epi64( (__m128i *)( out + 6 ), _mm_unpackhi_epi64( v, v ) );
+	}
+	iqpack_p12( out, in + i, n - i );
+}
+
+__attribute__(( target( "sse2" ) ))
+static inline __m128i pack_s8_half_sse2( __m128i v, __m128 g ) {	// four samples, in the top halves of v's lanes
+
+	return _mm_cvtps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srai_epi32( v, 16 ) ), g ) );
+}
+
+__attribute__(( target( "sse2" ) ))
+static void pack_s8_sse2( int8_t *out, const short *in, size_t n, float gain ) {
+
+	size_t i;
+	__m128i a, b;
+	__m128 g = _mm_set1_ps( gain );
+
+	for( i = 0; i + 16 <= n; i += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( in + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( in + i + 8 ) );
+		a = _mm_packs_epi32( pack_s8_half_sse2( _mm_unpacklo_epi16( a, a ), g ), pack_s8_half_sse2( _mm_unpackhi_epi16( a, a ), g ) );
+		b = _mm_packs_epi32( pack_s8_half_sse2( _mm_unpacklo_epi16( b, b ), g ), pack_s8_half_sse2( _mm_unpackhi_epi16( b, b ), g ) );
+		_mm_storeu_si128( (__m128i *)( out + i ), _mm_packs_epi16( a, b ) );
+	}
+	iqpack_s8( out + i, in + i, n - i, gain );
+}
+
+// |v| saturates -32768 to 32767, as iqpack_bfp() does;  the group's peak is the largest lane of all four
+__attribute__(( target( "sse2" ) ))
+static void pack_bfp_sse2( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	__m128i v0, v1, v2, v3, m, r, c, z = _mm_setzero_si128();
+	int e;
+
+	for( i = 0; i + IQPACK_BFP_GROUP <= n; i += IQPACK_BFP_GROUP, out += IQPACK_BFP_GROUP + 1 ) {
+		v0 = _mm_loadu_si128( (const __m128i *)( in + i ) );
+		v1 = _mm_loadu_si128( (const __m128i *)( in + i + 8 ) );
+		v2 = _mm_loadu_si128( (const __m128i *)( in + i + 16 ) );
+		v3 = _mm_loadu_si128( (const __m128i *)( in + i + 24 ) );
+		m = _mm_max_epi16( _mm_max_epi16( _mm_max_epi16( v0, _mm_subs_epi16( z, v0 ) ), _mm_max_epi16( v1, _mm_subs_epi16( z, v1 ) ) ),
+			_mm_max_epi16( _mm_max_epi16( v2, _mm_subs_epi16( z, v2 ) ), _mm_max_epi16( v3, _mm_subs_epi16( z, v3 ) ) ) );
+		m = _mm_max_epi16( m, _mm_shuffle_epi32( m, 0x4e ) );
+		m = _mm_max_epi16( m, _mm_shuffle_epi32( m, 0xb1 ) );
+		m = _mm_max_epi16( m, _mm_shufflelo_epi16( m, 0xb1 ) );
+		out[ 0 ] = e = bfp_exponent( _mm_cvtsi128_si32( m ) & 0xffff );
+		r = _mm_set1_epi16( e ? 1 << ( e - 1 ) : 0 );
+		c = _mm_cvtsi32_si128( e );
+		_mm_storeu_si128( (__m128i *)( out + 1 ), _mm_packs_epi16( _mm_sra_epi16( _mm_adds_epi16( v0, r ), c ), _mm_sra_epi16( _mm_adds_epi16( v1, r ), c ) ) );
+		_mm_storeu_si128( (__m128i *)( out + 17 ), _mm_packs_epi16( _mm_sra_epi16( _mm_adds_epi16( v2, r ), c ), _mm_sra_epi16( _mm_adds_epi16( v3, r ), c ) ) );
+	}
+	iqpack_bfp( out, in + i, n - i );
+}
+
+static const struct kernels kernels_sse2 = {
+	"sse2", interleave_s16_sse2, interleave_s32_sse2, interleave_f32_sse2, s16_to_s32_sse2, s16_to_f32_sse2,
+	peak_count_sse2, fir_sym_sse2, deinterleave_s16_sse2, resample_sse2, scale_s16_sse2, pfb_fold_sse2, fft_butterfly_sse2,
+	iq_correct_sse2, iq_stats_sse2, pack_p12_sse2, pack_s8_sse2, pack_bfp_sse2
+};
+
+// AVX2 unpacks work within each 128 bit lane, so the lanes are put back in order with a permute.  Tails are
+// done in C rather than by the SSE2 kernels, which would pay an AVX/SSE transition penalty on some CPUs.
+__attribute__(( target( "avx2" ) ))
+static void interleave_s16_avx2( short *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	__m256i a, b, lo, hi;
+
+	for( i = 0; i + 16 <= n; i += 16, out += 32 ) {
+		a = _mm256_loadu_si256( (const __m256i *)( xi + i ) );
+		b = _mm256_loadu_si256( (const __m256i *)( xq + i ) );
+		lo = _mm256_unpacklo_epi16( a, b );
+		hi = _mm256_unpackhi_epi16( a, b );
+		_mm256_storeu_si256( (__m256i *)out, _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+		_mm256_storeu_si256( (__m256i *)( out + 16 ), _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+	}
+	interleave_s16_scalar( out, xi + i, xq + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void interleave_s32_avx2( int *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	__m128i a, b;
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		_mm256_storeu_si256( (__m256i *)out, _mm256_slli_epi32( _mm256_cvtepi16_epi32( _mm_unpacklo_epi16( a, b ) ), 16 ) );
+		_mm256_storeu_si256( (__m256i *)( out + 8 ), _mm256_slli_epi32( _mm256_cvtepi16_epi32( _mm_unpackhi_epi16( a, b ) ), 16 ) );
+	}
+	interleave_s32_scalar( out, xi + i, xq + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void interleave_f32_avx2( float *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	__m128i a, b;
+	__m256 scale = _mm256_set1_ps( 1.0f / 32768 );
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = _mm_loadu_si128( (const __m128i *)( xi + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( xq + i ) );
+		_mm256_storeu_ps( out, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm_unpacklo_epi16( a, b ) ) ), scale ) );
+		_mm256_storeu_ps( out + 8, _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm_unpackhi_epi16( a, b ) ) ), scale ) );
+	}
+	interleave_f32_scalar( out, xi + i, xq + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void s16_to_s32_avx2( int *out, const short *in, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i + 8 <= n; i += 8 )
+		_mm256_storeu_si256( (__m256i *)( out + i ),
+			_mm256_slli_epi32( _mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i *)( in + i ) ) ), 16 ) );
+	s16_to_s32_scalar( out + i, in + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void s16_to_f32_avx2( float *out, const short *in, unsigned n ) {
+
+	unsigned i;
+	__m256 scale = _mm256_set1_ps( 1.0f / 32768 );
+
+	for( i = 0; i + 8 <= n; i += 8 )
+		_mm256_storeu_ps( out + i, _mm256_mul_ps( _mm256_cvtepi32_ps(
+			_mm256_cvtepi16_epi32( _mm_loadu_si128( (const __m128i *)( in + i ) ) ) ), scale ) );
+	s16_to_f32_scalar( out + i, in + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void peak_count_avx2( const short *in, unsigned n, int threshold, unsigned *peak, unsigned *count ) {
+
+	unsigned i, p, c;
+	__m256i v, t = _mm256_set1_epi16( (short)threshold ), m = _mm256_setzero_si256(), acc = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi16( 1 );
+	unsigned short lanes[ 16 ];
+	int sums[ 8 ];
+
+	for( i = 0; i + 16 <= n; i += 16 ) {
+		v = _mm256_abs_epi16( _mm256_loadu_si256( (const __m256i *)( in + i ) ) );	// read as unsigned from here on
+		m = _mm256_max_epu16( m, v );
+		// v > t  <=>  max( v, t + 1 ) == v, unsigned
+		acc = _mm256_sub_epi32( acc, _mm256_madd_epi16( _mm256_cmpeq_epi16( _mm256_max_epu16( v, _mm256_add_epi16( t, one ) ), v ), one ) );
+	}
+	_mm256_storeu_si256( (__m256i *)lanes, m );
+	_mm256_storeu_si256( (__m256i *)sums, acc );
+	peak_count_scalar( in + i, n - i, threshold, &p, &c );
+	for( i = 0; i < 16; i++ )
+		if( lanes[ i ] > p )
+			p = lanes[ i ];
+	*peak = p;
+	*count = c + sums[ 0 ] + sums[ 1 ] + sums[ 2 ] + sums[ 3 ] + sums[ 4 ] + sums[ 5 ] + sums[ 6 ] + sums[ 7 ];
+}
+
+// As fir_sym_sse2();  the in-lane unpacks and the in-lane pack cancel out so no permute is needed
+__attribute__(( target( "avx2" ) ))
+static void fir_sym_avx2( short *out, const short *x, const short *g, unsigned npairs, unsigned span, const short *c, short center, unsigned n ) {
+
+	unsigned m, j;
+	__m256i a, b, gg, lo, hi, z = _mm256_setzero_si256(), cc = _mm256_set1_epi32( (unsigned short)center ), rnd = _mm256_set1_epi32( 1 << 14 );
+
+	for( m = 0; m + 16 <= n; m += 16 ) {
+		a = _mm256_loadu_si256( (const __m256i *)( c + m ) );
+		lo = _mm256_madd_epi16( _mm256_unpacklo_epi16( a, z ), cc );
+		hi = _mm256_madd_epi16( _mm256_unpackhi_epi16( a, z ), cc );
+		for( j = 0; j < npairs; j++ ) {
+			a = _mm256_loadu_si256( (const __m256i *)( x + m + j ) );
+			b = _mm256_loadu_si256( (const __m256i *)( x + m + span - 1 - j ) );
+			gg = _mm256_set1_epi16( g[ j ] );
+			lo = _mm256_add_epi32( lo, _mm256_madd_epi16( _mm256_unpacklo_epi16( a, b ), gg ) );
+			hi = _mm256_add_epi32( hi, _mm256_madd_epi16( _mm256_unpackhi_epi16( a, b ), gg ) );
+		}
+		lo = _mm256_srai_epi32( _mm256_add_epi32( lo, rnd ), 15 );
+		hi = _mm256_srai_epi32( _mm256_add_epi32( hi, rnd ), 15 );
+		_mm256_storeu_si256( (__m256i *)( out + m ), _mm256_packs_epi32( lo, hi ) );
+	}
+	fir_sym_scalar( out + m, x + m, g, npairs, span, c + m, center, n - m );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void deinterleave_s16_avx2( short *e, short *o, const short *in, unsigned n ) {
+
+	unsigned i;
+	__m256i a, b;
+
+	for( i = 0; i + 16 <= n; i += 16, in += 32 ) {
+		a = _mm256_loadu_si256( (const __m256i *)in );
+		b = _mm256_loadu_si256( (const __m256i *)( in + 16 ) );
+		_mm256_storeu_si256( (__m256i *)( e + i ), _mm256_permute4x64_epi64( _mm256_packs_epi32(
+			_mm256_srai_epi32( _mm256_slli_epi32( a, 16 ), 16 ), _mm256_srai_epi32( _mm256_slli_epi32( b, 16 ), 16 ) ), 0xd8 ) );
+		_mm256_storeu_si256( (__m256i *)( o + i ), _mm256_permute4x64_epi64( _mm256_packs_epi32(
+			_mm256_srai_epi32( a, 16 ), _mm256_srai_epi32( b, 16 ) ), 0xd8 ) );
+	}
+	deinterleave_s16_scalar( e + i, o + i, in, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void resample_avx2( short *out, const short *x, const short *c, unsigned taps, unsigned L, unsigned M, unsigned *pos, unsigned *phase, unsigned n ) {
+
+	unsigned i, t, p = *pos, ph = *phase;
+	const short *h;
+	__m256i acc;
+	__m128i a;
+
+	for( i = 0; i < n; i++ ) {
+		h = c + ph * taps;
+		acc = _mm256_setzero_si256();
+		for( t = 0; t < taps; t += 16 )
+			acc = _mm256_add_epi32( acc, _mm256_madd_epi16( _mm256_loadu_si256( (const __m256i *)( h + t ) ), _mm256_loadu_si256( (const __m256i *)( x + p + t ) ) ) );
+		a = _mm_add_epi32( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+		a = _mm_add_epi32( a, _mm_shuffle_epi32( a, 0x4e ) );
+		a = _mm_add_epi32( a, _mm_shuffle_epi32( a, 0xb1 ) );
+		out[ i ] = q15_sat( _mm_cvtsi128_si32( a ) );
+		ph += M;
+		p += ph / L;
+		ph %= L;
+	}
+	*pos = p;
+	*phase = ph;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void scale_s16_avx2( short *buf, unsigned n, int g, int dg ) {
+
+	unsigned i;
+	__m256i v, lo, hi, gb, step = _mm256_set1_epi32( 4 * dg );
+	__m256i ga = _mm256_add_epi32( _mm256_set1_epi32( g ), _mm256_mullo_epi32( _mm256_set1_epi32( dg ), _mm256_setr_epi32( 0, 0, 1, 1, 2, 2, 3, 3 ) ) );
+	__m256 q = _mm256_set1_ps( 1.0f / 65536 );
+
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = _mm256_loadu_si256( (const __m256i *)( buf + 2 * i ) );
+		gb = _mm256_add_epi32( ga, step );
+		lo = _mm256_cvtps_epi32( _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_castsi256_si128( v ) ) ), _mm256_mul_ps( _mm256_cvtepi32_ps( ga ), q ) ) );
+		hi = _mm256_cvtps_epi32( _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_extracti128_si256( v, 1 ) ) ), _mm256_mul_ps( _mm256_cvtepi32_ps( gb ), q ) ) );
+		_mm256_storeu_si256( (__m256i *)( buf + 2 * i ), _mm256_permute4x64_epi64( _mm256_packs_epi32( lo, hi ), 0xd8 ) );	// packs works per 128-bit lane
+		ga = _mm256_add_epi32( gb, step );
+	}
+	scale_s16_scalar( buf + 2 * i, n - i, g + (int)i * dg, dg );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void pfb_fold_avx2( float *w, const float *g, const float *x, unsigned m, unsigned t ) {
+
+	unsigned j, s;
+	__m256 acc;
+	float a;
+
+	for( j = 0; j + 8 <= m; j += 8 ) {
+		for( s = 0, acc = _mm256_setzero_ps(); s < t; s++ )
+			acc = _mm256_add_ps( acc, _mm256_mul_ps( _mm256_loadu_ps( g + s * m + j ), _mm256_loadu_ps( x + s * m + j ) ) );
+		_mm256_storeu_ps( w + j, acc );
+	}
+	for( ; j < m; j++ ) {
+		for( s = 0, a = 0; s < t; s++ )
+			a += g[ s * m + j ] * x[ s * m + j ];
+		w[ j ] = a;
+	}
+}
+
+__attribute__(( target( "avx2" ) ))
+static void fft_butterfly_avx2( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n ) {
+
+	unsigned j;
+	__m256 xr, xi, yr, yi, tr, ti;
+
+	for( j = 0; j + 8 <= n; j += 8 ) {
+		xr = _mm256_loadu_ps( br + j );
+		xi = _mm256_loadu_ps( bi + j );
+		yr = _mm256_loadu_ps( wr + j );
+		yi = _mm256_loadu_ps( wi + j );
+		tr = _mm256_sub_ps( _mm256_mul_ps( xr, yr ), _mm256_mul_ps( xi, yi ) );
+		ti = _mm256_add_ps( _mm256_mul_ps( xr, yi ), _mm256_mul_ps( xi, yr ) );
+		xr = _mm256_loadu_ps( ar + j );
+		xi = _mm256_loadu_ps( ai + j );
+		_mm256_storeu_ps( br + j, _mm256_sub_ps( xr, tr ) );
+		_mm256_storeu_ps( bi + j, _mm256_sub_ps( xi, ti ) );
+		_mm256_storeu_ps( ar + j, _mm256_add_ps( xr, tr ) );
+		_mm256_storeu_ps( ai + j, _mm256_add_ps( xi, ti ) );
+	}
+	fft_butterfly( ar + j, ai + j, br + j, bi + j, wr + j, wi + j, n - j );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void iq_correct_avx2( short *out, const short *xi, const short *xq, unsigned n, const int *c ) {
+
+	unsigned i;
+	__m256i a, b, q, lo, hi, k = _mm256_set1_epi32( (int)( (unsigned)c[ 1 ] << 16 | ( c[ 0 ] & 0xffff ) ) );
+	__m256i oi = _mm256_set1_epi16( c[ 2 ] ), dq = _mm256_set1_epi32( c[ 3 ] );
+
+	for( i = 0; i + 16 <= n; i += 16, out += 32 ) {
+		a = _mm256_loadu_si256( (const __m256i *)( xi + i ) );
+		b = _mm256_loadu_si256( (const __m256i *)( xq + i ) );
+		q = _mm256_packs_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16( a, b ), k ), dq ), 14 ),
+			_mm256_srai_epi32( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16( a, b ), k ), dq ), 14 ) );	// the in-lane unpacks and pack cancel:  Q in order
+		a = _mm256_adds_epi16( a, oi );
+		lo = _mm256_unpacklo_epi16( a, q );
+		hi = _mm256_unpackhi_epi16( a, q );
+		_mm256_storeu_si256( (__m256i *)out, _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+		_mm256_storeu_si256( (__m256i *)( out + 16 ), _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+	}
+	iq_correct_scalar( out, xi + i, xq + i, n - i, c );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void iq_stats_avx2( const short *xi, const short *xq, unsigned n, double *s ) {
+
+	unsigned i, j;
+	__m256i a, b;
+	__m256 il, ih, ql, qh, si, sq, sii, sqq, siq;
+	float f[ 5 ][ 8 ];
+
+	for( i = 0; i + 16 <= n; ) {
+		si = sq = sii = sqq = siq = _mm256_setzero_ps();
+		for( j = 0; j < 64 && i + 16 <= n; j++, i += 16 ) {	// as iq_stats_sse2()
+			a = _mm256_loadu_si256( (const __m256i *)( xi + i ) );
+			b = _mm256_loadu_si256( (const __m256i *)( xq + i ) );
+			il = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_castsi256_si128( a ) ) );
+			ih = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_extracti128_si256( a, 1 ) ) );
+			ql = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_castsi256_si128( b ) ) );
+			qh = _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( _mm256_extracti128_si256( b, 1 ) ) );
+			si = _mm256_add_ps( si, _mm256_add_ps( il, ih ) );
+			sq = _mm256_add_ps( sq, _mm256_add_ps( ql, qh ) );
+			sii = _mm256_add_ps( sii, _mm256_add_ps( _mm256_mul_ps( il, il ), _mm256_mul_ps( ih, ih ) ) );
+			sqq = _mm256_add_ps( sqq, _mm256_add_ps( _mm256_mul_ps( ql, ql ), _mm256_mul_ps( qh, qh ) ) );
+			siq = _mm256_add_ps( siq, _mm256_add_ps( _mm256_mul_ps( il, ql ), _mm256_mul_ps( ih, qh ) ) );
+		}
+		_mm256_storeu_ps( f[ 0 ], si );
+		_mm256_storeu_ps( f[ 1 ], sq );
+		_mm256_storeu_ps( f[ 2 ], sii );
+		_mm256_storeu_ps( f[ 3 ], sqq );
+		_mm256_storeu_ps( f[ 4 ], siq );
+		for( j = 0; j < 5; j++ )
+			s[ j ] += (double)f[ j ][ 0 ] + f[ j ][ 1 ] + f[ j ][ 2 ] + f[ j ][ 3 ] + f[ j ][ 4 ] + f[ j ][ 5 ] + f[ j ][ 6 ] + f[ j ][ 7 ];
+	}
+	iq_stats_scalar( xi + i, xq + i, n - i, s );
+}
+
+// As pack_p12_sse2(), with a byte shuffle taking each lane's four 24-bit words to 12 bytes:  16-byte stores 12
+// bytes apart, the last one four bytes over
+__attribute__(( target( "avx2" ) ))
+static void pack_p12_avx2( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	__m256i v, r = _mm256_set1_epi16( 8 ), lo = _mm256_set1_epi32( 0xfff ), hi = _mm256_set1_epi32( 0xfff000 );
+	__m256i sh = _mm256_setr_epi8( 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1 );
+
+	for( i = 0; i + 20 <= n; i += 16, out += 24 ) {
+		v = _mm256_srai_epi16( _mm256_adds_epi16( _mm256_loadu_si256( (const __m256i *)( in + i ) ), r ), 4 );
+		v = _mm256_or_si256( _mm256_and_si256( v, lo ), _mm256_and_si256( _mm256_srli_epi32( v, 4 ), hi ) );
+		v = _mm256_shuffle_epi8( v, sh );
+		_mm_storeu_si128( (__m128i *)out, _mm256_castsi256_si128( v ) );
+		_mm_storeu_si128( (__m128i *)( out + 12 ), _mm256_extracti128_si256( v, 1 ) );
+	}
+	iqpack_p12( out, in + i, n - i );
+}
+
+__attribute__(( target( "avx2" ) ))
+static inline __m256i pack_s8_quarter_avx2( __m128i v, __m256 g ) {
+
+	return _mm256_cvtps_epi32( _mm256_mul_ps( _mm256_cvtepi32_ps( _mm256_cvtepi16_epi32( v ) ), g ) );
+}
+
+// The in-lane packs leave 4-sample dwords in the order 0 2 4 6 1 3 5 7:  one permute puts them right
+__attribute__(( target( "avx2" ) ))
+static void pack_s8_avx2( int8_t *out, const short *in, size_t n, float gain ) {
+
+	size_t i;
+	__m256i a, b;
+	__m256 g = _mm256_set1_ps( gain );
+
+	for( i = 0; i + 32 <= n; i += 32 ) {
+		a = _mm256_loadu_si256( (const __m256i *)( in + i ) );
+		b = _mm256_loadu_si256( (const __m256i *)( in + i + 16 ) );
+		a = _mm256_packs_epi32( pack_s8_quarter_avx2( _mm256_castsi256_si128( a ), g ), pack_s8_quarter_avx2( _mm256_extracti128_si256( a, 1 ), g ) );
+		b = _mm256_packs_epi32( pack_s8_quarter_avx2( _mm256_castsi256_si128( b ), g ), pack_s8_quarter_avx2( _mm256_extracti128_si256( b, 1 ), g ) );
+		_mm256_storeu_si256( (__m256i *)( out + i ), _mm256_permutevar8x32_epi32( _mm256_packs_epi16( a, b ), _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 ) ) );
+	}
+	iqpack_s8( out + i, in + i, n - i, gain );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void pack_bfp_avx2( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	__m256i v0, v1, r, z = _mm256_setzero_si256();
+	__m128i m, c;
+	int e;
+
+	for( i = 0; i + IQPACK_BFP_GROUP <= n; i += IQPACK_BFP_GROUP, out += IQPACK_BFP_GROUP + 1 ) {
+		v0 = _mm256_loadu_si256( (const __m256i *)( in + i ) );
+		v1 = _mm256_loadu_si256( (const __m256i *)( in + i + 16 ) );
+		r = _mm256_max_epi16( _mm256_max_epi16( v0, _mm256_subs_epi16( z, v0 ) ), _mm256_max_epi16( v1, _mm256_subs_epi16( z, v1 ) ) );
+		m = _mm_max_epi16( _mm256_castsi256_si128( r ), _mm256_extracti128_si256( r, 1 ) );
+		m = _mm_max_epi16( m, _mm_shuffle_epi32( m, 0x4e ) );
+		m = _mm_max_epi16( m, _mm_shuffle_epi32( m, 0xb1 ) );
+		m = _mm_max_epi16( m, _mm_shufflelo_epi16( m, 0xb1 ) );
+		out[ 0 ] = e = bfp_exponent( _mm_cvtsi128_si32( m ) & 0xffff );
+		r = _mm256_set1_epi16( e ? 1 << ( e - 1 ) : 0 );
+		c = _mm_cvtsi32_si128( e );
+		_mm256_storeu_si256( (__m256i *)( out + 1 ), _mm256_permute4x64_epi64( _mm256_packs_epi16( _mm256_sra_epi16( _mm256_adds_epi16( v0, r ), c ),
+			_mm256_sra_epi16( _mm256_adds_epi16( v1, r ), c ) ), 0xd8 ) );
+	}
+	iqpack_bfp( out, in + i, n - i );
+}
+
+static const struct kernels kernels_avx2 = {
+	"avx2", interleave_s16_avx2, interleave_s32_avx2, interleave_f32_avx2, s16_to_s32_avx2, s16_to_f32_avx2,
+	peak_count_avx2, fir_sym_avx2, deinterleave_s16_avx2, resample_avx2, scale_s16_avx2, pfb_fold_avx2, fft_butterfly_avx2,
+	iq_correct_avx2, iq_stats_avx2, pack_p12_avx2, pack_s8_avx2, pack_bfp_avx2
+};
+
+#elif defined( __aarch64__ )
+
+static void interleave_s16_neon( short *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	int16x8x2_t v;
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		v.val[ 0 ] = vld1q_s16( xi + i );
+		v.val[ 1 ] = vld1q_s16( xq + i );
+		vst2q_s16( out, v );
+	}
+	interleave_s16_scalar( out, xi + i, xq + i, n - i );
+}
+
+static void interleave_s32_neon( int *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	int16x4_t a, b;
+	int32x4x2_t v;
+
+	for( i = 0; i + 4 <= n; i += 4, out += 8 ) {
+		a = vld1_s16( xi + i );
+		b = vld1_s16( xq + i );
+		v.val[ 0 ] = vshll_n_s16( a, 16 );
+		v.val[ 1 ] = vshll_n_s16( b, 16 );
+		vst2q_s32( out, v );
+	}
+	interleave_s32_scalar( out, xi + i, xq + i, n - i );
+}
+
+static void interleave_f32_neon( float *out, const short *xi, const short *xq, unsigned n ) {
+
+	unsigned i;
+	float32x4x2_t v;
+
+	for( i = 0; i + 4 <= n; i += 4, out += 8 ) {
+		v.val[ 0 ] = vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vld1_s16( xi + i ) ) ), 1.0f / 32768 );
+		v.val[ 1 ] = vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vld1_s16( xq + i ) ) ), 1.0f / 32768 );
+		vst2q_f32( out, v );
+	}
+	interleave_f32_scalar( out, xi + i, xq + i, n - i );
+}
+
+static void s16_to_s32_neon( int *out, const short *in, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i + 4 <= n; i += 4 )
+		vst1q_s32( out + i, vshll_n_s16( vld1_s16( in + i ), 16 ) );
+	s16_to_s32_scalar( out + i, in + i, n - i );
+}
+
+static void s16_to_f32_neon( float *out, const short *in, unsigned n ) {
+
+	unsigned i;
+
+	for( i = 0; i + 4 <= n; i += 4 )
+		vst1q_f32( out + i, vmulq_n_f32( vcvtq_f32_s32( vmovl_s16( vld1_s16( in + i ) ) ), 1.0f / 32768 ) );
+	s16_to_f32_scalar( out + i, in + i, n - i );
+}
+
+static void peak_count_neon( const short *in, unsigned n, int threshold, unsigned *peak, unsigned *count ) {
+
+	unsigned i, p, c;
+	uint16x8_t v, m = vdupq_n_u16( 0 ), t = vdupq_n_u16( threshold );
+	uint32x4_t acc = vdupq_n_u32( 0 );
+
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = vreinterpretq_u16_s16( vabsq_s16( vld1q_s16( in + i ) ) );	// |-32768| wraps to 0x8000, right as unsigned
+		m = vmaxq_u16( m, v );
+		acc = vpadalq_u16( acc, vshrq_n_u16( vcgtq_u16( v, t ), 15 ) );
+	}
+	peak_count_scalar( in + i, n - i, threshold, &p, &c );
+	if( vmaxvq_u16( m ) > p )
+		p = vmaxvq_u16( m );
+	*peak = p;
+	*count = c + vaddvq_u32( acc );
+}
+
+static void fir_sym_neon( short *out, const short *x, const short *g, unsigned npairs, unsigned span, const short *c, short center, unsigned n ) {
+
+	unsigned m, j;
+	int32x4_t acc;
+
+	for( m = 0; m + 4 <= n; m += 4 ) {
+		acc = vmull_n_s16( vld1_s16( c + m ), center );
+		for( j = 0; j < npairs; j++ )
+			acc = vmlaq_n_s32( acc, vaddl_s16( vld1_s16( x + m + j ), vld1_s16( x + m + span - 1 - j ) ), g[ j ] );
+		vst1_s16( out + m, vqrshrn_n_s32( acc, 15 ) );
+	}
+	fir_sym_scalar( out + m, x + m, g, npairs, span, c + m, center, n - m );
+}
+
+static void deinterleave_s16_neon( short *e, short *o, const short *in, unsigned n ) {
+
+	unsigned i;
+	int16x8x2_t v;
+
+	for( i = 0; i + 8 <= n; i += 8, in += 16 ) {
+		v = vld2q_s16( in );
+		vst1q_s16( e + i, v.val[ 0 ] );
+		vst1q_s16( o + i, v.val[ 1 ] );
+	}
+	deinterleave_s16_scalar( e + i, o + i, in, n - i );
+}
+
+static void resample_neon( short *out, const short *x, const short *c, unsigned taps, unsigned L, unsigned M, unsigned *pos, unsigned *phase, unsigned n ) {
+
+	unsigned i, t, p = *pos, ph = *phase;
+	const short *h;
+	int32x4_t acc;
+
+	for( i = 0; i < n; i++ ) {
+		h = c + ph * taps;
+		acc = vdupq_n_s32( 0 );
+		for( t = 0; t < taps; t += 8 ) {
+			acc = vmlal_s16( acc, vld1_s16( h + t ), vld1_s16( x + p + t ) );
+			acc = vmlal_s16( acc, vld1_s16( h + t + 4 ), vld1_s16( x + p + t + 4 ) );
+		}
+		out[ i ] = q15_sat( vaddvq_s32( acc ) );
+		ph += M;
+		p += ph / L;
+		ph %= L;
+	}
+	*pos = p;
+	*phase = ph;
+}
+
+static void scale_s16_neon( short *buf, unsigned n, int g, int dg ) {
+
+	unsigned i;
+	int16x8_t v;
+	int32x4_t ga = { g, g, g + dg, g + dg }, gb, step = vdupq_n_s32( 2 * dg );	// gains of pairs 0-1, 2-3
+	int32x4_t lo, hi;
+
+	for( i = 0; i + 4 <= n; i += 4 ) {
+		v = vld1q_s16( buf + 2 * i );
+		gb = vaddq_s32( ga, step );
+		lo = vcvtnq_s32_f32( vmulq_f32( vcvtq_f32_s32( vmovl_s16( vget_low_s16( v ) ) ), vmulq_n_f32( vcvtq_f32_s32( ga ), 1.0f / 65536 ) ) );
+		hi = vcvtnq_s32_f32( vmulq_f32( vcvtq_f32_s32( vmovl_s16( vget_high_s16( v ) ) ), vmulq_n_f32( vcvtq_f32_s32( gb ), 1.0f / 65536 ) ) );
+		vst1q_s16( buf + 2 * i, vcombine_s16( vqmovn_s32( lo ), vqmovn_s32( hi ) ) );
+		ga = vaddq_s32( gb, step );
+	}
+	scale_s16_scalar( buf + 2 * i, n - i, g + (int)i * dg, dg );
+}
+
+static void pfb_fold_neon( float *w, const float *g, const float *x, unsigned m, unsigned t ) {
+
+	unsigned j, s;
+	float32x4_t acc;
+	float a;
+
+	for( j = 0; j + 4 <= m; j += 4 ) {
+		for( s = 0, acc = vdupq_n_f32( 0 ); s < t; s++ )
+			acc = vaddq_f32( acc, vmulq_f32( vld1q_f32( g + s * m + j ), vld1q_f32( x + s * m + j ) ) );
+		vst1q_f32( w + j, acc );
+	}
+	for( ; j < m; j++ ) {
+		for( s = 0, a = 0; s < t; s++ )
+			a += g[ s * m + j ] * x[ s * m + j ];
+		w[ j ] = a;
+	}
+}
+
+static void fft_butterfly_neon( float *ar, float *ai, float *br, float *bi, const float *wr, const float *wi, unsigned n ) {
+
+	unsigned j;
+	float32x4_t xr, xi, yr, yi, tr, ti;
+
+	for( j = 0; j + 4 <= n; j += 4 ) {
+		xr = vld1q_f32( br + j );
+		xi = vld1q_f32( bi + j );
+		yr = vld1q_f32( wr + j );
+		yi = vld1q_f32( wi + j );
+		tr = vsubq_f32( vmulq_f32( xr, yr ), vmulq_f32( xi, yi ) );
+		ti = vaddq_f32( vmulq_f32( xr, yi ), vmulq_f32( xi, yr ) );
+		xr = vld1q_f32( ar + j );
+		xi = vld1q_f32( ai + j );
+		vst1q_f32( br + j, vsubq_f32( xr, tr ) );
+		vst1q_f32( bi + j, vsubq_f32( xi, ti ) );
+		vst1q_f32( ar + j, vaddq_f32( xr, tr ) );
+		vst1q_f32( ai + j, vaddq_f32( xi, ti ) );
+	}
+	fft_butterfly( ar + j, ai + j, br + j, bi + j, wr + j, wi + j, n - j );
+}
+
+static void iq_correct_neon( short *out, const short *xi, const short *xq, unsigned n, const int *c ) {
+
+	unsigned i;
+	int16x8_t a, b, oi = vdupq_n_s16( c[ 2 ] );
+	int32x4_t lo, hi, dq = vdupq_n_s32( c[ 3 ] );
+	int16x8x2_t v;
+
+	for( i = 0; i + 8 <= n; i += 8, out += 16 ) {
+		a = vld1q_s16( xi + i );
+		b = vld1q_s16( xq + i );
+		lo = vmlal_n_s16( vmlal_n_s16( dq, vget_low_s16( a ), c[ 0 ] ), vget_low_s16( b ), c[ 1 ] );
+		hi = vmlal_n_s16( vmlal_n_s16( dq, vget_high_s16( a ), c[ 0 ] ), vget_high_s16( b ), c[ 1 ] );
+		v.val[ 0 ] = vqaddq_s16( a, oi );
+		v.val[ 1 ] = vcombine_s16( vqmovn_s32( vshrq_n_s32( lo, 14 ) ), vqmovn_s32( vshrq_n_s32( hi, 14 ) ) );
+		vst2q_s16( out, v );
+	}
+	iq_correct_scalar( out, xi + i, xq + i, n - i, c );
+}
+
+static void iq_stats_neon( const short *xi, const short *xq, unsigned n, double *s ) {
+
+	unsigned i, j;
+	int16x8_t a, b;
+	float32x4_t il, ih, ql, qh, si, sq, sii, sqq, siq;
+
+	for( i = 0; i + 8 <= n; ) {
+		si = sq = sii = sqq = siq = vdupq_n_f32( 0 );
+		for( j = 0; j < 128 && i + 8 <= n; j++, i += 8 ) {	// as iq_stats_sse2()
+			a = vld1q_s16( xi + i );
+			b = vld1q_s16( xq + i );
+			il = vcvtq_f32_s32( vmovl_s16( vget_low_s16( a ) ) );
+			ih = vcvtq_f32_s32( vmovl_s16( vget_high_s16( a ) ) );
+			ql = vcvtq_f32_s32( vmovl_s16( vget_low_s16( b ) ) );
+			qh = vcvtq_f32_s32( vmovl_s16( vget_high_s16( b ) ) );
+			si = vaddq_f32( si, vaddq_f32( il, ih ) );
+			sq = vaddq_f32( sq, vaddq_f32( ql, qh ) );
+			sii = vmlaq_f32( vmlaq_f32( sii, il, il ), ih, ih );
+			sqq = vmlaq_f32( vmlaq_f32( sqq, ql, ql ), qh, qh );
+			siq = vmlaq_f32( vmlaq_f32( siq, il, ql ), ih, qh );
+		}
+		s[ 0 ] += vaddvq_f32( si );
+		s[ 1 ] += vaddvq_f32( sq );
+		s[ 2 ] += vaddvq_f32( sii );
+		s[ 3 ] += vaddvq_f32( sqq );
+		s[ 4 ] += vaddvq_f32( siq );
+	}
+	iq_stats_scalar( xi + i, xq + i, n - i, s );
+}
+
+// Even and odd samples apart, then the three bytes of each pair's 24-bit word stored interleaved by vst3
+static void pack_p12_neon( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	int16x8x2_t v;
+	uint16x8_t a, b;
+	uint8x8x3_t o;
+
+	for( i = 0; i + 16 <= n; i += 16, out += 24 ) {
+		v = vld2q_s16( in + i );
+		a = vreinterpretq_u16_s16( vshrq_n_s16( vqaddq_s16( v.val[ 0 ], vdupq_n_s16( 8 ) ), 4 ) );
+		b = vreinterpretq_u16_s16( vshrq_n_s16( vqaddq_s16( v.val[ 1 ], vdupq_n_s16( 8 ) ), 4 ) );
+		o.val[ 0 ] = vmovn_u16( a );
+		o.val[ 1 ] = vmovn_u16( vorrq_u16( vandq_u16( vshrq_n_u16( a, 8 ), vdupq_n_u16( 0xf ) ), vshlq_n_u16( b, 4 ) ) );
+		o.val[ 2 ] = vmovn_u16( vshrq_n_u16( b, 4 ) );
+		vst3_u8( out, o );
+	}
+	iqpack_p12( out, in + i, n - i );
+}
+
+static void pack_s8_neon( int8_t *out, const short *in, size_t n, float gain ) {
+
+	size_t i;
+	int16x8_t v;
+	float32x4_t g = vdupq_n_f32( gain );
+
+	for( i = 0; i + 8 <= n; i += 8 ) {
+		v = vld1q_s16( in + i );
+		vst1_s8( out + i, vqmovn_s16( vcombine_s16(
+			vqmovn_s32( vcvtnq_s32_f32( vmulq_f32( vcvtq_f32_s32( vmovl_s16( vget_low_s16( v ) ) ), g ) ) ),
+			vqmovn_s32( vcvtnq_s32_f32( vmulq_f32( vcvtq_f32_s32( vmovl_s16( vget_high_s16( v ) ) ), g ) ) ) ) ) );
+	}
+	iqpack_s8( out + i, in + i, n - i, gain );
+}
+
+static void pack_bfp_neon( uint8_t *out, const short *in, size_t n ) {
+
+	size_t i;
+	int16x8_t v[ 4 ], r, c;
+	int k, e;
+
+	for( i = 0; i + IQPACK_BFP_GROUP <= n; i += IQPACK_BFP_GROUP, out += IQPACK_BFP_GROUP + 1 ) {
+		for( k = 0; k < 4; k++ )
+			v[ k ] = vld1q_s16( in + i + 8 * k );
+		out[ 0 ] = e = bfp_exponent( vmaxvq_s16( vmaxq_s16( vmaxq_s16( vqabsq_s16( v[ 0 ] ), vqabsq_s16( v[ 1 ] ) ),
+			vmaxq_s16( vqabsq_s16( v[ 2 ] ), vqabsq_s16( v[ 3 ] ) ) ) ) );
+		r = vdupq_n_s16( e ? 1 << ( e - 1 ) : 0 );
+		c = vdupq_n_s16( -e );
+		for( k = 0; k < 4; k++ )
+			vst1_s8( (int8_t *)out + 1 + 8 * k, vqmovn_s16( vshlq_s16( vqaddq_s16( v[ k ], r ), c ) ) );
+	}
+	iqpack_bfp( out, in + i, n - i );
+}
+
+static const struct kernels kernels_neon = {
+	"neon", interleave_s16_neon, interleave_s32_neon, interleave_f32_neon, s16_to_s32_neon, s16_to_f32_neon,
+	peak_count_neon, fir_sym_neon, deinterleave_s16_neon, resample_neon, scale_s16_neon, pfb_fold_neon, fft_butterfly_neon,
+	iq_correct_neon, iq_stats_neon, pack_p12_neon, pack_s8_neon, pack_bfp_neon
+};
+
+#endif
+
+static const struct kernels *all_kernels[] = {
+	&kernels_scalar,
+#if defined( __x86_64__ ) || defined( __i386__ )
+	&kernels_sse2,
+	&kernels_avx2,
+#elif defined( __aarch64__ )
+	&kernels_neon,
+#endif
+};
+
+static const struct kernels *kern = &kernels_scalar;
+
+static int kernels_supported( const struct kernels *k ) {
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+	__builtin_cpu_init();
+	if( k == &kernels_sse2 )
+		return __builtin_cpu_supports( "sse2" );
+	if( k == &kernels_avx2 )
+		return __builtin_cpu_supports( "avx2" );
+#endif
+	return 1;
+}
+
+static void select_kernels( void ) {	// pick the last (fastest) kernel set this CPU can run
+
+	int i;
+
+	for( i = 0; i < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); i++ )
+		if( kernels_supported( all_kernels[ i ] ) )
+			kern = all_kernels[ i ];
+}
+
+// Write numSamples I/Q pairs from xi/xq to out in the output format
+static void interleave( void *out, const short *xi, const short *xq, unsigned numSamples ) {
+
+	if( rcv->out_format == FMT_S32 )
+		kern->interleave_s32( out, xi, xq, numSamples );
+	else if( rcv->out_format == FMT_F32 )
+		kern->interleave_f32( out, xi, xq, numSamples );
+	else
+		kern->interleave_s16( out, xi, xq, numSamples );
+}
+
+// Convert numSamples interleaved S16 I/Q pairs to the output format.  Returns buf itself for S16.
+static void *convert( void *out, short *buf, unsigned numSamples ) {
+
+	if( rcv->out_format == FMT_S32 )
+		kern->s16_to_s32( out, buf, numSamples * 2 );
+	else if( rcv->out_format == FMT_F32 )
+		kern->s16_to_f32( out, buf, numSamples * 2 );
+	else
+		return buf;
+	return out;
+}
+
+// Software decimation (-t).  The RSP runs without hardware decimation and the ADC stream is reduced by
+// 2^rateshift in a cascade of half-band stages, optionally followed by an FIR at the output rate that
+// trims the band edges.  Everything works on planar I and Q in Q15 fixed point using the fir_sym kernel.
+// Each stage keeps the input history it still needs in front of the new samples.
+
+static double bessel_i0( double x ) {
+
+	double sum = 1, term = 1;
+	int k;
+
+	for( k = 1; k < 50; k++ ) {
+		term *= ( x / ( 2 * k ) ) * ( x / ( 2 * k ) );
+		sum += term;
+	}
+	return sum;
+}
+
+static double kaiser( int n, int len, double beta ) {
+
+	double r = 2.0 * n / ( len - 1 ) - 1;
+
+	return bessel_i0( beta * sqrt( 1 - r * r ) ) / bessel_i0( beta );
+}
+
+// Kaiser windowed half-band of 4k-1 taps, quantised so the even taps sum to 0.5 and all of them to exactly 1
+static void hb_design( struct hb_stage *s, int k ) {
+
+	int j, len = 4 * k - 1, c = 2 * k - 1, n, sum = 0;
+	double h;
+
+	s->k = k;
+	for( j = 0; j < k; j++ ) {
+		n = 2 * j;		// tap index, odd distance from the centre
+		h = sin( M_PI * ( n - c ) / 2 ) / ( M_PI * ( n - c ) ) * kaiser( n, len, 8.0 );
+		s->g[ j ] = lrint( h * 32768 );
+		sum += 2 * s->g[ j ];
+	}
+	s->g[ k - 1 ] += ( 16384 - sum ) / 2;	// taps nearest the centre absorb the rounding, in pairs
+	s->c = 16384 + ( 16384 - sum ) % 2;		// and the centre tap any odd remainder
+}
+
+// Kaiser windowed low-pass of len (odd) taps with its cut-off at 0.45 of the sample rate, unity DC gain
+static void fir_design( int len ) {
+
+	int n, p = len / 2, sum = 0;
+	double h, fc = 0.45;
+
+	rcv->fir_len = len;
+	for( n = 0; n <= p; n++ ) {
+		h = n == p ? 2 * fc : sin( 2 * M_PI * fc * ( n - p ) ) / ( M_PI * ( n - p ) );
+		rcv->fir_taps[ n ] = lrint( h * kaiser( n, len, 7.0 ) * 32768 );
+		sum += n == p ? rcv->fir_taps[ n ] : 2 * rcv->fir_taps[ n ];
+	}
+	rcv->fir_taps[ p ] += 32768 - sum;
+}
+
+static void dec_free( void ) {
+
+	int i, c;
+
+	for( i = 0; i < rcv->dec_stages; i++ )
+		for( c = 0; c < 2; c++ ) {
+			free( rcv->hb[ i ].e[ c ] );
+			free( rcv->hb[ i ].o[ c ] );
+			free( rcv->hb[ i ].out[ c ] );
+			rcv->hb[ i ].e[ c ] = rcv->hb[ i ].o[ c ] = rcv->hb[ i ].out[ c ] = NULL;
+		}
+	for( c = 0; c < 2; c++ ) {
+		free( rcv->fir_x[ c ] );
+		free( rcv->fir_out[ c ] );
+		rcv->fir_x[ c ] = rcv->fir_out[ c ] = NULL;
+	}
+}
+
+// Size every stage for input blocks of up to API_MAXFRAMES ADC samples, once, at open
+static void dec_alloc( void ) {
+
+	int i, c;
+	unsigned n = API_MAXFRAMES;
+
+	for( i = 0; i < rcv->dec_stages; i++ ) {
+		for( c = 0; c < 2; c++ ) {
+			rcv->hb[ i ].e[ c ] = malloc( ( 2 * rcv->hb[ i ].k + n / 2 + 2 ) * sizeof( short ) );
+			rcv->hb[ i ].o[ c ] = malloc( ( 2 * rcv->hb[ i ].k + n / 2 + 2 ) * sizeof( short ) );
+			rcv->hb[ i ].out[ c ] = malloc( ( n / 2 + 2 ) * sizeof( short ) );
+			if( !rcv->hb[ i ].e[ c ] || !rcv->hb[ i ].o[ c ] || !rcv->hb[ i ].out[ c ] ) {
+				fprintf( stderr, "Cannot allocate decimation buffers\n" );
+				exit( 1 );
+			}
+		}
+		n = n / 2 + 2;
+	}
+	for( c = 0; c < 2 && rcv->fir_len; c++ ) {
+		rcv->fir_x[ c ] = malloc( ( rcv->fir_len + n ) * sizeof( short ) );
+		rcv->fir_out[ c ] = malloc( n * sizeof( short ) );
+		if( !rcv->fir_x[ c ] || !rcv->fir_out[ c ] ) {
+			fprintf( stderr, "Cannot allocate decimation buffers\n" );
+			exit( 1 );
+		}
+	}
+}
+
+// Stage filter lengths:  the last stage sees the output band edge and needs the sharpest filter, the
+// earlier ones only have to protect a band that is small compared with their sample rate
+static void dec_init( int stages, int taps ) {
+
+	int i;
+
+	dec_free();
+	rcv->dec_stages = stages;
+	for( i = 0; i < stages; i++ ) {
+		memset( &rcv->hb[ i ], 0, sizeof( rcv->hb[ i ] ) );
+		hb_design( &rcv->hb[ i ], i == stages - 1 ? 14 : i == stages - 2 ? 6 : 4 );
+	}
+	rcv->fir_len = 0;
+	rcv->fir_nx = 0;
+	if( taps )
+		fir_design( taps );
+	dec_alloc();
+}
+
+static unsigned hb_run( struct hb_stage *s, short **in, unsigned n ) {
+
+	unsigned c, i, ne = 0, no = 0, m;
+	int k = s->k;
+
+	for( c = 0; c < 2; c++ ) {	// split into even and odd phases behind the history
+		ne = s->ne;
+		no = s->no;
+		i = 0;
+		if( s->phase && n )
+			s->o[ c ][ no++ ] = in[ c ][ i++ ];
+		kern->deinterleave_s16( s->e[ c ] + ne, s->o[ c ] + no, in[ c ] + i, ( n - i ) / 2 );
+		ne += ( n - i ) / 2;
+		no += ( n - i ) / 2;
+		i += ( n - i ) & ~1;
+		if( i < n )
+			s->e[ c ][ ne++ ] = in[ c ][ i ];
+	}
+	s->phase = ( s->phase + n ) & 1;
+
+	// out[m] needs e[m .. m+2k-1] and o[m+k-1]
+	m = ne >= 2 * k ? ne - ( 2 * k - 1 ) : 0;
+	if( no < k )
+		m = 0;
+	else if( m > no - ( k - 1 ) )
+		m = no - ( k - 1 );
+
+	for( c = 0; c < 2; c++ ) {
+		kern->fir_sym( s->out[ c ], s->e[ c ], s->g, k, 2 * k, s->o[ c ] + k - 1, s->c, m );
+		memmove( s->e[ c ], s->e[ c ] + m, ( ne - m ) * sizeof( short ) );
+		memmove( s->o[ c ], s->o[ c ] + m, ( no - m ) * sizeof( short ) );
+	}
+	s->ne = ne - m;
+	s->no = no - m;
+	return m;
+}
+
+static unsigned fir_run( short **in, unsigned n ) {
+
+	unsigned c, m, p = rcv->fir_len / 2;
+
+	m = rcv->fir_nx + n >= rcv->fir_len ? rcv->fir_nx + n - ( rcv->fir_len - 1 ) : 0;
+	for( c = 0; c < 2; c++ ) {
+		memcpy( rcv->fir_x[ c ] + rcv->fir_nx, in[ c ], n * sizeof( short ) );
+		kern->fir_sym( rcv->fir_out[ c ], rcv->fir_x[ c ], rcv->fir_taps, p, rcv->fir_len, rcv->fir_x[ c ] + p, rcv->fir_taps[ p ], m );
+		memmove( rcv->fir_x[ c ], rcv->fir_x[ c ] + m, ( rcv->fir_nx + n - m ) * sizeof( short ) );
+	}
+	rcv->fir_nx += n - m;
+	return m;
+}
+
+// Decimate a block of ADC samples.  On return *xi and *xq point at the output, which may be empty.
+static unsigned decimate( short **xi, short **xq, unsigned numSamples ) {
+
+	short *io[ 2 ] = { *xi, *xq };
+	int i;
+
+	for( i = 0; i < rcv->dec_stages && numSamples; i++ ) {
+		numSamples = hb_run( &rcv->hb[ i ], io, numSamples );
+		io[ 0 ] = rcv->hb[ i ].out[ 0 ];
+		io[ 1 ] = rcv->hb[ i ].out[ 1 ];
+	}
+	if( rcv->fir_len && numSamples ) {
+		numSamples = fir_run( io, numSamples );
+		io[ 0 ] = rcv->fir_out[ 0 ];
+		io[ 1 ] = rcv->fir_out[ 1 ];
+	}
+	*xi = io[ 0 ];
+	*xq = io[ 1 ];
+	return numSamples;
+}
+
+// Magnitude response of the whole software decimator at f, a fraction of the ADC rate
+static double dec_response( double f ) {
+
+	double re, mag = 1;
+	int i, j, k;
+
+	for( i = 0; i < rcv->dec_stages; i++, f *= 2 ) {	// each stage runs at half the rate of the one before
+		k = rcv->hb[ i ].k;
+		re = rcv->hb[ i ].c / 32768.0;	// centre tap, phase referenced to it
+		for( j = 0; j < k; j++ )
+			re += 2 * rcv->hb[ i ].g[ j ] / 32768.0 * cos( 2 * M_PI * f * ( 2 * k - 1 - 2 * j ) );
+		mag *= fabs( re );
+	}
+	if( rcv->fir_len ) {
+		k = rcv->fir_len / 2;
+		re = rcv->fir_taps[ k ] / 32768.0;
+		for( j = 0; j < k; j++ )
+			re += 2 * rcv->fir_taps[ j ] / 32768.0 * cos( 2 * M_PI * f * ( k - j ) );
+		mag *= fabs( re );
+	}
+	return mag;
+}
+
+// Report pass-band droop at 0.4 of the output rate and the worst alias that lands within +/-0.4 of it
+static void dec_report( const char *indent ) {
+
+	double fout = 1.0 / ( 1 << rcv->dec_stages ), f, a, worst = 0, droop = dec_response( 0.4 * fout );
+
+	for( f = 0.5 * fout; f <= 0.5; f += fout / 400 ) {
+		a = fabs( f - fout * floor( f / fout + 0.5 ) );	// where it lands after decimation
+		if( a <= 0.4 * fout && dec_response( f ) > worst )
+			worst = dec_response( f );
+	}
+	fprintf( stderr, "%sSoftware decimation: %d half-band stage(s)", indent, rcv->dec_stages );
+	if( rcv->fir_len )
+		fprintf( stderr, " + %d tap FIR", rcv->fir_len );
+	fprintf( stderr, ", %.2f dB at 0.4*fs, aliases into +/-0.4*fs below %.1f dB\n",
+		20 * log10( droop ), rcv->dec_stages ? 20 * log10( worst ) : -INFINITY );
+}
+
+// Rational resampler for output rates that are not a power-of-two division of a usable ADC rate.
+// pick_adc_rate() chooses the ADC rate and L/M;  the decimated stream is then interpolated by L and
+// decimated by M with a polyphase low-pass (RS_TAPS taps per phase, Q15, each phase normalised to unity
+// gain) using the resample kernel.  Planar I and Q, history kept in front of the new samples.
+
+static int gcd( int a, int b ) {
+
+	while( b ) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// ADC rate for an output rate:  rate * 2^shift if that is in range (smallest shift first), otherwise
+// rate * M/L * 2^shift for the smallest M that gives a whole number of Hz.  Returns 0 if nothing fits.
+static long pick_adc_rate( int rate, int maxshift, int *shift, int *L, int *M ) {
+
+	long adc;
+	int l, m, k;
+
+	for( m = 1; m <= 32; m++ )
+		for( l = 1; l <= m; l++ ) {
+			if( ( m > 1 && l == m ) || gcd( l, m ) != 1 || ( (long)rate * m ) % l )
+				continue;
+			for( k = 0; k <= maxshift; k++ ) {
+				adc = ( (long)rate * m / l ) << k;
+				if( adc >= 2048000 && adc < 8064000 ) {
+					*shift = k;
+					*L = l;
+					*M = m;
+					return adc;
+				}
+			}
+		}
+	return 0;
+}
+
+// RSPduo dual-tuner mode runs the ADC at DUO_FS with a 1620 kHz IF and the API hands each tuner's samples over at
+// zero IF and DUO_RATE, ahead of any decimation.  So only the decimation and the resampler are free:  the largest
+// power-of-two decimation that leaves at least rate, then L/M down from there.  Returns 0 if nothing fits.  A '-Z'
+// channel is the same from its filter bank's rate.
+#define DUO_FS 6000000
+#define DUO_RATE 2000000
+
+static long pick_down( long in, int rate, int maxshift, int *shift, int *L, int *M ) {
+
+	int k, g;
+
+	if( rate > in )
+		return 0;
+	for( k = maxshift; k && ( ( in >> k ) < rate || in % ( 1L << k ) ); k-- )
+		;
+	g = gcd( rate, in >> k );
+	if( rate / g > 1024 )	// more phases than is sensible to hold
+		return 0;
+	*shift = k;
+	*L = rate / g;
+	*M = ( in >> k ) / g;
+	return in;
+}
+
+static long pick_duo_rate( int rate, int maxshift, int *shift, int *L, int *M ) {
+
+	return pick_down( DUO_RATE, rate, maxshift, shift, L, M );
+}
+
+// Size the history and output for input blocks of up to API_MAXFRAMES samples, once, at open
+static void rs_alloc( void ) {
+
+	int c;
+
+	for( c = 0; c < 2; c++ ) {
+		free( rcv->rs_x[ c ] );
+		free( rcv->rs_out[ c ] );
+		rcv->rs_x[ c ] = malloc( ( RS_TAPS + API_MAXFRAMES ) * sizeof( short ) );
+		rcv->rs_out[ c ] = malloc( ( (size_t)API_MAXFRAMES * rcv->rs_L / rcv->rs_M + 2 ) * sizeof( short ) );
+		if( !rcv->rs_x[ c ] || !rcv->rs_out[ c ] ) {
+			fprintf( stderr, "Cannot allocate resampler buffers\n" );
+			exit( 1 );
+		}
+	}
+}
+
+static void rs_init( int L, int M ) {
+
+	int n, len = L * RS_TAPS, ph, t, sum;
+	double fc = 0.45 / ( L > M ? L : M ), *h = malloc( len * sizeof( double ) );	// cut-off relative to the L-times rate
+
+	rcv->rs_L = L;
+	rcv->rs_M = M;
+	free( rcv->rs_coefs );
+	rcv->rs_coefs = malloc( len * sizeof( short ) );
+	for( n = 0; n < len; n++ )
+		h[ n ] = ( n == ( len - 1 ) / 2.0 ? 2 * fc : sin( 2 * M_PI * fc * ( n - ( len - 1 ) / 2.0 ) ) / ( M_PI * ( n - ( len - 1 ) / 2.0 ) ) )
+			* kaiser( n, len, 8.0 ) * L;
+
+	// phase ph is h[ph], h[ph+L], ... applied newest sample first, so stored reversed for the kernel
+	for( ph = 0; ph < L; ph++ ) {
+		for( t = 0, sum = 0; t < RS_TAPS; t++ )
+			sum += rcv->rs_coefs[ ph * RS_TAPS + RS_TAPS - 1 - t ] = lrint( h[ ph + t * L ] * 32768 );
+		rcv->rs_coefs[ ph * RS_TAPS + RS_TAPS / 2 ] += 32768 - sum;
+	}
+	free( h );
+
+	rcv->rs_nx = 0;
+	rcv->rs_pos = 0;
+	rcv->rs_phase = 0;
+	rs_alloc();
+}
+
+// Magnitude response of the resampler's prototype at f, a fraction of the L-times rate, 1 at DC
+static double rs_response( double f ) {
+
+	double re = 0, im = 0, a;
+	int ph, t;
+
+	for( ph = 0; ph < rcv->rs_L; ph++ )
+		for( t = 0; t < RS_TAPS; t++ ) {
+			a = 2 * M_PI * f * ( ph + t * rcv->rs_L );
+			re += rcv->rs_coefs[ ph * RS_TAPS + RS_TAPS - 1 - t ] * cos( a );
+			im += rcv->rs_coefs[ ph * RS_TAPS + RS_TAPS - 1 - t ] * sin( a );
+		}
+	return hypot( re, im ) / ( 32768.0 * rcv->rs_L );
+}
+
+// As dec_report(), for the resampler from 'from' sps:  the nearest images are the worst, so only four are searched
+static void rs_report( const char *indent, long from ) {
+
+	double fout = 1.0 / rcv->rs_M, f, a, r, worst = 0;
+
+	for( f = 0.6 * fout; f <= 0.5 && f <= 4.4 * fout; f += fout / 100 ) {
+		a = fabs( f - fout * floor( f / fout + 0.5 ) );	// where it lands after taking every M'th
+		if( a <= 0.4 * fout && ( r = rs_response( f ) ) > worst )
+			worst = r;
+	}
+	fprintf( stderr, "%sResampling:  %u/%u from %ld sps, %d taps per phase, %.2f dB at 0.4*fs, aliases into +/-0.4*fs below %.1f dB\n",
+		indent, rcv->rs_L, rcv->rs_M, from, RS_TAPS, 20 * log10( rs_response( 0.4 * fout ) ), 20 * log10( worst ) );
+}
+
+static void rs_free( void ) {
+
+	int c;
+
+	for( c = 0; c < 2; c++ ) {
+		free( rcv->rs_x[ c ] );
+		free( rcv->rs_out[ c ] );
+		rcv->rs_x[ c ] = rcv->rs_out[ c ] = NULL;
+	}
+	free( rcv->rs_coefs );
+	rcv->rs_coefs = NULL;
+	rcv->rs_L = rcv->rs_M = 1;
+}
+
+// Resample a block.  On return *xi and *xq point at the output, which may be empty.
+static unsigned resample( short **xi, short **xq, unsigned numSamples ) {
+
+	unsigned c, n = 0, pos, phase;
+
+	for( c = 0; c < 2; c++ )
+		memcpy( rcv->rs_x[ c ] + rcv->rs_nx, c ? *xq : *xi, numSamples * sizeof( short ) );
+	rcv->rs_nx += numSamples;
+
+	// outputs while the window x[pos .. pos+RS_TAPS-1] is complete;  phase advances by M per output
+	for( pos = rcv->rs_pos, phase = rcv->rs_phase; pos + RS_TAPS <= rcv->rs_nx; n++ ) {
+		phase += rcv->rs_M;
+		pos += phase / rcv->rs_L;
+		phase %= rcv->rs_L;
+	}
+
+	for( c = 0; c < 2; c++ ) {
+		pos = rcv->rs_pos;
+		phase = rcv->rs_phase;
+		kern->resample( rcv->rs_out[ c ], rcv->rs_x[ c ], rcv->rs_coefs, RS_TAPS, rcv->rs_L, rcv->rs_M, &pos, &phase, n );
+		memmove( rcv->rs_x[ c ], rcv->rs_x[ c ] + pos, ( rcv->rs_nx - pos ) * sizeof( short ) );
+	}
+	rcv->rs_nx -= pos;
+	rcv->rs_pos = 0;
+	rcv->rs_phase = phase;
+
+	*xi = rcv->rs_out[ 0 ];
+	*xq = rcv->rs_out[ 1 ];
+	return n;
+}
+
+// The FFT and polyphase channelizer are in pfb.c (see pfb.h), run on the kernel set in use
+static struct pfb_kernels pfb_kern( void ) {
+
+	struct pfb_kernels k = { kern->deinterleave_s16, kern->s16_to_f32, kern->pfb_fold, kern->fft_butterfly };
+
+	return k;
+}
+
+// AGC window decision, run once at the end of each AGC3minTimeMs window (same logic as agc_reference())
+static void agc_decide( void ) {
+
+	// (do increase threshold count timing, etc. and decrease gain as necessary)
+	// if it has been long enough since we did an increase - AND is there a minimum number of A/D conversions above the last
+	if((rcv->agc_increase_timer > rcv->AGC5B) && (rcv->adc_high_count > rcv->AGC4A)) {
+		// is the current "gain reduction" value below the limit?
+		if(rcv->gain_reduction < rcv->AGC1increaseThreshold) {
+			// yes - decrease the gain by one step
+			rcv->gain_reduction+=rcv->gainstep_inc;
+
+			if(rcv->gain_reduction > 59)	// Gain reduction at maximum?
+				rcv->gain_reduction = rcv->max_gain_reduction;	// limit maximum amount of gain reduction
+			else	// Do API gain change only if valid value
+				rcv->gain_changed = 1;
+
+			rcv->agc_increase_timer = 0;  // reset timer for gain increase
+			rcv->agc_decrease_timer = 0;  // also reset AGC decrease timer because we just did an increase
+		}
+	}
+	else if (rcv->max_adc < rcv->AGC2decreaseThreshold) {  // (do decrease threshold count timing, etc. and increase gain as necessary)
+		if( (rcv->agc_decrease_timer > rcv->AGC6C) ) {
+			// yes - is the current "gain reduction" above the limit?
+			if(rcv->gain_reduction > rcv->min_gain_reduction) {	// prevent gain reduction from being set lower than explicitly specified in command line
+				// yes - increase the gain by one step
+				rcv->gain_reduction-=rcv->gainstep_dec;
+				rcv->gain_changed = 1;
+				rcv->agc_increase_timer = 0; // reset the gain adjustment timers
+				rcv->agc_decrease_timer = 0;
+				rcv->adc_high_count = 0;
+			}
+		}
+	}
+	rcv->max_adc = 0; // reset the ADC high-water value before the next AGC sampling window starts
+	rcv->agc_timer = 0;
+	rcv->adc_high_count = 0;	// end of timing window - reset high count for next time.
+}
+
+// Fold the peak and over-threshold count of a run of samples into the current AGC window
+static void agc_accumulate( const short *buf, unsigned n ) {
+
+	unsigned peak, count;
+
+	if( !n )
+		return;
+
+	if( rcv->AGC1increaseThreshold < 0 )		// every sample is above the threshold
+		kern->peak_count( buf, n, 0, &peak, &count ), count = n;
+	else if( rcv->AGC1increaseThreshold > 32767 )	// none can be
+		kern->peak_count( buf, n, 32767, &peak, &count ), count = 0;
+	else
+		kern->peak_count( buf, n, rcv->AGC1increaseThreshold, &peak, &count );
+
+	if( peak > rcv->max_adc )
+		rcv->max_adc = peak;	// get high water mark
+	if( rcv->adc_high_count < 65530 )	// bump count, prevent overflow
+		rcv->adc_high_count = rcv->adc_high_count + count < 65530 ? rcv->adc_high_count + count : 65530;
+}
+
+// Clipping, judged per block on all of its samples:  the time from a block that clips to the first that does not is
+// kept for the exit report.  With '-N' a block that clips, or any block while the API reports the ADC overloaded,
+// steps the gain reduction up by agc_fast dB at once rather than after the AGC window and AGC5B have run out, so
+// the change is posted at the end of the same block.  One step is in flight at a time:  if a block still clips
+// once it has landed, the next goes.  The gain comes back as before, through agc_decide()'s slow decay.
+#define AGC_CLIP 32000		// a sample bigger than this clips
+#define AGC_CLIP_COUNT 4	// and a block with this many of them is clipping
+
+static void agc_clip( const short *buf, unsigned numSamples ) {
+
+	unsigned long n;
+	unsigned peak, count;
+
+	kern->peak_count( buf, numSamples * 2, AGC_CLIP, &peak, &count );
+	if( count >= AGC_CLIP_COUNT && !rcv->clipping ) {
+		rcv->clipping = 1;
+		rcv->clip_since = rcv->agc_samples;
+	}
+	else if( count < AGC_CLIP_COUNT && rcv->clipping ) {
+		rcv->clipping = 0;
+		n = rcv->agc_samples - rcv->clip_since;
+		atomic_fetch_add_explicit( &rcv->clips, 1, memory_order_relaxed );
+		atomic_fetch_add_explicit( &rcv->clip_sum, n, memory_order_relaxed );
+		if( n > atomic_load_explicit( &rcv->clip_max, memory_order_relaxed ) )
+			atomic_store_explicit( &rcv->clip_max, n, memory_order_relaxed );
+	}
+	rcv->agc_samples += numSamples;
+
+	if( !rcv->agc_fast || rcv->gain_changed || rcv->gchange_lockout || rcv->gain_reduction >= rcv->max_gain_reduction
+		|| ( count < AGC_CLIP_COUNT && !atomic_load_explicit( &rcv->overload, memory_order_relaxed ) ) )
+		return;
+	rcv->gain_reduction = rcv->gain_reduction + rcv->agc_fast < rcv->max_gain_reduction ? rcv->gain_reduction + rcv->agc_fast : rcv->max_gain_reduction;
+	rcv->gain_changed = 1;
+	rcv->agc_increase_timer = 0;	// as after a step up in agc_decide()
+	rcv->agc_decrease_timer = 0;
+	atomic_fetch_add_explicit( &rcv->attacks, 1, memory_order_relaxed );
+}
+
+// Process AGC on a block of samples.  Like the original, looks at the first numSamples shorts of the
+// interleaved buffer and advances the ms timers every agc_timer_scaling+1 of them.  Rather than running
+// the window logic per sample, the block is cut at each ms tick:  the detector runs over each piece with
+// the SIMD peak/count kernel and the timers and window decision run once per tick.
+void agc(short *buf, unsigned numSamples) {
+
+	unsigned n;
+
+	agc_clip( buf, numSamples );
+	while( numSamples ) {
+		n = rcv->agc_timer_scaling + 1 - rcv->counter_samples;	// samples up to and including the next tick
+		if( n > numSamples ) {	// no tick in the rest of this block
+			agc_accumulate( buf, numSamples );
+			rcv->counter_samples += numSamples;
+			return;
+		}
+
+		agc_accumulate( buf, n );
+		buf += n;
+		numSamples -= n;
+
+		rcv->counter_ms++;	// update AGC "window" timers
+		rcv->debug_counter_ms++;
+		rcv->counter_samples = 0;
+		rcv->agc_timer++; // this is the timer for the AGC loop;
+		rcv->agc_increase_timer++;
+		rcv->agc_decrease_timer++;
+
+		if(rcv->agc_timer >= rcv->AGC3minTimeMs)  // we can look at the AGC timing again since it has been long enough
+			agc_decide();
+
+		if(rcv->debugPeriod > 0) {
+			if (rcv->debug_counter_ms > rcv->debugPeriod) {
+				rcv->debug_counter_ms = 0;
+				fprintf(stderr, "DEBUG: agc_timer=%d, gain_reduction=%d, abs_adc=%d, max_adc=%d, gain_changed=%d, adc_high_count=%u\n", rcv->agc_timer, rcv->gain_reduction, abs(buf[-1]), rcv->max_adc, rcv->gain_changed, rcv->adc_high_count);
+			}
+		}
+	}
+}
+
+// New AGC settings staged by the control socket, taken between two blocks
+static void agc_take( void ) {
+
+	const struct agc_params *p = &rcv->agc_staged;
+
+	rcv->AGCEnable = p->AGCEnable;
+	rcv->AGC1increaseThreshold = p->AGC1increaseThreshold;
+	rcv->AGC2decreaseThreshold = p->AGC2decreaseThreshold;
+	rcv->AGC3minTimeMs = p->AGC3minTimeMs;
+	rcv->AGC4A = p->AGC4A;
+	rcv->AGC5B = p->AGC5B;
+	rcv->AGC6C = p->AGC6C;
+	rcv->gainstep_inc = p->gainstep_inc;
+	rcv->gainstep_dec = p->gainstep_dec;
+	rcv->min_gain_reduction = p->min_gain_reduction;
+	rcv->max_gain_reduction = p->max_gain_reduction;
+	rcv->agc_fast = p->agc_fast;
+	if( p->set_gain >= 0 && p->set_gain != rcv->gain_reduction ) {	// through the usual path, after any change in flight
+		rcv->gain_reduction = p->set_gain;
+		rcv->gain_changed = 1;
+	}
+	atomic_store_explicit( &rcv->agc_staged_ready, 0, memory_order_release );
+}
+
+// AGC state compared between the two engines by check_agc()
+struct agc_snapshot {
+	int gain_reduction, gain_changed, counter_samples, counter_ms, debug_counter_ms;
+	int agc_timer, agc_increase_timer, agc_decrease_timer, max_adc, adc_high_count;
+};
+
+static void agc_save( struct agc_snapshot *s ) {
+
+	s->gain_reduction = rcv->gain_reduction;
+	s->gain_changed = rcv->gain_changed;
+	s->counter_samples = rcv->counter_samples;
+	s->counter_ms = rcv->counter_ms;
+	s->debug_counter_ms = rcv->debug_counter_ms;
+	s->agc_timer = rcv->agc_timer;
+	s->agc_increase_timer = rcv->agc_increase_timer;
+	s->agc_decrease_timer = rcv->agc_decrease_timer;
+	s->max_adc = rcv->max_adc;
+	s->adc_high_count = rcv->adc_high_count;
+}
+
+static void agc_load( const struct agc_snapshot *s ) {
+
+	rcv->gain_reduction = s->gain_reduction;
+	rcv->gain_changed = s->gain_changed;
+	rcv->counter_samples = s->counter_samples;
+	rcv->counter_ms = s->counter_ms;
+	rcv->debug_counter_ms = s->debug_counter_ms;
+	rcv->agc_timer = s->agc_timer;
+	rcv->agc_increase_timer = s->agc_increase_timer;
+	rcv->agc_decrease_timer = s->agc_decrease_timer;
+	rcv->max_adc = s->max_adc;
+	rcv->adc_high_count = s->adc_high_count;
+}
+
+// Feed buf (numSamples interleaved I/Q pairs) through agc_reference() and agc() in blocks of varying size,
+// comparing the complete AGC state after every block.  Returns the number of blocks that differed.
+static unsigned check_agc( const char *what, short *buf, unsigned numSamples ) {
+
+	static const unsigned sizes[] = { 1008, 252, 2016, 1, 769, 63, 4032, 1537, 504, 7 };
+	struct agc_snapshot start, ref, blk;
+	struct timespec t0, t1;
+	unsigned pos, n, k, bad = 0, changes = 0;
+	double ns_ref = 0, ns_blk = 0;
+
+	start.gain_reduction = rcv->min_gain_reduction;
+	start.gain_changed = start.counter_samples = start.counter_ms = start.debug_counter_ms = 0;
+	start.agc_timer = start.agc_increase_timer = start.agc_decrease_timer = start.max_adc = start.adc_high_count = 0;
+	agc_load( &start );
+	agc_save( &ref );
+	blk = ref;
+
+	for( pos = 0, k = 0; pos < numSamples; pos += n, k++ ) {
+		n = sizes[ k % ( sizeof( sizes ) / sizeof( sizes[ 0 ] ) ) ];
+		if( n > numSamples - pos )
+			n = numSamples - pos;
+
+		agc_load( &ref );
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		agc_reference( buf + pos * 2, n );
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		ns_ref += ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec );
+		changes += rcv->gain_changed;
+		rcv->gain_changed = 0;	// as if process_block() had passed the change to the API
+		agc_save( &ref );
+
+		agc_load( &blk );
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		agc( buf + pos * 2, n );
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		ns_blk += ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec );
+		rcv->gain_changed = 0;
+		agc_save( &blk );
+
+		if( memcmp( &ref, &blk, sizeof( ref ) ) )
+			bad++;
+	}
+
+	fprintf( stderr, "   %-8s AGC on %s:  %u blocks, %u gain changes, per-sample %.3f ns, block %.3f ns per sample  %s\n",
+		kern->name, what, k, changes, ns_ref / numSamples, ns_blk / numSamples, bad ? "MISMATCH" : "identical" );
+	return bad;
+}
+
+// -K AGC regression:  a synthetic signal that alternates between overload and quiet often enough to drive
+// gain changes in both directions, plus raw S16 I/Q read from stdin if it is redirected from a recording.
+static void check_agc_engines( short *rec, unsigned nrec ) {
+
+	enum { RATE = 768000, SECONDS = 8 };
+	unsigned i, n = RATE * SECONDS, seed = 1;
+	short *syn = malloc( n * 2 * sizeof( short ) );
+	int j, amp;
+
+	rcv->agc_timer_scaling = RATE / 1000;
+	rcv->AGC3minTimeMs = 50;		// short windows so there are plenty of decisions to compare
+	rcv->AGC4A = 100;
+	rcv->AGC5B = 100;
+	rcv->AGC6C = 200;
+	rcv->debugPeriod = 0;
+
+	for( i = 0; i < n; i++ ) {
+		amp = ( i / ( RATE / 5 ) ) % 3 ? 4000 : 30000;	// 200 ms of overload then 400 ms quiet
+		for( j = 0; j < 2; j++ ) {
+			seed = seed * 1103515245 + 12345;
+			syn[ i * 2 + j ] = (int)( ( seed >> 16 ) % ( 2 * amp + 1 ) ) - amp;
+		}
+	}
+
+	fprintf( stderr, "AGC regression (block agc() against per-sample agc_reference()):\n" );
+	for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+		if( !kernels_supported( all_kernels[ j ] ) )
+			continue;
+		kern = all_kernels[ j ];
+		check_agc( "synthetic", syn, n );
+		if( nrec )
+			check_agc( "stdin", rec, nrec );
+	}
+
+	free( syn );
+}
+
+// -K compact output formats (-F p12, s8, bfp):  the cost per sample of packing a block for each kernel set, whose
+// bytes must be iqpack.c's, then what each format saves against its SNR (the packing error against the S16 it was
+// packed from), over the whole signal and in its worst 64-frame stretch, on a strong tone, a weak one, the weak
+// one with a strong burst through half of every other block (where s8's one scale a block is at its worst) and
+// anything recorded on stdin.
+static void wire_tradeoff( const char *name, const short *in, unsigned frames ) {
+
+	enum { BLOCK = 1008, STRETCH = 64 };
+	static const int formats[] = { IQPACK_P12, IQPACK_S8, IQPACK_BFP };
+	char *unit = malloc( BLOCK * 4 + sizeof( struct iqpack_header ) );
+	short *out = malloc( BLOCK * 4 );
+	unsigned i, pos, n;
+	double sig, err, s, e, worst, d;
+	size_t bytes;
+	int f;
+
+	fprintf( stderr, "   %-22s", name );
+	for( f = 0; f < sizeof( formats ) / sizeof( formats[ 0 ] ); f++ ) {
+		rcv->wire = formats[ f ];
+		sig = err = s = e = 0;
+		worst = INFINITY;
+		for( pos = bytes = 0; pos < frames; pos += n ) {
+			n = frames - pos < BLOCK ? frames - pos : BLOCK;
+			bytes += wire_pack( unit, in + pos * 2, n );
+			iqpack_decode( (struct iqpack_header *)unit, out );
+			for( i = 0; i < n * 2; i++ ) {
+				d = in[ pos * 2 + i ];
+				s += d * d;
+				e += ( d - out[ i ] ) * ( d - out[ i ] );
+				if( ( pos * 2 + i + 1 ) % ( STRETCH * 2 ) == 0 ) {
+					if( e && 10 * log10( s / e ) < worst )
+						worst = 10 * log10( s / e );
+					sig += s;
+					err += e;
+					s = e = 0;
+				}
+			}
+		}
+		sig += s;
+		err += e;
+		fprintf( stderr, "  %s %.2f %5.1f %5.1f", iqpack_name( formats[ f ] ), (double)bytes / frames, err ? 10 * log10( sig / err ) : INFINITY, worst );
+	}
+	fprintf( stderr, "\n" );
+	free( unit );
+	free( out );
+}
+
+static void benchmark_wire( const short *rec, unsigned nrec ) {
+
+	enum { N = 1008, REPS = 20000, SYN = 768000 };
+	static const int formats[] = { IQPACK_P12, IQPACK_S8, IQPACK_BFP };
+	static short in[ N * 2 ];
+	static char ref[ 3 ][ N * 4 + sizeof( struct iqpack_header ) ], out[ N * 4 + sizeof( struct iqpack_header ) ];
+	short *syn = malloc( SYN * 2 * sizeof( short ) );
+	const struct kernels *saved = kern;
+	struct timespec t0, t1;
+	unsigned i, seed = 1, f;
+	size_t len[ 3 ];
+	double ns, amp;
+	int j, r, level;
+
+	for( i = 0; i < N * 2; i++ ) {		// a tone at -6 dBFS in noise, clipping now and then
+		seed = seed * 1103515245 + 12345;
+		in[ i ] = sat16( lrint( 16384 * ( i & 1 ? sin( i * 0.01 ) : cos( i * 0.01 ) ) + (int)( seed >> 16 & 0x3fff ) - 8192 ) * 2 );
+	}
+	rcv->channels = 2;
+	for( f = 0; f < 3; f++ )
+		len[ f ] = iqpack_encode( ref[ f ], formats[ f ], 2, in, N );
+
+	fprintf( stderr, "Compact output formats, %d I/Q pairs per block, ns per sample to pack:\n", N );
+	fprintf( stderr, "   %-8s %10s %10s %10s\n", "kernels", "p12", "s8", "bfp" );
+	for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+		kern = all_kernels[ j ];
+		if( !kernels_supported( kern ) )
+			continue;
+		fprintf( stderr, "   %-8s", kern->name );
+		for( f = 0; f < 3; f++ ) {
+			rcv->wire = formats[ f ];
+			clock_gettime( CLOCK_MONOTONIC, &t0 );
+			for( r = 0; r < REPS; r++ ) {
+				wire_pack( out, in, N );
+				__asm__ volatile( "" ::: "memory" );
+			}
+			clock_gettime( CLOCK_MONOTONIC, &t1 );
+			ns = ( ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec ) ) / ( (double)REPS * N * 2 );
+			fprintf( stderr, " %10.3f%s", ns, memcmp( out, ref[ f ], len[ f ] ) ? " MISMATCH" : "" );
+		}
+		fprintf( stderr, "\n" );
+	}
+	kern = saved;
+
+	fprintf( stderr, "Compact output formats, bytes per frame (S16 4.00) and SNR against S16 in dB, overall and worst:\n" );
+	for( level = 0; level < 3; level++ ) {
+		amp = level ? 32768 * 0.01 : 32768 * 0.1;	// -20 or -40 dBFS
+		for( i = 0; i < SYN; i++ ) {
+			seed = seed * 1103515245 + 12345;
+			r = level == 2 && ( i / 504 ) % 4 == 3 ? 90 : 1;	// the burst:  +39 dB for half a block in two
+			syn[ i * 2 ] = sat16( lrint( r * amp * cos( i * 0.3 ) + ( (int)( seed >> 16 & 0xff ) - 128 ) * 0.05 * r ) );
+			syn[ i * 2 + 1 ] = sat16( lrint( r * amp * sin( i * 0.3 ) + ( (int)( seed >> 8 & 0xff ) - 128 ) * 0.05 * r ) );
+		}
+		wire_tradeoff( level == 0 ? "tone at -20 dBFS" : level == 1 ? "tone at -40 dBFS" : "-40 dBFS with bursts", syn, SYN );
+	}
+	if( nrec )
+		wire_tradeoff( "stdin", rec, nrec );
+	rcv->wire = 0;
+	rcv->wire_in = rcv->wire_out = 0;
+	free( syn );
+}
+
+// -K decimation throughput:  one second at a 3.072 MS/s ADC rate through the software decimator for each
+// output rate, with and without a final FIR.  Every kernel set must produce the same output as scalar.
+static void benchmark_decimation( void ) {
+
+	enum { ADC = 3072000, BLOCK = 1008 };
+	static const int fir[] = { 0, 31 };
+	short *xi = malloc( ADC * sizeof( short ) ), *xq = malloc( ADC * sizeof( short ) ), *p, *q;
+	unsigned i, pos, n, sum, ref[ 4 ][ 2 ], seed = 1;
+	int j, shift, t;
+	struct timespec t0, t1;
+	double ns;
+
+	for( i = 0; i < ADC; i++ ) {	// tone plus noise, a little below full scale
+		seed = seed * 1103515245 + 12345;
+		xi[ i ] = 20000 * cos( i * 0.01 ) + ( (int)( seed >> 16 ) % 4000 ) - 2000;
+		xq[ i ] = 20000 * sin( i * 0.01 ) + ( (int)( seed >> 8 ) % 4000 ) - 2000;
+	}
+
+	fprintf( stderr, "Software decimation from %d sps, %d sample blocks:\n", ADC, BLOCK );
+	for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+		if( !kernels_supported( all_kernels[ j ] ) )
+			continue;
+		kern = all_kernels[ j ];
+		for( shift = 5; shift >= 2; shift-- )
+			for( t = 0; t < 2; t++ ) {
+				dec_init( shift, fir[ t ] );
+				for( pos = sum = 0, ns = 0; pos < ADC; pos += BLOCK ) {
+					n = ADC - pos < BLOCK ? ADC - pos : BLOCK;
+					p = xi + pos;
+					q = xq + pos;
+					clock_gettime( CLOCK_MONOTONIC, &t0 );
+					n = decimate( &p, &q, n );
+					clock_gettime( CLOCK_MONOTONIC, &t1 );
+					ns += ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec );
+					for( i = 0; i < n; i++ )	// checksum of the output, outside the timing
+						sum = sum * 31 + (unsigned short)p[ i ] + ( (unsigned short)q[ i ] << 16 );
+				}
+				if( !j )
+					ref[ 5 - shift ][ t ] = sum;
+				fprintf( stderr, "   %-8s %6d sps, %3d tap FIR:  %6.2f ns per ADC sample, %6.1fx real time per core  %s\n",
+					kern->name, ADC >> shift, fir[ t ], ns / ADC, 1e9 / ns, sum == ref[ 5 - shift ][ t ] ? "" : "MISMATCH" );
+				if( !j )
+					dec_report( "            " );
+			}
+	}
+	dec_free();
+	free( xi );
+	free( xq );
+}
+
+// -K resampler throughput:  one second of output at each of four L/M ratios, every kernel set matching scalar
+static void benchmark_resampler( void ) {
+
+	enum { BLOCK = 1008 };
+	static const int ratio[][ 3 ] = { { 48000, 3, 4 }, { 44100, 147, 160 }, { 250000, 125, 128 }, { 1200000, 25, 32 } };
+	short *xi, *xq, *p, *q;
+	unsigned i, pos, n, nout, sum, ref[ 4 ], seed = 1;
+	int j, r, L, M;
+	long in;
+	struct timespec t0, t1;
+	double ns;
+
+	fprintf( stderr, "Rational resampling, one second of input in %d sample blocks:\n", BLOCK );
+	for( r = 0; r < sizeof( ratio ) / sizeof( ratio[ 0 ] ); r++ ) {
+		L = ratio[ r ][ 1 ];
+		M = ratio[ r ][ 2 ];
+		in = (long)ratio[ r ][ 0 ] * M / L;
+		xi = malloc( in * sizeof( short ) );
+		xq = malloc( in * sizeof( short ) );
+		for( i = 0; i < in; i++ ) {
+			seed = seed * 1103515245 + 12345;
+			xi[ i ] = 20000 * cos( i * 0.01 ) + ( (int)( seed >> 16 ) % 4000 ) - 2000;
+			xq[ i ] = 20000 * sin( i * 0.01 ) + ( (int)( seed >> 8 ) % 4000 ) - 2000;
+		}
+		for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+			if( !kernels_supported( all_kernels[ j ] ) )
+				continue;
+			kern = all_kernels[ j ];
+			rs_init( L, M );
+			for( pos = sum = nout = 0, ns = 0; pos < in; pos += BLOCK ) {
+				n = in - pos < BLOCK ? in - pos : BLOCK;
+				p = xi + pos;
+				q = xq + pos;
+				clock_gettime( CLOCK_MONOTONIC, &t0 );
+				n = resample( &p, &q, n );
+				clock_gettime( CLOCK_MONOTONIC, &t1 );
+				ns += ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec );
+				for( i = 0; i < n; i++ )
+					sum = sum * 31 + (unsigned short)p[ i ] + ( (unsigned short)q[ i ] << 16 );
+				nout += n;
+			}
+			if( !j )
+				ref[ r ] = sum;
+			fprintf( stderr, "   %-8s %7d sps (%3d/%-3d from %7ld):  %6.2f ns per output sample, %5.1f%% of a core per MS/s  %s\n",
+				kern->name, ratio[ r ][ 0 ], L, M, in, ns / nout, ns / nout / 10, sum == ref[ r ] ? "" : "MISMATCH" );
+		}
+		rs_report( "            ", in );
+		free( xi );
+		free( xq );
+	}
+	rs_free();
+}
+
+// -K channelizer throughput:  2^21 samples of an 8 MS/s stream through the filter bank and on to 1, 4 and 16 channels
+// of 48 kHz, as the wideband receiver's and the channels' writer threads would run them.  The bank's share of a core
+// and each channel's give the channels one core could carry.  Every kernel set's first channel must come out as
+// scalar's, to within float rounding.
+static void benchmark_channelizer( void ) {
+
+	enum { FS = 8000000, RATE = 48000, BLOCK = 2016, N = 1 << 21, NREF = (long)N * RATE / FS + 64 };
+	static const int counts[] = { 1, 4, 16 };
+	struct receiver *save = rcv, *a = receiver_new(), *ch[ CHAN_MAX ];
+	struct pfb_nco *nco[ CHAN_MAX ];
+	struct pfb_kernels pk;
+	short *in = malloc( N * 2 * sizeof( short ) ), *out[ CHAN_MAX ], *ref = malloc( NREF * 2 * sizeof( short ) );
+	short *xi, *xq, di[ BLOCK ], dq[ BLOCK ];
+	unsigned i, pos, n, m, nref, M = pfb_size( FS, RATE );
+	int j, k, c, shift = 0, L = 1, Mr = 1, worst;
+	double ph[ CHAN_MAX ][ 2 ], rot[ CHAN_MAX ][ 2 ], re, im, bank, chans, t = (double)N / FS * 1e9, pc;
+	struct timespec t0, t1, t2;
+	unsigned seed = 1;
+
+	a->rate = FS;
+	for( c = 0; c < CHAN_MAX; c++ ) {	// spread over the band, each with a tone 5 kHz above its centre
+		ch[ c ] = receiver_new();
+		ch[ c ]->chan_of = a;
+		ch[ c ]->rate = RATE;
+		ch[ c ]->chan_offset = ( c - ( CHAN_MAX - 1 ) / 2.0 ) * ( FS * 0.8 / CHAN_MAX );
+		a->chans[ c ] = ch[ c ];
+		nco[ c ] = &ch[ c ]->chan_nco;
+		out[ c ] = malloc( ( BLOCK / ( M / 2 ) + 2 ) * 2 * sizeof( short ) );
+		ph[ c ][ 0 ] = 1;
+		ph[ c ][ 1 ] = 0;
+		rot[ c ][ 0 ] = cos( 2 * M_PI * ( ch[ c ]->chan_offset + 5000 ) / FS );
+		rot[ c ][ 1 ] = sin( 2 * M_PI * ( ch[ c ]->chan_offset + 5000 ) / FS );
+	}
+	for( i = 0; i < N; i++ ) {
+		seed = seed * 1103515245 + 12345;
+		for( c = 0, re = im = 0; c < CHAN_MAX; c++ ) {
+			re += ph[ c ][ 0 ];
+			im += ph[ c ][ 1 ];
+			pc = ph[ c ][ 0 ] * rot[ c ][ 0 ] - ph[ c ][ 1 ] * rot[ c ][ 1 ];
+			ph[ c ][ 1 ] = ph[ c ][ 0 ] * rot[ c ][ 1 ] + ph[ c ][ 1 ] * rot[ c ][ 0 ];
+			ph[ c ][ 0 ] = pc;
+		}
+		in[ 2 * i ] = lrint( re * 1500 ) + ( (int)( seed >> 16 ) % 2000 ) - 1000;
+		in[ 2 * i + 1 ] = lrint( im * 1500 ) + ( (int)( seed >> 8 ) % 2000 ) - 1000;
+	}
+
+	fprintf( stderr, "Channelizer from %d sps (%u-branch filter bank, %d taps per branch) to %d sps channels, %d sample blocks:\n",
+		FS, M, PFB_TAPS, RATE, BLOCK );
+	for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+		if( !kernels_supported( all_kernels[ j ] ) )
+			continue;
+		kern = all_kernels[ j ];
+		pk = pfb_kern();
+		for( k = 0; k < sizeof( counts ) / sizeof( counts[ 0 ] ); k++ ) {
+			pfb_free( a->pfb );
+			if( !( a->pfb = pfb_new( M, BLOCK ) ) ) {
+				fprintf( stderr, "Cannot allocate the filter bank\n" );
+				exit( 1 );
+			}
+			a->nchans = counts[ k ];
+			for( c = 0; c < a->nchans; c++ ) {
+				rcv = ch[ c ];
+				pick_down( 2 * FS / M, RATE, DEC_MAXSTAGES, &shift, &L, &Mr );
+				dec_init( shift, 0 );
+				rs_init( L, Mr );
+				pfb_tune( a->pfb, &ch[ c ]->chan_nco, FS, ch[ c ]->chan_offset );
+			}
+			for( pos = 0, nref = 0, worst = 0, bank = chans = 0; pos < N; pos += BLOCK ) {
+				n = N - pos < BLOCK ? N - pos : BLOCK;
+				clock_gettime( CLOCK_MONOTONIC, &t0 );
+				m = pfb_steps( a->pfb, n );
+				pfb_run( a->pfb, in + 2 * pos, n, nco, a->nchans, out, &pk );
+				clock_gettime( CLOCK_MONOTONIC, &t1 );
+				for( c = 0; c < a->nchans; c++ ) {	// as chan_block()
+					rcv = ch[ c ];
+					xi = di;
+					xq = dq;
+					kern->deinterleave_s16( xi, xq, out[ c ], m );
+					i = resample( &xi, &xq, decimate( &xi, &xq, m ) );
+					if( c )
+						continue;
+					for( ; i && nref < NREF; i--, nref++, xi++, xq++ )
+						if( !j ) {
+							ref[ 2 * nref ] = *xi;
+							ref[ 2 * nref + 1 ] = *xq;
+						}
+						else if( abs( ref[ 2 * nref ] - *xi ) > worst || abs( ref[ 2 * nref + 1 ] - *xq ) > worst )
+							worst = abs( ref[ 2 * nref ] - *xi ) > abs( ref[ 2 * nref + 1 ] - *xq ) ? abs( ref[ 2 * nref ] - *xi ) : abs( ref[ 2 * nref + 1 ] - *xq );
+				}
+				clock_gettime( CLOCK_MONOTONIC, &t2 );
+				bank += ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec );
+				chans += ( t2.tv_sec - t1.tv_sec ) * 1e9 + ( t2.tv_nsec - t1.tv_nsec );
+			}
+			pc = chans / a->nchans / t * 100;
+			fprintf( stderr, "   %-8s %2d channel(s):  filter bank %5.1f%% of a core, %5.2f%% per channel  ->  %4.0f channels per core at 8 MS/s  %s\n",
+				kern->name, a->nchans, bank / t * 100, pc, bank < t ? ( 100 - bank / t * 100 ) / pc : 0, worst > 2 ? "MISMATCH" : "" );
+		}
+	}
+
+	for( c = 0; c < CHAN_MAX; c++ ) {
+		rcv = ch[ c ];
+		dec_free();
+		rs_free();
+		free( ch[ c ] );
+		free( out[ c ] );
+	}
+	pfb_free( a->pfb );
+	free( a );
+	free( in );
+	free( ref );
+	rcv = save;
+}
+
+// -K stdout into a pipe:  CPU per MB of write() from a block buffer, as stdout goes by default, against vmsplice()
+// from a pool as with '-j', with a thread read()ing the other end as the WebSDR would.  Each block is first copied to
+// where it goes out from, for the interleave rx() does there.  The writes block here rather than drop, so every
+// byte gets through.
+struct pipe_bench {
+	int fd;
+	double cpu_s;
+	unsigned long long bytes;
+};
+
+static void *pipe_bench_reader( void *arg ) {
+
+	struct pipe_bench *b = arg;
+	char *buf = malloc( 1 << 16 );
+	struct timespec t0, t1;
+	ssize_t ret;
+
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &t0 );
+	while( ( ret = read( b->fd, buf, 1 << 16 ) ) > 0 || ( ret < 0 && errno == EINTR ) )
+		b->bytes += ret > 0 ? ret : 0;
+	clock_gettime( CLOCK_THREAD_CPUTIME_ID, &t1 );
+	b->cpu_s = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) * 1e-9;
+	free( buf );
+	return NULL;
+}
+
+static size_t pipe_bench_splice( int fd, char *p, size_t len ) {
+
+	struct iovec iov = { p, len };
+	ssize_t ret;
+
+	while( iov.iov_len && ( ret = vmsplice( fd, &iov, 1, 0 ) ) > 0 ) {
+		iov.iov_base = (char *)iov.iov_base + ret;
+		iov.iov_len -= ret;
+	}
+	return len - iov.iov_len;
+}
+
+static void benchmark_pipe( void ) {
+
+	enum { TOTAL = 256 << 20, PIPE = 1 << 20 };
+	static const size_t blocks[] = { 2016, 4032, 16128, 65536 };	// 504 and 1008 frames of S16 (the API's blocks), 1008 of 4 channels of F32, and large
+	size_t page = sysconf( _SC_PAGESIZE ), blk, pool_size, head, sent, len, done;
+	struct timespec t0, t1, c0, c1;
+	struct pipe_bench b;
+	pthread_t reader;
+	char *src, *buf, *pool;
+	double wall, cpu;
+	ssize_t ret;
+	int fd[ 2 ], i, splice, size;
+
+	fprintf( stderr, "Stdout into a pipe, %d MB through each way, CPU per MB:\n", TOTAL >> 20 );
+	fprintf( stderr, "   %-7s %-10s %12s %12s %10s\n", "block", "path", "writer us", "reader us", "MB/s" );
+	src = malloc( blocks[ 3 ] );
+	buf = malloc( blocks[ 3 ] );
+	for( i = 0; i < blocks[ 3 ]; i++ )
+		src[ i ] = i * 7;
+	for( i = 0; i < sizeof( blocks ) / sizeof( blocks[ 0 ] ); i++ )
+		for( splice = 0; splice < 2; splice++ ) {
+			blk = blocks[ i ];
+			if( pipe( fd ) ) {
+				fprintf( stderr, "pipe: %s\n", strerror( errno ) );
+				goto out;
+			}
+			fcntl( fd[ 1 ], F_SETPIPE_SZ, PIPE );
+			size = fcntl( fd[ 1 ], F_GETPIPE_SZ );
+			pool_size = 2 * ( size + 4 * ( ( blk + page - 1 ) & ~( page - 1 ) ) );	// as pipe_space() makes it
+			pool = splice ? mmap( NULL, pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0 ) : NULL;
+			if( pool == MAP_FAILED ) {
+				fprintf( stderr, "mmap: %s\n", strerror( errno ) );
+				goto out;
+			}
+			memset( &b, 0, sizeof( b ) );
+			b.fd = fd[ 0 ];
+			pthread_create( &reader, NULL, pipe_bench_reader, &b );
+
+			clock_gettime( CLOCK_MONOTONIC, &t0 );
+			clock_gettime( CLOCK_THREAD_CPUTIME_ID, &c0 );
+			for( done = head = sent = 0; done < TOTAL; done += blk ) {
+				if( !splice ) {
+					memcpy( buf, src, blk );
+					for( len = 0; len < blk; len += ret )
+						if( ( ret = write( fd[ 1 ], buf + len, blk - len ) ) <= 0 )
+							break;
+					continue;
+				}
+				if( head + blk > pool_size ) {	// as stdout_output():  the blocks go in one after another, out a page at a time
+					pipe_bench_splice( fd[ 1 ], pool + sent, head - sent );
+					head = sent = 0;
+				}
+				memcpy( pool + head, src, blk );
+				head += blk;
+				sent += pipe_bench_splice( fd[ 1 ], pool + sent, ( head & ~( page - 1 ) ) - sent );
+			}
+			if( splice )
+				pipe_bench_splice( fd[ 1 ], pool + sent, head - sent );
+			clock_gettime( CLOCK_THREAD_CPUTIME_ID, &c1 );
+			close( fd[ 1 ] );
+			pthread_join( reader, NULL );
+			clock_gettime( CLOCK_MONOTONIC, &t1 );
+			close( fd[ 0 ] );
+			if( pool )
+				munmap( pool, pool_size );
+
+			cpu = ( c1.tv_sec - c0.tv_sec ) + ( c1.tv_nsec - c0.tv_nsec ) * 1e-9;
+			wall = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) * 1e-9;
+			fprintf( stderr, "   %-7zu %-10s %12.1f %12.1f %10.0f%s\n", blk, splice ? "vmsplice" : "write", cpu * 1e6 / ( b.bytes * 1e-6 ),
+				b.cpu_s * 1e6 / ( b.bytes * 1e-6 ), b.bytes * 1e-6 / wall, b.bytes != done ? "  SHORT" : "" );
+		}
+out:
+	free( src );
+	free( buf );
+}
+
+// -K:  time each kernel set against the original interleave loop in rx() and check they agree, then run the AGC regression and
+// the compact format, software decimation, resampler, channelizer and pipe benchmarks
+static void benchmark_kernels( void ) {
+
+	enum { N = 1008, REPS = 20000, NREC = 768000 * 8 };
+	static short xi[ N ], xq[ N ];
+	static short ref16[ N * 2 ], s16[ N * 2 ], refsc[ N * 2 ], refiq[ N * 2 ];
+	short *rec = NULL;
+	unsigned nrec = 0;
+	ssize_t got;
+	static int ref32[ N * 2 ], s32[ N * 2 ];
+	static float reff[ N * 2 ], f32[ N * 2 ];
+	static const int iqc[ 4 ] = { -3000, 22000, 900, -1234567 };	// -E at its limits, so some of Q clips
+	struct timespec t0, t1;
+	const struct kernels *k;
+	short *p;
+	int i, j, r, bad;
+	double ns[ 9 ], refst[ 5 ] = { 0 }, st[ 5 ];
+	unsigned seed = 1;
+
+	for( i = 0; i < N; i++ ) {
+		seed = seed * 1103515245 + 12345;
+		xi[ i ] = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		xq[ i ] = seed >> 16;
+	}
+
+#define TIME_NS( expr ) ( { clock_gettime( CLOCK_MONOTONIC, &t0 ); for( r = 0; r < REPS; r++ ) { expr; __asm__ volatile( "" ::: "memory" ); } \
+	clock_gettime( CLOCK_MONOTONIC, &t1 ); ( ( t1.tv_sec - t0.tv_sec ) * 1e9 + ( t1.tv_nsec - t0.tv_nsec ) ) / ( (double)REPS * N ); } )
+
+	ns[ 0 ] = TIME_NS( for( i = 0, p = ref16; i < N; i++, p += 2 ) { p[ 0 ] = xi[ i ]; p[ 1 ] = xq[ i ]; } );
+	interleave_s32_scalar( ref32, xi, xq, N );
+	interleave_f32_scalar( reff, xi, xq, N );
+	memcpy( refsc, ref16, sizeof( refsc ) );
+	scale_s16_scalar( refsc, N, 20000, 181 );	// a ramp from -10 to +12 dB, clipping at the top
+	iq_correct_scalar( refiq, xi, xq, N, iqc );
+	iq_stats_scalar( xi, xq, N, refst );
+
+	fprintf( stderr, "Kernel benchmark, %d I/Q pairs per block, ns per I/Q pair:\n", N );
+	fprintf( stderr, "   original rx() loop:  %.3f\n", ns[ 0 ] );
+	fprintf( stderr, "   %-8s %10s %10s %10s %10s %10s %10s %10s %10s\n", "kernels", "il_s16", "il_s32", "il_f32", "s16->s32", "s16->f32", "gain",
+		"iq_corr", "iq_stats" );
+
+	for( j = 0; j < sizeof( all_kernels ) / sizeof( all_kernels[ 0 ] ); j++ ) {
+		k = all_kernels[ j ];
+		if( !kernels_supported( k ) ) {
+			fprintf( stderr, "   %-8s (not supported by this CPU)\n", k->name );
+			continue;
+		}
+		ns[ 1 ] = TIME_NS( k->interleave_s16( s16, xi, xq, N ) );
+		ns[ 2 ] = TIME_NS( k->interleave_s32( s32, xi, xq, N ) );
+		ns[ 3 ] = TIME_NS( k->interleave_f32( f32, xi, xq, N ) );
+		fprintf( stderr, "   %-8s %10.3f %10.3f %10.3f", k->name, ns[ 1 ], ns[ 2 ], ns[ 3 ] );
+		if( memcmp( s16, ref16, sizeof( s16 ) ) || memcmp( s32, ref32, sizeof( s32 ) ) || memcmp( f32, reff, sizeof( f32 ) ) )
+			fprintf( stderr, "  MISMATCH in interleave" );
+		ns[ 4 ] = TIME_NS( k->s16_to_s32( s32, ref16, N * 2 ) );
+		ns[ 5 ] = TIME_NS( k->s16_to_f32( f32, ref16, N * 2 ) );
+		fprintf( stderr, " %10.3f %10.3f", ns[ 4 ], ns[ 5 ] );
+		if( memcmp( s32, ref32, sizeof( s32 ) ) || memcmp( f32, reff, sizeof( f32 ) ) )
+			fprintf( stderr, "  MISMATCH in conversion" );
+		ns[ 6 ] = TIME_NS( k->scale_s16( s16, N, 65536, 0 ) );
+		memcpy( s16, ref16, sizeof( s16 ) );
+		k->scale_s16( s16, N, 20000, 181 );
+		fprintf( stderr, " %10.3f%s", ns[ 6 ], memcmp( s16, refsc, sizeof( s16 ) ) ? "  MISMATCH in gain" : "" );
+		ns[ 7 ] = TIME_NS( k->iq_correct( s16, xi, xq, N, iqc ) );
+		ns[ 8 ] = TIME_NS( st[ 0 ] = 0; k->iq_stats( xi, xq, N, st ) );
+		memset( st, 0, sizeof( st ) );
+		k->iq_stats( xi, xq, N, st );
+		for( i = bad = 0; i < 5; i++ )	// the products are summed in float:  close, not exact
+			bad |= fabs( st[ i ] - refst[ i ] ) > 1e-6 * fabs( refst[ i ] ) + 1;
+		fprintf( stderr, " %10.3f %10.3f%s%s\n", ns[ 7 ], ns[ 8 ], memcmp( s16, refiq, sizeof( s16 ) ) ? "  MISMATCH in iq_corr" : "",
+			bad ? "  MISMATCH in iq_stats" : "" );
+	}
+#undef TIME_NS
+
+	if( !isatty( 0 ) ) {	// recorded I/Q on stdin
+		rec = malloc( NREC * 2 * sizeof( short ) );
+		while( nrec < NREC && ( got = read( 0, rec + nrec * 2, ( NREC - nrec ) * 2 * sizeof( short ) ) ) > 0 )
+			nrec += got / ( 2 * sizeof( short ) );	// a trailing partial I/Q pair is ignored
+	}
+	check_agc_engines( rec, nrec );
+	benchmark_wire( rec, nrec );
+	free( rec );
+	benchmark_decimation();
+	benchmark_resampler();
+	benchmark_channelizer();
+	benchmark_pipe();
+
+	select_kernels();
+	fprintf( stderr, "Selected kernels:  %s\n", kern->name );
+}
+
+// ALSA output.  pcm_setup() sets the hardware and software parameters explicitly so the period and buffer
+// sizes are known (and reported) rather than whatever snd_pcm_set_params() derives from one latency figure.
+// With -m the PCM uses mmap access:  the caller gets a pointer into the driver's buffer from pcm_area(),
+// writes the block there and hands it over with pcm_commit(), which saves the copy done by snd_pcm_writei().
+
+static snd_pcm_format_t pcm_format( void ) {
+
+	return rcv->out_format == FMT_S32 ? SND_PCM_FORMAT_S32_LE : rcv->out_format == FMT_F32 ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_S16_LE;
+}
+
+static int pcm_setup( unsigned rate, unsigned latency_us ) {
+
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	unsigned buffer_us = latency_us, period = rcv->period_us ? rcv->period_us : latency_us / 4;
+	int ret, dir = 0;
+
+	snd_pcm_hw_params_malloc( &hw );
+	snd_pcm_sw_params_malloc( &sw );
+
+	if( ( ret = snd_pcm_hw_params_any( rcv->pcm, hw ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_rate_resample( rcv->pcm, hw, 0 ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_access( rcv->pcm, hw, rcv->pcm_mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_format( rcv->pcm, hw, pcm_format() ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_channels( rcv->pcm, hw, rcv->channels ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_rate( rcv->pcm, hw, rate, 0 ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_buffer_time_near( rcv->pcm, hw, &buffer_us, &dir ) ) < 0
+		|| ( ret = snd_pcm_hw_params_set_period_time_near( rcv->pcm, hw, &period, &dir ) ) < 0
+		|| ( ret = snd_pcm_hw_params( rcv->pcm, hw ) ) < 0 ) {
+		fprintf( stderr, "snd_pcm_hw_params: %s\n", snd_strerror( ret ) );
+		goto out;
+	}
+	snd_pcm_hw_params_get_buffer_size( hw, &rcv->pcm_buffer );
+	snd_pcm_hw_params_get_period_size( hw, &rcv->pcm_period, &dir );
+
+	rcv->pcm_rate = rate;
+	rcv->pcm_target = rcv->fill_us ? (snd_pcm_uframes_t)rate * rcv->fill_us / 1000000 : rcv->pcm_buffer / 2;
+	if( rcv->pcm_target + rcv->pcm_period > rcv->pcm_buffer )
+		rcv->pcm_target = rcv->pcm_buffer > rcv->pcm_period ? rcv->pcm_buffer - rcv->pcm_period : rcv->pcm_buffer / 2;
+	rcv->pcm_fill = rcv->pcm_target;
+	rcv->pcm_zero = calloc( rcv->pcm_period, rcv->channels * rcv->out_bps );	// all three formats have all-zero silence
+
+	// start at the target fill, wake us a period at a time
+	if( ( ret = snd_pcm_sw_params_current( rcv->pcm, sw ) ) < 0
+		|| ( ret = snd_pcm_sw_params_set_start_threshold( rcv->pcm, sw, rcv->pcm_target ) ) < 0
+		|| ( ret = snd_pcm_sw_params_set_avail_min( rcv->pcm, sw, rcv->pcm_period ) ) < 0
+		|| ( ret = snd_pcm_sw_params( rcv->pcm, sw ) ) < 0 )
+		fprintf( stderr, "snd_pcm_sw_params: %s\n", snd_strerror( ret ) );
+out:
+	snd_pcm_hw_params_free( hw );
+	snd_pcm_sw_params_free( sw );
+	return ret;
+}
+
+static void pcm_xrun( int err );
+
+// Contiguous free space in the mmap'ed buffer for up to *frames frames (*frames is reduced to what there is).
+// NULL if the buffer is full.  Each successful call must be followed by pcm_commit().
+static void *pcm_area( snd_pcm_uframes_t *frames ) {
+
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_sframes_t avail;
+	int ret;
+
+	if( ( avail = snd_pcm_avail_update( rcv->pcm ) ) < 0 ) {
+		pcm_xrun( avail );
+		if( ( avail = snd_pcm_avail_update( rcv->pcm ) ) < 0 )
+			return NULL;
+	}
+	if( (snd_pcm_uframes_t)avail < *frames )
+		*frames = avail;
+	if( !*frames )
+		return NULL;
+
+	if( ( ret = snd_pcm_mmap_begin( rcv->pcm, &areas, &rcv->pcm_offset, frames ) ) < 0 ) {
+		fprintf( stderr, "snd_pcm_mmap_begin: %s\n", snd_strerror( ret ) );
+		return NULL;
+	}
+	return (char *)areas[ 0 ].addr + ( areas[ 0 ].first + rcv->pcm_offset * areas[ 0 ].step ) / 8;
+}
+
+static void pcm_commit( snd_pcm_uframes_t frames ) {
+
+	snd_pcm_sframes_t ret;
+
+	if( ( ret = snd_pcm_mmap_commit( rcv->pcm, rcv->pcm_offset, frames ) ) < 0 || (snd_pcm_uframes_t)ret != frames ) {
+		pcm_xrun( ret < 0 ? ret : -EPIPE );
+		return;
+	}
+
+	// mmap writes don't trigger the start threshold - start by hand once the buffer reaches it
+	if( snd_pcm_state( rcv->pcm ) == SND_PCM_STATE_PREPARED && rcv->pcm_buffer - snd_pcm_avail_update( rcv->pcm ) >= rcv->pcm_target )
+		if( ( ret = snd_pcm_start( rcv->pcm ) ) < 0 )
+			fprintf( stderr, "snd_pcm_start: %s\n", snd_strerror( ret ) );
+}
+
+// Room for a whole block in one piece of the mmap'ed buffer, for rx() to interleave into, or NULL.  process_block()
+// commits it.
+static void *pcm_block( unsigned numSamples ) {
+
+	snd_pcm_uframes_t frames = numSamples;
+	void *area = pcm_area( &frames );
+
+	if( area && frames < numSamples ) {	// wraps - give it back, process_block() will copy it in two pieces
+		pcm_commit( 0 );
+		area = NULL;
+	}
+	return rcv->pcm_zc = area;
+}
+
+// Copy a block into the mmap'ed buffer, converting from S16 on the way if obuf is NULL.  Whatever does not fit
+// is dropped, as snd_pcm_writei() would in non-blocking mode.
+static void pcm_mmap_write( short *buf, const void *obuf, unsigned numSamples ) {
+
+	snd_pcm_uframes_t frames;
+	void *area;
+	unsigned done;
+
+	for( done = 0; done < numSamples; done += frames ) {
+		frames = numSamples - done;
+		if( !( area = pcm_area( &frames ) ) ) {
+			rcv->pcm_dropped += numSamples - done;
+			return;
+		}
+		if( obuf )
+			memcpy( area, (const char *)obuf + done * rcv->channels * rcv->out_bps, frames * rcv->channels * rcv->out_bps );
+		else if( rcv->out_format == FMT_S16 )
+			memcpy( area, buf + done * 2, frames * 2 * sizeof( short ) );
+		else
+			convert( area, buf + done * 2, frames );
+		memcpy( rcv->pcm_last, (char *)area + ( frames - 1 ) * rcv->channels * rcv->out_bps, rcv->channels * rcv->out_bps );
+		pcm_commit( frames );
+	}
+}
+
+// Write n frames of silence, or as many as fit
+static void pcm_silence( snd_pcm_uframes_t n ) {
+
+	snd_pcm_uframes_t frames;
+	snd_pcm_sframes_t ret;
+	void *area;
+
+	for( ; n; n -= frames ) {
+		frames = n < rcv->pcm_period ? n : rcv->pcm_period;
+		if( rcv->pcm_mmap ) {
+			if( !( area = pcm_area( &frames ) ) )
+				return;
+			memset( area, 0, frames * rcv->channels * rcv->out_bps );
+			pcm_commit( frames );
+		}
+		else if( ( ret = snd_pcm_writei( rcv->pcm, rcv->pcm_zero, frames ) ) <= 0 )
+			return;
+		else
+			frames = ret;
+	}
+}
+
+// Recover from an xrun:  prepare the PCM again and pre-fill it with silence to the target level, so that
+// playback restarts with the usual margin rather than on the edge (or on repeated audio).
+static void pcm_xrun( int err ) {
+
+	int ret;
+
+	rcv->pcm_xruns++;
+	if( err != -EPIPE )
+		fprintf( stderr, "ALSA output error: %s\n", snd_strerror( err ) );
+	else if( verbose )
+		fprintf( stderr, "ALSA underrun, %lu total\n", rcv->pcm_xruns );
+
+	if( ( ret = snd_pcm_prepare( rcv->pcm ) ) < 0 ) {
+		fprintf( stderr, "snd_pcm_prepare: %s\n", snd_strerror( ret ) );
+		return;
+	}
+	pcm_silence( rcv->pcm_target );
+	rcv->pcm_fill = rcv->pcm_target;
+	rcv->pcm_frac = 0;
+}
+
+// Fill-level control.  The RSP and sound card clocks drift apart, so the buffer would slowly drain or fill
+// until it xruns.  The fill is smoothed over about a second and steered back to the target by a PI
+// controller whose output, at most PCM_MAXPPM, is applied by dropping or repeating a single frame now and
+// then.  Returns -1 to drop a frame from this block, 1 to repeat one after it, else 0.
+#define PCM_MAXPPM 1000
+
+static int pcm_control( unsigned numSamples ) {
+
+	snd_pcm_sframes_t avail, delay;
+	double dt = (double)numSamples / rcv->pcm_rate, err, corr;
+
+	if( snd_pcm_state( rcv->pcm ) != SND_PCM_STATE_RUNNING || snd_pcm_avail_delay( rcv->pcm, &avail, &delay ) < 0 )
+		return 0;
+
+	rcv->pcm_fill += ( delay - rcv->pcm_fill ) * ( dt < 1 ? dt : 1 );
+	err = ( rcv->pcm_fill - rcv->pcm_target ) / rcv->pcm_rate;		// seconds too full
+	rcv->pcm_integral += err * dt / 400;					// integral time 20 s
+	rcv->pcm_integral = fmax( -PCM_MAXPPM * 1e-6, fmin( PCM_MAXPPM * 1e-6, rcv->pcm_integral ) );
+	corr = fmax( -PCM_MAXPPM * 1e-6, fmin( PCM_MAXPPM * 1e-6, err / 10 + rcv->pcm_integral ) );
+
+	if( ( rcv->pcm_frac += corr * numSamples ) >= 1 ) {
+		rcv->pcm_frac -= 1;
+		rcv->pcm_removed++;
+		return -1;
+	}
+	if( rcv->pcm_frac <= -1 ) {
+		rcv->pcm_frac += 1;
+		rcv->pcm_inserted++;
+		return 1;
+	}
+	return 0;
+}
+
+// Hand a block to ALSA, obuf in the output format (or, with -m, S16 buf to convert on the way in)
+static void pcm_output( short *buf, void *obuf, unsigned numSamples ) {
+
+	int adj = numSamples > 1 ? pcm_control( numSamples ) : 0;
+	unsigned n = numSamples - ( adj < 0 );
+	snd_pcm_sframes_t ret;
+
+	if( rcv->pcm_mmap ) {	// already in the driver's buffer if rx() got it from pcm_block(), else copy/convert it in
+		if( rcv->pcm_zc && ( obuf ? obuf : buf ) == rcv->pcm_zc ) {
+			memcpy( rcv->pcm_last, (char *)rcv->pcm_zc + ( n - 1 ) * rcv->channels * rcv->out_bps, rcv->channels * rcv->out_bps );
+			pcm_commit( n );
+		}
+		else
+			pcm_mmap_write( buf, obuf, n );
+		rcv->pcm_zc = NULL;
+		if( adj > 0 )
+			pcm_mmap_write( NULL, memcpy( alloca( rcv->channels * rcv->out_bps ), rcv->pcm_last, rcv->channels * rcv->out_bps ), 1 );
+		return;
+	}
+
+	if( ( ret = snd_pcm_writei( rcv->pcm, obuf, n ) ) < 0 ) {
+		if( ret != -EAGAIN ) {
+			pcm_xrun( ret );
+			ret = snd_pcm_writei( rcv->pcm, obuf, n );
+		}
+		if( ret < 0 ) {
+			rcv->pcm_dropped += n;
+			return;
+		}
+	}
+	rcv->pcm_dropped += n - ret;
+	memcpy( rcv->pcm_last, (char *)obuf + ( n - 1 ) * rcv->channels * rcv->out_bps, rcv->channels * rcv->out_bps );
+	if( adj > 0 && snd_pcm_writei( rcv->pcm, rcv->pcm_last, 1 ) != 1 )
+		rcv->pcm_dropped++;
+}
+
+// Compact output (-F p12, s8 or bfp, see iqpack.h):  the S16 output is packed by the SIMD kernels on its way to
+// stdout, a block to a unit, or to the network, a packet to a unit.  Everything before it works in S16 as usual.
+// The bytes in and out are counted for the exit report.
+static size_t wire_pack( void *out, const short *buf, unsigned numSamples ) {
+
+	struct iqpack_header *h = out;
+	size_t n = (size_t)numSamples * rcv->channels;
+	unsigned peak, count;
+
+	h->magic = IQPACK_MAGIC;
+	h->format = rcv->wire;
+	h->channels = rcv->channels;
+	h->pad = 0;
+	h->frames = numSamples;
+	h->scale = 1;
+	if( rcv->wire == IQPACK_P12 )
+		kern->pack_p12( (uint8_t *)( h + 1 ), buf, n );
+	else if( rcv->wire == IQPACK_S8 ) {
+		kern->peak_count( buf, n, 32767, &peak, &count );
+		if( !peak )
+			peak = 1;
+		h->scale = peak / 127.0f;
+		kern->pack_s8( (int8_t *)( h + 1 ), buf, n, 127.0f / peak );
+	}
+	else
+		kern->pack_bfp( (uint8_t *)( h + 1 ), buf, n );
+	rcv->wire_in += n * sizeof( short );
+	rcv->wire_out += sizeof( *h ) + iqpack_size( rcv->wire, n );
+	return sizeof( *h ) + iqpack_size( rcv->wire, n );
+}
+
+// Network output (-o udp://... or tcp://...) is iqnet.c's (see iqnet.h).  The compact formats are packed here, a
+// unit for each packet, with the kernels in use.
+static size_t net_pack( void *arg, void *out, const short *in, unsigned frames ) {
+
+	return wire_pack( out, in, frames );
+}
+
+// Shared memory output (-o shm://name):  a ring that any number of local readers follow independently, see
+// iqshm.h.  It holds about a second;  a reader further behind than that skips ahead.
+static int shm_open_ring( void ) {
+
+	uint64_t size, want = (uint64_t)rcv->rate * rcv->channels * rcv->out_bps;
+
+	for( size = 1 << 20; size < want; size <<= 1 )
+		;
+	if( !( rcv->shm = iqshm_create( rcv->out + 6, size, rcv->rate, rcv->out_format, rcv->channels, rcv->out_bps ) ) ) {
+		fprintf( stderr, "%s: %s\n", rcv->out, strerror( errno ) );
+		return 1;
+	}
+	return 0;
+}
+
+// Room in the ring for rx() to interleave a block into
+static void *shm_block( unsigned numSamples ) {
+
+	return rcv->shm_zc = iqshm_begin( rcv->shm, (size_t)numSamples * rcv->channels * rcv->out_bps );
+}
+
+static void shm_output( const void *obuf, unsigned numSamples ) {
+
+	size_t len = (size_t)numSamples * rcv->channels * rcv->out_bps;
+
+	if( obuf != rcv->shm_zc )	// not already there
+		memcpy( iqshm_begin( rcv->shm, len ), obuf, len );
+	iqshm_commit( rcv->shm, rcv->block_ns, rcv->gain_reduction );
+	rcv->shm_zc = NULL;
+}
+
+// SigMF recording (-o sigmf://path) is iqrec.c's (see iqrec.h).  It asks for the settings of the receiver it records
+// each time it describes them, from its own thread, as they can change under it (-C).
+static void rec_settings( void *arg, struct rec_settings *s ) {
+
+	struct receiver *r = arg;
+
+	s->freq[ 0 ] = r->freq;
+	s->freq[ 1 ] = r->quad ? r->peer->freq : 0;
+	snprintf( s->hw, sizeof( s->hw ), "SDRplay %s%s", r->sernum,
+		r->quad ? " tuners A and B" : r->tuner == sdrplay_api_Tuner_B ? " tuner B" : r->peer ? " tuner A" : "" );
+	s->fs_hz = r->adc_rate;
+	s->decimation = r->decimation;
+	s->software_decimation = r->swdec;
+	s->resample_L = r->rs_L;
+	s->resample_M = r->rs_M;
+	s->lna_state = r->lna;
+	s->bandwidth_khz = r->bwtype;
+	s->agc = r->AGCEnable;
+}
+
+// Note a gain change of rcv's tuner for the recording's annotations, at the frame where it took effect
+static void rec_gain( int gain_reduction ) {
+
+	if( rcv->rec )
+		rec_event( rcv->rec, gain_reduction, 0 );
+	else if( rcv->peer && rcv->peer->quad && rcv->peer->rec )	// tuner B, recorded with tuner A
+		rec_event( rcv->peer->rec, gain_reduction, 1 );
+}
+
+// Stdout (no '-o'):  usually a pipe into the WebSDR.  The pipe is grown with F_SETPIPE_SZ to hold PIPE_MS of output
+// (as far as /proc/sys/fs/pipe-max-size lets an unprivileged process) and written to, short writes and all, as are
+// files and terminals.
+// With '-j' the pipe is filled with vmsplice() instead, from a pool of page-aligned memory that rx() interleaves
+// straight into, so the pipe takes the pool's pages instead of a copy of them and the reader's read() is the only
+// copy made.  Blocks go into the pool one after another and go to the pipe a whole page at a time;  the part-filled
+// last page waits for the next block.  The pool is reused:  a block is only put where the pool held samples that
+// went to the pipe more than two pipes' worth ago, which a reader that read()s the pipe (as the WebSDR does) has
+// taken by then.  A reader that splice()s or tee()s the pages on (pv, socat, a relay) can hold them longer and would
+// then see them rewritten, so '-j' is only for a reader that reads.  It pays for blocks of 16 KiB and more ("-K"):
+// below that each vmsplice() costs more than the copy it saves.  In the API callback nothing waits for the reader -
+// a block that finds the pipe still has no room for what was already waiting is dropped whole and counted, so the
+// stream stays in step - but the '-q' writer thread, a channel's thread and a replay wait for it, as a write() does.
+#define PIPE_MS 250				// pipe size aimed for, in ms of output
+#define PIPE_MIN ( 1 << 20 )	// ... but not less than this
+
+static void pipe_open( void ) {
+
+	struct stat st;
+	long want, max;
+	FILE *f;
+
+	if( fstat( 1, &st ) || !S_ISFIFO( st.st_mode ) )
+		return;
+	want = (long)rcv->rate * rcv->channels * rcv->out_bps * PIPE_MS / 1000;
+	if( want < PIPE_MIN )
+		want = PIPE_MIN;
+	if( fcntl( 1, F_GETPIPE_SZ ) < want && fcntl( 1, F_SETPIPE_SZ, want ) < 0 && ( f = fopen( "/proc/sys/fs/pipe-max-size", "r" ) ) ) {
+		if( fscanf( f, "%ld", &max ) == 1 && max < want && fcntl( 1, F_GETPIPE_SZ ) < max )	// as much as we may have
+			fcntl( 1, F_SETPIPE_SZ, max );
+		fclose( f );
+	}
+	if( ( rcv->pipe_size = fcntl( 1, F_GETPIPE_SZ ) ) < 0 )
+		rcv->pipe_size = 0;
+	rcv->pipe_page = sysconf( _SC_PAGESIZE );
+}
+
+// vmsplice() flags:  only the API callback must not wait for the reader
+static int pipe_flags( void ) {
+
+	return rcv->ring_buf || rcv->replay || rcv->chan_of ? 0 : SPLICE_F_NONBLOCK;
+}
+
+// Splice what is waiting in the pool into the pipe, as much of it as the pipe has room for:  the whole pages, or
+// with 'all' the last part-filled one too (which must then not be added to)
+static void pipe_send( int all, int flags ) {
+
+	size_t page = rcv->pipe_page;
+	struct iovec iov;
+	ssize_t ret;
+
+	if( !all && rcv->pipe_head < rcv->pipe_sent + page )
+		return;
+	iov.iov_base = rcv->pipe_pool + rcv->pipe_sent;
+	iov.iov_len = all ? rcv->pipe_head - rcv->pipe_sent : ( rcv->pipe_head & ~( page - 1 ) ) - rcv->pipe_sent;
+	while( iov.iov_len ) {
+		if( ( ret = vmsplice( 1, &iov, 1, flags ) ) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			if( errno != EAGAIN && !rcv->pipe_errors++ )
+				fprintf( stderr, "vmsplice: %s\n", strerror( errno ) );
+			break;
+		}
+		rcv->pipe_calls++;
+		if( (size_t)ret < iov.iov_len )
+			rcv->pipe_partial++;
+		iov.iov_base = (char *)iov.iov_base + ret;
+		iov.iov_len -= ret;
+		rcv->pipe_sent += ret;
+		rcv->pipe_bytes += ret;
+	}
+}
+
+// Room in the pool for a block of len bytes, or NULL
+static char *pipe_space( size_t len ) {
+
+	size_t page = rcv->pipe_page;
+	void *p;
+
+	if( len > rcv->pipe_blk ) {	// the first block, or a bigger one than the pool was made for
+		if( rcv->pipe_head != rcv->pipe_sent )
+			pipe_send( 1, pipe_flags() );
+		if( rcv->pipe_head != rcv->pipe_sent )	// the old pool still holds some
+			return NULL;
+		if( rcv->pipe_pool )		// any of its pages still in the pipe stay there
+			munmap( rcv->pipe_pool, rcv->pipe_pool_size );
+		rcv->pipe_pool = NULL;
+		rcv->pipe_blk = 2 * ( ( len + page - 1 ) & ~( page - 1 ) );
+		rcv->pipe_pool_size = 2 * ( (size_t)rcv->pipe_size + 2 * rcv->pipe_blk );
+		rcv->pipe_head = rcv->pipe_sent = 0;
+		if( ( p = mmap( NULL, rcv->pipe_pool_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0 ) ) == MAP_FAILED ) {
+			rcv->pipe_blk = 0;
+			return NULL;
+		}
+		rcv->pipe_pool = p;
+	}
+	if( rcv->pipe_head - rcv->pipe_sent + len > rcv->pipe_blk + page )	// the pipe is not taking what is waiting
+		return NULL;
+	if( rcv->pipe_head + len > rcv->pipe_pool_size ) {	// back to the start, once the rest has gone
+		pipe_send( 1, pipe_flags() );
+		if( rcv->pipe_head != rcv->pipe_sent )
+			return NULL;
+		rcv->pipe_head = rcv->pipe_sent = 0;
+	}
+	return rcv->pipe_pool + rcv->pipe_head;
+}
+
+static void *pipe_block( unsigned numSamples ) {
+
+	return rcv->pipe_zc = pipe_space( (size_t)numSamples * rcv->channels * rcv->out_bps );
+}
+
+// At exit, once the stream has stopped:  the last part-filled page
+static void pipe_flush( void ) {
+
+	if( rcv->pipe_pool )
+		pipe_send( 1, 0 );
+}
+
+static void stdout_write( const char *p, size_t len ) {
+
+	ssize_t ret;
+
+	while( len ) {
+		if( ( ret = write( 1, p, len ) ) > 0 ) {
+			p += ret;
+			len -= ret;
+		}
+		else if( ret < 0 && errno == EINTR )
+			continue;
+		else {
+			if( !rcv->pipe_errors++ )
+				fprintf( stderr, "write: %s\n", ret ? strerror( errno ) : "returned 0" );
+			return;
+		}
+	}
+}
+
+static void stdout_output( const void *obuf, unsigned numSamples ) {
+
+	size_t len = (size_t)numSamples * rcv->channels * rcv->out_bps;
+	char *p;
+
+	if( !rcv->pipe_splice || !rcv->pipe_size ) {
+		if( rcv->wire ) {	// packed
+			p = SCRATCH( rcv->scratch[ 1 ], len + sizeof( struct iqpack_header ) );
+			len = wire_pack( p, obuf, numSamples );
+			obuf = p;
+		}
+		stdout_write( obuf, len );
+		return;
+	}
+
+	if( obuf == rcv->pipe_zc )	// already there
+		p = rcv->pipe_zc;
+	else if( !( p = pipe_space( len + ( rcv->wire ? sizeof( struct iqpack_header ) : 0 ) ) ) ) {
+		pipe_send( 0, pipe_flags() );
+		rcv->pipe_dropped += numSamples;
+		return;
+	}
+	else if( rcv->wire )
+		len = wire_pack( p, obuf, numSamples );
+	else
+		memcpy( p, obuf, len );
+	rcv->pipe_zc = NULL;
+	rcv->pipe_head += len;
+	pipe_send( 0, pipe_flags() );
+}
+
+// Where rx() can interleave a block so that it is already in the output - the mmap'ed ALSA buffer, the shared
+// memory ring, a recording chunk or the pipe's pool - else NULL
+static void *direct_block( unsigned numSamples ) {
+
+	if( rcv->quad )		// tuner A's output holds both tuners
+		return NULL;
+	if( rcv->pcm && rcv->pcm_mmap )
+		return pcm_block( numSamples );
+	if( rcv->shm )
+		return shm_block( numSamples );
+	if( rcv->rec )
+		return rec_block( rcv->rec, numSamples, rcv->block_ns );
+	if( rcv->pipe_splice && rcv->pipe_size && !rcv->wire )
+		return pipe_block( numSamples );
+	return NULL;
+}
+
+// Send a block to rcv's output:  ALSA, the network, shared memory, a recording or stdout
+static void output( short *buf, void *obuf, unsigned numSamples ) {
+
+    if( rcv->net ) {
+		net_output( rcv->net, obuf, numSamples, rcv->block_ns, rcv->gain_reduction,
+			rcv->wire ? SCRATCH( rcv->scratch[ 1 ], net_wire_size( rcv->net, numSamples ) ) : NULL );
+    }
+    else if( rcv->shm ) {
+		shm_output( obuf, numSamples );
+    }
+    else if( rcv->rec ) {
+		rec_output( rcv->rec, obuf, numSamples, rcv->block_ns );
+    }
+    else if( rcv->pcm ) {		// Send samples to audio (ALSA) device
+		pcm_output( buf, obuf, numSamples );
+    } 
+	else {		// Send samples to STDOUT
+		stdout_output( obuf, numSamples );
+	}
+}
+
+// 4-channel output of an RSPduo in dual-tuner mode.  The API delivers each block of samples to the tuner A and
+// tuner B callbacks in turn, with the same firstSampleNum, so the first of the two to arrive waits in tuner A's
+// receiver and the second interleaves them frame by frame and sends the result to tuner A's output.  A block
+// that finds nothing to pair with (its partner was lost or ran short) is dropped and counted.
+static void quad_output( const void *obuf, unsigned numSamples ) {
+
+	struct receiver *self = rcv, *a = rcv->tuner == sdrplay_api_Tuner_B ? rcv->peer : rcv;
+	unsigned i, fb = 2 * self->out_bps;
+	const char *pa, *pb;
+	char *out;
+
+	pthread_mutex_lock( &a->quad_lock );
+	if( !a->quad_n || a->quad_from == self->tuner || a->quad_num != self->sample_num || a->quad_n != numSamples ) {
+		a->quad_dropped += a->quad_n;	// first of a pair:  hold it (in place of anything stale)
+		a->quad_n = 0;
+		if( (size_t)numSamples * fb > a->quad_size )	// more than pair_tuners() made room for
+			a->quad_dropped += numSamples;
+		else {
+			memcpy( a->quad_buf, obuf, (size_t)numSamples * fb );
+			a->quad_n = numSamples;
+			a->quad_num = self->sample_num;
+			a->quad_from = self->tuner;
+		}
+		pthread_mutex_unlock( &a->quad_lock );
+		return;
+	}
+
+	pa = self == a ? obuf : a->quad_buf;
+	pb = self == a ? a->quad_buf : obuf;
+	out = SCRATCH( a->scratch[ 2 ], (size_t)numSamples * 2 * fb );
+	for( i = 0; i < numSamples; i++ ) {
+		memcpy( out + i * 2 * fb, pa + i * fb, fb );
+		memcpy( out + i * 2 * fb + fb, pb + i * fb, fb );
+	}
+	a->quad_n = 0;
+
+	rcv = a;
+	output( NULL, out, numSamples );
+	rcv = self;
+	pthread_mutex_unlock( &a->quad_lock );
+}
+
+// DC offset and I/Q imbalance correction (-E ms).  A zero-IF tuner's DC offset puts a spike in the middle of the band,
+// and a mismatch in the gain and phase of its I and Q paths mirrors every signal about the centre as an image.
+// iq_stats() sums the first and second moments of each block as it leaves the decimator and resampler, and their
+// running means (time constant 'ms') give the two offsets, the gain error (the ratio of the Q and I powers) and the
+// phase error (the correlation of I and Q).  The block is then corrected by iq_correct() in place of the interleave
+// rx() does anyway:  the offsets come off, I is left as it is and Q is made orthogonal to it at the same power,
+//	Q' = ( Q - g sin(phi) I ) / ( g cos(phi) ).
+#define IQC_MAXTAN 0.25		// corrects up to 14 degrees of phase error
+#define IQC_MAXGAIN 1.5		// and 3.5 dB of gain error
+
+// The gain (Q over I) and the sine of the phase error of the I/Q pair from rcv's running means, 0 while there is
+// too little signal to tell
+static int iqc_imbalance( double *g, double *sinp ) {
+
+	double *m = rcv->iqc_m, vii = m[ 2 ] - m[ 0 ] * m[ 0 ], vqq = m[ 3 ] - m[ 1 ] * m[ 1 ], viq = m[ 4 ] - m[ 0 ] * m[ 1 ];
+
+	if( vii < 1 || vqq < 1 )
+		return 0;
+	*g = sqrt( vqq / vii );
+	*sinp = viq / sqrt( vii * vqq );
+	return 1;
+}
+
+// rx():  take this block into the estimate and set the coefficients that correct it
+static void iqc_update( const short *xi, const short *xq, unsigned numSamples ) {
+
+	double s[ 5 ] = { 0 }, *m = rcv->iqc_m, alpha, g, sinp, a = 0, b = 1;
+	int k;
+
+	kern->iq_stats( xi, xq, numSamples, s );
+	alpha = rcv->iqc_primed ? fmin( 1, numSamples / ( rcv->rate * rcv->iqc_ms * 1e-3 ) ) : 1;
+	for( k = 0; k < 5; k++ )
+		m[ k ] += alpha * ( s[ k ] / numSamples - m[ k ] );
+	rcv->iqc_primed = 1;
+
+	if( iqc_imbalance( &g, &sinp ) ) {
+		a = fmax( -IQC_MAXTAN, fmin( IQC_MAXTAN, -sinp / sqrt( fmax( 0.01, 1 - sinp * sinp ) ) ) );	// -tan(phi)
+		b = fmax( 1 / IQC_MAXGAIN, fmin( IQC_MAXGAIN, sqrt( 1 + a * a ) / g ) );		// 1 / ( g cos(phi) )
+	}
+	rcv->iqc_c[ 0 ] = lrint( a * 16384 );
+	rcv->iqc_c[ 1 ] = lrint( b * 16384 );
+	rcv->iqc_c[ 2 ] = lrint( -m[ 0 ] );
+	rcv->iqc_c[ 3 ] = lrint( -( a * m[ 0 ] + b * m[ 1 ] ) * 16384 ) + 8192;	// and rounds
+}
+
+static void iqc_report( void ) {
+
+	double g, sinp;
+
+	if( !iqc_imbalance( &g, &sinp ) )
+		return;
+	fprintf( stderr, "IQ correction: DC offset %.1f (I) %.1f (Q) LSB, gain imbalance %.2f dB, phase error %.2f degrees\n", rcv->iqc_m[ 0 ],
+		rcv->iqc_m[ 1 ], 20 * log10( g ), asin( sinp ) * 180 / M_PI );
+}
+
+// Spectrum tap (-Q sink[?bins=N][&fps=F][&avg=A]), for setting the AGC thresholds and spotting interference without
+// an FFT tool on the output.  rx() copies a snapshot of 'bins' frames of the stream, as it leaves the decimator and
+// resampler, into a free slot fps*avg times a second, a fraction of the samples, and a thread at SCHED_IDLE
+// windows and transforms each and averages 'avg' of them into a power spectrum.  Every spectrum, with its peak and
+// noise floor (the median bin), goes out as a struct iqshm_spectrum frame (iqshm.h) to a shared memory ring
+// ('shm://name', read as the I/Q one is) or a file or FIFO.  The tap is at most one copy of a block in rx(), and
+// is timed;  a snapshot is skipped, and counted, when every slot is still waiting for the spectrum thread or the
+// '-q' ring is over half full, so under load the tap does nothing at all.
+#define SPEC_SLOTS 8
+#define SPEC_MAXBINS 8192
+
+struct spectrum {
+	unsigned bins, fps, avg;
+	unsigned every;			// frames from the start of one snapshot to the start of the next
+	short *slot[ SPEC_SLOTS ];	// snapshots, interleaved S16
+	uint64_t slot_ns[ SPEC_SLOTS ];	// block_ns of the block each ended in
+	int fd;					// file output, -1 for shared memory
+	struct iqshm *shm;
+	sem_t sem;
+	pthread_t thread;
+
+	// rx()
+	unsigned wait;			// frames to go before the next snapshot
+	unsigned have;			// frames of the snapshot under way, 0 = none
+	unsigned long taps, shed;	// callbacks that copied, snapshots skipped
+	uint64_t tap_ns, tap_max_ns;	// time spent copying
+	_Alignas(RING_ALIGN) atomic_uint head;	// snapshots filled
+
+	// spectrum thread
+	_Alignas(RING_ALIGN) atomic_uint tail;	// snapshots taken
+	unsigned done;			// averaged so far
+	short *in[ 2 ];
+	float *win, *x[ 2 ];
+	double *acc, scale;		// summed power, and what makes a full-scale tone of it 1
+	struct fft fft;
+	struct iqshm_spectrum *frame;
+	int16_t *sorted;
+	unsigned long shed_sent;
+	int peak, floor;		// of the last spectrum, dBFS * 100
+	unsigned long frames, errors;
+};
+
+// The writer thread is falling behind:  leave the samples alone
+static int spec_busy( void ) {
+
+	return rcv->ring_buf && atomic_load_explicit( &rcv->ring_head, memory_order_relaxed )
+		- atomic_load_explicit( &rcv->ring_tail, memory_order_relaxed ) > rcv->ring_size / 2;
+}
+
+// rx():  the next numSamples frames of rcv's stream, interleaved S16
+static void spec_tap( const short *buf, unsigned numSamples ) {
+
+	struct spectrum *s = rcv->spec;
+	unsigned head, n;
+	uint64_t t0;
+
+	if( !s->have && s->wait >= numSamples ) {	// nothing wanted from this block
+		s->wait -= numSamples;
+		return;
+	}
+	t0 = mono_ns();
+	while( numSamples ) {
+		if( !s->have ) {
+			if( s->wait >= numSamples ) {
+				s->wait -= numSamples;
+				break;
+			}
+			buf += 2 * s->wait;
+			numSamples -= s->wait;
+			s->wait = 0;
+			head = atomic_load_explicit( &s->head, memory_order_relaxed );
+			if( head - atomic_load_explicit( &s->tail, memory_order_acquire ) == SPEC_SLOTS || spec_busy() ) {
+				s->shed++;
+				s->wait = s->every;
+				continue;
+			}
+		}
+		head = atomic_load_explicit( &s->head, memory_order_relaxed );
+		n = numSamples < s->bins - s->have ? numSamples : s->bins - s->have;
+		memcpy( s->slot[ head % SPEC_SLOTS ] + 2 * s->have, buf, n * 2 * sizeof( short ) );
+		buf += 2 * n;
+		numSamples -= n;
+		if( ( s->have += n ) == s->bins ) {
+			s->slot_ns[ head % SPEC_SLOTS ] = rcv->block_ns;
+			atomic_store_explicit( &s->head, head + 1, memory_order_release );
+			sem_post( &s->sem );
+			s->have = 0;
+			s->wait = s->every - s->bins;
+		}
+	}
+	t0 = mono_ns() - t0;
+	s->taps++;
+	s->tap_ns += t0;
+	if( t0 > s->tap_max_ns )
+		s->tap_max_ns = t0;
+}
+
+static int spec_cmp( const void *a, const void *b ) {
+
+	return *(const int16_t *)a - *(const int16_t *)b;
+}
+
+// The averaged spectrum, with its peak and floor, out as a frame
+static void spec_publish( struct receiver *r, uint64_t ns ) {
+
+	struct spectrum *s = r->spec;
+	struct iqshm_spectrum *f = s->frame;
+	size_t len = sizeof( *f ) + s->bins * sizeof( int16_t );
+	unsigned long shed = MET_LOAD( s->shed );
+	unsigned k, peak = 0;
+	double db;
+	char *p;
+	ssize_t ret;
+
+	for( k = 0; k < s->bins; k++ ) {
+		db = 10 * log10( s->acc[ k ] * s->scale + 1e-30 );
+		f->bin[ k ] = db < -320 ? -32000 : db > 320 ? 32000 : lrint( db * 100 );
+		if( f->bin[ k ] > f->bin[ peak ] )
+			peak = k;
+	}
+	memcpy( s->sorted, f->bin, s->bins * sizeof( int16_t ) );
+	qsort( s->sorted, s->bins, sizeof( int16_t ), spec_cmp );
+
+	f->magic = IQSHM_SPECTRUM_MAGIC;
+	f->bins = s->bins;
+	f->averages = s->avg;
+	f->time_ns = ns;
+	f->seq = s->frames;
+	f->rate = r->rate;
+	f->freq = MET_LOAD( r->freq );
+	f->peak = s->peak = f->bin[ peak ];
+	f->floor = s->floor = s->sorted[ s->bins / 2 ];
+	f->peak_bin = peak;
+	f->gain_reduction = MET_LOAD( r->gain_reduction );
+	f->shed = shed - s->shed_sent;
+	s->shed_sent = shed;
+
+	if( s->shm ) {
+		memcpy( iqshm_begin( s->shm, len ), f, len );
+		iqshm_commit( s->shm, ns, f->gain_reduction );
+	}
+	else
+		for( p = (char *)f; len; len -= ret, p += ret )
+			if( ( ret = write( s->fd, p, len ) ) <= 0 ) {
+				if( !s->errors++ )
+					fprintf( stderr, "%s: Spectrum output failed: %s\n", r->spec_sink, ret ? strerror( errno ) : "short write" );
+				break;
+			}
+	s->frames++;
+}
+
+// Window, transform and average the snapshots as they come, at the lowest priority there is
+static void *spec_thread( void *arg ) {
+
+	struct receiver *r = arg;
+	struct spectrum *s = r->spec;
+	struct sched_param sp = { 0 };
+	struct pfb_kernels pk = pfb_kern();
+	unsigned tail, k, n = s->bins;
+	uint64_t ns;
+	sigset_t all;
+	float *re, *im;
+
+	sigfillset( &all );		// term() belongs on another thread
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	pthread_setschedparam( pthread_self(), SCHED_IDLE, &sp );
+	for(;;) {
+		while( sem_wait( &s->sem ) && errno == EINTR )
+			;
+		tail = atomic_load_explicit( &s->tail, memory_order_relaxed );
+		if( tail == atomic_load_explicit( &s->head, memory_order_acquire ) )
+			continue;
+		kern->deinterleave_s16( s->in[ 0 ], s->in[ 1 ], s->slot[ tail % SPEC_SLOTS ], n );
+		ns = s->slot_ns[ tail % SPEC_SLOTS ];
+		atomic_store_explicit( &s->tail, tail + 1, memory_order_release );	// the slot is rx()'s again
+
+		kern->s16_to_f32( s->x[ 0 ], s->in[ 0 ], n );
+		kern->s16_to_f32( s->x[ 1 ], s->in[ 1 ], n );
+		for( k = 0; k < n; k++ ) {
+			s->x[ 0 ][ k ] *= s->win[ k ];
+			s->x[ 1 ][ k ] *= s->win[ k ];
+		}
+		fft_run( &s->fft, s->x[ 0 ], s->x[ 1 ], &pk );
+		re = s->fft.re;
+		im = s->fft.im;
+		for( k = 0; k < n; k++ )	// negative frequencies first
+			s->acc[ ( k + n / 2 ) & ( n - 1 ) ] += (double)re[ k ] * re[ k ] + (double)im[ k ] * im[ k ];
+		if( ++s->done == s->avg ) {
+			spec_publish( r, ns );
+			memset( s->acc, 0, n * sizeof( double ) );
+			s->done = 0;
+		}
+	}
+	return arg;
+}
+
+// Set up rcv's '-Q' and start its thread.  Returns 0, or 1 after reporting an error.
+static int spec_open( void ) {
+
+	struct spectrum *s = calloc( 1, sizeof( *s ) );
+	char *sink = strdup( rcv->spec_sink ), *opts, *opt;
+	unsigned k, i;
+	uint64_t size;
+	double sum = 0;
+	struct stat st;
+	int ret;
+
+	s->bins = 1024;
+	s->fps = 10;
+	s->avg = 8;
+	if( ( opts = strchr( sink, '?' ) ) ) {
+		*opts++ = 0;
+		for( opt = strtok( opts, "&" ); opt; opt = strtok( NULL, "&" ) ) {
+			if( !strncmp( opt, "bins=", 5 ) )
+				s->bins = atoi( opt + 5 );
+			else if( !strncmp( opt, "fps=", 4 ) )
+				s->fps = atoi( opt + 4 );
+			else if( !strncmp( opt, "avg=", 4 ) )
+				s->avg = atoi( opt + 4 );
+			else {
+				fprintf( stderr, "%s: Unknown option '%s' - expected bins=N, fps=F or avg=A\n", rcv->spec_sink, opt );
+				return 1;
+			}
+		}
+	}
+	if( s->bins < 64 || s->bins > SPEC_MAXBINS || s->bins & ( s->bins - 1 ) || s->fps < 1 || s->fps > 100 || s->avg < 1 || s->avg > 1000 ) {
+		fprintf( stderr, "%s: The bins must be a power of two from 64 to %d, fps 1 to 100 and avg 1 to 1000\n", rcv->spec_sink, SPEC_MAXBINS );
+		return 1;
+	}
+	if( ( s->every = rcv->rate / ( s->fps * s->avg ) ) < s->bins )	// as often as it can, back to back
+		s->every = s->bins;
+	s->wait = s->every - s->bins;
+
+	s->fd = -1;
+	if( !strncasecmp( sink, "shm://", 6 ) ) {
+		for( size = 1 << 16; size < 4 * s->fps * ( sizeof( struct iqshm_spectrum ) + s->bins * sizeof( int16_t ) ); size <<= 1 )	// about 4 s
+			;
+		if( !( s->shm = iqshm_create( sink + 6, size, s->fps, IQSHM_SPECTRUM, 1, sizeof( int16_t ) ) ) ) {
+			fprintf( stderr, "%s: %s\n", sink, strerror( errno ) );
+			return 1;
+		}
+	}
+	else if( ( s->fd = open( sink, !stat( sink, &st ) && S_ISFIFO( st.st_mode ) ? O_RDWR | O_CLOEXEC	// a FIFO never blocks the open or EPIPEs
+			: O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) < 0 ) {
+		fprintf( stderr, "%s: %s\n", sink, strerror( errno ) );
+		return 1;
+	}
+	free( sink );
+
+	for( i = 0; i < SPEC_SLOTS; i++ ) {
+		s->slot[ i ] = malloc( s->bins * 2 * sizeof( short ) );
+		memset( s->slot[ i ], 0, s->bins * 2 * sizeof( short ) );	// pre-fault the pages now, not in the callback
+	}
+	s->in[ 0 ] = malloc( s->bins * sizeof( short ) );
+	s->in[ 1 ] = malloc( s->bins * sizeof( short ) );
+	s->x[ 0 ] = malloc( s->bins * sizeof( float ) );
+	s->x[ 1 ] = malloc( s->bins * sizeof( float ) );
+	s->win = malloc( s->bins * sizeof( float ) );
+	s->acc = calloc( s->bins, sizeof( double ) );
+	s->frame = calloc( 1, sizeof( struct iqshm_spectrum ) + s->bins * sizeof( int16_t ) );
+	s->sorted = malloc( s->bins * sizeof( int16_t ) );
+	for( k = 0; k < s->bins; k++ )		// a Kaiser window much like Blackman's:  sidelobes below -70 dB
+		sum += s->win[ k ] = kaiser( k, s->bins, 8.6 );
+	s->scale = 1 / ( sum * sum * s->avg );
+	if( fft_init( &s->fft, s->bins ) ) {
+		fprintf( stderr, "Cannot allocate the spectrum's FFT\n" );
+		return 1;
+	}
+	sem_init( &s->sem, 0, 0 );
+
+	rcv->spec = s;
+	if( ( ret = pthread_create( &s->thread, NULL, spec_thread, rcv ) ) ) {
+		fprintf( stderr, "Cannot create spectrum thread: %s\n", strerror( ret ) );
+		return 1;
+	}
+	return 0;
+}
+
+static void spec_report( void ) {
+
+	struct spectrum *s = rcv->spec;
+
+	fprintf( stderr, "Spectrum tap: %lu spectra (%lu write error(s)), %lu snapshot(s) skipped under load;  %.2f us (mean), %.2f us (max) in rx() over %lu callbacks\n",
+		s->frames, s->errors, s->shed, s->taps ? s->tap_ns * 1e-3 / s->taps : 0, s->tap_max_ns * 1e-3, s->taps );
+}
+
+// Runtime metrics (-M):  rx() and process_block() count samples, blocks, resets and gain changes and time every
+// callback into log2 histograms in the receiver's struct metrics.  Each counter has a single writer, so the hot
+// path only does plain relaxed loads and stores (no locked instructions) and reads the vDSO clock.  A metrics
+// thread of its own renders everything in the Prometheus text format:  every second to a file, replaced
+// atomically (for node_exporter's textfile collector, a cron job or a human), or on each connection to a Unix
+// socket ('-M unix:path'), as plain text or as an HTTP response if the client sends a GET.
+#define MET_BUCKETS 22		// histogram buckets up to 1, 2, 4 ... 2^21 us (2.1 s), then +Inf
+
+struct met_hist {
+	atomic_ulong bucket[ MET_BUCKETS + 1 ];
+	atomic_ulong count, sum_ns, max_ns;
+};
+
+struct metrics {
+	// written by the callback
+	struct met_hist cb_interval;	// from one callback to the next
+	struct met_hist cb_jitter;		// how far that was from the time the previous block took to sample
+	struct met_hist cb_time;		// in rx(), including process_block() unless '-q' moves it to the writer thread
+	struct met_hist retune;			// from a control socket retune to the first block at the new frequency
+	atomic_ulong callbacks, samples_in;
+	uint64_t last_ns, nominal_ns;
+
+	// written by process_block()
+	_Alignas(RING_ALIGN) struct met_hist block_time;	// in process_block():  AGC, conversion and output
+	struct met_hist lockout;		// from a gain change being posted to the end of the API's grChanged
+	atomic_ulong blocks, samples_out, resets, gain_applied;
+	uint64_t lockout_since;
+
+	// written by update_sdrplay_gain_reduction(), on the control thread
+	atomic_ulong gain_up, gain_down, gain_errors;
+	int last_gr;
+};
+
+static char *metrics_path;		// -M
+static int met_fd = -1;			// listening Unix socket
+static pthread_t met_thread;
+static time_t met_started;
+
+static inline void met_add( atomic_ulong *c, unsigned long v ) {	// only ever from one thread
+
+	atomic_store_explicit( c, atomic_load_explicit( c, memory_order_relaxed ) + v, memory_order_relaxed );
+}
+
+static void met_observe( struct met_hist *h, uint64_t ns ) {
+
+	uint64_t us = ( ns + 999 ) / 1000;
+	int i = us <= 1 ? 0 : 64 - __builtin_clzll( us - 1 );	// the first bucket whose bound is >= us
+
+	met_add( h->bucket + ( i < MET_BUCKETS ? i : MET_BUCKETS ), 1 );
+	met_add( &h->count, 1 );
+	met_add( &h->sum_ns, ns );
+	if( ns > atomic_load_explicit( &h->max_ns, memory_order_relaxed ) )
+		atomic_store_explicit( &h->max_ns, ns, memory_order_relaxed );
+}
+
+// The start of a callback of numSamples samples
+static void met_callback( struct metrics *m, uint64_t t, unsigned numSamples ) {
+
+	if( m->last_ns ) {
+		met_observe( &m->cb_interval, t - m->last_ns );
+		met_observe( &m->cb_jitter, t - m->last_ns > m->nominal_ns ? t - m->last_ns - m->nominal_ns : m->nominal_ns - ( t - m->last_ns ) );
+	}
+	m->last_ns = t;
+	m->nominal_ns = (uint64_t)numSamples * 1000000000 / rcv->cb_rate;
+	met_add( &m->callbacks, 1 );
+	met_add( &m->samples_in, numSamples );
+}
+
+// A gain update sent to the API (or the replay), ret its result
+static void met_gain( int ret, int gain_reduction ) {
+
+	struct metrics *m = rcv->met;
+
+	if( !m )
+		return;
+	if( ret )
+		atomic_fetch_add_explicit( &m->gain_errors, 1, memory_order_relaxed );
+	else if( gain_reduction > m->last_gr )
+		atomic_fetch_add_explicit( &m->gain_down, 1, memory_order_relaxed );
+	else if( gain_reduction < m->last_gr )
+		atomic_fetch_add_explicit( &m->gain_up, 1, memory_order_relaxed );
+	m->last_gr = gain_reduction;
+}
+
+// One metric for every receiver r for which cond holds.  expr may use r.
+#define MET_SOME( cond, name, type, help, fmt, expr ) do { \
+	fprintf( fp, "# HELP sdrplayalsa_" name " " help "\n# TYPE sdrplayalsa_" name " " type "\n" ); \
+	for( i = 0; i < numreceivers; i++ ) { \
+		r = receivers[ i ]; \
+		if( cond ) \
+			fprintf( fp, "sdrplayalsa_" name "{%s} " fmt "\n", labels[ i ], expr ); \
+	} \
+} while( 0 )
+#define MET_EACH( name, type, help, fmt, expr ) MET_SOME( 1, name, type, help, fmt, expr )
+
+static void met_hist_render( FILE *fp, const char *name, const char *help, size_t member, char labels[][ 128 ] ) {
+
+	const struct met_hist *h;
+	unsigned long n;
+	int i, j;
+
+	fprintf( fp, "# HELP sdrplayalsa_%s_seconds %s\n# TYPE sdrplayalsa_%s_seconds histogram\n", name, help, name );
+	for( i = 0; i < numreceivers; i++ ) {
+		h = (const struct met_hist *)( (const char *)receivers[ i ]->met + member );
+		for( n = 0, j = 0; j < MET_BUCKETS; j++ ) {
+			n += atomic_load_explicit( &h->bucket[ j ], memory_order_relaxed );
+			fprintf( fp, "sdrplayalsa_%s_seconds_bucket{%s,le=\"%.9g\"} %lu\n", name, labels[ i ], ( 1 << j ) * 1e-6, n );
+		}
+		fprintf( fp, "sdrplayalsa_%s_seconds_bucket{%s,le=\"+Inf\"} %lu\n", name, labels[ i ], atomic_load( &h->count ) );
+		fprintf( fp, "sdrplayalsa_%s_seconds_sum{%s} %.9f\n", name, labels[ i ], atomic_load( &h->sum_ns ) * 1e-9 );
+		fprintf( fp, "sdrplayalsa_%s_seconds_count{%s} %lu\n", name, labels[ i ], atomic_load( &h->count ) );
+	}
+	fprintf( fp, "# HELP sdrplayalsa_%s_max_seconds Longest of the above\n# TYPE sdrplayalsa_%s_max_seconds gauge\n", name, name );
+	for( i = 0; i < numreceivers; i++ ) {
+		h = (const struct met_hist *)( (const char *)receivers[ i ]->met + member );
+		fprintf( fp, "sdrplayalsa_%s_max_seconds{%s} %.9f\n", name, labels[ i ], atomic_load( &h->max_ns ) * 1e-9 );
+	}
+}
+
+// Everything, in the Prometheus text exposition format.  Returns a malloc()ed string.
+static char *met_render( size_t *len ) {
+
+	char *buf = NULL, labels[ MAX_RECEIVERS ][ 128 ];
+	FILE *fp = open_memstream( &buf, len );
+	struct receiver *r;
+	int i, spectra = 0;
+
+	for( i = 0; i < numreceivers; i++ ) {
+		r = receivers[ i ];
+		spectra |= r->spec != NULL;
+		snprintf( labels[ i ], sizeof( labels[ i ] ), "receiver=\"%d\",serial=\"%.63s\",tuner=\"%c\"", i,
+			r->replay ? "replay" : r->sernum, r->tuner == sdrplay_api_Tuner_B ? 'B' : 'A' );
+	}
+
+	fprintf( fp, "# HELP sdrplayalsa_start_time_seconds When this process started streaming\n# TYPE sdrplayalsa_start_time_seconds gauge\n"
+		"sdrplayalsa_start_time_seconds %ld\n", (long)met_started );
+	MET_EACH( "sample_rate", "gauge", "Output sample rate", "%d", r->rate );
+	MET_EACH( "callbacks_total", "counter", "Stream callbacks", "%lu", atomic_load( &r->met->callbacks ) );
+	MET_EACH( "samples_in_total", "counter", "Samples (I/Q pairs) handed to the callback", "%lu", atomic_load( &r->met->samples_in ) );
+	MET_EACH( "samples_out_total", "counter", "Frames processed for output, after decimation and resampling", "%lu", atomic_load( &r->met->samples_out ) );
+	MET_EACH( "blocks_total", "counter", "Blocks processed for output", "%lu", atomic_load( &r->met->blocks ) );
+	MET_EACH( "ring_overruns_total", "counter", "Blocks dropped because the '-q' writer thread fell behind", "%lu", atomic_load( &r->ring_overruns ) );
+	MET_EACH( "ring_highwater_bytes", "gauge", "Most of the '-q' ring ever in use", "%zu", atomic_load( &r->ring_highwater ) );
+	MET_EACH( "output_dropped_frames_total", "counter", "Frames an ALSA, 4-channel, SigMF or pipe output had no room for", "%lu",
+		MET_LOAD( r->pcm_dropped ) + MET_LOAD( r->quad_dropped ) + ( r->rec ? MET_LOAD( r->rec->dropped ) : 0 ) + MET_LOAD( r->pipe_dropped ) );
+	MET_EACH( "network_dropped_packets_total", "counter", "Packets a network output could not send", "%lu", r->net ? MET_LOAD( r->net->dropped ) : 0 );
+	MET_EACH( "alsa_xruns_total", "counter", "ALSA underruns and overruns", "%lu", MET_LOAD( r->pcm_xruns ) );
+	MET_EACH( "alsa_drift_corrections_total", "counter", "Frames dropped or repeated to hold the ALSA fill level", "%lu",
+		MET_LOAD( r->pcm_inserted ) + MET_LOAD( r->pcm_removed ) );
+	MET_EACH( "resets_total", "counter", "Changes of the API's reset flag", "%lu", atomic_load( &r->met->resets ) );
+	MET_EACH( "gain_reduction_db", "gauge", "Gain reduction as last set", "%d", MET_LOAD( r->gain_reduction ) );
+	fprintf( fp, "# HELP sdrplayalsa_gain_changes_total Gain updates sent, by direction\n# TYPE sdrplayalsa_gain_changes_total counter\n" );
+	for( i = 0; i < numreceivers; i++ ) {
+		r = receivers[ i ];
+		fprintf( fp, "sdrplayalsa_gain_changes_total{%s,direction=\"up\"} %lu\n", labels[ i ], atomic_load( &r->met->gain_up ) );
+		fprintf( fp, "sdrplayalsa_gain_changes_total{%s,direction=\"down\"} %lu\n", labels[ i ], atomic_load( &r->met->gain_down ) );
+	}
+	MET_EACH( "gain_errors_total", "counter", "Gain updates the API refused", "%lu", atomic_load( &r->met->gain_errors ) );
+	MET_EACH( "gain_applied_total", "counter", "Gain changes the API reported done (grChanged)", "%lu", atomic_load( &r->met->gain_applied ) );
+	if( spectra ) {
+		MET_SOME( r->spec, "spectrum_tap_seconds_total", "counter", "Time the stream callback spent copying snapshots for the '-Q' spectrum", "%.9f",
+			MET_LOAD( r->spec->tap_ns ) * 1e-9 );
+		MET_SOME( r->spec, "spectrum_snapshots_skipped_total", "counter", "'-Q' snapshots skipped under load", "%lu", MET_LOAD( r->spec->shed ) );
+		MET_SOME( r->spec, "spectrum_frames_total", "counter", "'-Q' spectra published", "%lu", MET_LOAD( r->spec->frames ) );
+		MET_SOME( r->spec, "spectrum_peak_dbfs", "gauge", "Strongest bin of the last '-Q' spectrum", "%.2f", MET_LOAD( r->spec->peak ) * 0.01 );
+		MET_SOME( r->spec, "spectrum_floor_dbfs", "gauge", "Median bin (the noise floor) of the last '-Q' spectrum", "%.2f", MET_LOAD( r->spec->floor ) * 0.01 );
+	}
+	met_hist_render( fp, "callback_interval", "Time from one stream callback to the next", offsetof( struct metrics, cb_interval ), labels );
+	met_hist_render( fp, "callback_jitter", "Difference between a callback interval and the time the previous block took to sample",
+		offsetof( struct metrics, cb_jitter ), labels );
+	met_hist_render( fp, "callback_duration", "Time spent in the stream callback", offsetof( struct metrics, cb_time ), labels );
+	met_hist_render( fp, "block_duration", "Time spent on AGC, conversion and output of a block", offsetof( struct metrics, block_time ), labels );
+	met_hist_render( fp, "retune_latency", "Time from a retune over the control socket to the first block at the new frequency",
+		offsetof( struct metrics, retune ), labels );
+	met_hist_render( fp, "gain_lockout", "Time from a gain update to the end of the API's grChanged, during which AGC cannot change the gain",
+		offsetof( struct metrics, lockout ), labels );
+	fclose( fp );
+	return buf;
+}
+
+static void met_write_file( void ) {
+
+	char tmp[ PATH_MAX ], *buf;
+	size_t len;
+	FILE *fp;
+
+	snprintf( tmp, sizeof( tmp ), "%s.tmp", metrics_path );
+	buf = met_render( &len );
+	if( !( fp = fopen( tmp, "w" ) ) || fwrite( buf, 1, len, fp ) != len || fclose( fp ) || rename( tmp, metrics_path ) ) {
+		if( verbose )
+			fprintf( stderr, "Cannot write metrics to %s: %s\n", metrics_path, strerror( errno ) );
+		if( fp )
+			unlink( tmp );
+	}
+	free( buf );
+}
+
+// One client of the Unix socket:  an HTTP GET gets an HTTP response, anything else (or nothing) just the text
+static void met_serve( int fd ) {
+
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	struct timeval tv = { 1, 0 };
+	char req[ 1024 ], hdr[ 128 ], *buf;
+	size_t len;
+	ssize_t n = 0;
+	int http;
+
+	setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );	// a client that stops reading cannot hold us up
+	if( poll( &pfd, 1, 100 ) > 0 )
+		n = recv( fd, req, sizeof( req ) - 1, MSG_DONTWAIT );
+	http = n >= 4 && !memcmp( req, "GET ", 4 );
+	buf = met_render( &len );
+	if( http ) {
+		snprintf( hdr, sizeof( hdr ), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len );
+		send( fd, hdr, strlen( hdr ), MSG_NOSIGNAL );
+	}
+	send( fd, buf, len, MSG_NOSIGNAL );
+	free( buf );
+	close( fd );
+}
+
+static void *met_run( void *arg ) {
+
+	struct pollfd pfd = { met_fd, POLLIN, 0 };
+	sigset_t all;
+	int fd;
+
+	sigfillset( &all );		// term() belongs on another thread
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	for(;;) {
+		if( met_fd < 0 ) {
+			met_write_file();
+			sleep( 1 );
+		}
+		else if( poll( &pfd, 1, -1 ) > 0 && ( fd = accept4( met_fd, NULL, NULL, SOCK_CLOEXEC ) ) >= 0 )
+			met_serve( fd );
+	}
+	return arg;
+}
+
+// Give every receiver its counters and start publishing them.  Returns 0, or 1 after reporting an error.
+static int met_start( void ) {
+
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	int i, ret;
+
+	for( i = 0; i < numreceivers; i++ ) {
+		receivers[ i ]->met = aligned_alloc( RING_ALIGN, ( sizeof( struct metrics ) + RING_ALIGN - 1 ) & ~( RING_ALIGN - 1 ) );
+		memset( receivers[ i ]->met, 0, sizeof( struct metrics ) );
+		receivers[ i ]->met->last_gr = receivers[ i ]->gain_reduction;
+	}
+	met_started = time( NULL );
+
+	if( !strncmp( metrics_path, "unix:", 5 ) ) {
+		if( strlen( metrics_path + 5 ) >= sizeof( sa.sun_path ) ) {
+			fprintf( stderr, "Metrics socket path too long: %s\n", metrics_path + 5 );
+			return 1;
+		}
+		strcpy( sa.sun_path, metrics_path + 5 );
+		unlink( sa.sun_path );
+		if( ( met_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0
+			|| bind( met_fd, (struct sockaddr *)&sa, sizeof( sa ) ) || listen( met_fd, 16 ) ) {
+			fprintf( stderr, "Cannot listen on %s: %s\n", sa.sun_path, strerror( errno ) );
+			return 1;
+		}
+	}
+	else
+		met_write_file();	// errors now rather than in the background
+
+	if( ( ret = pthread_create( &met_thread, NULL, met_run, NULL ) ) ) {
+		fprintf( stderr, "Cannot create metrics thread: %s\n", strerror( ret ) );
+		return 1;
+	}
+	fprintf( stderr, "Metrics:  %s%s\n", met_fd >= 0 ? "Unix socket " : "", met_fd >= 0 ? metrics_path + 5 : metrics_path );
+	return 0;
+}
+
+// At exit:  the file gets the final counts, the socket goes away
+static void met_stop( void ) {
+
+	if( met_fd >= 0 )
+		unlink( metrics_path + 5 );
+	else
+		met_write_file();
+}
+
+// Gain compensation (-J ref):  the output is scaled by the difference between the gain reduction in effect and
+// 'ref', so its level stays where it would be at that gain reduction whatever the AGC does, and consumers need no
+// gain file.  The AGC still sees the samples as they come.  A new gain takes over on the block where grChanged
+// says the RSP applied it, ramping from the old over GC_RAMP_US so any small misalignment does not click.
+#define GC_RAMP_US 250
+
+static int gc_q16( int gain_reduction ) {
+
+	return lrint( 65536 * pow( 10, ( gain_reduction - rcv->gc_ref ) / 20.0 ) );
+}
+
+// gain_reduction has taken effect from this block on
+static void gc_to( int gain_reduction ) {
+
+	rcv->gc_target = gc_q16( gain_reduction );
+	rcv->gc_left = (unsigned)( (long)rcv->rate * GC_RAMP_US / 1000000 ) + 1;
+	rcv->gc_step = ( rcv->gc_target - rcv->gc_gain ) / (int)rcv->gc_left;
+}
+
+static void gain_comp( short *buf, unsigned numSamples ) {
+
+	unsigned n;
+
+	if( rcv->gc_left ) {
+		n = numSamples < rcv->gc_left ? numSamples : rcv->gc_left;
+		kern->scale_s16( buf, n, rcv->gc_gain, rcv->gc_step );
+		rcv->gc_gain += (int)n * rcv->gc_step;
+		if( !( rcv->gc_left -= n ) )
+			rcv->gc_gain = rcv->gc_target;
+		buf += 2 * n;
+		numSamples -= n;
+	}
+	if( numSamples && rcv->gc_gain != 65536 )
+		kern->scale_s16( buf, numSamples, rcv->gc_gain, 0 );
+}
+
+// Everything downstream of the sample copy:  AGC lock-out tracking, AGC, output and gain changes.
+// Called from the RX callback directly, or from the writer thread when the ring buffer is in use.
+// buf holds interleaved S16 samples;  obuf, if not NULL, already holds them in the output format.
+static void process_block( short *buf, void *obuf, unsigned numSamples, int grChanged, unsigned reset ) {
+
+	int quad = rcv->quad || ( rcv->peer && rcv->peer->quad );
+	struct metrics *m = rcv->met;
+	uint64_t t0 = m ? mono_ns() : 0;
+
+	if( atomic_load_explicit( &rcv->agc_staged_ready, memory_order_acquire ) )	// new settings from the control socket
+		agc_take();
+
+	// Set lock-outs for AGC gain changes
+
+	if(grChanged)	{	// has "grChanged" gone non-zero indicating an operation in process?
+		if( !rcv->grChanged_flag && rcv->gain_inflight >= 0 ) {	// our gain change took effect here
+			if( rcv->gc_ref >= 0 )
+				gc_to( rcv->gain_inflight );
+			rec_gain( rcv->gain_inflight );
+			rcv->gain_inflight = -1;
+		}
+		if( m && !rcv->grChanged_flag )
+			met_add( &m->gain_applied, 1 );
+		rcv->grChanged_flag = 1;		// yes
+		rcv->gchange_lockout = 1;	// unconditionally set lockout to prevent gain reduction call
+	}
+	else if(rcv->grChanged_flag)	{	// has grChanged gone BACK to zero after being nonzero?
+		rcv->grChanged_flag = 0;		// yes - clear detect flag
+		rcv->gchange_lockout = 0;	// clear gain change lockout
+		if( m && m->lockout_since ) {
+			met_observe( &m->lockout, t0 - m->lockout_since );
+			m->lockout_since = 0;
+		}
+	}
+	else if( rcv->gchange_lockout && atomic_load_explicit( &rcv->gain_failed, memory_order_relaxed ) ) {	// the update never happened
+		atomic_store( &rcv->gain_failed, 0 );
+		rcv->gchange_lockout = 0;
+		rcv->gain_inflight = -1;
+		rcv->gain_changed = 1;		// try again, e.g. once an LNA change from the control socket is done
+		if( m )
+			m->lockout_since = 0;
+	}
+
+	if(reset != rcv->reset_flag)	{	// Indicate change in status of the "reset" flag from the API
+		fprintf( stderr, "API reset Flag is now %u\n", reset);
+		rcv->reset_flag = reset;
+		if( m )
+			met_add( &m->resets, 1 );
+	}
+
+    if(rcv->AGCEnable) {		// send samples to our own AGC function if enabled
+		agc( buf, numSamples );
+    }
+	if( rcv->gc_ref >= 0 )
+		gain_comp( buf, numSamples );
+	if( rcv->nchans )	// feed the '-Z' channels
+		chan_run( buf, numSamples );
+
+	if( !rcv->nchans || rcv->out ) {	// with '-Z' the wideband stream itself goes out only to a '-o'
+		if( !obuf && ( !rcv->pcm || !rcv->pcm_mmap || quad ) )		// convert to the output format if the caller has not already done so
+			obuf = convert( rcv->out_format == FMT_S16 ? NULL : SCRATCH( rcv->scratch[ 1 ], numSamples * 2 * rcv->out_bps ), buf, numSamples );
+
+		if( quad )		// one half of an RSPduo's 4-channel output
+			quad_output( obuf, numSamples );
+		else
+			output( buf, obuf, numSamples );
+	}
+	//
+
+	if (rcv->gain_changed) {		// are we to change gain?
+		if(!rcv->gchange_lockout && !ctl_post_gain( rcv, rcv->gain_reduction ))	{	// bail out if gain change is in process - we can wait until later
+	    	rcv->gain_changed = 0;		// indicate that we (will) have changed gain
+			rcv->gchange_lockout=1;		// set lockout to prevent another gain change until we know API is ready
+			rcv->gain_inflight = rcv->gain_reduction;
+			if( rcv->replay )	// the stand-in RSP takes it at once, so a replay runs the same however the threads are scheduled
+				replay_update( rcv->gain_reduction );
+			if( m )
+				m->lockout_since = mono_ns();
+		}
+	}
+
+	if( m ) {
+		met_add( &m->blocks, 1 );
+		met_add( &m->samples_out, numSamples );
+		met_observe( &m->block_time, mono_ns() - t0 );
+	}
+}
+
+// Reserve space for a block of numSamples at the head of the ring.  Returns NULL (and counts an
+// overrun) if the writer has fallen behind and there is no room - the whole block is then dropped.
+static struct ring_block *ring_reserve( unsigned numSamples, size_t *total ) {
+
+	size_t head = atomic_load_explicit( &rcv->ring_head, memory_order_relaxed );
+	size_t tail = atomic_load_explicit( &rcv->ring_tail, memory_order_acquire );
+	size_t len = RING_ALIGN + ( ( ( (size_t)numSamples << 2 ) + RING_ALIGN - 1 ) & ~(size_t)( RING_ALIGN - 1 ) );
+	size_t off = head & ( rcv->ring_size - 1 );
+	size_t pad = ( off + len > rcv->ring_size ) ? rcv->ring_size - off : 0;	// record may not wrap - skip to start of buffer
+	struct ring_block *b;
+
+	if( ( head - tail ) + pad + len > rcv->ring_size ) {
+		atomic_fetch_add_explicit( &rcv->ring_overruns, 1, memory_order_relaxed );
+		return NULL;
+	}
+
+	if( pad ) {
+		b = (struct ring_block *)( rcv->ring_buf + off );
+		b->numSamples = 0;
+		b->len = pad;
+		off = 0;
+	}
+
+	if( ( head - tail ) + pad + len > atomic_load_explicit( &rcv->ring_highwater, memory_order_relaxed ) )
+		atomic_store_explicit( &rcv->ring_highwater, ( head - tail ) + pad + len, memory_order_relaxed );
+
+	*total = pad + len;
+	b = (struct ring_block *)( rcv->ring_buf + off );
+	b->numSamples = numSamples;
+	b->len = len;
+	return b;
+}
+
+static void ring_commit( size_t total ) {
+
+	atomic_store_explicit( &rcv->ring_head, atomic_load_explicit( &rcv->ring_head, memory_order_relaxed ) + total, memory_order_release );
+	sem_post( &rcv->ring_sem );
+}
+
+// Channelizer plumbing (-Z):  the wideband receiver runs its filter bank over each block it processes and writes every
+// channel's share straight into that channel's ring.  Each channel's writer thread takes it on to the channel's rate
+// and output, so the channels run in parallel and a slow sink holds up only its own channel.
+static void chan_run( const short *buf, unsigned numSamples ) {
+
+	struct receiver *r = rcv;
+	struct ring_block *b[ CHAN_MAX ];
+	struct pfb_nco *nco[ CHAN_MAX ];
+	struct pfb_kernels pk = pfb_kern();
+	short *out[ CHAN_MAX ], *drop;
+	size_t total[ CHAN_MAX ];
+	unsigned steps = pfb_steps( r->pfb, numSamples );
+	int c, ok;
+
+	for( c = 0; c < r->nchans; c++ )
+		nco[ c ] = &r->chans[ c ]->chan_nco;
+	if( !steps ) {		// too few samples for an output yet:  they just join the history
+		pfb_run( r->pfb, buf, numSamples, nco, r->nchans, out, &pk );
+		return;
+	}
+	drop = SCRATCH( r->scratch[ 2 ], steps * 2 * sizeof( short ) );	// for a channel whose ring is full
+	for( c = 0; c < r->nchans; c++ ) {
+		rcv = r->chans[ c ];
+		if( ( b[ c ] = ring_reserve( steps, total + c ) ) ) {
+			b[ c ]->grChanged = 0;
+			b[ c ]->reset = 0;
+			b[ c ]->time_ns = r->block_ns;
+			out[ c ] = (short *)( (char *)b[ c ] + RING_ALIGN );
+		}
+		else
+			out[ c ] = drop;
+	}
+	ok = !pfb_run( r->pfb, buf, numSamples, nco, r->nchans, out, &pk );	// (the bank was made for the API's largest block)
+	for( c = 0; c < r->nchans; c++ ) {
+		rcv = r->chans[ c ];
+		if( b[ c ] && ok )
+			ring_commit( total[ c ] );
+		else if( b[ c ] )		// the block is dropped as if the ring had been full
+			atomic_fetch_add_explicit( &rcv->ring_overruns, 1, memory_order_relaxed );
+	}
+	rcv = r;
+}
+
+// A channel's writer thread:  a block from the filter bank, at its bin rate, on to the channel's rate and output
+static void chan_block( short *buf, unsigned numSamples ) {
+
+	short *xi = SCRATCH( rcv->scratch[ 0 ], numSamples * 2 * sizeof( short ) ), *xq = xi + numSamples;
+
+	kern->deinterleave_s16( xi, xq, buf, numSamples );
+	if( rcv->swdec && !( numSamples = decimate( &xi, &xq, numSamples ) ) )
+		return;
+	if( rcv->rs_coefs && !( numSamples = resample( &xi, &xq, numSamples ) ) )
+		return;
+	buf = SCRATCH( rcv->scratch[ 2 ], numSamples * 2 * sizeof( short ) );
+	kern->interleave_s16( buf, xi, xq, numSamples );
+	process_block( buf, NULL, numSamples, 0, rcv->reset_flag );	// the wideband receiver reports the API's resets
+}
+
+// Real-time operation (-H, -A, -Y):  the threads every sample passes through - the API's callback thread (or a
+// replay's), set up on its first callback, and the '-q' writer threads - run SCHED_FIFO at priority -H on the -A
+// CPUs, and once everything has started the whole process is locked into memory.  The buffers rx() and
+// process_block() work in are allocated and touched before streaming starts and those threads touch their stacks
+// ahead of time, so nothing on the sample path waits for a page fault.  rt_report() checks that all of it took.
+#define RT_STACK ( 256 * 1024 )	// stack touched in advance
+#define RT_WANTED ( rt_prio || rt_ncpus || rt_lock )
+
+static int rt_prio;				// -H, SCHED_FIFO priority, 0 = normal scheduling
+static cpu_set_t rt_cpus;		// -A
+static int rt_ncpus;			// CPUs in rt_cpus, 0 = no '-A'
+static int rt_lock;				// -Y
+
+// "2", "2,3" or "2-5,7" into rt_cpus
+static int rt_parse_cpus( const char *s ) {
+
+	char *end;
+	long a, b;
+
+	CPU_ZERO( &rt_cpus );
+	do {
+		a = b = strtol( s, &end, 10 );
+		if( *end == '-' )
+			b = strtol( end + 1, &end, 10 );
+		if( end == s || a < 0 || b < a || b >= CPU_SETSIZE || ( *end && *end != ',' ) )
+			return -1;
+		for( ; a <= b; a++ )
+			CPU_SET( a, &rt_cpus );
+		s = end + 1;
+	} while( *end );
+	rt_ncpus = CPU_COUNT( &rt_cpus );
+	return 0;
+}
+
+// The n'th CPU of rt_cpus, round robin
+static int rt_cpu( int n ) {
+
+	int cpu;
+
+	n %= rt_ncpus;
+	for( cpu = 0; !CPU_ISSET( cpu, &rt_cpus ) || n--; cpu++ )
+		;
+	return cpu;
+}
+
+static __attribute__((noinline)) void rt_prefault( void ) {
+
+	volatile char stack[ RT_STACK ];
+
+	memset( (char *)stack, 0, sizeof( stack ) );
+}
+
+// Give thread t SCHED_FIFO priority rt_prio and put it on cpu, or on the -A CPUs if cpu < 0.  Returns 0 or an errno.
+static int rt_thread( pthread_t t, int cpu ) {
+
+	struct sched_param sp = { .sched_priority = rt_prio };
+	cpu_set_t one;
+	int ret = 0, err;
+
+	if( rt_prio )
+		ret = pthread_setschedparam( t, SCHED_FIFO, &sp );
+	if( cpu >= 0 ) {
+		CPU_ZERO( &one );
+		CPU_SET( cpu, &one );
+		err = pthread_setaffinity_np( t, sizeof( one ), &one );
+	}
+	else
+		err = rt_ncpus ? pthread_setaffinity_np( t, sizeof( rt_cpus ), &rt_cpus ) : 0;
+	return ret ? ret : err;
+}
+
+// First callback on this thread
+static void rt_callback( void ) {
+
+	int ret;
+
+	rcv->rt_pending = 0;
+	rt_prefault();
+	ret = rt_thread( pthread_self(), -1 );
+	atomic_store( &rcv->rt_cb, ret ? -ret : 1 );
+}
+
+// rcv's scratch buffers, faulted in now rather than in the first callbacks
+static void scratch_init( void ) {
+
+	int i;
+
+	for( i = 0; i < 3; i++ ) {
+		if( posix_memalign( (void **)&rcv->scratch[ i ], RING_ALIGN, SCRATCH_BYTES ) ) {
+			fprintf( stderr, "Cannot allocate sample buffers\n" );
+			exit( 1 );
+		}
+		memset( rcv->scratch[ i ], 0, SCRATCH_BYTES );
+	}
+	rcv->rt_pending = RT_WANTED;
+}
+
+static void rt_why( int err ) {
+
+	struct rlimit rl;
+
+	if( err == EPERM && !getrlimit( RLIMIT_RTPRIO, &rl ) )
+		fprintf( stderr, " (RLIMIT_RTPRIO is %ld:  raise it with 'ulimit -r' or limits.conf, or give the process CAP_SYS_NICE)",
+			rl.rlim_cur == RLIM_INFINITY ? -1L : (long)rl.rlim_cur );
+	else if( err == EINVAL && rt_ncpus )
+		fprintf( stderr, " (are all of the '-A' CPUs online and in the process's cpuset?)" );
+	fputc( '\n', stderr );
+}
+
+static void rt_thread_report( const char *what, int result ) {
+
+	if( result > 0 && rt_prio )
+		fprintf( stderr, "   %s:  SCHED_FIFO priority %d%s\n", what, rt_prio, rt_ncpus ? " on the '-A' CPUs" : "" );
+	else if( result > 0 )
+		fprintf( stderr, "   %s:  %s\n", what, rt_ncpus ? "on the '-A' CPUs" : "stack faulted in" );
+	else if( !result )
+		fprintf( stderr, "   %s:  WARNING - not set up yet, no samples have arrived\n", what );
+	else {
+		fprintf( stderr, "   %s:  WARNING - could not apply the real-time settings: %s", what, strerror( -result ) );
+		rt_why( -result );
+	}
+}
+
+// Startup self-check:  once the receivers have been started, lock memory and report whether every requested
+// real-time setting took
+static void rt_report( void ) {
+
+	struct receiver *r;
+	struct rlimit rl;
+	long pages = 0;
+	char name[ 56 ], what[ 80 ];
+	FILE *fp;
+	int i;
+
+	usleep( 200000 );	// time for the first callbacks
+	fprintf( stderr, "Real-time self-check:\n" );
+	if( rt_lock ) {
+		if( mlockall( MCL_CURRENT | MCL_FUTURE ) ) {
+			fprintf( stderr, "   Memory:  WARNING - cannot lock it: %s", strerror( errno ) );
+			if( !getrlimit( RLIMIT_MEMLOCK, &rl ) && rl.rlim_cur != RLIM_INFINITY )
+				fprintf( stderr, " (RLIMIT_MEMLOCK is %lu KiB:  raise it with 'ulimit -l' or limits.conf, or give the process CAP_IPC_LOCK)",
+					(unsigned long)( rl.rlim_cur >> 10 ) );
+			fputc( '\n', stderr );
+		}
+		else {
+			if( ( fp = fopen( "/proc/self/statm", "r" ) ) ) {
+				if( fscanf( fp, "%*d %ld", &pages ) != 1 )
+					pages = 0;
+				fclose( fp );
+			}
+			fprintf( stderr, "   Memory:  locked, %.1f MB resident\n", pages * sysconf( _SC_PAGESIZE ) * 1e-6 );
+		}
+	}
+	for( i = 0; i < numreceivers; i++ ) {
+		r = receivers[ i ];
+		snprintf( name, sizeof( name ), "%.40s tuner %c", r->replay ? "replay" : r->sernum, r->tuner == sdrplay_api_Tuner_B ? 'B' : 'A' );
+		snprintf( what, sizeof( what ), "%s callback thread", name );
+		if( !r->chan_of )	// a '-Z' channel has only its writer
+			rt_thread_report( what, atomic_load( &r->rt_cb ) );
+		if( r->ring_buf ) {
+			snprintf( what, sizeof( what ), "%s writer thread", name );
+			rt_thread_report( what, r->rt_writer );
+		}
+	}
+}
+
+// Writer thread - drains the ring and does all of the potentially blocking work
+static void *writer( void *arg ) {
+
+	size_t head, tail;
+	struct ring_block *b;
+	unsigned long overruns, reported = 0;
+
+	rcv = arg;
+	if( RT_WANTED )
+		rt_prefault();
+	for(;;) {
+		while( sem_wait( &rcv->ring_sem ) && errno == EINTR )
+			;
+
+		head = atomic_load_explicit( &rcv->ring_head, memory_order_acquire );
+		tail = atomic_load_explicit( &rcv->ring_tail, memory_order_relaxed );
+
+		while( tail != head ) {
+			b = (struct ring_block *)( rcv->ring_buf + ( tail & ( rcv->ring_size - 1 ) ) );
+			rcv->block_ns = b->time_ns;
+			if( b->numSamples && rcv->chan_of )
+				chan_block( (short *)( (char *)b + RING_ALIGN ), b->numSamples );
+			else if( b->numSamples )
+				process_block( (short *)( (char *)b + RING_ALIGN ), NULL, b->numSamples, b->grChanged, b->reset );
+			tail += b->len;
+			atomic_store_explicit( &rcv->ring_tail, tail, memory_order_release );
+		}
+
+		overruns = atomic_load_explicit( &rcv->ring_overruns, memory_order_relaxed );
+		if( verbose && overruns != reported ) {
+			fprintf( stderr, "Ring buffer overrun: %lu block(s) dropped, %lu total\n", overruns - reported, overruns );
+			reported = overruns;
+		}
+	}
+	return arg;
+}
+
+static void ring_init( int samplerate ) {
+
+	size_t want = (size_t)samplerate * 4 * rcv->ring_ms / 1000;
+	int ret;
+
+	for( rcv->ring_size = 65536; rcv->ring_size < want; rcv->ring_size <<= 1 )	// power of two so offsets are a mask
+		;
+
+	if( posix_memalign( (void **)&rcv->ring_buf, RING_ALIGN, rcv->ring_size ) ) {
+		fprintf( stderr, "Cannot allocate %zu byte ring buffer\n", rcv->ring_size );
+		exit( 1 );
+	}
+	memset( rcv->ring_buf, 0, rcv->ring_size );	// pre-fault the pages now, not in the callback
+
+	sem_init( &rcv->ring_sem, 0, 0 );
+
+	if( ( ret = pthread_create( &rcv->writer_thread, NULL, writer, rcv ) ) ) {
+		fprintf( stderr, "Cannot create writer thread: %s\n", strerror( ret ) );
+		exit( 1 );
+	}
+
+	if( rcv->cpu >= 0 || RT_WANTED ) {	// daemon mode keeps each receiver's processing on its own core
+		if( ( ret = rt_thread( rcv->writer_thread, rcv->cpu ) ) && !RT_WANTED )
+			fprintf( stderr, "Cannot pin writer thread to CPU %d: %s\n", rcv->cpu, strerror( ret ) );
+		rcv->rt_writer = ret ? -ret : 1;
+	}
+}
+
+// The first block at the frequency of a retune asked for over the control socket:  how long did it take?
+static void retune_done( void ) {
+
+	uint64_t ns = mono_ns() - atomic_exchange( &rcv->retune_ns, 0 );
+
+	atomic_fetch_add_explicit( &rcv->retunes, 1, memory_order_relaxed );
+	atomic_store_explicit( &rcv->retune_last_ns, ns, memory_order_relaxed );
+	atomic_fetch_add_explicit( &rcv->retune_sum_ns, ns, memory_order_relaxed );
+	if( ns > atomic_load_explicit( &rcv->retune_max_ns, memory_order_relaxed ) )
+		atomic_store_explicit( &rcv->retune_max_ns, ns, memory_order_relaxed );
+	if( rcv->met )
+		met_observe( &rcv->met->retune, ns );
+	if( verbose )
+		fprintf( stderr, "Retuned %s to %d Hz:  first block after %.2f ms\n", rcv->sernum, rcv->freq, ns * 1e-6 );
+}
+
+static void rx_block( short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned numSamples, unsigned reset, void *cbContext ) {
+
+    short *buf;
+    struct ring_block *b = NULL;
+    size_t total;
+    int grChanged = params->grChanged;
+
+	rcv = cbContext;
+	if( rcv->rt_pending )
+		rt_callback();
+	rcv->sample_num = params->firstSampleNum;
+	if( numSamples > API_MAXFRAMES ) {	// more than the buffers were sized for
+		rcv->oversize++;
+		rcv->grChanged_carry |= params->grChanged;
+		return;
+	}
+	if( params->rfChanged && atomic_load_explicit( &rcv->retune_ns, memory_order_relaxed ) )
+		retune_done();
+	if( rcv->net || rcv->shm || rcv->rec || rcv->spec )		// output is stamped with the time the block arrived
+		rcv->block_ns = now_ns();
+	if( rcv->swdec ) {	// we do the decimation
+		if( !( numSamples = decimate( &xi, &xq, numSamples ) ) ) {
+			rcv->grChanged_carry |= grChanged;	// don't lose a grChanged on a block that produced no output
+			return;
+		}
+	}
+	if( rcv->rs_coefs ) {	// and the rational resampling to the output rate
+		if( !( numSamples = resample( &xi, &xq, numSamples ) ) ) {
+			rcv->grChanged_carry |= grChanged;
+			return;
+		}
+	}
+	grChanged |= rcv->grChanged_carry;
+	rcv->grChanged_carry = 0;
+	if( rcv->iqc_ms )
+		iqc_update( xi, xq, numSamples );
+
+	if( rcv->ring_buf ) {	// copy straight into the ring and let the writer thread do the rest
+		if( !( b = ring_reserve( numSamples, &total ) ) )
+			return;
+		b->grChanged = grChanged;
+		b->reset = reset;
+		b->time_ns = rcv->block_ns;
+		buf = (short *)( (char *)b + RING_ALIGN );
+	}
+	else if( rcv->out_format != FMT_S16 && !rcv->AGCEnable && rcv->gc_ref < 0 && !rcv->nchans && !rcv->iqc_ms && !rcv->spec ) {	// nothing needs S16 - interleave straight to the output format
+		if( !( buf = direct_block( numSamples ) ) )
+			buf = SCRATCH( rcv->scratch[ 0 ], numSamples * 2 * rcv->out_bps );
+		interleave( buf, xi, xq, numSamples );
+		process_block( NULL, buf, numSamples, grChanged, reset );
+		return;
+	}
+	else if( !( buf = rcv->out_format == FMT_S16 ? direct_block( numSamples ) : NULL ) )
+		buf = SCRATCH( rcv->scratch[ 0 ], numSamples * 2 * sizeof (short) );
+
+	if( rcv->iqc_ms )
+		kern->iq_correct( buf, xi, xq, numSamples, rcv->iqc_c );
+	else
+		kern->interleave_s16( buf, xi, xq, numSamples );	// Copy samples to local buffer
+	if( rcv->spec )		// now and then a snapshot for the spectrum
+		spec_tap( buf, numSamples );
+
+	if( b )
+		ring_commit( total );
+	else
+		process_block( buf, NULL, numSamples, grChanged, reset );
+}
+
+void rx( short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned numSamples, unsigned reset, void *cbContext ) {
+
+	struct metrics *m = ( (struct receiver *)cbContext )->met;
+	uint64_t t0;
+
+	if( !m ) {
+		rx_block( xi, xq, params, numSamples, reset, cbContext );
+		return;
+	}
+	rcv = cbContext;
+	met_callback( m, t0 = mono_ns(), numSamples );
+	rx_block( xi, xq, params, numSamples, reset, cbContext );
+	met_observe( &m->cb_time, mono_ns() - t0 );
+}
+
+// Tuner B of an RSPduo in dual-tuner mode.  The API gives both stream callbacks the same context, tuner A's receiver.
+void rx_b( short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned numSamples, unsigned reset, void *cbContext ) {
+
+	rx( xi, xq, params, numSamples, reset, ( (struct receiver *)cbContext )->peer );
+}
+
+// API events.  An ADC overload (or its end) is passed to the AGC's fast attack and acknowledged through the control
+// thread, as the API sends no further overload events for the tuner until it is.
+void event( sdrplay_api_EventT id, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params, void *cbContext ) {
+
+	struct receiver *r = cbContext;
+	struct ctl_cmd c = { .type = CTL_ACK, .value = tuner };
+	int detected;
+
+	if( id != sdrplay_api_PowerOverloadChange )
+		return;
+	if( tuner == sdrplay_api_Tuner_B && r->tuner != sdrplay_api_Tuner_B && r->peer )	// tuner A's context, as for rx_b()
+		r = r->peer;
+	detected = params->powerOverloadParams.powerOverloadChangeType == sdrplay_api_Overload_Detected;
+	atomic_store( &r->overload, detected );
+	if( detected )
+		atomic_fetch_add_explicit( &r->overloads, 1, memory_order_relaxed );
+	if( verbose )
+		fprintf( stderr, "%s tuner %c:  ADC overload %s\n", r->sernum, tuner == sdrplay_api_Tuner_B ? 'B' : 'A', detected ? "detected" : "corrected" );
+	c.r = r;
+	if( ctl_post( &c ) )	// queue full:  acknowledge from here rather than lose every later event
+		sdrplay_api_Update( devices[ r->devind ].dev, tuner, sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None );
+}
+
+// Replay (-I file):  a raw S16 I/Q capture, or a SigMF recording such as '-o sigmf://' makes, stands in for the
+// RSP.  A thread feeds the mmap'ed file to rx() in blocks of the size the API delivers at that rate, paced to
+// real time or (-P) as fast as rx() returns, so everything from rx() on runs exactly as it does live.  A gain
+// change acts on the replayed samples a few blocks after it is asked for, with grChanged set as the API does,
+// relative to the gain the capture was recorded at (from a SigMF recording's gain annotations, else '-g'), so
+// the AGC sees the effect of its own decisions.  When every replay reaches the end of its file the process
+// exits, reporting how fast rx() and everything behind it ran.
+#define REPLAY_GR_LATENCY 4		// blocks from a gain change to its effect, as in sdrplay_sim.c
+
+struct replay_gain {			// the gain the capture was recorded at from sample on
+	uint64_t sample;
+	int gain_reduction;
+};
+
+struct replay {
+	const char *map;			// the capture
+	size_t map_len;
+	uint64_t frames;
+	int format;					// FMT_S16, FMT_S32 or FMT_F32
+	int channels;				// I/Q pairs per frame;  only the first (tuner A of a 4-channel recording) is replayed
+	long rate, fs_hz;
+	unsigned block;				// samples per rx() call
+	struct replay_gain *gains;
+	unsigned ngains;
+
+	sdrplay_api_DeviceParamsT dp;	// stand-ins for the device's parameters, which open_receiver() fills in as usual
+	sdrplay_api_DevParamsT dev;
+	sdrplay_api_RxChannelParamsT ch;
+
+	_Atomic int gain_requested;	// by process_block()
+	int gain_applied, gain_pending;
+	unsigned gain_changes;
+	pthread_t thread;
+	atomic_int stop;
+	uint64_t start_ns, end_ns, busy_ns, max_ns, blocks, frame;
+};
+
+static atomic_int replays_running;
+
+// The number after "key": in json, or def
+static double json_number( const char *json, const char *key, double def ) {
+
+	char pat[ 64 ];
+	const char *p;
+
+	snprintf( pat, sizeof( pat ), "\"%s\"", key );
+	if( !( p = strstr( json, pat ) ) || !( p = strchr( p + strlen( pat ), ':' ) ) )
+		return def;
+	return strtod( p + 1, NULL );
+}
+
+// The string after "key": in json, or def
+static void json_string( const char *json, const char *key, char *s, size_t n, const char *def ) {
+
+	char pat[ 64 ];
+	const char *p, *e;
+
+	snprintf( pat, sizeof( pat ), "\"%s\"", key );
+	if( !( p = strstr( json, pat ) ) || !( p = strchr( p + strlen( pat ), '"' ) ) || !( e = strchr( ++p, '"' ) ) ) {
+		snprintf( s, n, "%s", def );
+		return;
+	}
+	snprintf( s, n, "%.*s", (int)( e - p ), p );
+}
+
+// Read what replay needs from a .sigmf-meta:  the sample format and rate, the frequency and the gain annotations
+static int replay_meta( struct replay *rp, const char *path ) {
+
+	FILE *fp = fopen( path, "r" );
+	char type[ 16 ], *meta, *p, *e, *obj;
+	long len;
+
+	if( !fp || fseek( fp, 0, SEEK_END ) || ( len = ftell( fp ) ) < 0 || fseek( fp, 0, SEEK_SET )
+		|| !( meta = calloc( 1, len + 1 ) ) || fread( meta, 1, len, fp ) != len ) {
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 1;
+	}
+	fclose( fp );
+
+	json_string( meta, "core:datatype", type, sizeof( type ), "" );
+	if( !strcmp( type, "ci16_le" ) || !strcmp( type, "ci16" ) )
+		rp->format = FMT_S16;
+	else if( !strcmp( type, "ci32_le" ) || !strcmp( type, "ci32" ) )
+		rp->format = FMT_S32;
+	else if( !strcmp( type, "cf32_le" ) || !strcmp( type, "cf32" ) )
+		rp->format = FMT_F32;
+	else {
+		fprintf( stderr, "%s: Cannot replay samples of type '%s' (ci16_le, ci32_le or cf32_le only)\n", path, type );
+		return 1;
+	}
+	rp->rate = json_number( meta, "core:sample_rate", 0 );
+	rp->channels = json_number( meta, "core:num_channels", 1 );
+	rp->fs_hz = json_number( meta, "sdrplayalsa:fs_hz", 0 );
+	if( !rcv->freq )
+		rcv->freq = json_number( meta, "core:frequency", 0 );
+
+	if( ( p = strstr( meta, "\"annotations\"" ) ) )
+		for( ; ( p = strchr( p, '{' ) ) && ( e = strchr( p, '}' ) ); p = e ) {
+			obj = strndup( p, e - p );
+			if( strstr( obj, "\"sdrplayalsa:gain_reduction\"" ) && !strstr( obj, "\"sdrplayalsa:tuner\": \"B\"" ) ) {
+				if( !( rp->ngains & 63 ) && !( rp->gains = realloc( rp->gains, ( rp->ngains + 64 ) * sizeof( *rp->gains ) ) ) ) {
+					fprintf( stderr, "Cannot allocate gain annotations\n" );
+					exit( 1 );
+				}
+				rp->gains[ rp->ngains ].sample = json_number( obj, "core:sample_start", 0 );
+				rp->gains[ rp->ngains++ ].gain_reduction = json_number( obj, "sdrplayalsa:gain_reduction", 0 );
+			}
+			free( obj );
+		}
+	free( meta );
+	return 0;
+}
+
+// Set rcv up to replay rcv->replay_file.  Returns 0, or 1 after reporting an error.
+static int replay_open( void ) {
+
+	struct replay *rp = calloc( 1, sizeof( *rp ) );
+	char base[ 300 ], path[ 320 ], *p;
+	struct stat st;
+	unsigned d;
+	int fd;
+
+	rp->format = FMT_S16;
+	rp->channels = 1;
+	snprintf( base, sizeof( base ), "%s", rcv->replay_file );
+	if( ( p = strstr( base, ".sigmf-" ) ) && ( !strcmp( p, ".sigmf-data" ) || !strcmp( p, ".sigmf-meta" ) ) )
+		*p = 0;
+	snprintf( path, sizeof( path ), "%s.sigmf-meta", base );
+	if( !access( path, R_OK ) ) {	// a SigMF recording
+		if( replay_meta( rp, path ) )
+			return 1;
+		snprintf( path, sizeof( path ), "%s.sigmf-data", base );
+	}
+	else	// raw S16 I/Q at the '-r' rate
+		snprintf( path, sizeof( path ), "%s", rcv->replay_file );
+
+	if( !rp->rate )
+		rp->rate = rcv->rate;
+	if( !rcv->rate )
+		rcv->rate = rp->rate;
+	if( !rp->rate ) {
+		fprintf( stderr, "%s: No sample rate - give '-r'\n", rcv->replay_file );
+		return 1;
+	}
+	if( ( fd = open( path, O_RDONLY | O_CLOEXEC ) ) < 0 || fstat( fd, &st ) ) {
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 1;
+	}
+	rp->frames = st.st_size / ( rp->channels * 2 * ( rp->format == FMT_S16 ? 2 : 4 ) );
+	if( !rp->frames ) {
+		fprintf( stderr, "%s: No samples\n", path );
+		return 1;
+	}
+	if( ( rp->map = mmap( NULL, rp->map_len = st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 ) ) == MAP_FAILED ) {
+		fprintf( stderr, "%s: %s\n", path, strerror( errno ) );
+		return 1;
+	}
+	close( fd );
+	madvise( (void *)rp->map, rp->map_len, MADV_SEQUENTIAL );
+
+	// The API's block size:  1008 samples at the ADC rate, divided by its decimation
+	if( rp->fs_hz > rp->rate )
+		d = rp->fs_hz / rp->rate;
+	else
+		for( d = 1; rp->rate * d < 2048000; d <<= 1 )
+			;
+	if( ( rp->block = 1008 / d ) < 32 )
+		rp->block = 32;
+
+	rp->dp.devParams = &rp->dev;
+	rp->dp.rxChannelA = rp->dp.rxChannelB = &rp->ch;
+	rp->gain_applied = rp->gain_requested = rcv->gain_reduction;
+	rcv->replay = rp;
+	rcv->dp = &rp->dp;
+	rcv->devind = -1;
+	snprintf( rcv->sernum, sizeof( rcv->sernum ), "%.63s", ( p = strrchr( path, '/' ) ) ? p + 1 : path );
+	return 0;
+}
+
+// A gain change from process_block()
+static int replay_update( int gain_reduction ) {
+
+	atomic_store( &rcv->replay->gain_requested, gain_reduction );
+	return sdrplay_api_Success;
+}
+
+static inline short sat16( long v ) {
+
+	return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+// Samples [pos, pos + n) of the capture's first channel into xi/xq as S16, times scale
+static void replay_read( short *xi, short *xq, uint64_t pos, unsigned n, float scale ) {
+
+	struct replay *rp = rcv->replay;
+	unsigned stride = rp->channels * 2, i;
+	const short *s16 = (const short *)rp->map + pos * stride;
+	const int *s32 = (const int *)rp->map + pos * stride;
+	const float *f32 = (const float *)rp->map + pos * stride;
+
+	if( rp->format == FMT_S16 && stride == 2 )
+		kern->deinterleave_s16( xi, xq, s16, n );
+	else
+		for( i = 0; i < n; i++ ) {
+			xi[ i ] = rp->format == FMT_S16 ? s16[ i * stride ] : rp->format == FMT_S32 ? s32[ i * stride ] >> 16 : sat16( lrintf( f32[ i * stride ] * 32768 ) );
+			xq[ i ] = rp->format == FMT_S16 ? s16[ i * stride + 1 ] : rp->format == FMT_S32 ? s32[ i * stride + 1 ] >> 16 : sat16( lrintf( f32[ i * stride + 1 ] * 32768 ) );
+		}
+	if( scale != 1 )
+		for( i = 0; i < n; i++ ) {
+			xi[ i ] = sat16( lrintf( xi[ i ] * scale ) );
+			xq[ i ] = sat16( lrintf( xq[ i ] * scale ) );
+		}
+}
+
+static void *replay_thread( void *arg ) {
+
+	struct replay *rp;
+	sdrplay_api_StreamCbParamsT params;
+	struct timespec next, t0, t1;
+	sigset_t all;
+	short *xi, *xq;
+	unsigned n, g = 0, reset = 1;
+	int recorded, grChanged;
+	uint64_t ns;
+
+	sigfillset( &all );		// term() belongs on another thread
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	rcv = arg;
+	rp = rcv->replay;
+	xi = malloc( rp->block * sizeof( short ) );
+	xq = malloc( rp->block * sizeof( short ) );
+	recorded = rp->gain_applied;
+
+	clock_gettime( CLOCK_MONOTONIC, &next );
+	rp->start_ns = now_ns();
+	for( rp->frame = 0; rp->frame < rp->frames && !atomic_load( &rp->stop ); rp->frame += n ) {
+		n = rp->frames - rp->frame < rp->block ? rp->frames - rp->frame : rp->block;
+
+		grChanged = 0;
+		if( rp->gain_pending && !--rp->gain_pending ) {		// a gain change takes effect on this block
+			rp->gain_applied = atomic_load( &rp->gain_requested );
+			rp->gain_changes++;
+			grChanged = 1;
+		}
+		else if( !rp->gain_pending && atomic_load( &rp->gain_requested ) != rp->gain_applied )
+			rp->gain_pending = REPLAY_GR_LATENCY;
+		for( ; g < rp->ngains && rp->gains[ g ].sample <= rp->frame; g++ )
+			recorded = rp->gains[ g ].gain_reduction;
+		replay_read( xi, xq, rp->frame, n, recorded == rp->gain_applied ? 1 : powf( 10, ( recorded - rp->gain_applied ) / 20.0f ) );
+
+		memset( &params, 0, sizeof( params ) );
+		params.firstSampleNum = rp->frame;
+		params.numSamples = n;
+		params.grChanged = grChanged;
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		rx( xi, xq, &params, n, reset, arg );
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+		ns = ( t1.tv_sec - t0.tv_sec ) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+		rp->busy_ns += ns;
+		if( ns > rp->max_ns )
+			rp->max_ns = ns;
+		rp->blocks++;
+		reset = 0;
+
+		if( !rcv->replay_fast ) {	// the API's pace
+			next.tv_nsec += (long)n * 1000000000 / rp->rate;
+			while( next.tv_nsec >= 1000000000 ) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+			while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL ) == EINTR )
+				;
+		}
+	}
+	rp->end_ns = now_ns();
+	free( xi );
+	free( xq );
+	if( atomic_fetch_sub( &replays_running, 1 ) == 1 && !atomic_load( &rp->stop ) )	// the last one to finish ends the run
+		kill( getpid(), SIGTERM );
+	return arg;
+}
+
+static int replay_start( void ) {
+
+	int ret;
+
+	atomic_fetch_add( &replays_running, 1 );
+	if( ( ret = pthread_create( &rcv->replay->thread, NULL, replay_thread, rcv ) ) ) {
+		fprintf( stderr, "Cannot create replay thread: %s\n", strerror( ret ) );
+		return 1;
+	}
+	return 0;
+}
+
+// Stop rcv's replay and report
+static void replay_stop( void ) {
+
+	struct replay *rp = rcv->replay;
+	double t;
+
+	atomic_store( &rp->stop, 1 );
+	pthread_join( rp->thread, NULL );
+	t = ( rp->end_ns - rp->start_ns ) * 1e-9;
+	fprintf( stderr, "Replay of %s: %llu frames in %.3f s (%.2f MS/s, %.1fx real time), %u gain change(s), final gain reduction %d dB\n",
+		rcv->sernum, (unsigned long long)rp->frame, t, t > 0 ? rp->frame / t * 1e-6 : 0, t > 0 ? rp->frame / t / rp->rate : 0, rp->gain_changes, rp->gain_applied );
+	fprintf( stderr, "   rx() and everything behind it:  %.1f ns per sample, %.1f us per block of %u (max %.1f us), %.2f%% of a core in real time\n",
+		rp->frame ? (double)rp->busy_ns / rp->frame : 0, rp->blocks ? rp->busy_ns * 1e-3 / rp->blocks : 0, rp->block, rp->max_ns * 1e-3,
+		rp->frame ? 100.0 * rp->busy_ns / rp->frame * rp->rate * 1e-9 : 0 );
+}
+
+// Control socket (-C path):  live changes without restarting the stream.  Each line a client sends is a command,
+// optionally prefixed by '@n' for receiver n (default 0), and is answered with "ok" or "error: why" after any
+// output.  Retunes, LNA and bandwidth changes go through the control thread's queue as sdrplay_api_Update() calls
+// with the matching reason;  gain and AGC settings are staged whole in the receiver and process_block() takes
+// them between two blocks, so the AGC never runs on half of a change.
+//	freq hz				retune
+//	gain dB				gain reduction, and with AGC its new minimum (as '-g')
+//	lna state			LNA state
+//	bw kHz				IF bandwidth:  200, 300, 600, 1536 or 5000
+//	agc [on|off] [k=v...]	AGC on or off and any of its settings, named by their options:  a b c x y z s S g G N
+//	hop ms hz hz...		step through the frequencies, 'ms' on each, until 'hop off' or the next 'freq'
+//	status				settings and retune latency
+#define CTL_MAXCLIENTS 8
+
+static char *control_path;	// -C
+static int ctl_fd = -1;
+static pthread_t ctl_sock_thread;
+
+struct ctl_client {
+	int fd;
+	size_t len;
+	char buf[ 1024 ];
+};
+
+static int ctl_int( const char *s, int *v ) {
+
+	char *end;
+	long l = strtol( s, &end, 0 );
+
+	if( !*s || *end || l < INT_MIN || l > INT_MAX )
+		return -1;
+	*v = l;
+	return 0;
+}
+
+// Run a command on the control thread and wait for the API's answer
+static int ctl_sync( struct receiver *r, int type, int value ) {
+
+	struct ctl_cmd c = { .r = r, .type = type, .value = value };
+	sem_t done;
+	int ret;
+
+	sem_init( &done, 0, 0 );
+	c.result = &ret;
+	c.done = &done;
+	while( ctl_post( &c ) )
+		usleep( 1000 );
+	while( sem_wait( &done ) && errno == EINTR )
+		;
+	sem_destroy( &done );
+	return ret;
+}
+
+// Stage new AGC settings for process_block().  Returns 0, or -1 if the last lot has not been taken (no blocks?).
+static int ctl_stage( struct receiver *r, const struct agc_params *p ) {
+
+	int i;
+
+	for( i = 0; atomic_load_explicit( &r->agc_staged_ready, memory_order_acquire ); i++ ) {
+		if( i == 100 )
+			return -1;
+		usleep( 10000 );
+	}
+	r->agc_staged = *p;
+	atomic_store_explicit( &r->agc_staged_ready, 1, memory_order_release );
+	r->agc_ctl = *p;
+	r->agc_ctl.set_gain = -1;
+	return 0;
+}
+
+static void ctl_status( int fd, int n ) {
+
+	struct receiver *r = receivers[ n ];
+	const struct agc_params *p = &r->agc_ctl;
+	unsigned long retunes = atomic_load( &r->retunes );
+
+	dprintf( fd, "receiver %d %s tuner %c:  %d Hz, gain reduction %d dB, LNA state %d, bandwidth %d kHz, AGC %s (a=%d b=%d c=%d x=%d y=%d z=%d s=%d S=%d g=%d G=%d N=%d)%s\n",
+		n, r->replay ? r->replay_file : r->sernum, r->tuner == sdrplay_api_Tuner_B ? 'B' : 'A', r->freq, MET_LOAD( r->gain_reduction ), r->lna, r->bwtype,
+		p->AGCEnable ? "on" : "off", p->AGC1increaseThreshold, p->AGC2decreaseThreshold, p->AGC3minTimeMs, p->AGC4A, p->AGC5B, p->AGC6C,
+		p->gainstep_dec, p->gainstep_inc, p->min_gain_reduction, p->max_gain_reduction, p->agc_fast, atomic_load( &r->overload ) ? ", ADC overloaded" : "" );
+	if( retunes )
+		dprintf( fd, "   %lu retune(s), first block at the new frequency after %.2f ms (last), %.2f ms (mean), %.2f ms (max)\n", retunes,
+			atomic_load( &r->retune_last_ns ) * 1e-6, atomic_load( &r->retune_sum_ns ) * 1e-6 / retunes, atomic_load( &r->retune_max_ns ) * 1e-6 );
+	if( r->ctl_hop_n )
+		dprintf( fd, "   hopping over %u frequencies, %u ms on each\n", r->ctl_hop_n, r->ctl_hop_ms );
+}
+
+// Set an AGC setting named by its option letter from "k=v".  Returns 0, or -1 if k or v is no good.
+static int ctl_agc_setting( struct agc_params *p, const char *kv ) {
+
+	int v, *f = NULL, lo = 0, hi = INT_MAX;
+
+	if( !kv[ 0 ] || kv[ 1 ] != '=' || ctl_int( kv + 2, &v ) )
+		return -1;
+	switch( kv[ 0 ] ) {
+	case 'a':	f = &p->AGC1increaseThreshold;	break;
+	case 'b':	f = &p->AGC2decreaseThreshold;	break;
+	case 'c':	f = &p->AGC3minTimeMs;	lo = 50;	break;
+	case 'x':	f = &p->AGC4A;	break;
+	case 'y':	f = &p->AGC5B;	lo = 50;	break;
+	case 'z':	f = &p->AGC6C;	lo = 50;	break;
+	case 's':	f = &p->gainstep_dec;	lo = 1;	hi = 10;	break;
+	case 'S':	f = &p->gainstep_inc;	lo = 1;	hi = 10;	break;
+	case 'g':	f = &p->min_gain_reduction;	lo = 20;	hi = 59;	break;
+	case 'G':	f = &p->max_gain_reduction;	lo = 20;	hi = 59;	break;
+	case 'N':	f = &p->agc_fast;	hi = 20;	break;
+	}
+	if( !f || v < lo || v > hi )
+		return -1;
+	*f = v;
+	return 0;
+}
+
+static void ctl_command( int fd, char *line ) {
+
+	char *argv[ 256 ], *save;
+	int argc = 0, n = 0, picked = 0, v, i, ret;
+	struct receiver *r;
+	struct agc_params p;
+	struct ctl_hop *h;
+	struct ctl_cmd c;
+
+	for( argv[ 0 ] = strtok_r( line, " \t\r", &save ); argv[ argc ] && argc < 255; argv[ ++argc ] = strtok_r( NULL, " \t\r", &save ) )
+		;
+	if( argc && argv[ 0 ][ 0 ] == '@' ) {
+		if( ctl_int( argv[ 0 ] + 1, &n ) || n < 0 || n >= numreceivers ) {
+			dprintf( fd, "error: no receiver %s\n", argv[ 0 ] + 1 );
+			return;
+		}
+		picked = 1;
+		argc--;
+		memmove( argv, argv + 1, argc * sizeof( *argv ) );
+	}
+	if( !argc )
+		return;
+	r = receivers[ n ];
+	p = r->agc_ctl;
+	if( r->chan_of && strcmp( argv[ 0 ], "status" ) ) {
+		dprintf( fd, "error: a '-Z' channel follows the tuning and gain of the receiver it comes from\n" );
+		return;
+	}
+
+	if( !strcmp( argv[ 0 ], "status" ) ) {
+		for( i = 0; i < numreceivers; i++ )
+			if( i == n || !picked )
+				ctl_status( fd, i );
+	}
+	else if( ( !strcmp( argv[ 0 ], "freq" ) || !strcmp( argv[ 0 ], "lna" ) || !strcmp( argv[ 0 ], "bw" ) ) && argc == 2 ) {
+		if( ctl_int( argv[ 1 ], &v ) || v < 0 || ( argv[ 0 ][ 0 ] == 'b' && v != 200 && v != 300 && v != 600 && v != 1536 && v != 5000 ) ) {
+			dprintf( fd, "error: bad value %s\n", argv[ 1 ] );
+			return;
+		}
+		if( r->replay ) {
+			dprintf( fd, "error: a replay cannot be retuned\n" );
+			return;
+		}
+		if( argv[ 0 ][ 0 ] == 'f' && r->ctl_hop_n ) {	// a retune by hand ends the hopping
+			c = (struct ctl_cmd){ .r = r, .type = CTL_HOP };
+			while( ctl_post( &c ) )
+				usleep( 1000 );
+			r->ctl_hop_n = 0;
+		}
+		if( ( ret = ctl_sync( r, argv[ 0 ][ 0 ] == 'f' ? CTL_FREQ : argv[ 0 ][ 0 ] == 'l' ? CTL_LNA : CTL_BW, v ) ) ) {
+			dprintf( fd, "error: %s\n", sdrplay_api_GetErrorString( ret ) );
+			return;
+		}
+	}
+	else if( !strcmp( argv[ 0 ], "gain" ) && argc == 2 ) {
+		if( ctl_int( argv[ 1 ], &v ) || v < 20 || v > 59 ) {
+			dprintf( fd, "error: gain reduction is 20 to 59 dB\n" );
+			return;
+		}
+		p.min_gain_reduction = p.set_gain = v;
+		if( p.max_gain_reduction < v )
+			p.max_gain_reduction = v;
+		if( ctl_stage( r, &p ) ) {
+			dprintf( fd, "error: the stream is not running\n" );
+			return;
+		}
+	}
+	else if( !strcmp( argv[ 0 ], "agc" ) ) {
+		for( i = 1; i < argc; i++ )
+			if( !strcmp( argv[ i ], "on" ) || !strcmp( argv[ i ], "off" ) )
+				p.AGCEnable = argv[ i ][ 1 ] == 'n';
+			else if( ctl_agc_setting( &p, argv[ i ] ) ) {
+				dprintf( fd, "error: bad AGC setting %s\n", argv[ i ] );
+				return;
+			}
+		if( p.min_gain_reduction > p.max_gain_reduction ) {
+			dprintf( fd, "error: g is above G\n" );
+			return;
+		}
+		if( ctl_stage( r, &p ) ) {
+			dprintf( fd, "error: the stream is not running\n" );
+			return;
+		}
+	}
+	else if( !strcmp( argv[ 0 ], "hop" ) && ( argc >= 3 || ( argc == 2 && !strcmp( argv[ 1 ], "off" ) ) ) ) {
+		if( r->replay ) {
+			dprintf( fd, "error: a replay cannot be retuned\n" );
+			return;
+		}
+		h = NULL;
+		if( argc >= 3 ) {
+			h = calloc( 1, sizeof( *h ) + ( argc - 2 ) * sizeof( int ) );
+			if( ctl_int( argv[ 1 ], &v ) || v < 1 ) {
+				free( h );
+				dprintf( fd, "error: bad dwell time %s\n", argv[ 1 ] );
+				return;
+			}
+			h->dwell_ns = v * 1000000ULL;
+			for( i = 2; i < argc; i++ )
+				if( ctl_int( argv[ i ], h->freq + h->n++ ) || h->freq[ h->n - 1 ] <= 0 ) {
+					free( h );
+					dprintf( fd, "error: bad frequency %s\n", argv[ i ] );
+					return;
+				}
+		}
+		c = (struct ctl_cmd){ .r = r, .type = CTL_HOP, .hop = h };
+		while( ctl_post( &c ) )
+			usleep( 1000 );
+		r->ctl_hop_n = h ? h->n : 0;
+		r->ctl_hop_ms = h ? v : 0;
+	}
+	else {
+		dprintf( fd, "error: commands are [@receiver] freq hz | gain dB | lna state | bw kHz | agc [on|off] [a|b|c|x|y|z|s|S|g|G=value...] | "
+			"hop ms hz... | hop off | status\n" );
+		return;
+	}
+	dprintf( fd, "ok\n" );
+}
+
+static void *ctl_serve( void *arg ) {
+
+	struct pollfd pfd[ 1 + CTL_MAXCLIENTS ];
+	struct ctl_client cl[ CTL_MAXCLIENTS ];
+	struct timeval tv = { 1, 0 };
+	sigset_t all;
+	int n = 0, i, fd;
+	ssize_t len;
+	char *nl;
+
+	sigfillset( &all );		// term() belongs on another thread
+	pthread_sigmask( SIG_BLOCK, &all, NULL );
+	for(;;) {
+		pfd[ 0 ] = (struct pollfd){ ctl_fd, POLLIN, 0 };
+		for( i = 0; i < n; i++ )
+			pfd[ 1 + i ] = (struct pollfd){ cl[ i ].fd, POLLIN, 0 };
+		if( poll( pfd, 1 + n, -1 ) <= 0 )
+			continue;
+
+		for( i = n - 1; i >= 0; i-- ) {		// backwards, as a client that goes is replaced by the last
+			if( !pfd[ 1 + i ].revents )
+				continue;
+			if( ( len = read( cl[ i ].fd, cl[ i ].buf + cl[ i ].len, sizeof( cl[ i ].buf ) - 1 - cl[ i ].len ) ) <= 0 ) {
+				close( cl[ i ].fd );
+				cl[ i ] = cl[ --n ];
+				continue;
+			}
+			cl[ i ].len += len;
+			while( ( nl = memchr( cl[ i ].buf, '\n', cl[ i ].len ) ) ) {
+				*nl = 0;
+				ctl_command( cl[ i ].fd, cl[ i ].buf );
+				cl[ i ].len -= nl + 1 - cl[ i ].buf;
+				memmove( cl[ i ].buf, nl + 1, cl[ i ].len );
+			}
+			if( cl[ i ].len == sizeof( cl[ i ].buf ) - 1 ) {
+				dprintf( cl[ i ].fd, "error: line too long\n" );
+				cl[ i ].len = 0;
+			}
+		}
+
+		if( pfd[ 0 ].revents & POLLIN && ( fd = accept4( ctl_fd, NULL, NULL, SOCK_CLOEXEC ) ) >= 0 ) {
+			if( n == CTL_MAXCLIENTS ) {
+				dprintf( fd, "error: too many clients\n" );
+				close( fd );
+				continue;
+			}
+			setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );	// a client that stops reading cannot hold us up
+			cl[ n ].fd = fd;
+			cl[ n++ ].len = 0;
+		}
+	}
+	return arg;
+}
+
+// Open the control socket.  Returns 0, or 1 after reporting an error.
+static int ctl_listen( void ) {
+
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct receiver *r;
+	int i, ret;
+
+	for( i = 0; i < numreceivers; i++ ) {
+		r = receivers[ i ];
+		r->agc_ctl = (struct agc_params){ r->AGCEnable, r->AGC1increaseThreshold, r->AGC2decreaseThreshold, r->AGC3minTimeMs, r->AGC4A, r->AGC5B,
+			r->AGC6C, r->gainstep_inc, r->gainstep_dec, r->min_gain_reduction, r->max_gain_reduction, r->agc_fast, -1 };
+	}
+	if( strlen( control_path ) >= sizeof( sa.sun_path ) ) {
+		fprintf( stderr, "Control socket path too long: %s\n", control_path );
+		return 1;
+	}
+	strcpy( sa.sun_path, control_path );
+	unlink( sa.sun_path );
+	if( ( ctl_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0
+		|| bind( ctl_fd, (struct sockaddr *)&sa, sizeof( sa ) ) || listen( ctl_fd, 16 ) ) {
+		fprintf( stderr, "Cannot listen on %s: %s\n", control_path, strerror( errno ) );
+		return 1;
+	}
+	if( ( ret = pthread_create( &ctl_sock_thread, NULL, ctl_serve, NULL ) ) ) {
+		fprintf( stderr, "Cannot create control socket thread: %s\n", strerror( ret ) );
+		return 1;
+	}
+	fprintf( stderr, "Control socket:  %s\n", control_path );
+	return 0;
+}
+
+static void usage( char *argv0 ) {
+
+    fprintf( stderr, "usage: %s [options...]\n"
+	     "options:\n"
+	     "    -a inc   AGC \"increase\" threshold, default 16384\n"
+	     "    -A cpus  run the callback and writer threads on these CPUs ('2', '2,3', '2-5');  in daemon mode each receiver's writer\n"
+	     "             thread gets one of them in turn\n"
+	     "    -B bwType baseband low-pass filter bandwidth (200, 300, 600, 1536, 5000 kHz)\n"
+	     "    -b dec   AGC \"decrease\" threshold, default 8192\n"
+	     "    -c min   AGC sample period (ms), default 500, minimum 50\n"
+	     "    -C path  listen for live changes on the Unix socket 'path', one command per line, optionally prefixed '@receiver':\n"
+	     "             'freq hz', 'gain dB', 'lna state', 'bw kHz', 'agc [on|off] [k=v...]' (k one of a b c x y z s S g G N as these\n"
+	     "             options), 'hop ms hz hz...' to step through frequencies, 'hop off' and 'status', which includes the retune latency\n"
+	     "    -d       list available input/output devices\n"
+	     "    -D file  daemon mode:  run a receiver for each line of 'file', which holds that receiver's options as on this command\n"
+	     "             line ('#' starts a comment).  Options given here are defaults for every line.  Each receiver needs its own\n"
+	     "             '-i' and all but one need '-o';  processing runs on a writer thread per receiver ('-q', default 100) pinned to a CPU\n"
+	     "    -e gainfile  write gain_reduction value to file\n"
+	     "    -E ms    correct the DC offset and I/Q gain and phase imbalance (the spike at the centre and the mirror images), tracked\n"
+	     "             with a time constant of 'ms' (>=0) milliseconds, default 0 (off).  The estimates are reported at exit\n"
+	     "    -F fmt   output sample format: s16, s32 or f32, default s16;  or for stdout and the network a compact one (see iqpack.h):\n"
+	     "             p12 (packed 12-bit), s8 (8-bit with a scale per block) or bfp (8-bit mantissas with an exponent per 32 samples)\n"
+	     "    -f freq  set tuner frequency (in Hz)\n"
+	     "    -g gain  set min gain reduction during AGC operation or fixed gain w/AGC disabled, default 30\n"
+	     "    -G gain  set max gain reduction during AGC operation, default 59\n"
+	     "    -H prio  run the callback and writer threads SCHED_FIFO at priority 'prio' (1-99)\n"
+	     "    -h       show usage\n"
+	     "    -i ser   specify input SDRPlay device by serial number (full or partial)\n"
+	     "    -I file  replay a capture through rx() instead of streaming from an RSP:  a SigMF recording (as '-o sigmf://' makes,\n"
+	     "             giving the rate, frequency and recorded gains) or raw S16 I/Q at the '-r' rate.  Blocks are the size the API\n"
+	     "             would deliver, gain changes act on the samples, and the run ends with the throughput of rx() and all behind it\n"
+	     "    -j       fill a pipe on stdout with vmsplice() from a reused pool instead of write():  less CPU for blocks of 16 KiB and\n"
+	     "             more, but only for a reader that read()s the pipe (not splice() or tee()).  Blocks the pipe has no room for are\n"
+	     "             dropped when output runs in the API callback;  with '-q' or '-I' the output waits for the reader\n"
+	     "    -J gr    gain compensation:  scale the output for the gain reduction in effect, from the block the RSP applies each change,\n"
+	     "             so its level stays as at 'gr' dB (20-59) of gain reduction through every AGC step (scaled as S16:  above full scale\n"
+	     "             clips)\n"
+	     "    -K       benchmark the I/Q interleave and conversion kernels, check the AGC against the per-sample reference and exit\n"
+	     "             (raw S16 I/Q redirected to stdin is also run through the AGC check)\n"
+	     "    -l val   set LNA state, default 3.  See SDRPlay API gain reduction tables for more info\n"
+         "    -L latency in microseconds - Used only with '-o' parameter - must be >=30000, default 50000\n"
+	     "    -k us    ALSA buffer fill to hold (drift is corrected by dropping/repeating single frames), default half the '-L' latency\n"
+	     "    -m       use mmap access to the ALSA device given with '-o' so blocks are written straight into its buffer (not for '-Z'\n"
+	     "             channels, which always use read/write access)\n"
+	     "    -M path  keep runtime metrics (callback timing histograms, samples, drops, xruns, resets, gain changes and lock-outs) and\n"
+	     "             write them to 'path' every second in the Prometheus text format, or with 'unix:path' serve them on a Unix socket\n"
+	     "             (plain text, or HTTP to a GET).  For every receiver in daemon mode\n"
+	     "    -n       AGC enable, uses parameters a,b,c,g,s,S,x,y,z,N\n"
+	     "    -N dB    AGC fast attack:  step the gain reduction up this much (1-20) on the first block that clips or the API's ADC\n"
+	     "             overload event, rather than after the AGC window;  the gain still comes back slowly, default 0 (off)\n"
+	     "    -o dev   specify output device (Use with '-L' parameter), or a network sink:  'udp://host:port' sends packets to an address\n"
+	     "             (unicast or multicast), 'tcp://[addr]:port' serves them to every client that connects.  See '-U' and '-V'.\n"
+	     "             'shm://name' writes a shared memory ring that any number of local readers can follow (see iqshm.h, iqshmcat)\n"
+	     "             'sigmf://path[?size=MB][&time=s][&io=thread]' records to path.sigmf-data and path.sigmf-meta, with O_DIRECT and\n"
+	     "             io_uring where available, starting a new numbered pair every 'size' MB or 'time' seconds if given.\n"
+	     "             Without '-o' samples go to stdout;  a pipe is grown to hold 250 ms of them\n"
+	     "    -O dev   RSPduo:  output device for tuner B with '-u';  without it both tuners go to this receiver's output as 4 channels\n"
+	     "             (I and Q of tuner A, then of tuner B, in each frame)\n"
+	     "    -p us    ALSA period in microseconds, default a quarter of the '-L' latency\n"
+	     "    -P       with '-I', replay as fast as possible rather than in real time (a benchmark of the processing chain - leave out '-q')\n"
+	     "    -Q sink[?bins=N][&fps=F][&avg=A]  spectrum tap:  'fps' times a second average 'avg' windowed FFTs of 'bins' bins\n"
+	     "             (default 1024, 10, 8) of snapshots of the stream, taken in rx() only when it is not under load, and write\n"
+	     "             them with their peak and noise floor as binary frames (struct iqshm_spectrum in iqshm.h) to 'shm://name', a\n"
+	     "             shared memory ring, or to a file or FIFO.  The cost in rx() is reported at exit\n"
+	     "    -q ms    buffer output through a writer thread with a ring of 'ms' depth (>=10) so a slow sink cannot stall the API callback, default 0 (off)\n"
+	     "    -r rate  set sampling rate (in Hz) [96000, 192000, 384000 or 768000 are exact;  other rates use the nearest power-of-two ADC rate or a rational resampler unless '-R' is specified]\n"
+         "    -R rexp  If specified, use with '-r' to set decimation and sample rate:  Choose 'rexp' so that 'rate * 2^rexp' is >=2.048 and <8.064 Msamples/sec:  Decimation is 2^rexp (Must be 0-5)\n"
+	     "    -S step_inc  set gain AGC attenuation increase (gain reduction) step size in dB, default = 1 (1-10)\n"
+	     "    -s step_dec  set gain AGC attenuation decrease (gain increase) step size in dB, default = 1 (1-10)\n"
+	     "    -T tuner RSPduo:  use tuner 'a' (default) or 'b'.  In daemon mode a '-T b' line with the same '-i' as a tuner A line\n"
+	     "             runs the two tuners together in dual-tuner mode, each with its own settings and output\n"
+	     "    -t taps  decimate in software (half-band cascade) rather than in the RSP, with a final FIR of 'taps' taps (0 = none, or odd 3-127)\n"
+	     "    -U bytes network sink:  sample bytes per packet, default 1432 (one 1500-byte Ethernet frame with the headers)\n"
+	     "    -u freq  RSPduo dual-tuner mode:  also run tuner B at 'freq' (in Hz), with the same settings (see '-O')\n"
+	     "    -V url   receive a network sink's stream ('udp://[group]:port' or 'tcp://host:port'), write its samples to stdout and\n"
+	     "             report the packet rate and loss each second\n"
+	     "    -v       enable verbose output\n"
+	     "    -W       enable wideband signal mode (e.g. half-band filtering). Warning: High CPU useage! (May not work)\n"
+	     "    -w debugPeriodMs    warning/debug output period (ms)\n"
+		 "    -X       Set to USB Xfer mode to BULK rather than Isochronous \n"
+	     "    -Y       lock all memory once streaming has started.  With any of '-A', '-H' and '-Y' sample buffers and thread stacks\n"
+	     "             are faulted in up front and a self-check at startup reports any setting that could not be applied\n"
+	     "    -x A     num of A/D samples above threshold (-a parameter) before detection, default 4096\n"
+	     "    -y B     gain decrease event time (ms), default 1000, minimum 50\n"
+	     "    -z C     gain increase event time (ms), default 5000, minimum 50\n"
+	     "    -Z off:rate[:dev]  a narrowband channel 'off' Hz from '-f', at 'rate' (at most 1/16 of '-r'), to output 'dev' (as '-o';\n"
+	     "             none = stdout).  Repeat for up to %d channels, cut from the stream by one polyphase FFT filter bank on this\n"
+	     "             receiver's writer thread ('-q', default 100) and each finished on its own thread.  The wideband stream itself\n"
+	     "             goes out only if '-o' is given.  '-K' reports the channels per core at 8 MS/s\n\n", argv0, CHAN_MAX );
+}
+
+static void setopt( int *p, char *optarg, char *argv0 ) {
+
+    char *endp;
+
+    *p = strtol( optarg, &endp, 0 );
+
+    if( p < 0 || !*optarg || *endp ) {
+	usage( argv0 );
+	exit( 1 );
+    }
+}
+
+void term(int signum)	{		// termination signal handler
+int ret;
+int err = 0;
+int i, j;
+
+	for( i = 0; i < numreceivers; i++ ) {
+		rcv = receivers[ i ];
+		if( !rcv->dp )		// never got as far as the API
+			continue;
+		if( rcv->replay )
+			replay_stop();
+
+		if(rcv->pcm)
+			fprintf(stderr, "ALSA output: %lu xrun(s), %lu frame(s) dropped, drift correction +%lu/-%lu frame(s) (%+.0f ppm), fill %.0f of %lu target frames\n",
+				rcv->pcm_xruns, rcv->pcm_dropped, rcv->pcm_inserted, rcv->pcm_removed, -rcv->pcm_integral * 1e6, rcv->pcm_fill, (unsigned long)rcv->pcm_target);
+		if(rcv->ring_buf)
+			fprintf(stderr, "Ring buffer: %zu bytes, high-water %zu bytes, %lu block(s) dropped\n", rcv->ring_size,
+				atomic_load(&rcv->ring_highwater), atomic_load(&rcv->ring_overruns));
+		if(rcv->net)
+			net_report(rcv->net);
+		if(rcv->wire_in)
+			fprintf(stderr, "Packed output (%s): %.1f MB for %.1f MB of S16 (%.1f%%)\n", iqpack_name(rcv->wire), rcv->wire_out * 1e-6, rcv->wire_in * 1e-6,
+				100.0 * rcv->wire_out / rcv->wire_in);
+		if(rcv->pipe_splice && rcv->pipe_size)
+			fprintf(stderr, "Pipe output: %.1f MB spliced in %lu vmsplice() call(s), %lu partial, %lu frame(s) dropped for want of room in the %d KiB pipe\n",
+				rcv->pipe_bytes * 1e-6, rcv->pipe_calls, rcv->pipe_partial, rcv->pipe_dropped, rcv->pipe_size >> 10);
+		if(rcv->shm)
+			fprintf(stderr, "Shared memory output: %.1f MB written, %u reader(s) attached\n", iqshm_header(rcv->shm)->head * 1e-6, iqshm_header(rcv->shm)->readers);
+		if(rcv->oversize)
+			fprintf(stderr, "Input: %lu block(s) of over %d frames dropped\n", rcv->oversize, API_MAXFRAMES);
+		if(rcv->quad)
+			fprintf(stderr, "4-channel output: %lu frame(s) dropped for want of the other tuner's block\n", rcv->quad_dropped);
+		if(atomic_load(&rcv->retunes))
+			fprintf(stderr, "Retunes: %lu, first block at the new frequency after %.2f ms (mean), %.2f ms (max)\n", atomic_load(&rcv->retunes),
+				atomic_load(&rcv->retune_sum_ns) * 1e-6 / atomic_load(&rcv->retunes), atomic_load(&rcv->retune_max_ns) * 1e-6);
+		if(rcv->AGCEnable && (atomic_load(&rcv->clips) || atomic_load(&rcv->overloads)))
+			fprintf(stderr, "AGC: %lu clipping episode(s), time to unclip %.1f ms (mean), %.1f ms (max);  %lu ADC overload event(s), %lu fast-attack step(s)\n",
+				atomic_load(&rcv->clips), atomic_load(&rcv->clips) ? atomic_load(&rcv->clip_sum) * 1e3 / atomic_load(&rcv->clips) / rcv->rate : 0,
+				atomic_load(&rcv->clip_max) * 1e3 / rcv->rate, atomic_load(&rcv->overloads), atomic_load(&rcv->attacks));
+		if(rcv->iqc_ms)
+			iqc_report();
+		if(rcv->spec)
+			spec_report();
+		if(rcv->met && atomic_load(&rcv->met->cb_jitter.count))
+			fprintf(stderr, "Callback jitter: %.1f us (mean), %.1f us (max) over %lu callbacks\n", atomic_load(&rcv->met->cb_jitter.sum_ns) * 1e-3
+				/ atomic_load(&rcv->met->cb_jitter.count), atomic_load(&rcv->met->cb_jitter.max_ns) * 1e-3, atomic_load(&rcv->met->cb_jitter.count));
+
+		if(rcv->replay || rcv->chan_of || (rcv->tuner == sdrplay_api_Tuner_B && rcv->peer))	// no device, or another receiver owns it
+			continue;
+
+		ret = sdrplay_api_Uninit((devices+rcv->devind)->dev);
+
+		if(ret != sdrplay_api_Success)	{
+			fprintf(stderr, "SDRPlay uninit failed");
+			err = 1;
+		}
+		else
+			fprintf(stderr, "SDRPlay uninit successful");
+
+		fprintf(stderr, " for device %s\n", rcv->sernum);
+
+		ret = sdrplay_api_ReleaseDevice( devices + rcv->devind );
+
+		if(ret != sdrplay_api_Success)	{
+			fprintf(stderr, "SDRPlay Device release failed");
+			err = 1;
+		}
+		else
+			fprintf(stderr, "SDRPlay Device release successful");
+
+		fprintf(stderr, " for device %s\n", rcv->sernum);
+	}
+
+	for( i = 0; i < numreceivers; i++ ) {		// readers see the ring go quiet and new ones cannot attach
+		if( receivers[ i ]->shm )
+			iqshm_destroy( receivers[ i ]->shm );
+		if( receivers[ i ]->spec && receivers[ i ]->spec->shm )
+			iqshm_destroy( receivers[ i ]->spec->shm );
+	}
+
+	for( i = 0; i < numreceivers; i++ ) {		// the streams have stopped:  finish the recordings and the pipe
+		rcv = receivers[ i ];
+		if( rcv->rec ) {
+			for( j = 0; j < 100 && rcv->ring_buf && atomic_load( &rcv->ring_tail ) != atomic_load( &rcv->ring_head ); j++ )
+				usleep( 10000 );	// the writer thread is still outputting what the callback left it
+			rec_close( rcv->rec );
+		}
+		if( rcv->pipe_splice && rcv->pipe_size )
+			pipe_flush();
+	}
+
+	if( metrics_path )
+		met_stop();
+	if( ctl_fd >= 0 )
+		unlink( control_path );
+
+	if(!use_api)	// only replays
+		exit(0);
+
+	ret = sdrplay_api_UnlockDeviceApi();
+
+	if(ret != sdrplay_api_Success)	{
+		fprintf(stderr, "SDRPlay Device unlock failed\n");
+		err = 1;
+	}
+	else
+		fprintf(stderr, "SDRPlay Device unlock successful\n");
+
+	ret = sdrplay_api_Close();	// close sdrplay API as gracefully as possible
+
+	if(ret != sdrplay_api_Success)	{
+		fprintf(stderr, "SDRPlay API close failed\n");
+		err = 1;
+	}
+	else
+		fprintf(stderr, "SDRPlay API close successful\n");
+
+	if(!err)	// no error
+		exit (0);
+	else	// error in closing
+		exit(1);
+}
+
+
+
+// Parse command line (or config file line) options into rcv.  Returns -1 to carry on, else an exit code.
+static int parse_options( int argc, char *argv[] ) {
+
+    int opt;
+
+    while( ( opt = getopt( argc, argv, "a:b:c:dD:e:E:f:g:hi:jk:l:mno:p:q:r:s:t:u:vw:x:y:z:A:B:C:F:H:I:J:KL:M:N:O:PQ:WG:S:R:T:U:V:XYZ:" ) ) >= 0 )
+
+	switch( opt ) {
+	case 'a':
+	    setopt( &rcv->AGC1increaseThreshold, optarg, argv[ 0 ] );
+	    break;
+
+	case 'A': // CPU affinity
+	    if( rt_parse_cpus( optarg ) ) {
+		fprintf( stderr, "%s: Bad CPU list '%s' - give CPUs like '2', '2,3' or '2-5'\n", argv[ 0 ], optarg );
+		return 1;
+	    }
+	    break;
+
+	case 'b':
+	    setopt( &rcv->AGC2decreaseThreshold, optarg, argv[ 0 ] );
+	    break;
+
+    case 'B':
+	    setopt (&rcv->bwtype, optarg, argv[ 0 ] );
+	    if((rcv->bwtype != 200) && (rcv->bwtype != 300) && (rcv->bwtype != 600) && (rcv->bwtype != 1536) && (rcv->bwtype != 5000)) {
+			fprintf( stderr, "%s: Invalid bandwidth specified - must be 200, 300, 600, 1536 or 5000.\n", argv[ 0 ] );
+			return 1;
+	    }
+	    break;
+
+	case 'c':
+	    setopt( &rcv->AGC3minTimeMs, optarg, argv[ 0 ] );
+	    break;
+
+	case 'C': // control socket
+	    control_path = optarg;
 	    break;
 
 	case 'd': // list devices
 	    devlist = 1;
 	    break;
+
+	case 'D': // daemon mode
+	    config = optarg;
+	    break;
 	    
 	case 'e': // write gain_reduction to file
-	    gainfile = optarg;
+	    rcv->gainfile = optarg;
 	    break;
 	    
+	case 'F': // output format
+	    if( !strcasecmp( optarg, "s16" ) )
+			rcv->out_format = FMT_S16, rcv->out_bps = 2;
+	    else if( !strcasecmp( optarg, "s32" ) )
+			rcv->out_format = FMT_S32, rcv->out_bps = 4;
+	    else if( !strcasecmp( optarg, "f32" ) )
+			rcv->out_format = FMT_F32, rcv->out_bps = 4;
+	    else if( !strcasecmp( optarg, "p12" ) )		// packed from S16 at the output
+			rcv->out_format = FMT_S16, rcv->out_bps = 2, rcv->wire = IQPACK_P12;
+	    else if( !strcasecmp( optarg, "s8" ) )
+			rcv->out_format = FMT_S16, rcv->out_bps = 2, rcv->wire = IQPACK_S8;
+	    else if( !strcasecmp( optarg, "bfp" ) )
+			rcv->out_format = FMT_S16, rcv->out_bps = 2, rcv->wire = IQPACK_BFP;
+	    else {
+			usage( argv[ 0 ] );
+			return 1;
+	    }
+	    break;
+
 	case 'f': // frequency
-	    setopt( &freq, optarg, argv[ 0 ] );
+	    setopt( &rcv->freq, optarg, argv[ 0 ] );
 	    break;
 	    
 	case 'g': // gain (reduction) - fixed gain, or minimum gain reduction level during AGC operation
-	    setopt( &min_gain_reduction, optarg, argv[ 0 ] );
+	    setopt( &rcv->min_gain_reduction, optarg, argv[ 0 ] );
 	    //
-	    if(min_gain_reduction < 20) min_gain_reduction = 20;  // trap invalid value
-	    else if(min_gain_reduction > max_gain_reduction) min_gain_reduction = max_gain_reduction;
-	    gain_reduction = min_gain_reduction;
+	    if(rcv->min_gain_reduction < 20) rcv->min_gain_reduction = 20;  // trap invalid value
+	    else if(rcv->min_gain_reduction > rcv->max_gain_reduction) rcv->min_gain_reduction = rcv->max_gain_reduction;
+	    rcv->gain_reduction = rcv->min_gain_reduction;
 	    break;
 		
 	case 'G':  // maximum amount of gain reduction during AGC operation
-	    setopt( &max_gain_reduction, optarg, argv[ 0 ] );
-	    if(max_gain_reduction < gain_reduction) max_gain_reduction = gain_reduction;	// don't allow setting lower than minimum gain reduction
-	    else if(max_gain_reduction > 59) max_gain_reduction = 59;  // trap invalid value
+	    setopt( &rcv->max_gain_reduction, optarg, argv[ 0 ] );
+	    if(rcv->max_gain_reduction < rcv->gain_reduction) rcv->max_gain_reduction = rcv->gain_reduction;	// don't allow setting lower than minimum gain reduction
+	    else if(rcv->max_gain_reduction > 59) rcv->max_gain_reduction = 59;  // trap invalid value
 	    break;
 	    
+	case 'H': // SCHED_FIFO priority
+	    setopt( &rt_prio, optarg, argv[ 0 ] );
+	    if( rt_prio < sched_get_priority_min( SCHED_FIFO ) || rt_prio > sched_get_priority_max( SCHED_FIFO ) ) {
+		fprintf( stderr, "%s: SCHED_FIFO priority must be %d to %d\n", argv[ 0 ], sched_get_priority_min( SCHED_FIFO ), sched_get_priority_max( SCHED_FIFO ) );
+		return 1;
+	    }
+	    break;
+
 	case 'h': // help
 	    usage( argv[ 0 ] );
 	    return 0;
 	    
 	case 'i': // input device (serial number)
-	    in_dev = optarg;
+	    rcv->in_dev = optarg;
+	    break;
+
+	case 'I': // replay a capture
+	    rcv->replay_file = optarg;
 	    break;
 	    
+	case 'K': // kernel benchmark
+	    benchmark_kernels();
+	    return 0;
+
 	case 'l': // lna
-	    setopt( &lna, optarg, argv[ 0 ] );
+	    setopt( &rcv->lna, optarg, argv[ 0 ] );
+	    break;
+
+	case 'L':
+		setopt( &rcv->latency_us, optarg, argv[ 0 ] );
+		break;
+
+	case 'k': // ALSA fill target
+	    setopt( &rcv->fill_us, optarg, argv[ 0 ] );
+	    break;
+
+	case 'm': // mmap ALSA output
+	    rcv->pcm_mmap = 1;
+	    break;
+
+	case 'j': // vmsplice() into a pipe on stdout
+	    rcv->pipe_splice = 1;
+	    break;
+
+	case 'M': // metrics
+	    metrics_path = optarg;
+	    break;
+
+	case 'E': // DC and I/Q imbalance correction
+	    setopt( &rcv->iqc_ms, optarg, argv[ 0 ] );
+	    if( rcv->iqc_ms < 0 ) {
+		fprintf( stderr, "%s: IQ correction time constant must be 0 (off) or more ms\n", argv[ 0 ] );
+		return 1;
+	    }
+	    break;
+
+	case 'J': // gain compensation
+	    setopt( &rcv->gc_ref, optarg, argv[ 0 ] );
+	    if( rcv->gc_ref < 20 || rcv->gc_ref > 59 ) {
+		fprintf( stderr, "%s: Gain compensation reference must be a gain reduction of 20 to 59 dB\n", argv[ 0 ] );
+		return 1;
+	    }
 	    break;
 
-	case 'L':
-		setopt( &latency_us, optarg, argv[ 0 ] );
-		break;
+	case 'N': // AGC fast attack
+	    setopt( &rcv->agc_fast, optarg, argv[ 0 ] );
+	    if( rcv->agc_fast < 0 || rcv->agc_fast > 20 ) {
+		fprintf( stderr, "%s: AGC fast attack must be 0 (off) to 20 dB\n", argv[ 0 ] );
+		return 1;
+	    }
+	    break;
 
 	case 'n': // new AGC enable
-	    AGCEnable = 1;
+	    rcv->AGCEnable = 1;
 	    break;
     	    
 	case 'o': // output device
-	    out = optarg;
+	    rcv->out = optarg;
 	    break;
 	    
+	case 'O': // tuner B output device
+	    rcv->out_b = optarg;
+	    break;
+
+	case 'Q': // spectrum tap
+	    rcv->spec_sink = optarg;
+	    break;
+
+	case 'P': // replay as fast as possible
+	    rcv->replay_fast = 1;
+	    break;
+
+	case 'p': // ALSA period
+	    setopt( &rcv->period_us, optarg, argv[ 0 ] );
+	    break;
+
+	case 'q': // ring buffer depth
+	    setopt( &rcv->ring_ms, optarg, argv[ 0 ] );
+	    break;
+
 	case 'r': // sample rate
-	    setopt( &rate, optarg, argv[ 0 ] );
+	    setopt( &rcv->rate, optarg, argv[ 0 ] );
 	    break;
 
         case 'R': // sample rate decimation exponent
-	    setopt( &rateval, optarg, argv [ 0 ] );
+	    setopt( &rcv->rateval, optarg, argv [ 0 ] );
             break;
 	
 	case 'S':  // AGC step size for INCREASE of attenuation
-	    setopt( &gainstep_inc, optarg, argv[ 0 ] );
-            if(gainstep_inc < 1) gainstep_inc = 1;
-            else if(gainstep_inc > 10) gainstep_inc = 10;
+	    setopt( &rcv->gainstep_inc, optarg, argv[ 0 ] );
+            if(rcv->gainstep_inc < 1) rcv->gainstep_inc = 1;
+            else if(rcv->gainstep_inc > 10) rcv->gainstep_inc = 10;
 	    break;
 
 	case 's':  // AGC step size for DECREASE of attenuation
-	    setopt( &gainstep_dec, optarg, argv[ 0 ] );
-            if(gainstep_dec < 1) gainstep_dec = 1;
-            else if(gainstep_dec > 10) gainstep_dec = 10;
+	    setopt( &rcv->gainstep_dec, optarg, argv[ 0 ] );
+            if(rcv->gainstep_dec < 1) rcv->gainstep_dec = 1;
+            else if(rcv->gainstep_dec > 10) rcv->gainstep_dec = 10;
 	    break;
 
     case 'W': // Wideband Signal mode
-	    wbs = 1;
+	    rcv->wbs = 1;
             break;
 	    
 	case 't': // FIR taps
-	    setopt( &taps, optarg, argv[ 0 ] );
+	    setopt( &rcv->taps, optarg, argv[ 0 ] );
+	    rcv->swdec = 1;
+	    break;
+
+	case 'T': // RSPduo tuner
+	    if( !strcasecmp( optarg, "a" ) )
+			rcv->tuner = sdrplay_api_Tuner_A;
+	    else if( !strcasecmp( optarg, "b" ) )
+			rcv->tuner = sdrplay_api_Tuner_B;
+	    else {
+			usage( argv[ 0 ] );
+			return 1;
+	    }
+	    break;
+
+	case 'U': // network packet size
+	    setopt( &rcv->net_payload, optarg, argv[ 0 ] );
+	    break;
+
+	case 'V': // network monitor
+	    return net_monitor( optarg );
+
+	case 'u': // RSPduo tuner B frequency
+	    setopt( &rcv->freq_b, optarg, argv[ 0 ] );
 	    break;
 	    
 	case 'v': // verbose
@@ -531,23 +6152,35 @@ extern int main( int argc, char *argv[] ) {
 	    break;
 
 	case 'w':
-	    setopt( &debugPeriod, optarg, argv[ 0 ] );
+	    setopt( &rcv->debugPeriod, optarg, argv[ 0 ] );
 	    break;
 
 	case 'X':  // Xfermode = BULK
-		bulkmode = 1;
+		rcv->bulkmode = 1;
 		break;
 
 	case 'x':
-	    setopt( &AGC4A, optarg, argv[ 0 ] );
+	    setopt( &rcv->AGC4A, optarg, argv[ 0 ] );
 	    break;
 
 	case 'y':
-	    setopt( &AGC5B, optarg, argv[ 0 ] );
+	    setopt( &rcv->AGC5B, optarg, argv[ 0 ] );
 	    break;
 
 	case 'z':
-	    setopt( &AGC6C, optarg, argv[ 0 ] );
+	    setopt( &rcv->AGC6C, optarg, argv[ 0 ] );
+	    break;
+
+	case 'Y': // lock memory
+	    rt_lock = 1;
+	    break;
+
+	case 'Z': // channelizer channel
+	    if( rcv->nchan_spec == CHAN_MAX ) {
+		fprintf( stderr, "%s: At most %d '-Z' channels per receiver\n", argv[ 0 ], CHAN_MAX );
+		return 1;
+	    }
+	    rcv->chan_spec[ rcv->nchan_spec++ ] = optarg;
 	    break;
 
 	default:
@@ -555,143 +6188,513 @@ extern int main( int argc, char *argv[] ) {
 	    return 1;
 	}
 
-
-    if( ( ret = sdrplay_api_Open() ) ) {
-		fprintf( stderr, "sdr_api_Open: %s\n", sdrplay_api_GetErrorString( ret ) );
+    if( optind < argc ) {
+		fprintf( stderr, "%s: Unexpected argument '%s'\n", argv[ 0 ], argv[ optind ] );
 		return 1;
     }
+    return -1;
+}
 
-    agc_timer_scaling = rate / 1000;
+// Daemon mode:  each non-blank line of the config file holds the options for one receiver, exactly as they
+// would be given on the command line ('#' starts a comment).  Options given on the command line itself are
+// the defaults for every line.  Returns 0, or 1 after reporting an error.
+static int read_config( char *argv0, struct receiver *defaults ) {
 
-    if (verbose && AGCEnable) {
-		fprintf(stderr, "enabled AGC with\n  AGC1increaseThreshold=%d,\n  AGC2decreaseThreshold=%d,\n  AGC3minTimeMs=%d,\n  AGC4A=%d,\n  AGC5B=%d,\n  AGC6C=%d\n", AGC1increaseThreshold, AGC2decreaseThreshold, AGC3minTimeMs, AGC4A, AGC5B, AGC6C);
-		fprintf(stderr, "agc_timer_scaling = %d\n", agc_timer_scaling);
-    }
-	
-    sdrplay_api_DebugEnable( NULL, verbose );
-    sdrplay_api_LockDeviceApi();
-    sdrplay_api_GetDevices( devices, &numdevices, 8 );
+	FILE *fp = fopen( config, "r" );
+	char line[ 1024 ], *argv[ 64 ], *p;
+	int argc, lineno = 0, ret;
+
+	if( !fp ) {
+		fprintf( stderr, "%s: Cannot open config file %s: %s\n", argv0, config, strerror( errno ) );
+		return 1;
+	}
+
+	while( fgets( line, sizeof( line ), fp ) ) {
+		lineno++;
+		if( ( p = strchr( line, '#' ) ) )
+			*p = 0;
+
+		argv[ 0 ] = argv0;
+		for( argc = 1, p = strtok( strdup( line ), " \t\r\n" ); p && argc < 63; p = strtok( NULL, " \t\r\n" ) )
+			argv[ argc++ ] = p;		// strings stay allocated, the receiver points into them
+		argv[ argc ] = NULL;
+		if( argc == 1 )
+			continue;
+
+		if( numreceivers == MAX_RECEIVERS ) {
+			fprintf( stderr, "%s: %s:%d: Too many receivers (at most %d)\n", argv0, config, lineno, MAX_RECEIVERS );
+			fclose( fp );
+			return 1;
+		}
+
+		rcv = receiver_new();
+		memcpy( rcv, defaults, sizeof( *rcv ) );
+		optind = 0;		// restart getopt() for the new argument list
+		if( ( ret = parse_options( argc, argv ) ) >= 0 ) {
+			fprintf( stderr, "%s: %s:%d: Bad options\n", argv0, config, lineno );
+			fclose( fp );
+			return 1;
+		}
+		receivers[ numreceivers++ ] = rcv;
+	}
+	fclose( fp );
+
+	if( !numreceivers ) {
+		fprintf( stderr, "%s: No receivers in %s\n", argv0, config );
+		return 1;
+	}
+	return 0;
+}
+
+// RSPduo dual-tuner mode:  a receiver with '-u' gets a tuner B receiver made from its own settings, and in daemon
+// mode a '-T b' receiver is paired with the tuner A receiver of the same '-i'.  Tuner A's receiver owns the
+// device and one sdrplay_api_Init() streams both.  Returns 0, or 1 after reporting an error.
+static int pair_tuners( char *argv0 ) {
 
-    if( devlist ) {
-	fputs( "Available input devices:\n", stderr );
-	fprintf( stderr, "    %d devices available:\n", numdevices );
-	for( i = 0; i < numdevices; i++ )
-	    fprintf( stderr, "    %s (%d)\n", devices[ i ].SerNo, devices[ i ].hwVer );
+	struct receiver *a, *b;
+	int i, j, n = numreceivers;
+
+	for( i = 0; i < n; i++ ) {
+		a = receivers[ i ];
+		if( !a->freq_b )
+			continue;
+		if( a->tuner != sdrplay_api_Tuner_A ) {
+			fprintf( stderr, "%s: '-u' adds tuner B to a tuner A receiver\n", argv0 );
+			return 1;
+		}
+		if( numreceivers == MAX_RECEIVERS ) {
+			fprintf( stderr, "%s: Too many receivers (at most %d)\n", argv0, MAX_RECEIVERS );
+			return 1;
+		}
+		b = receiver_new();
+		memcpy( b, a, sizeof( *b ) );
+		b->tuner = sdrplay_api_Tuner_B;
+		b->freq = a->freq_b;
+		b->freq_b = 0;
+		b->gainfile = NULL;
+		b->out = a->out_b;
+		if( !a->out_b ) {	// both tuners on a's output
+			a->quad = 1;
+			a->channels = 4;
+			b->pcm_mmap = 0;
+		}
+		a->peer = b;
+		b->peer = a;
+		receivers[ numreceivers++ ] = b;
+	}
 
-	// FIXME also show ALSA devices
+	for( i = 0; i < numreceivers; i++ ) {	// a tuner B receiver left on its own uses that tuner in single-tuner mode
+		b = receivers[ i ];
+		if( b->tuner != sdrplay_api_Tuner_B || b->peer || !b->in_dev )
+			continue;
+		for( j = 0; j < numreceivers; j++ ) {
+			a = receivers[ j ];
+			if( a->tuner == sdrplay_api_Tuner_A && !a->peer && a->in_dev && !strcasecmp( a->in_dev, b->in_dev ) ) {
+				a->peer = b;
+				b->peer = a;
+				break;
+			}
+		}
+	}
 
+	for( i = 0; i < numreceivers; i++ ) {
+		a = receivers[ i ];
+		if( a->tuner != sdrplay_api_Tuner_A || !( b = a->peer ) )
+			continue;
+		if( a->rate != b->rate || a->swdec != b->swdec || ( a->swdec && a->taps != b->taps ) ) {
+			fprintf( stderr, "%s: Both tuners of an RSPduo must have the same '-r' and '-t'\n", argv0 );
+			return 1;
+		}
+		if( a->quad && ( a->ring_ms || b->ring_ms ) ) {
+			fprintf( stderr, "%s: 4-channel output is written from the API callback - it cannot be used with '-q'\n", argv0 );
+			return 1;
+		}
+		if( a->quad && !( a->quad_buf = malloc( a->quad_size = (size_t)API_MAXFRAMES * 2 * a->out_bps ) ) ) {
+			fprintf( stderr, "%s: Cannot allocate 4-channel output buffer\n", argv0 );
+			return 1;
+		}
+		pthread_mutex_init( &a->quad_lock, NULL );
+	}
 	return 0;
+}
+
+// Open rcv's output:  ALSA, a network, shared memory or recording sink, or stdout.  Returns 0, or 1 after reporting
+// an error.
+static int open_output( char *argv0 ) {
+
+    int ret;
+
+    if( rcv->pcm_mmap && ( !rcv->out || strstr( rcv->out, "://" ) ) ) {
+		fprintf( stderr, "%s: '-m' only applies to ALSA output ('-o dev')\n", argv0 );
+		return 1;
     }
-    
-    if( !numdevices ) {
-		fprintf( stderr, "\n%s: no suitable input devices found\n\n", argv[ 0 ] );
+    if( rcv->wire && rcv->out && strncasecmp( rcv->out, "udp://", 6 ) && strncasecmp( rcv->out, "tcp://", 6 ) ) {
+		fprintf( stderr, "%s: '-F %s' is for stdout and network output\n", argv0, iqpack_name( rcv->wire ) );
 		return 1;
     }
 
-    if( bwbad )	{
-		fprintf( stderr, "%s: Invalid bandwidth specified - must be 200, 300, 600 or 1536.\n", argv[ 0 ] );
+    if( rcv->out && ( !strncasecmp( rcv->out, "udp://", 6 ) || !strncasecmp( rcv->out, "tcp://", 6 ) ) ) {	// network sink
+		if( !( rcv->net = net_open( rcv->out, rcv->net_payload, rcv->wire ? rcv->wire : rcv->out_format, rcv->channels,
+				rcv->wire ? 0 : rcv->out_bps, rcv->rate, net_pack, rcv, verbose ) ) )
+			return 1;
+    }
+    else if( rcv->out && !strncasecmp( rcv->out, "shm://", 6 ) ) {	// shared memory ring
+		if( shm_open_ring() )
+			return 1;
+    }
+    else if( rcv->out && !strncasecmp( rcv->out, "sigmf://", 8 ) ) {	// recording
+		int gain[ 2 ] = { rcv->gain_reduction, rcv->quad ? rcv->peer->gain_reduction : 0 };
+
+		if( !( rcv->rec = rec_open( rcv->out + 8, rcv->out_format, rcv->rate, rcv->channels, rcv->out_bps, gain, rec_settings, rcv ) ) )
+			return 1;
+    }
+    else if( rcv->out ) {	// PCM (ALSA) device specified?
+		if( ( ret = snd_pcm_open( &rcv->pcm, rcv->out, SND_PCM_STREAM_PLAYBACK, 0 ) ) < 0 ) {
+		    fprintf( stderr, "snd_pcm_open: %s\n", snd_strerror( ret ) );
+		    return 1;
+		}
+
+		if(rcv->latency_us < 30000) {	// Trap invalid latency setting
+			fprintf( stderr,"Specified latency in usec is %u - must be >=30000!\n", rcv->latency_us);
+			return 1;
+		}
+		snd_pcm_nonblock( rcv->pcm, SND_PCM_NONBLOCK );
+    
+		if( rcv->period_us && ( rcv->period_us < 1000 || rcv->period_us > rcv->latency_us / 2 ) ) {
+			fprintf( stderr, "Specified period in usec is %u - must be >=1000 and at most half the latency!\n", rcv->period_us );
+			return 1;
+		}
+
+		if( pcm_setup( rcv->rate, rcv->latency_us ) < 0 )
+		    return 1;
+
+		if( ( ret = snd_pcm_prepare( rcv->pcm ) ) < 0 ) {
+	    	fprintf( stderr, "snd_pcm_prepare: %s\n", snd_strerror( ret ) );
+		    return 1;
+		}
+    }
+    else if( !rcv->nchans && !( rcv->peer && rcv->peer->quad ) )	// stdout, unless it has nothing for it
+		pipe_open();
+    return 0;
+}
+
+static void output_report( void ) {
+
+	if( rcv->peer && rcv->peer->quad )
+		fprintf( stderr, "   Output:  channels 3 and 4 of tuner A's output\n" );
+	else if(rcv->net)
+		fprintf( stderr, "   Output:  %s  (%s, %u frames per packet)\n", rcv->out, rcv->net->tcp ? "TCP server" : net_multicast( &rcv->net->addr ) ? "UDP multicast" : "UDP",
+			net_frames( rcv->net ) );
+	else if(rcv->shm)
+		fprintf( stderr, "   Output:  shared memory ring /%s, %llu bytes  (read with iqshmcat or iqshm.h)\n", rcv->out + 6,
+			(unsigned long long)iqshm_header( rcv->shm )->size );
+	else if(rcv->rec) {
+		fprintf( stderr, "   Output:  SigMF recording %s%s.sigmf-data  (%s, %u chunks of %zu KiB", rcv->rec->base, rcv->rec->rotate ? "-NNNNN" : "",
+			rcv->rec->uring >= 0 ? "io_uring" : "writer thread", rcv->rec->nchunks, rcv->rec->chunk_size >> 10 );
+		if( rcv->rec->max_bytes )
+			fprintf( stderr, ", new file every %llu MB", (unsigned long long)( rcv->rec->max_bytes >> 20 ) );
+		if( rcv->rec->max_frames )
+			fprintf( stderr, ", new file every %llu s", (unsigned long long)( rcv->rec->max_frames / rcv->rate ) );
+		fprintf( stderr, ")\n" );
+	}
+	else if(rcv->out)
+		fprintf( stderr, "   Output device: '%s'  Configured latency = %u uSec  (%s access, buffer %lu frames, period %lu frames, fill target %lu frames)\n", rcv->out, rcv->latency_us,
+			rcv->pcm_mmap ? "mmap" : "read/write", (unsigned long)rcv->pcm_buffer, (unsigned long)rcv->pcm_period, (unsigned long)rcv->pcm_target );
+	else if(rcv->nchans)
+		fprintf( stderr, "   Output:  none but the '-Z' channels\n" );
+	else if(rcv->pipe_size)
+		fprintf( stderr, "   Output using STDIO:  a pipe of %d KiB%s  (use '-o' and '-L' parameters to specify audio device and latency in uSec)\n",
+			rcv->pipe_size >> 10, rcv->pipe_splice ? ", spliced into with vmsplice()" : "" );
+	else
+		fprintf( stderr, "   Output using STDIO:  Use '-o' and '-L' parameters to specify audio device and latency in uSec\n");
+}
+
+// '-Z':  a channel receiver for each channel of a wideband receiver, with its own rate and output and no device or
+// AGC of its own.  They go after all the others, so each is opened after its wideband receiver.  Returns 0, or 1
+// after reporting an error.
+static int chan_receivers( char *argv0 ) {
+
+	struct receiver *a, *c;
+	char *end;
+	int i, j, n = numreceivers;
+
+	for( i = 0; i < n; i++ ) {
+		a = receivers[ i ];
+		if( !a->nchan_spec )
+			continue;
+		if( a->peer ) {
+			fprintf( stderr, "%s: '-Z' cannot be used in RSPduo dual-tuner mode\n", argv0 );
+			return 1;
+		}
+		if( !a->ring_ms && !a->replay_fast )	// the filter bank runs on the writer thread (a '-P' replay times it in rx())
+			a->ring_ms = 100;
+		for( j = 0; j < a->nchan_spec; j++ ) {
+			if( numreceivers == MAX_RECEIVERS ) {
+				fprintf( stderr, "%s: Too many receivers (at most %d, with the '-Z' channels)\n", argv0, MAX_RECEIVERS );
+				return 1;
+			}
+			c = receiver_new();
+			c->chan_of = a;
+			c->chan_num = j + 1;
+			c->chan_offset = strtol( a->chan_spec[ j ], &end, 0 );
+			if( *end == ':' )
+				c->rate = strtol( end + 1, &end, 0 );
+			if( c->rate <= 0 || ( *end && *end != ':' ) ) {
+				fprintf( stderr, "%s: Bad channel '%s' - give '-Z offset:rate[:output]'\n", argv0, a->chan_spec[ j ] );
+				return 1;
+			}
+			c->out = *end ? end + 1 : NULL;
+			c->out_format = a->out_format;
+			c->out_bps = a->out_bps;
+			c->wire = a->wire;
+			c->pipe_splice = a->pipe_splice;
+			c->latency_us = a->latency_us;
+			c->period_us = a->period_us;
+			c->fill_us = a->fill_us;
+			c->net_payload = a->net_payload;
+			c->gain_reduction = a->gain_reduction;
+			c->lna = a->lna;
+			c->bwtype = a->bwtype;
+			c->ring_ms = a->ring_ms;
+			a->chans[ a->nchans++ ] = c;
+			receivers[ numreceivers++ ] = c;
+		}
+	}
+	return 0;
+}
+
+// Open a '-Z' channel once its wideband receiver is open:  the filter bank (made for the first of the receiver's
+// channels, sized for the widest), the channel's bin and NCO, its decimation and resampling and its output.
+// Returns 0, or 1 after reporting an error.
+static int chan_open( char *argv0 ) {
+
+	struct receiver *a = rcv->chan_of, *c = rcv;
+	long fs = a->rate, bin_rate;
+	int i, widest = 0, shift, L, M;
+
+	if( labs( (long)c->chan_offset ) + c->rate / 2 > fs * 0.45 ) {
+		fprintf( stderr, "%s: Channel %d (%+d Hz, %d sps) does not fit in the %ld sps stream it comes from\n", argv0, c->chan_num, c->chan_offset, c->rate, fs );
+		return 1;
+	}
+	if( !a->pfb ) {
+		for( i = 0; i < a->nchans; i++ )
+			if( a->chans[ i ]->rate > widest )
+				widest = a->chans[ i ]->rate;
+		if( !( i = pfb_size( fs, widest ) ) ) {
+			fprintf( stderr, "%s: No filter bank for %d sps channels from %ld sps:  a channel can be at most 1/16 of the wideband rate\n", argv0, widest, fs );
+			return 1;
+		}
+		if( !( a->pfb = pfb_new( i, API_MAXFRAMES ) ) ) {
+			fprintf( stderr, "%s: Cannot allocate the filter bank\n", argv0 );
+			return 1;
+		}
+		fprintf( stderr, "Channelizer for %s:  %u-branch polyphase filter bank, %d taps per branch, bins %ld Hz apart at %ld sps\n",
+			a->replay ? a->replay_file : a->sernum, a->pfb->M, PFB_TAPS, fs / a->pfb->M, 2 * fs / a->pfb->M );
+	}
+	bin_rate = 2 * fs / a->pfb->M;
+	if( !pick_down( bin_rate, c->rate, DEC_MAXSTAGES, &shift, &L, &M ) ) {
+		fprintf( stderr, "%s: No decimation from the filter bank's %ld sps to channel %d's %d sps\n", argv0, bin_rate, c->chan_num, c->rate );
+		return 1;
+	}
+
+	c->freq = a->freq + c->chan_offset;
+	c->dp = a->dp;
+	c->devind = a->devind;
+	c->adc_rate = a->adc_rate;
+	c->cb_rate = bin_rate;
+	c->decimation = 1 << shift;
+	c->agc_timer_scaling = c->rate / 1000;
+	snprintf( c->sernum, sizeof( c->sernum ), "%.48s/ch%d", a->replay ? "replay" : a->sernum, c->chan_num );
+	if( ( c->swdec = shift > 0 ) )
+		dec_init( shift, 0 );
+	if( M != 1 )
+		rs_init( L, M );
+	pfb_tune( a->pfb, &c->chan_nco, fs, c->chan_offset );
+	if( open_output( argv0 ) )
 		return 1;
+
+	fprintf( stderr, "Channel %d of %s:\n", c->chan_num, a->replay ? a->replay_file : a->sernum );
+	fprintf( stderr, "   Frequency:  %u Hz  (%+d Hz:  bin %u, NCO %+.0f Hz)\n", c->freq, c->chan_offset, c->chan_nco.bin,
+		c->chan_offset - lround( (double)c->chan_offset * a->pfb->M / fs ) * (double)fs / a->pfb->M );
+	fprintf( stderr, "   Sample rate:  %u  (from the filter bank's %ld sps)\n", c->rate, bin_rate );
+	if( c->swdec )
+		dec_report( "   " );
+	if( c->rs_coefs )
+		rs_report( "   ", bin_rate >> shift );
+	fprintf( stderr, "   Output format:  %s  (%s kernels)\n", c->wire ? iqpack_name( c->wire ) : c->out_format == FMT_S32 ? "S32" : c->out_format == FMT_F32 ? "F32" : "S16", kern->name );
+	output_report();
+	fprintf( stderr, "   Output ring buffer:  %u ms\n", c->ring_ms );
+	return 0;
+}
+
+// Check rcv's settings, find and select its device (the API lock must be held), open its output and set up
+// its processing and device parameters.  Returns 0, or 1 after reporting an error.
+static int open_receiver( char *argv0 ) {
+
+    int ret;
+    int i;
+    int decimation = 1;
+    int rateshift = 2;
+    int rs_l = 1, rs_m = 1;
+    long adc_rate;
+    int dual = rcv->peer != NULL;	// RSPduo dual-tuner mode
+    sdrplay_api_RxChannelParamsT *ch;
+
+    if( rcv->chan_of )
+		return chan_open( argv0 );
+
+    if( rcv->replay_file ) {	// a capture stands in for the RSP
+		if( dual ) {
+			fprintf( stderr, "%s: '-I' cannot be used in RSPduo dual-tuner mode\n", argv0 );
+			return 1;
+		}
+		if( replay_open() )
+			return 1;
     }
 
-    if( !freq ) {
-		fprintf( stderr, "%s: No frequency specified\n", argv[ 0 ] );
+    if( !rcv->freq ) {
+		fprintf( stderr, "%s: No frequency specified\n", argv0 );
 		return 1;
     }
     
-    if( !rate ) {
-		fprintf( stderr, "%s: No sample rate specified\n", argv[ 0 ] );
+    if( !rcv->rate ) {
+		fprintf( stderr, "%s: No sample rate specified\n", argv0 );
 		return 1;
     }
 
-    if( ((AGC5B <50) || (AGC6C < 50) || (AGC3minTimeMs < 50)) && (AGCEnable == 1))   {
+    if( ((rcv->AGC5B <50) || (rcv->AGC6C < 50) || (rcv->AGC3minTimeMs < 50)) && (rcv->AGCEnable == 1))   {
         fprintf( stderr, "AGC Timing value setting <50 msec - recheck values! \n" );
         return 1;
     }
 
-    if((rateval == -1) && (rate != 96000) && (rate != 192000) && (rate != 384000) && (rate != 768000))  {
-		fprintf( stderr, "%s: Invalid sample rate specified\n", argv[ 0 ] );
+    if( rcv->swdec && ( rcv->taps < 0 || rcv->taps > 127 || ( rcv->taps && ( rcv->taps < 3 || !( rcv->taps & 1 ) ) ) ) ) {
+		fprintf( stderr, "%s: FIR taps must be 0 or an odd number from 3 to 127\n", argv0 );
 		return 1;
     }
-    
-    for( i = 0; i < numdevices; i++ )	{
-		if( in_dev && strcasestr( devices[ i ].SerNo, in_dev ) ) {
-	   		devind = i;
-		}
-	}
 
-    if( in_dev && !strcasestr( devices[ devind ].SerNo, in_dev ) ) {
-		fprintf( stderr, "%s: device %s not found\n", argv[ 0 ], in_dev );
+    if( rcv->ring_ms && ( rcv->ring_ms < 10 ) ) {
+		fprintf( stderr, "%s: Ring buffer depth must be >=10 ms\n", argv0 );
 		return 1;
     }
 
-    if( ( ret = sdrplay_api_SelectDevice( devices + devind ) ) ) {
-		fprintf( stderr, "sdr_api_SelectDevice: %s\n", sdrplay_api_GetErrorString( ret ) );
+    if( rcv->rate <= 0 ) {
+		fprintf( stderr, "%s: Invalid sample rate specified\n", argv0 );
 		return 1;
     }
 
-	sprintf(sernum, "%s",devices[devind].SerNo);	// get serial number
+    if( rcv->agc_fast && !rcv->AGCEnable && !control_path )	// ('agc on' on the control socket can start it later)
+		fprintf( stderr, "%s: Warning:  '-N' has no effect without the AGC ('-n')\n", argv0 );
 
-    sdrplay_api_UnlockDeviceApi();
-    
-    if( out ) {	// PCM (ALSA) device specified?
-		if( ( ret = snd_pcm_open( &pcm, out, SND_PCM_STREAM_PLAYBACK, 0 ) ) < 0 ) {
-		    fprintf( stderr, "snd_pcm_open: %s\n", snd_strerror( ret ) );
-		    return 1;
+    rcv->agc_timer_scaling = rcv->rate / 1000;
+
+    if (verbose && rcv->AGCEnable) {
+		fprintf(stderr, "enabled AGC with\n  AGC1increaseThreshold=%d,\n  AGC2decreaseThreshold=%d,\n  AGC3minTimeMs=%d,\n  AGC4A=%d,\n  AGC5B=%d,\n  AGC6C=%d\n", rcv->AGC1increaseThreshold, rcv->AGC2decreaseThreshold, rcv->AGC3minTimeMs, rcv->AGC4A, rcv->AGC5B, rcv->AGC6C);
+		fprintf(stderr, "agc_timer_scaling = %d\n", rcv->agc_timer_scaling);
+    }
+
+    if( dual && rcv->rateval != -1 ) {
+		fprintf( stderr, "%s: '-R' cannot be used in RSPduo dual-tuner mode, where the ADC rate is fixed\n", argv0 );
+		return 1;
+    }
+
+    if( dual && rcv->bwtype > 1536 ) {
+		fprintf( stderr, "%s: Bandwidth must be 1536 kHz or less in RSPduo dual-tuner mode\n", argv0 );
+		return 1;
+    }
+
+    if( dual && rcv->tuner == sdrplay_api_Tuner_B ) {	// tuner A's receiver, opened first, has selected the device
+		rcv->devind = rcv->peer->devind;
+		rcv->dp = rcv->peer->dp;
+    }
+    else if( !rcv->replay ) {
+		rcv->devind = -1;
+		for( i = 0; i < numdevices; i++ )	{
+			if( rcv->in_dev ? !!strcasestr( devices[ i ].SerNo, rcv->in_dev ) : rcv->devind < 0 ) {
+		   		rcv->devind = i;
+			}
 		}
 
-		if(latency_us < 30000) {	// Trap invalid latency setting
-			fprintf( stderr,"Specified latency in usec is %u - must be >=30000!\n", latency_us);
+		if( rcv->devind < 0 ) {
+			fprintf( stderr, "%s: device %s not found\n", argv0, rcv->in_dev );
 			return 1;
 		}
-		snd_pcm_nonblock( pcm, SND_PCM_NONBLOCK );
-    
-		if( ( ret = snd_pcm_set_params( pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 2, rate, 0, latency_us ) ) < 0 ) {
-		    fprintf( stderr, "snd_pcm_set_params: %s\n", snd_strerror( ret ) );
-		    return 1;
+
+		for( i = 0; receivers[ i ] != rcv; i++ )
+			if( receivers[ i ]->devind == rcv->devind && receivers[ i ] != rcv->peer ) {
+				fprintf( stderr, "%s: device %s is already in use by another receiver\n", argv0, devices[ rcv->devind ].SerNo );
+				return 1;
+			}
+
+		if( dual || rcv->tuner == sdrplay_api_Tuner_B ) {	// choose the RSPduo's mode before selecting it
+			if( devices[ rcv->devind ].hwVer != SDRPLAY_RSPduo_ID ) {
+				fprintf( stderr, "%s: device %s is not an RSPduo - it has only one tuner\n", argv0, devices[ rcv->devind ].SerNo );
+				return 1;
+			}
+			devices[ rcv->devind ].tuner = dual ? sdrplay_api_Tuner_Both : sdrplay_api_Tuner_B;
+			devices[ rcv->devind ].rspDuoMode = dual ? sdrplay_api_RspDuoMode_Dual_Tuner : sdrplay_api_RspDuoMode_Single_Tuner;
+			if( dual )
+				devices[ rcv->devind ].rspDuoSampleFreq = DUO_FS;
 		}
 
-		if( ( ret = snd_pcm_prepare( pcm ) ) < 0 ) {
-	    	fprintf( stderr, "snd_pcm_prepare: %s\n", snd_strerror( ret ) );
-		    return 1;
+		if( ( ret = sdrplay_api_SelectDevice( devices + rcv->devind ) ) ) {
+			fprintf( stderr, "sdr_api_SelectDevice: %s\n", sdrplay_api_GetErrorString( ret ) );
+			return 1;
 		}
     }
+
+	if( !rcv->replay )
+		sprintf(rcv->sernum, "%s",devices[rcv->devind].SerNo);	// get serial number
+
+    if( open_output( argv0 ) || ( rcv->spec_sink && spec_open() ) )
+		return 1;
     
-    if( ( ret = sdrplay_api_GetDeviceParams( devices[ devind ].dev, &dp ) ) ) {
+    if( !rcv->dp && ( ret = sdrplay_api_GetDeviceParams( devices[ rcv->devind ].dev, &rcv->dp ) ) ) {
 		fprintf( stderr, "sdr_api_GetDeviceParams: %s\n", sdrplay_api_GetErrorString( ret ) );
 		return 1;
     }
     
-    if( gainfile ) {   // make sure that we can open gain file
-		if( 0 == ( gainfp = fopen( gainfile, "w" ) )  ) {   // Cannot open gainfile - error
-		    fprintf( stderr, "Cannot open gainfile:  %s\n", snd_strerror( ret ) );
-	    	return 1;
-		}
-        else {	// Init successful - load gain file with zero value to indicate active AGC
-		    fseek(gainfp, 0, SEEK_SET);
-	    	fprintf(gainfp, "0\n");
-		    fflush(gainfp); 
-        }
+    if( rcv->gainfile && write_gainfile( 0 ) ) {	// make sure that we can write the gain file, and start it at zero to indicate active AGC
+		fprintf( stderr, "Cannot write gainfile %s:  %s\n", rcv->gainfile, strerror( errno ) );
+		return 1;
     }
 
 
     // Determine appropriate decimation rate if "-R" parameter not specified
 
-    if(rateval == -1)	{	// If no "-R" parameter specified
-       if(rate == 96000)	{
+    if( rcv->replay ) {	// the capture is what the API would deliver:  only software decimation can follow it
+		for( rateshift = 0; ( (long)rcv->rate << rateshift ) < rcv->replay->rate && rateshift < DEC_MAXSTAGES; rateshift++ )
+			;
+		if( ( (long)rcv->rate << rateshift ) != rcv->replay->rate || ( rateshift && !rcv->swdec ) ) {
+			fprintf( stderr, "%s: The capture's rate of %ld must be the sample rate, or with '-t' a power-of-two multiple of it\n", argv0, rcv->replay->rate );
+			return 1;
+		}
+    }
+    else if( dual ) {	// the rate ahead of decimation is fixed - only the decimation and resampling can be chosen
+       if( !pick_duo_rate( rcv->rate, rcv->swdec ? DEC_MAXSTAGES : 5, &rateshift, &rs_l, &rs_m ) ) {
+		fprintf( stderr, "%s: No usable decimation for a sample rate of %u in RSPduo dual-tuner mode\n", argv0, rcv->rate );
+		return 1;
+       }
+    }
+    else if(rcv->rateval == -1)	{	// If no "-R" parameter specified
+       if(rcv->rate == 96000)	{
 	   rateshift = 5;	// 96000 * (2^5) = 3072000 sps ADC rate
        }
-       else if(rate == 192000)	{
+       else if(rcv->rate == 192000)	{
 	   rateshift = 4;	// 192000 * (2^4) = 3072000 sps ADC rate
        }
-       else if(rate == 384000)	{
+       else if(rcv->rate == 384000)	{
 	   rateshift = 3;	// 384000 * (2^3) = 3072000 sps ADC rate
        }
-       else if(rate == 768000)	{
+       else if(rcv->rate == 768000)	{
 	   rateshift = 2;       // 768000 * (2^2) = 3072000 sps ADC rate
        }
+       else if( !pick_adc_rate( rcv->rate, rcv->swdec ? DEC_MAXSTAGES : 5, &rateshift, &rs_l, &rs_m ) ) {
+		fprintf( stderr, "%s: No usable ADC rate for a sample rate of %u\n", argv0, rcv->rate );
+		return 1;
+       }
     }
     else   {
-		rateshift = rateval;
+		rateshift = rcv->rateval;
     }
 
     // Calculate "longhand" so we don't need math.h's "pow()" function just for this
@@ -700,51 +6703,248 @@ extern int main( int argc, char *argv[] ) {
        decimation *= 2;
     }
 
-    if(((rate << rateshift) < 2048000) || ((rate << rateshift) >= 8064000))   {
-		fprintf( stderr, "ADC sample rate of [%u*(2^%u)]=%lu out of range! \n", rate, rateshift, (long int)(rate << rateshift));
+    adc_rate = ( (long)rcv->rate * rs_m / rs_l ) << rateshift;
+    if( !dual && !rcv->replay && ((adc_rate < 2048000) || (adc_rate >= 8064000)) )   {
+		fprintf( stderr, "ADC sample rate of [%u*(2^%u)]=%lu out of range! \n", rcv->rate, rateshift, adc_rate);
 		return 1;
     }
+    if( rs_m != 1 )
+		rs_init( rs_l, rs_m );
 
-    dp->devParams->fsFreq.fsHz = rate << rateshift;
-	if(bulkmode)
-		dp->devParams->mode = sdrplay_api_BULK;
+    rcv->adc_rate = dual ? DUO_FS : rcv->replay && rcv->replay->fs_hz ? rcv->replay->fs_hz : adc_rate;
+    rcv->decimation = decimation;
+    rcv->cb_rate = rcv->replay ? rcv->replay->rate : ( (long)rcv->rate * rs_m / rs_l ) << ( rcv->swdec ? rateshift : 0 );
+    if( !dual )		// fixed by rspDuoSampleFreq in dual-tuner mode
+		rcv->dp->devParams->fsFreq.fsHz = adc_rate;
+	if(rcv->bulkmode)
+		rcv->dp->devParams->mode = sdrplay_api_BULK;
 
-    dp->rxChannelA->tunerParams.rfFreq.rfHz = freq;
-    dp->rxChannelA->tunerParams.bwType = bwtype;
-    dp->rxChannelA->tunerParams.ifType = 0;
-    dp->rxChannelA->tunerParams.gain.gRdB = gain_reduction;
-    dp->rxChannelA->tunerParams.gain.LNAstate = lna;
-#if 1
-    dp->rxChannelA->ctrlParams.decimation.enable = 1;
-    dp->rxChannelA->ctrlParams.decimation.decimationFactor = decimation;
-    dp->rxChannelA->ctrlParams.decimation.wideBandSignal = wbs;
-#endif
-    dp->rxChannelA->ctrlParams.agc.enable = 0;
+    ch = rx_channel();
+    ch->tunerParams.rfFreq.rfHz = rcv->freq;
+    ch->tunerParams.bwType = rcv->bwtype;
+    ch->tunerParams.ifType = dual ? sdrplay_api_IF_1_620 : 0;	// the API converts it to zero IF
+    ch->tunerParams.gain.gRdB = rcv->gain_reduction;
+    ch->tunerParams.gain.LNAstate = rcv->lna;
+    if( rcv->swdec ) {	// full ADC rate to us, decimated in dec_init()'s cascade
+		ch->ctrlParams.decimation.enable = 0;
+		ch->ctrlParams.decimation.decimationFactor = 1;
+		dec_init( rateshift, rcv->taps );
+    }
+    else {
+		ch->ctrlParams.decimation.enable = 1;
+		ch->ctrlParams.decimation.decimationFactor = decimation;
+		ch->ctrlParams.decimation.wideBandSignal = rcv->wbs;
+    }
+    ch->ctrlParams.agc.enable = 0;
+
+	if( dual || rcv->tuner == sdrplay_api_Tuner_B )
+		fprintf( stderr, "For device %s tuner %c:\n", rcv->sernum, rcv->tuner == sdrplay_api_Tuner_B ? 'B' : 'A' );
+	else
+		fprintf( stderr, "For device %s:\n", rcv->sernum);
+	fprintf( stderr, "   Frequency:  %u Hz\n", rcv->freq );
+	//
+	fprintf( stderr, "   BWType value:  %u\n", rcv->bwtype );
+    fprintf( stderr, "   WBS value:  %u (0=off, 1=0n) \n", rcv->wbs );
+    fprintf( stderr, "   AGC gain reduction step size:  %u dB\n", rcv->gainstep_inc );
+    fprintf( stderr, "   AGC gain increase step size:  %u dB\n", rcv->gainstep_dec );
+    if( rcv->agc_fast )
+	fprintf( stderr, "   AGC fast attack:  %d dB\n", rcv->agc_fast );
+    if( rcv->iqc_ms )
+	fprintf( stderr, "   IQ correction:  DC offset and I/Q imbalance, %d ms time constant\n", rcv->iqc_ms );
+    if( rcv->gc_ref >= 0 ) {
+	rcv->gc_gain = rcv->gc_target = gc_q16( rcv->gain_reduction );
+	fprintf( stderr, "   Gain compensation:  output level as at %d dB gain reduction\n", rcv->gc_ref );
+    }
+    fprintf( stderr, "   Sample rate:  %u  (Decimation: %u  Shift: %u) \n", rcv->rate, decimation, rateshift );
+	if( rcv->swdec )
+		dec_report( "   " );
+	if( rcv->rs_coefs )
+		rs_report( "   ", adc_rate >> rateshift );
+    if( rcv->replay )
+		fprintf( stderr, "   Replaying:  %s, %llu frames (%.1f s) at %ld sps in blocks of %u, %s\n", rcv->replay_file, (unsigned long long)rcv->replay->frames,
+			(double)rcv->replay->frames / rcv->replay->rate, rcv->replay->rate, rcv->replay->block, rcv->replay_fast ? "as fast as possible" : "in real time" );
+    else if( dual )
+		fprintf( stderr, "   ADC sample rate:  %u sps  (RSPduo dual-tuner mode, %u sps per tuner at zero IF)\n", DUO_FS, DUO_RATE );
+    else
+		fprintf( stderr, "   ADC sample rate:  %lu sps \n", adc_rate);
+	fprintf( stderr, "   USB Transfer is in %s mode \n",(rcv->bulkmode ? "Bulk" : "Isochronous") );
+	fprintf( stderr, "   Output format:  %s  (%s kernels)\n", rcv->wire ? iqpack_name( rcv->wire ) : rcv->out_format == FMT_S32 ? "S32" : rcv->out_format == FMT_F32 ? "F32" : "S16", kern->name );
+
+	output_report();
+	if( rcv->spec )
+		fprintf( stderr, "   Spectrum tap:  %s, %u bins of %.1f Hz, %u averaged, %.1f spectra/s\n", rcv->spec_sink, rcv->spec->bins,
+			(double)rcv->rate / rcv->spec->bins, rcv->spec->avg, fmin( rcv->spec->fps, (double)rcv->rate / rcv->spec->every / rcv->spec->avg ) );
+	if( rcv->quad )
+		fprintf( stderr, "   4-channel output:  I/Q of tuner A, then of tuner B\n" );
+	if(rcv->ring_ms)
+		fprintf( stderr, "   Output ring buffer:  %u ms\n", rcv->ring_ms );
+	if(rcv->cpu >= 0)
+		fprintf( stderr, "   Writer thread pinned to CPU %d\n", rcv->cpu );
+	return 0;
+}
+
+// Start rcv streaming.  Runs on its own thread per receiver in daemon mode, since sdrplay_api_Init() takes a while.
+static void *start_receiver( void *arg ) {
+
+    int ret, i;
+
+    rcv = arg;
+    if( ( rcv->tuner == sdrplay_api_Tuner_B && rcv->peer ) || rcv->chan_of )	// started along with tuner A, or the wideband receiver
+		return NULL;
+
+    scratch_init();
+    if( rcv->ring_ms )
+		ring_init( rcv->rate );
+    if( rcv->peer ) {	// tuner B's buffers must be ready before its first callback
+		rcv = rcv->peer;
+		scratch_init();
+		if( rcv->ring_ms )
+			ring_init( rcv->rate );
+		rcv = arg;
+    }
+    for( i = 0; i < ( (struct receiver *)arg )->nchans; i++ ) {	// and the '-Z' channels' rings before the filter bank feeds them
+		rcv = ( (struct receiver *)arg )->chans[ i ];
+		scratch_init();
+		ring_init( rcv->cb_rate );
+    }
+    rcv = arg;
+
+    if( rcv->replay )
+		return replay_start() ? (void *)1 : NULL;
+    
+    if( ( ret = sdrplay_api_Init( devices[ rcv->devind ].dev, &callbacks, rcv ) ) ) {
+		fprintf( stderr, "sdr_api_Init for device %s: %s\n", rcv->sernum, sdrplay_api_GetErrorString( ret ) );
+		return (void *)1;
+    }
+    return NULL;
+}
+
+extern int main( int argc, char *argv[] ) {
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = term;
+    sigaction(SIGTERM, &action, NULL);
+
+    int ret;
+    int i;
+    int stdout_users = 0;
+    int pass;
+    struct receiver *defaults;
+    pthread_t starters[ MAX_RECEIVERS ];
+    void *failed;
+
+	if(argc <2)	{			// do usage if no arguments
+		usage( argv[ 0 ] );
+		return 1;
+	}
+	
+    rcv = defaults = receiver_new();
+    if( ( ret = parse_options( argc, argv ) ) >= 0 )
+		return ret;
+
+    if( config ) {	// daemon mode - the command line only supplies defaults
+		if( read_config( argv[ 0 ], defaults ) )
+			return 1;
+    }
+    else
+		receivers[ numreceivers++ ] = defaults;
+
+    if( pair_tuners( argv[ 0 ] ) || chan_receivers( argv[ 0 ] ) )
+		return 1;
+
+    if( config )
+		for( i = 0; i < numreceivers; i++ ) {
+			rcv = receivers[ i ];
+			if( !rcv->ring_ms && !rcv->quad && !( rcv->peer && rcv->peer->quad ) )	// processing goes on the writer thread, one per receiver
+				rcv->ring_ms = 100;
+			rcv->cpu = rt_ncpus ? rt_cpu( i ) : i % sysconf( _SC_NPROCESSORS_ONLN );
+		}
+
+    for( i = 0; i < numreceivers; i++ )
+		stdout_users += !receivers[ i ]->out && !( receivers[ i ]->peer && receivers[ i ]->peer->quad ) && !receivers[ i ]->nchans;
+    if( stdout_users > 1 ) {
+		fprintf( stderr, "%s: Only one receiver can write to stdout - give the others '-o'\n", argv[ 0 ] );
+		return 1;
+    }
+
+    select_kernels();
+
+    for( i = 0; i < numreceivers; i++ )
+		use_api |= !receivers[ i ]->replay_file;
+
+    if( use_api ) {
+		if( ( ret = sdrplay_api_Open() ) ) {
+			fprintf( stderr, "sdr_api_Open: %s\n", sdrplay_api_GetErrorString( ret ) );
+			return 1;
+		}
+
+		sdrplay_api_DebugEnable( NULL, verbose );
+		sdrplay_api_LockDeviceApi();
+		sdrplay_api_GetDevices( devices, &numdevices, 8 );
+
+		if( devlist ) {
+			fputs( "Available input devices:\n", stderr );
+			fprintf( stderr, "    %d devices available:\n", numdevices );
+			for( i = 0; i < numdevices; i++ )
+				fprintf( stderr, "    %s (%d)\n", devices[ i ].SerNo, devices[ i ].hwVer );
+
+			// FIXME also show ALSA devices
+
+			return 0;
+		}
+
+		if( !numdevices ) {
+			fprintf( stderr, "\n%s: no suitable input devices found\n\n", argv[ 0 ] );
+			return 1;
+		}
+    }
+
+    // Select every device under one hold of the API lock rather than one process each fighting for it.  Tuner B
+    // of an RSPduo pair goes second, once tuner A has selected the device.
+    for( pass = 0; pass < 2; pass++ )
+		for( i = 0; i < numreceivers; i++ ) {
+			rcv = receivers[ i ];
+			if( ( rcv->tuner == sdrplay_api_Tuner_B && rcv->peer ) != pass )
+				continue;
+			if( open_receiver( argv[ 0 ] ) )
+				return 1;
+		}
+
+    if( use_api )
+		sdrplay_api_UnlockDeviceApi();
+
+    if( metrics_path && met_start() )
+		return 1;
 
     callbacks.StreamACbFn = rx;
+    callbacks.StreamBCbFn = rx_b;
     callbacks.EventCbFn = event;
 
-    if(strlen(in_dev))
-		fprintf( stderr, "For device %s:\n", devices[devind].SerNo);
-	//
-	fprintf( stderr, "   BWType value:  %u\n", bwtype );
-    fprintf( stderr, "   WBS value:  %u (0=off, 1=0n) \n", wbs );
-    fprintf( stderr, "   AGC gain reduction step size:  %u dB\n", gainstep_inc );
-    fprintf( stderr, "   AGC gain increase step size:  %u dB\n", gainstep_dec );
-    fprintf( stderr, "   Sample rate:  %u  (Decimation: %u  Shift: %u) \n", rate, decimation, rateshift );
-    fprintf( stderr, "   ADC sample rate:  %lu sps \n",(long int)(rate << rateshift));
-	fprintf( stderr, "   USB Transfer is in %s mode \n",(bulkmode ? "Bulk" : "Isochronous") );
-
-	if(out)
-		fprintf( stderr, "   Output device: '%s'  Configured latency = %u uSec\n", out, latency_us);
-	else
-		fprintf( stderr, "   Output using STDIO:  Use '-o' and '-L' parameters to specify audio device and latency in uSec\n");
-    
-    if( ( ret = sdrplay_api_Init( devices[ devind ].dev, &callbacks, NULL ) ) ) {
-		fprintf( stderr, "sdr_api_Init: %s\n", sdrplay_api_GetErrorString( ret ) );
+    if( ctl_start() || ( control_path && ctl_listen() ) )
 		return 1;
+
+    if( numreceivers == 1 ) {
+		if( start_receiver( receivers[ 0 ] ) )
+			return 1;
+    }
+    else {	// devices start in parallel
+		for( i = 0; i < numreceivers; i++ )
+			if( ( ret = pthread_create( starters + i, NULL, start_receiver, receivers[ i ] ) ) ) {
+				fprintf( stderr, "Cannot create start-up thread: %s\n", strerror( ret ) );
+				return 1;
+			}
+		for( ret = 0, i = 0; i < numreceivers; i++ ) {
+			pthread_join( starters[ i ], &failed );
+			ret |= failed != NULL;
+		}
+		if( ret )
+			term( 0 );
     }
     
+    if( RT_WANTED )
+		rt_report();
+
 //    update_sdrplay_gain_reduction();	
 
     for(;;)